@@ -1,13 +1,71 @@
 #include "sparse.hh"
+#include <cstring>
 #include <iostream>
 
+// Ended states whose buffers are kept for the next parser on the thread.
+struct sparse_state_pool_t
+{
+  sparse_state_t states[SP_STATE_POOL_SIZE];
+  size_t num_states;
+
+  sparse_state_pool_t() : num_states(0) {}
+
+  ~sparse_state_pool_t()
+  {
+    while (num_states > 0)
+      sparse_end(&states[--num_states]);
+  }
+};
+
+static thread_local sparse_state_pool_t sp_state_pool;
+
+// Takes a pooled state with a buffer of at least capacity, if there is one.
+static bool sp_borrow_state(sparse_state_t *state, size_t capacity)
+{
+  sparse_state_pool_t &pool = sp_state_pool;
+
+  if (pool.num_states == 0 || pool.states[pool.num_states - 1].buffer_capacity < capacity)
+    return false;
+
+  *state = pool.states[--pool.num_states];
+  return true;
+}
+
+// Ends the state's document and pools it, unless it's not worth keeping.
+// The state is left without a buffer if it was pooled.
+static bool sp_return_state(sparse_state_t *state, sparse_error_t *error)
+{
+  sparse_state_pool_t &pool = sp_state_pool;
+
+#ifdef __BLOCKS__
+  if (state->block != NULL)
+    return false;
+#endif
+  if (state->buffer == NULL || state->buffer_capacity > SP_STATE_POOL_MAX_BUFFER || pool.num_states == SP_STATE_POOL_SIZE)
+    return false;
+
+  *error = sparse_reset(state, SP_DEFAULT_OPTIONS, NULL, NULL);
+  pool.states[pool.num_states++] = *state;
+  state->buffer = NULL;
+  state->buffer_capacity = 0;
+  return true;
+}
+
 sparse_parser_t::sparse_parser_t(sparse_fn_t callback,
                                  void *context,
                                  int options,
                                  size_t initial_buffer_capacity) throw(sparse_no_mem_error_t)
 : finished(false)
 {
-  const sparse_error_t error = sparse_begin(this, initial_buffer_capacity, (sparse_options_t)options, callback, context);
+  sparse_error_t error;
+
+  if (sp_borrow_state(this, initial_buffer_capacity)) {
+    error = sparse_reset(this, (sparse_options_t)options, callback, context);
+    // Don't count whatever the pooled state parsed before.
+    sparse_reset_stats(this);
+  } else
+    error = sparse_begin(this, initial_buffer_capacity, (sparse_options_t)options, callback, context);
+
   if (error == SP_ERROR_NO_MEM)
     throw sparse_no_mem_error_t(state_error_string());
 }
@@ -53,20 +111,21 @@ sparse_parser_t::~sparse_parser_t()
 
 sparse_error_t sparse_parser_t::parse(const std::string &src) throw(sparse_exception_t)
 {
-  const char *src_begin = src.c_str();
-  const char *src_end = src_begin + src.size();
-  sparse_error_t error = SP_NO_ERROR;
-  try {
-    error = parse(src_begin, src_end);
-  } catch(std::runtime_error &) {
-    throw;
-  }
-  return error;
+  return parse(src.data(), src.data() + src.size());
 }
 
 sparse_error_t sparse_parser_t::parse(const char *const src_begin, const char *const src_end) throw(sparse_exception_t)
 {
-  sparse_error_t error = sparse_run(this, src_begin, src_end);
+  return check_run_error(sparse_run(this, src_begin, src_end));
+}
+
+sparse_error_t sparse_parser_t::parse_file(const std::string &path) throw(sparse_exception_t)
+{
+  return check_run_error(sparse_parse_file(this, path.c_str()));
+}
+
+sparse_error_t sparse_parser_t::check_run_error(sparse_error_t error) throw(sparse_exception_t)
+{
   switch (error) {
   case SP_NO_ERROR:
     return error;
@@ -74,6 +133,8 @@ sparse_error_t sparse_parser_t::parse(const char *const src_begin, const char *c
     throw sparse_no_mem_error_t(state_error_string());
   case SP_ERROR_INVALID_CHAR:
     throw sparse_invalid_char_error_t("Invalid character encountered.", error_begin, error_end);
+  case SP_ERROR_IO:
+    throw sparse_io_error_t(state_error_string());
   default:
     throw sparse_exception_t(state_error_string());
   }
@@ -84,7 +145,9 @@ sparse_error_t sparse_parser_t::finish() throw(sparse_exception_t)
   if (finished)
     throw sparse_exception_t("Parser already finished.");
 
-  const sparse_error_t error = sparse_end(this);
+  sparse_error_t error;
+  if (!sp_return_state(this, &error))
+    error = sparse_end(this);
   if (error == SP_ERROR_INCOMPLETE_DOCUMENT)
     throw sparse_incomplete_document_error_t(state_error_string());
 
@@ -93,6 +156,18 @@ sparse_error_t sparse_parser_t::finish() throw(sparse_exception_t)
   return error;
 }
 
+sparse_stats_t sparse_parser_t::stats() const
+{
+  sparse_stats_t result;
+  sparse_get_stats(this, &result);
+  return result;
+}
+
+void sparse_parser_t::reset_stats()
+{
+  sparse_reset_stats(this);
+}
+
 std::string sparse_parser_t::state_error_string(void) const
 {
   const size_t count = (size_t)(error_end - error_begin);
@@ -100,6 +175,239 @@ std::string sparse_parser_t::state_error_string(void) const
 }
 
 
+/* Reader */
+
+sparse_reader_t::sparse_reader_t(int options, size_t initial_buffer_capacity) throw(sparse_no_mem_error_t)
+{
+  if (sparse_reader_begin(this, initial_buffer_capacity, (sparse_options_t)options) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse buffer.");
+}
+
+sparse_reader_t::sparse_reader_t(const char *const src_begin, const char *const src_end, int options) throw(sparse_no_mem_error_t)
+{
+  if (sparse_reader_begin_string(this, (sparse_options_t)options, src_begin, src_end) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse buffer.");
+}
+
+sparse_reader_t::~sparse_reader_t()
+{
+  sparse_reader_end(this);
+}
+
+void sparse_reader_t::feed(const char *const src_begin, const char *const src_end)
+{
+  sparse_reader_feed(this, src_begin, src_end);
+}
+
+void sparse_reader_t::finish()
+{
+  sparse_reader_finish(this);
+}
+
+sparse_event_t sparse_reader_t::next() throw(sparse_exception_t)
+{
+  sparse_event_t event;
+
+  switch (sparse_reader_next(this, &event)) {
+  case SP_NO_ERROR:
+    return event;
+  case SP_ERROR_NO_MEM:
+    throw sparse_no_mem_error_t(std::string(event.begin, event.end));
+  case SP_ERROR_INVALID_CHAR:
+    throw sparse_invalid_char_error_t("Invalid character encountered.", event.begin, event.end);
+  case SP_ERROR_INCOMPLETE_DOCUMENT:
+    throw sparse_incomplete_document_error_t(std::string(event.begin, event.end));
+  default:
+    throw sparse_exception_t(std::string(event.begin, event.end));
+  }
+}
+
+void sparse_reader_t::skip_node()
+{
+  sparse_reader_skip_node(this);
+}
+
+
+/* Document */
+
+// Throws for an error from one of the sparse_parse_ value functions.
+static void sp_check_value_error(sparse_error_t error, const sparse_node_view_t &view, const char *type)
+  throw(sparse_exception_t)
+{
+  switch (error) {
+  case SP_NO_ERROR:
+    return;
+  case SP_ERROR_INVALID_VALUE:
+    throw sparse_invalid_value_error_t("Value of " + view.name_string() + " is not " + type + ".");
+  case SP_ERROR_OUT_OF_RANGE:
+    throw sparse_out_of_range_error_t("Value of " + view.name_string() + " is out of range.");
+  case SP_ERROR_NO_MEM:
+    throw sparse_no_mem_error_t("Could not allocate memory to parse value.");
+  default:
+    throw sparse_exception_t("Could not parse value.");
+  }
+}
+
+int64_t sparse_node_view_t::int_value() const throw(sparse_exception_t)
+{
+  int64_t result = 0;
+  sp_check_value_error(sparse_parse_int(value(), value() + value_length(), &result), *this, "an integer");
+  return result;
+}
+
+uint64_t sparse_node_view_t::uint_value() const throw(sparse_exception_t)
+{
+  uint64_t result = 0;
+  sp_check_value_error(sparse_parse_uint(value(), value() + value_length(), &result), *this, "an unsigned integer");
+  return result;
+}
+
+double sparse_node_view_t::double_value() const throw(sparse_exception_t)
+{
+  double result = 0.0;
+  sp_check_value_error(sparse_parse_double(value(), value() + value_length(), &result), *this, "a number");
+  return result;
+}
+
+bool sparse_node_view_t::bool_value() const throw(sparse_exception_t)
+{
+  int result = 0;
+  sp_check_value_error(sparse_parse_bool(value(), value() + value_length(), &result), *this, "a bool");
+  return result != 0;
+}
+
+// Values are short, so most fit the first try and the rest the second.
+std::vector<int64_t> sparse_node_view_t::int_values() const throw(sparse_exception_t)
+{
+  std::vector<int64_t> result(4);
+  size_t count = 0;
+
+  sp_check_value_error(sparse_parse_ints(value(), value() + value_length(), result.data(), result.size(), &count), *this, "integers");
+  if (count > result.size()) {
+    result.resize(count);
+    sp_check_value_error(sparse_parse_ints(value(), value() + value_length(), result.data(), result.size(), &count), *this, "integers");
+  }
+  result.resize(count);
+  return result;
+}
+
+std::vector<double> sparse_node_view_t::double_values() const throw(sparse_exception_t)
+{
+  std::vector<double> result(4);
+  size_t count = 0;
+
+  sp_check_value_error(sparse_parse_doubles(value(), value() + value_length(), result.data(), result.size(), &count), *this, "numbers");
+  if (count > result.size()) {
+    result.resize(count);
+    sp_check_value_error(sparse_parse_doubles(value(), value() + value_length(), result.data(), result.size(), &count), *this, "numbers");
+  }
+  result.resize(count);
+  return result;
+}
+
+sparse_tree_t::sparse_tree_t(sparse_symbols_t *symbols) throw(sparse_no_mem_error_t)
+{
+  const sparse_error_t error = symbols != NULL ? sparse_document_init_interned(this, symbols) : sparse_document_init(this);
+  if (error == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse document.");
+}
+
+sparse_tree_t::~sparse_tree_t()
+{
+  sparse_document_free(this);
+}
+
+sparse_error_t sparse_tree_t::parse(const std::string &src, int options) throw(sparse_exception_t)
+{
+  const char *src_begin = src.c_str();
+  return parse(src_begin, src_begin + src.size(), options);
+}
+
+sparse_error_t sparse_tree_t::parse(const char *const src_begin, const char *const src_end, int options) throw(sparse_exception_t)
+{
+  sparse_parser_t parser(sparse_document_fn, static_cast<sparse_document_t *>(this), options | SP_ZERO_COPY);
+  parser.parse(src_begin, src_end);
+  parser.finish();
+
+  if (sparse_document_error(this) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse document.");
+
+  return SP_NO_ERROR;
+}
+
+
+/* Writer */
+
+sparse_writer_t::sparse_writer_t() throw(sparse_no_mem_error_t)
+{
+  if (sparse_writer_begin(this, NULL, 0) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse writer.");
+}
+
+sparse_writer_t::sparse_writer_t(int fd) throw(sparse_no_mem_error_t)
+{
+  if (sparse_writer_begin_fd(this, fd) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse writer.");
+}
+
+sparse_writer_t::sparse_writer_t(sparse_flush_fn_t flush, void *context, size_t capacity) throw(sparse_no_mem_error_t)
+{
+  if (sparse_writer_begin_flush(this, capacity, flush, context) == SP_ERROR_NO_MEM)
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse writer.");
+}
+
+sparse_writer_t::~sparse_writer_t()
+{
+  sparse_writer_free(this);
+}
+
+void sparse_writer_t::check_error(sparse_error_t error) throw(sparse_exception_t)
+{
+  switch (error) {
+  case SP_NO_ERROR:
+    return;
+  case SP_ERROR_NO_MEM:
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse writer.");
+  case SP_ERROR_IO:
+    throw sparse_io_error_t("Could not write sparse document.");
+  case SP_ERROR_INCOMPLETE_DOCUMENT:
+    throw sparse_incomplete_document_error_t("Document is incomplete.");
+  default:
+    throw sparse_exception_t("Sparse writer calls are out of order.");
+  }
+}
+
+void sparse_writer_t::name(const std::string &name) throw(sparse_exception_t)
+{
+  check_error(sparse_writer_name(this, name.data(), name.size()));
+}
+
+void sparse_writer_t::value(const std::string &value) throw(sparse_exception_t)
+{
+  check_error(sparse_writer_value(this, value.data(), value.size()));
+}
+
+void sparse_writer_t::field(const std::string &name, const std::string &value) throw(sparse_exception_t)
+{
+  check_error(sparse_writer_field(this, name.data(), name.size(), value.data(), value.size()));
+}
+
+void sparse_writer_t::begin_node() throw(sparse_exception_t)
+{
+  check_error(sparse_writer_begin_node(this));
+}
+
+void sparse_writer_t::end_node() throw(sparse_exception_t)
+{
+  check_error(sparse_writer_end_node(this));
+}
+
+void sparse_writer_t::finish() throw(sparse_exception_t)
+{
+  check_error(sparse_writer_end(this));
+}
+
+
 /* Exceptions */
 
 sparse_exception_t::sparse_exception_t(const std::string &what)
@@ -157,3 +465,30 @@ sparse_incomplete_document_error_t::sparse_incomplete_document_error_t(const std
 sparse_incomplete_document_error_t::~sparse_incomplete_document_error_t() throw()
 {
 }
+
+sparse_io_error_t::sparse_io_error_t(const std::string &what)
+: sparse_exception_t(what)
+{
+}
+
+sparse_io_error_t::~sparse_io_error_t() throw()
+{
+}
+
+sparse_invalid_value_error_t::sparse_invalid_value_error_t(const std::string &what)
+: sparse_exception_t(what)
+{
+}
+
+sparse_invalid_value_error_t::~sparse_invalid_value_error_t() throw()
+{
+}
+
+sparse_out_of_range_error_t::sparse_out_of_range_error_t(const std::string &what)
+: sparse_exception_t(what)
+{
+}
+
+sparse_out_of_range_error_t::~sparse_out_of_range_error_t() throw()
+{
+}
@@ -2,8 +2,14 @@
 #define __CMT_SPARSE_HH__
 
 #include "sparse.h"
+#include "sparse_document.h"
+#include "sparse_file.h"
+#include "sparse_reader.h"
+#include "sparse_value.h"
+#include "sparse_writer.h"
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 /* Exceptions because those are always fun */
 class sparse_exception_t : public std::runtime_error {
@@ -37,8 +43,38 @@ public:
   virtual ~sparse_incomplete_document_error_t() throw();
 };
 
+class sparse_io_error_t : public sparse_exception_t {
+public:
+  sparse_io_error_t(const std::string &what);
+  virtual ~sparse_io_error_t() throw();
+};
+
+class sparse_invalid_value_error_t : public sparse_exception_t {
+public:
+  sparse_invalid_value_error_t(const std::string &what);
+  virtual ~sparse_invalid_value_error_t() throw();
+};
+
+class sparse_out_of_range_error_t : public sparse_exception_t {
+public:
+  sparse_out_of_range_error_t(const std::string &what);
+  virtual ~sparse_out_of_range_error_t() throw();
+};
+
 
 /* Parser */
+// Parsers that finish hand their state's buffer to a pool kept for each
+// thread, and new parsers on that thread take one from it instead of
+// allocating their own, so parsing many small documents in turn reuses the
+// same few warm buffers. Buffers larger than SP_STATE_POOL_MAX_BUFFER are freed
+// instead of pooled.
+#ifndef SP_STATE_POOL_SIZE
+#define SP_STATE_POOL_SIZE (4)
+#endif
+#ifndef SP_STATE_POOL_MAX_BUFFER
+#define SP_STATE_POOL_MAX_BUFFER (1024 * 1024)
+#endif
+
 class sparse_parser_t : protected sparse_state_t
 {
 private:
@@ -60,12 +96,163 @@ public:
 
   virtual sparse_error_t parse(const std::string &src) throw(sparse_exception_t);
   virtual sparse_error_t parse(const char *const src_begin, const char *const src_end) throw(sparse_exception_t);
+  // Parses a file without reading it into memory first (see sparse_parse_file).
+  virtual sparse_error_t parse_file(const std::string &path) throw(sparse_exception_t);
 
   // Can be called explicitly or will be called by the destructor.
   virtual sparse_error_t finish(void) throw(sparse_exception_t);
 
+  // Statistics for everything parsed since the parser was made or
+  // reset_stats was called. All zero unless Sparse was built with SP_STATS.
+  sparse_stats_t stats() const;
+  void reset_stats();
+
 private:
   virtual std::string state_error_string(void) const;
+  // Throws the exception for an error returned by sparse_run.
+  sparse_error_t check_run_error(sparse_error_t error) throw(sparse_exception_t);
+};
+
+
+/* Reader */
+// Pull-style alternative to sparse_parser_t. Events point into the input or
+// the reader's buffer and are valid until the next call to next or skip_node.
+class sparse_reader_t : protected sparse_reader_state_t
+{
+private:
+  sparse_reader_t(const sparse_reader_t &);
+  sparse_reader_t &operator = (const sparse_reader_t &);
+
+public:
+  // Reads input given to feed.
+  sparse_reader_t(int options = SP_DEFAULT_OPTIONS, size_t initial_buffer_capacity = 0) throw(sparse_no_mem_error_t);
+  // Reads a complete document. The string has to outlive the reader.
+  sparse_reader_t(const char *const src_begin, const char *const src_end, int options = SP_DEFAULT_OPTIONS) throw(sparse_no_mem_error_t);
+  ~sparse_reader_t();
+
+  void feed(const char *const src_begin, const char *const src_end);
+  void finish();
+
+  // Returns the next event, SP_NEED_INPUT, or SP_END_DOCUMENT. Throws on
+  // errors the same way sparse_parser_t does.
+  sparse_event_t next() throw(sparse_exception_t);
+  // Skips the rest of the innermost open node without producing events.
+  void skip_node();
+};
+
+/* Document */
+// Non-owning view of a node in a sparse_document_t. Names and values point
+// into the document and are only valid as long as it is.
+class sparse_node_view_t
+{
+private:
+  const sparse_document_t *doc;
+  uint32_t index;
+
+public:
+  sparse_node_view_t(const sparse_document_t *doc = NULL, uint32_t index = SP_NO_NODE)
+  : doc(doc), index(index) {}
+
+  bool valid() const { return doc != NULL && index != SP_NO_NODE; }
+  uint32_t node_index() const { return index; }
+  // True if the field opens a node (and so has children rather than a value).
+  bool is_node() const { return doc->nodes[index].value == NULL; }
+
+  const char *name() const { return doc->nodes[index].name; }
+  size_t name_length() const { return doc->nodes[index].name_length; }
+  // SP_NO_SYMBOL unless the document interns its names.
+  uint32_t symbol() const { return sparse_document_symbol(doc, index); }
+  std::string name_string() const { return std::string(name(), name_length()); }
+
+  // NULL for nodes.
+  const char *value() const { return doc->nodes[index].value; }
+  size_t value_length() const { return doc->nodes[index].value_length; }
+  std::string value_string() const { return is_node() ? std::string() : std::string(value(), value_length()); }
+
+  // The value read as a number or bool (see sparse_value.h). These throw
+  // sparse_invalid_value_error_t if it isn't one, which includes nodes, and
+  // sparse_out_of_range_error_t if it doesn't fit.
+  int64_t int_value() const throw(sparse_exception_t);
+  uint64_t uint_value() const throw(sparse_exception_t);
+  double double_value() const throw(sparse_exception_t);
+  bool bool_value() const throw(sparse_exception_t);
+  // The value read as numbers separated by spaces and tabs.
+  std::vector<int64_t> int_values() const throw(sparse_exception_t);
+  std::vector<double> double_values() const throw(sparse_exception_t);
+
+  sparse_node_view_t first_child() const { return sparse_node_view_t(doc, doc->nodes[index].first_child); }
+  sparse_node_view_t next_sibling() const { return sparse_node_view_t(doc, doc->nodes[index].next_sibling); }
+
+  // Returns the first child with the given name or an invalid view.
+  sparse_node_view_t find(const std::string &name) const
+  {
+    return sparse_node_view_t(doc, sparse_document_find(doc, index, name.data(), name.size()));
+  }
+  // Same for a name's symbol, in a document that interns its names.
+  sparse_node_view_t find(uint32_t symbol) const
+  {
+    return sparse_node_view_t(doc, sparse_document_find_symbol(doc, index, symbol));
+  }
+};
+
+// Owns a sparse_document_t. Each call to parse adds the document's root fields
+// to the tree's root node.
+class sparse_tree_t : protected sparse_document_t
+{
+private:
+  sparse_tree_t(const sparse_tree_t &);
+  sparse_tree_t &operator = (const sparse_tree_t &);
+
+public:
+  // If symbols isn't NULL, names are interned there (see sparse_symbols.h),
+  // and it has to outlive the tree.
+  explicit sparse_tree_t(sparse_symbols_t *symbols = NULL) throw(sparse_no_mem_error_t);
+  ~sparse_tree_t();
+
+  sparse_error_t parse(const std::string &src, int options = SP_DEFAULT_OPTIONS) throw(sparse_exception_t);
+  sparse_error_t parse(const char *const src_begin, const char *const src_end, int options = SP_DEFAULT_OPTIONS) throw(sparse_exception_t);
+
+  sparse_node_view_t root() const { return sparse_node_view_t(this, SP_DOCUMENT_ROOT); }
+  const sparse_document_t *document() const { return this; }
+};
+
+/* Writer */
+// Writes documents that parse back to the events written. Calls throw on
+// the first error, after which the writer can't be used.
+class sparse_writer_t : protected sparse_writer_state_t
+{
+private:
+  sparse_writer_t(const sparse_writer_t &);
+  sparse_writer_t &operator = (const sparse_writer_t &);
+
+  void check_error(sparse_error_t error) throw(sparse_exception_t);
+
+public:
+  // Writes into a buffer that grows as needed.
+  sparse_writer_t() throw(sparse_no_mem_error_t);
+  // Writes to fd in SP_WRITER_BLOCK_SIZE blocks.
+  explicit sparse_writer_t(int fd) throw(sparse_no_mem_error_t);
+  // Passes output to flush capacity bytes at a time.
+  sparse_writer_t(sparse_flush_fn_t flush, void *context, size_t capacity = SP_WRITER_BLOCK_SIZE) throw(sparse_no_mem_error_t);
+  ~sparse_writer_t();
+
+  void name(const std::string &name) throw(sparse_exception_t);
+  void value(const std::string &value) throw(sparse_exception_t);
+  void field(const std::string &name, const std::string &value) throw(sparse_exception_t);
+  // Opens a node, named by the last call to name or nameless if there wasn't
+  // one.
+  void begin_node() throw(sparse_exception_t);
+  void end_node() throw(sparse_exception_t);
+  // Flushes the rest of the output. Throws if a node is left open.
+  void finish() throw(sparse_exception_t);
+
+  // Output written into the writer's own buffer. Empty when flushing.
+  const char *data() const { return buffer; }
+  size_t size() const { return flush != NULL ? 0 : sparse_writer_state_t::size; }
+  std::string str() const { return std::string(data(), size()); }
+
+  // Context for sparse_writer_fn, to copy a parser's events to the writer.
+  sparse_writer_state_t *state() { return this; }
 };
 
 #endif /* end __SPARSE_HH__ include guard */
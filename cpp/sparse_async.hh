@@ -0,0 +1,435 @@
+#ifndef __CMT_SPARSE_ASYNC_HH__
+#define __CMT_SPARSE_ASYNC_HH__
+
+/*
+  Header-only C++20 front-end for reading documents from non-blocking pipes
+  and sockets (Linux only, since it waits on them with epoll). Each stream is
+  read by a coroutine that feeds a sparse_reader_state_t a chunk at a time as
+  data arrives and hands its events out one by one, so one thread can read
+  any number of streams at once without buffering whole documents.
+
+  Streams are only read when the code using them asks for the next event, so
+  a stream whose events aren't being taken stops being read and its writer
+  eventually blocks. Memory per stream is one chunk plus the reader's buffer.
+
+    sparse::task print_names(sparse::event_loop &loop, int fd)
+    {
+      sparse::event_stream events = sparse::read_events(loop, fd);
+      while (const sparse_event_t *event = co_await events.next()) {
+        if (event->msg == SP_NAME)
+          std::cout << std::string_view(event->begin, event->end - event->begin) << '\n';
+      }
+    }
+
+    sparse::event_loop loop;
+    loop.spawn(print_names(loop, first_socket));
+    loop.spawn(print_names(loop, second_socket));
+    loop.run();
+
+  Build sparse_reader.c, sparse.c and sparse_scan.c with it.
+*/
+
+#include "sparse.h"
+#include "sparse_reader.h"
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Bytes read from a stream at a time.
+#ifndef SP_ASYNC_CHUNK_SIZE
+#define SP_ASYNC_CHUNK_SIZE (16 * 1024)
+#endif
+
+// Chunks a stream reads in a row before letting other ready streams go, so a
+// fast writer can't starve the rest.
+#ifndef SP_ASYNC_CHUNKS_PER_TURN
+#define SP_ASYNC_CHUNKS_PER_TURN (4)
+#endif
+
+// Most streams the loop wakes per epoll_wait.
+#define SP_ASYNC_MAX_EVENTS (64)
+
+namespace sparse {
+
+// Coroutine type for tasks run by an event_loop. A task doesn't start until
+// it's spawned, and the loop frees it once it's done.
+class task
+{
+public:
+  struct promise_type
+  {
+    std::exception_ptr exception;
+
+    task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  task(const task &) = delete;
+  task &operator = (const task &) = delete;
+  ~task()
+  {
+    if (handle_)
+      handle_.destroy();
+  }
+
+private:
+  friend class event_loop;
+
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Waits for streams to become readable and resumes whatever's waiting on
+// them. Everything runs on the thread calling run.
+class event_loop
+{
+public:
+  // Throws std::system_error if there's no epoll instance to be had.
+  event_loop();
+  // Frees any tasks that haven't finished, along with their streams.
+  ~event_loop();
+
+  event_loop(const event_loop &) = delete;
+  event_loop &operator = (const event_loop &) = delete;
+
+  // Runs the task until it first waits on something.
+  void spawn(task work);
+  // Runs until every spawned task is done, or none of them are waiting on a
+  // stream. Rethrows the first exception a task lets escape.
+  void run();
+
+  struct readable_awaiter
+  {
+    event_loop &loop;
+    int fd;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { loop.wait(fd, handle); }
+    void await_resume() const noexcept {}
+  };
+
+  // co_await to wait until fd can be read from (or is closed or broken).
+  // Only one coroutine can wait on a given fd at a time.
+  readable_awaiter readable(int fd) { return readable_awaiter{ *this, fd }; }
+  // Stops watching fd. Whatever was waiting on it isn't resumed.
+  void forget(int fd);
+
+private:
+  void wait(int fd, std::coroutine_handle<> handle);
+  // Frees finished tasks, rethrowing the first exception one ended with.
+  void sweep();
+
+  int epoll_fd_;
+  std::vector<std::coroutine_handle<task::promise_type>> tasks_;
+  // Looked up by fd rather than storing handles in epoll, so an event that
+  // arrives for a stream freed earlier in the same batch is dropped.
+  std::unordered_map<int, std::coroutine_handle<>> waiting_;
+};
+
+inline event_loop::event_loop()
+: epoll_fd_(epoll_create1(EPOLL_CLOEXEC))
+{
+  if (epoll_fd_ < 0)
+    throw std::system_error(errno, std::system_category(), "epoll_create1");
+}
+
+inline event_loop::~event_loop()
+{
+  for (std::coroutine_handle<task::promise_type> handle : tasks_)
+    handle.destroy();
+  close(epoll_fd_);
+}
+
+inline void event_loop::spawn(task work)
+{
+  const std::coroutine_handle<task::promise_type> handle = std::exchange(work.handle_, nullptr);
+  tasks_.push_back(handle);
+  handle.resume();
+}
+
+inline void event_loop::run()
+{
+  epoll_event ready[SP_ASYNC_MAX_EVENTS];
+
+  sweep();
+  while (!tasks_.empty() && !waiting_.empty()) {
+    const int count = epoll_wait(epoll_fd_, ready, SP_ASYNC_MAX_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::system_error(errno, std::system_category(), "epoll_wait");
+    }
+
+    for (int index = 0; index < count; ++index) {
+      const auto waiter = waiting_.find(ready[index].data.fd);
+      if (waiter == waiting_.end())
+        continue;
+
+      const std::coroutine_handle<> handle = waiter->second;
+      waiting_.erase(waiter);
+      handle.resume();
+    }
+
+    sweep();
+  }
+}
+
+inline void event_loop::wait(int fd, std::coroutine_handle<> handle)
+{
+  epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  event.data.fd = fd;
+
+  // One-shot, so after the first wait the fd is already there to re-arm.
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) != 0
+      && (errno != ENOENT || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0))
+    throw std::system_error(errno, std::system_category(), "epoll_ctl");
+
+  waiting_[fd] = handle;
+}
+
+inline void event_loop::forget(int fd)
+{
+  waiting_.erase(fd);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+}
+
+inline void event_loop::sweep()
+{
+  std::exception_ptr exception;
+  size_t kept = 0;
+
+  for (std::coroutine_handle<task::promise_type> handle : tasks_) {
+    if (!handle.done()) {
+      tasks_[kept++] = handle;
+      continue;
+    }
+
+    if (!exception)
+      exception = handle.promise().exception;
+    handle.destroy();
+  }
+  tasks_.resize(kept);
+
+  if (exception)
+    std::rethrow_exception(exception);
+}
+
+
+namespace detail {
+
+// What a stream's coroutine yields: the event, and the reader and error to
+// keep for the stream's owner.
+struct stream_item
+{
+  sparse_event_t event;
+  sparse_reader_state_t *reader;
+  sparse_error_t error;
+};
+
+// Symmetric transfer to whatever coroutine is waiting on a stream.
+struct resume_consumer
+{
+  std::coroutine_handle<> consumer;
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<>) const noexcept { return consumer; }
+  void await_resume() const noexcept {}
+};
+
+} // namespace detail
+
+// Async generator of a stream's events. Get one from read_events.
+class event_stream
+{
+public:
+  struct promise_type
+  {
+    const sparse_event_t *current = nullptr;
+    sparse_reader_state_t *reader = nullptr;
+    sparse_error_t error = SP_NO_ERROR;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr exception;
+
+    event_stream get_return_object() { return event_stream(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    detail::resume_consumer final_suspend() noexcept
+    {
+      current = nullptr;
+      reader = nullptr;
+      return detail::resume_consumer{ consumer };
+    }
+    detail::resume_consumer yield_value(const detail::stream_item &item) noexcept
+    {
+      current = &item.event;
+      reader = item.reader;
+      error = item.error;
+      return detail::resume_consumer{ consumer };
+    }
+    void return_void() {}
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  struct next_awaiter
+  {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept { return handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) const noexcept
+    {
+      handle.promise().consumer = consumer;
+      return handle;
+    }
+    const sparse_event_t *await_resume() const
+    {
+      if (handle.promise().exception)
+        std::rethrow_exception(std::exchange(handle.promise().exception, nullptr));
+      return handle.promise().current;
+    }
+  };
+
+  event_stream(event_stream &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  event_stream(const event_stream &) = delete;
+  event_stream &operator = (const event_stream &) = delete;
+  ~event_stream()
+  {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  // co_await for the next event, or NULL once the document is done. An error
+  // comes as one last SP_ERROR event (as with sparse_reader_next), after
+  // which error returns it. Events are only valid until the next call.
+  next_awaiter next() { return next_awaiter{ handle_ }; }
+  sparse_error_t error() const { return handle_.promise().error; }
+  // Skips the rest of the innermost open node (see sparse_reader_skip_node).
+  // Only call this between events.
+  void skip_node()
+  {
+    if (handle_.promise().reader != nullptr)
+      sparse_reader_skip_node(handle_.promise().reader);
+  }
+
+private:
+  explicit event_stream(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+// Ends the reader and stops watching the stream however its coroutine ends,
+// including being freed while it waits.
+struct stream_resources
+{
+  event_loop &loop;
+  int fd;
+  sparse_reader_state_t reader;
+  bool begun = false;
+
+  stream_resources(event_loop &loop, int fd) : loop(loop), fd(fd) {}
+  stream_resources(const stream_resources &) = delete;
+  stream_resources &operator = (const stream_resources &) = delete;
+  ~stream_resources()
+  {
+    if (begun)
+      sparse_reader_end(&reader);
+    loop.forget(fd);
+  }
+};
+
+inline sparse_event_t error_event(const char *message)
+{
+  return sparse_event_t{ SP_ERROR, message, message + std::strlen(message) };
+}
+
+} // namespace detail
+
+/*
+  Reads one document from fd, which is switched to non-blocking. The stream
+  ends at end of file, or after an error: SP_ERROR_IO if fd can't be read,
+  SP_ERROR_NO_MEM, or whatever error the document has. fd isn't closed, and
+  has to stay open for as long as the stream's around.
+*/
+inline event_stream read_events(event_loop &loop, int fd,
+                                int options = SP_DEFAULT_OPTIONS,
+                                size_t chunk_size = SP_ASYNC_CHUNK_SIZE)
+{
+  static const char *const no_mem_message = "Could not allocate memory for sparse buffer.";
+  static const char *const io_message = "Could not read from the stream.";
+
+  detail::stream_resources resources(loop, fd);
+  std::unique_ptr<char[]> chunk(new char[chunk_size]);
+  detail::stream_item item = { sparse_event_t(), &resources.reader, SP_NO_ERROR };
+  size_t chunks_this_turn = 0;
+
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)) {
+    item.event = detail::error_event(io_message);
+    item.error = SP_ERROR_IO;
+    co_yield item;
+    co_return;
+  }
+
+  if (sparse_reader_begin(&resources.reader, 0, (sparse_options_t)options) != SP_NO_ERROR) {
+    item.event = detail::error_event(no_mem_message);
+    item.error = SP_ERROR_NO_MEM;
+    co_yield item;
+    co_return;
+  }
+  resources.begun = true;
+
+  for (;;) {
+    item.error = sparse_reader_next(&resources.reader, &item.event);
+
+    if (item.event.msg == SP_END_DOCUMENT)
+      co_return;
+
+    if (item.event.msg != SP_NEED_INPUT) {
+      co_yield item;
+      if (item.error != SP_NO_ERROR)
+        co_return;
+      continue;
+    }
+
+    if (chunks_this_turn == SP_ASYNC_CHUNKS_PER_TURN) {
+      chunks_this_turn = 0;
+      co_await loop.readable(fd);
+    }
+
+    const ssize_t size = read(fd, chunk.get(), chunk_size);
+    if (size > 0) {
+      ++chunks_this_turn;
+      sparse_reader_feed(&resources.reader, chunk.get(), chunk.get() + size);
+    } else if (size == 0) {
+      sparse_reader_finish(&resources.reader);
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      chunks_this_turn = 0;
+      co_await loop.readable(fd);
+    } else if (errno != EINTR) {
+      item.event = detail::error_event(io_message);
+      item.error = SP_ERROR_IO;
+      co_yield item;
+      co_return;
+    }
+  }
+}
+
+} // namespace sparse
+
+#endif /* end __CMT_SPARSE_ASYNC_HH__ include guard */
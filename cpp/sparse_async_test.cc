@@ -0,0 +1,213 @@
+#include "sparse_async.hh"
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#define NUM_STREAMS (8)
+
+static void log_event(std::string &log, const sparse_event_t &event)
+{
+  const size_t length = event.begin == NULL ? 0 : (size_t)(event.end - event.begin);
+  log += std::to_string((int)event.msg);
+  log += ':';
+  log += std::to_string(length);
+  log += ':';
+  log.append(event.begin == NULL ? "" : event.begin, length);
+}
+
+// Reads src in one go with a plain reader, stopping where a stream would.
+static std::string log_reader(std::string_view src, int options, sparse_error_t *error)
+{
+  sparse_reader_state_t reader;
+  sparse_event_t event;
+  std::string log;
+
+  sparse_reader_begin_string(&reader, (sparse_options_t)options, src.data(), src.data() + src.size());
+  for (;;) {
+    *error = sparse_reader_next(&reader, &event);
+    if (event.msg == SP_END_DOCUMENT)
+      break;
+    log_event(log, event);
+    if (*error != SP_NO_ERROR)
+      break;
+  }
+  sparse_reader_end(&reader);
+
+  return log;
+}
+
+static sparse::task log_stream(sparse::event_loop &loop, int fd, int options, size_t chunk_size,
+                               std::string &log, sparse_error_t &error)
+{
+  sparse::event_stream events = sparse::read_events(loop, fd, options, chunk_size);
+  while (const sparse_event_t *event = co_await events.next())
+    log_event(log, *event);
+  error = events.error();
+}
+
+// Only looks at root names, skipping every node.
+static sparse::task log_root_names(sparse::event_loop &loop, int fd, std::string &log)
+{
+  sparse::event_stream events = sparse::read_events(loop, fd, SP_TRIM_TRAILING_SPACES);
+  while (const sparse_event_t *event = co_await events.next()) {
+    if (event->msg == SP_NAME)
+      log.append(event->begin, event->end).append(" ");
+    else if (event->msg == SP_BEGIN_NODE)
+      events.skip_node();
+  }
+}
+
+// Stops after the first event, leaving the rest of the stream unread.
+static sparse::task take_first(sparse::event_loop &loop, int fd, std::string &log)
+{
+  sparse::event_stream events = sparse::read_events(loop, fd);
+  if (const sparse_event_t *event = co_await events.next())
+    log_event(log, *event);
+}
+
+// Writes src to every fd a few bytes at a time, taking turns so the readers
+// keep running out of input partway through.
+static void write_pieces(std::string_view src, const std::vector<int> &fds, size_t piece_size)
+{
+  for (size_t offset = 0; offset < src.size(); offset += piece_size) {
+    const size_t length = src.size() - offset < piece_size ? src.size() - offset : piece_size;
+    for (int fd : fds) {
+      if (write(fd, src.data() + offset, length) != (ssize_t)length)
+        std::perror("write");
+    }
+    usleep(50);
+  }
+
+  for (int fd : fds)
+    close(fd);
+}
+
+static int check_streams(std::string_view src, int options)
+{
+  sparse_error_t expected_error;
+  const std::string expected = log_reader(src, options, &expected_error);
+  std::vector<int> read_fds, write_fds;
+  std::string logs[NUM_STREAMS];
+  sparse_error_t errors[NUM_STREAMS];
+  int failures = 0;
+
+  sparse::event_loop loop;
+  for (size_t index = 0; index < NUM_STREAMS; ++index) {
+    int fds[2];
+    if (pipe(fds) != 0)
+      return 1;
+    read_fds.push_back(fds[0]);
+    write_fds.push_back(fds[1]);
+    // Some streams read less than the writer writes at once.
+    loop.spawn(log_stream(loop, fds[0], options, 1 + index * 3, logs[index], errors[index]));
+  }
+
+  std::thread writer(write_pieces, src, write_fds, 7);
+  loop.run();
+  writer.join();
+
+  for (size_t index = 0; index < NUM_STREAMS; ++index) {
+    if (logs[index] != expected || errors[index] != expected_error) {
+      std::fprintf(stderr, "Stream %zu differs:\n%s\nexpected:\n%s\n", index, logs[index].c_str(), expected.c_str());
+      ++failures;
+    }
+    close(read_fds[index]);
+  }
+
+  return failures;
+}
+
+static int check_skipping_and_abandoning(std::string_view src)
+{
+  std::string names, first;
+  int skip_fds[2], abandon_fds[2];
+  int failures = 0;
+
+  if (pipe(skip_fds) != 0 || pipe(abandon_fds) != 0)
+    return 1;
+
+  {
+    sparse::event_loop loop;
+    loop.spawn(log_root_names(loop, skip_fds[0], names));
+    loop.spawn(take_first(loop, abandon_fds[0], first));
+
+    std::thread writer(write_pieces, src, std::vector<int>{ skip_fds[1], abandon_fds[1] }, 5);
+    loop.run();
+    writer.join();
+  }
+
+  if (names != "materials/base/fl_tile1 fullscreen fov width height " || first != "3:23:materials/base/fl_tile1") {
+    std::fprintf(stderr, "Skipping or abandoning gave \"%s\" and \"%s\"\n", names.c_str(), first.c_str());
+    ++failures;
+  }
+
+  close(skip_fds[0]);
+  close(abandon_fds[0]);
+  return failures;
+}
+
+// A task that's still waiting when the loop goes away is freed with it.
+static int check_unfinished()
+{
+  std::string log;
+  sparse_error_t error = SP_NO_ERROR;
+  int fds[2];
+
+  if (pipe(fds) != 0)
+    return 1;
+
+  {
+    sparse::event_loop loop;
+    loop.spawn(log_stream(loop, fds[0], SP_DEFAULT_OPTIONS, SP_ASYNC_CHUNK_SIZE, log, error));
+    if (write(fds[1], "name value\nopen {", 17) != 17)
+      return 1;
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *const test_sources[] = {
+    "# A named root node:\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u\n"
+    "  clamp_v\n"
+    "}\n"
+    "\n"
+    "fullscreen\n"
+    "fov 100\n"
+    "width 800; height 600\n",
+
+    "name  value\\  with\\ttrailing   \n"
+    "escaped\\ name {\\}\n"
+    "  a\t\tb  \\\\  \n"
+    "}\n"
+    "last value",
+
+    "unbalanced { value }\n}\nnever read\n",
+    "open { node\n",
+  };
+
+  int failures = 0;
+
+  for (const char *src : test_sources) {
+    failures += check_streams(src, SP_DEFAULT_OPTIONS);
+    failures += check_streams(src, SP_TRIM_TRAILING_SPACES);
+  }
+
+  failures += check_skipping_and_abandoning(test_sources[0]);
+  failures += check_unfinished();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+#ifndef __CMT_SPARSE_BASIC_PARSER_HH__
+#define __CMT_SPARSE_BASIC_PARSER_HH__
+
+/*
+  Header-only C++17 version of sparse_run. Options are a template argument, so
+  branches for options that aren't set compile away, and events go straight to
+  the handler's member functions instead of through a function pointer, so
+  they can be inlined. Produces the same events as the C parser with the same
+  options (tokens are always passed without a copy where possible, as with
+  SP_ZERO_COPY).
+
+  A handler needs these members (sparse::null_handler has empty ones to
+  inherit from):
+
+    void on_name(std::string_view name);
+    void on_value(std::string_view value);
+    void on_begin_node();
+    void on_end_node();
+    void on_error(sparse_error_t error, std::string_view where);
+*/
+
+#include "sparse.h"
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace sparse {
+
+struct null_handler
+{
+  void on_name(std::string_view) {}
+  void on_value(std::string_view) {}
+  void on_begin_node() {}
+  void on_end_node() {}
+  void on_error(sparse_error_t, std::string_view) {}
+};
+
+namespace detail {
+
+constexpr bool is_structural(char c)
+{
+  return c == '{' || c == '}' || c == '#' || c == ';' || c == '\n' || c == '\\' || c == ' ' || c == '\t';
+}
+
+// Same as sp_scan_structural, minus the runtime AVX2 dispatch.
+inline const char *scan_structural(const char *begin, const char *end)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    const __m128i hits = _mm_or_si128(
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('#')))),
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(';')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('{')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('}')))));
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+
+    if (mask != 0) {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      return begin + index;
+#else
+      return begin + __builtin_ctz(mask);
+#endif
+    }
+  }
+#endif
+
+  for (; begin != end && !is_structural(*begin); ++begin)
+    ;
+  return begin;
+}
+
+inline const char *scan_newline(const char *begin, const char *end)
+{
+  const void *newline = std::memchr(begin, '\n', static_cast<size_t>(end - begin));
+  return newline != nullptr ? static_cast<const char *>(newline) : end;
+}
+
+} // namespace detail
+
+template <int Options, class Handler>
+class basic_parser
+{
+public:
+  static constexpr int options = Options;
+
+  basic_parser() = default;
+  explicit basic_parser(Handler handler) : handler_(std::move(handler)) {}
+
+  Handler &handler() { return handler_; }
+  const Handler &handler() const { return handler_; }
+
+  // Same as sparse_run: the document can be given in any number of pieces.
+  sparse_error_t parse(const char *const src_begin, const char *const src_end);
+  sparse_error_t parse(std::string_view src) { return parse(src.data(), src.data() + src.size()); }
+
+  // Same as sparse_end, except the parser can be used for another document
+  // afterward.
+  sparse_error_t finish();
+
+  size_t depth() const { return depth_; }
+
+private:
+  Handler handler_;
+  std::string buffer_;
+  size_t num_spaces_trailing_ = 0;
+  size_t depth_ = 0;
+  sparse_mode_t mode_ = SP_FIND_NAME;
+  bool in_escape_ = false;
+  int last_char_ = 0;
+};
+
+template <int Options, class Handler>
+sparse_error_t basic_parser<Options, Handler>::parse(const char *const src_begin, const char *const src_end)
+{
+  constexpr bool consume_whitespace = (Options & SP_CONSUME_WHITESPACE) != 0;
+  constexpr bool trim_spaces = (Options & SP_TRIM_TRAILING_SPACES) != 0;
+  constexpr bool nameless_nodes = (Options & SP_NAMELESS_NODES) != 0;
+  constexpr bool nameless_roots = nameless_nodes || (Options & SP_NAMELESS_ROOT_NODES) != 0;
+
+  sparse_error_t error = SP_NO_ERROR;
+
+  const char *src_iter = src_begin;
+  // Start of the current token in the source, or null if it's in buffer_.
+  const char *span_begin = nullptr;
+
+  size_t num_spaces_trailing = num_spaces_trailing_;
+  size_t depth = depth_;
+  sparse_mode_t mode = mode_;
+  bool in_escape = in_escape_;
+  int current_char = last_char_;
+  int last_char = 0;
+
+  const auto token = [&]() {
+    return span_begin != nullptr
+      ? std::string_view(span_begin, static_cast<size_t>(src_iter - span_begin) - num_spaces_trailing)
+      : std::string_view(buffer_.data(), buffer_.size() - num_spaces_trailing);
+  };
+
+  const auto reset_token = [&]() {
+    span_begin = nullptr;
+    buffer_.clear();
+  };
+
+  const auto spill_span = [&]() {
+    if (span_begin != nullptr) {
+      buffer_.assign(span_begin, static_cast<size_t>(src_iter - span_begin));
+      span_begin = nullptr;
+    }
+  };
+
+  for (; src_iter != src_end; ++src_iter) {
+    if (mode == SP_READ_COMMENT) {
+      const char *newline = detail::scan_newline(src_iter, src_end);
+      if (newline == src_end)
+        newline = src_end - 1;
+
+      if (newline != src_iter) {
+        current_char = newline[-1];
+        src_iter = newline;
+      }
+    }
+
+    last_char = current_char;
+    current_char = *src_iter;
+
+    // Escaped chars are never counted as trailing spaces.
+    bool escaped = false;
+
+    if (mode == SP_READ_COMMENT) {
+      if (current_char == '\n')
+        mode = SP_FIND_NAME;
+      continue;
+    } else if (in_escape) {
+      switch (current_char) {
+      case 'n': current_char = '\n'; break;
+      case 'r': current_char = '\r'; break;
+      case 'a': current_char = '\a'; break;
+      case 'b': current_char = '\b'; break;
+      case 'f': current_char = '\f'; break;
+      case 't': current_char = '\t'; break;
+      case '0': current_char = '\0'; break;
+      default: break;
+      }
+      in_escape = false;
+      escaped = true;
+    } else {
+      switch (current_char) {
+      case ' ':
+      case '\t':
+        if ((consume_whitespace && last_char == current_char) || mode == SP_FIND_NAME || mode == SP_FIND_VALUE) {
+          spill_span();
+          continue;
+        } else if (mode == SP_READ_NAME) {
+          mode = SP_FIND_VALUE;
+          handler_.on_name(token());
+          reset_token();
+          continue;
+        }
+        break;
+
+      case '{':
+        if (mode == SP_READ_NAME || mode == SP_FIND_VALUE) {
+          if (mode == SP_READ_NAME) {
+            handler_.on_name(token());
+            reset_token();
+          }
+          ++depth;
+          handler_.on_begin_node();
+        } else {
+          if (mode == SP_READ_VALUE) {
+            handler_.on_value(token());
+            reset_token();
+          }
+
+          if (nameless_nodes || (nameless_roots && depth == 0)) {
+            ++depth;
+            handler_.on_name(std::string_view());
+            handler_.on_begin_node();
+          } else {
+            error = SP_ERROR_INVALID_CHAR;
+            handler_.on_error(error, std::string_view(src_iter, 1));
+            goto basic_parser_exit;
+          }
+        }
+        mode = SP_FIND_NAME;
+        continue;
+
+      case '}':
+        if (mode == SP_READ_VALUE) {
+          handler_.on_value(token());
+          reset_token();
+        } else if (mode != SP_FIND_NAME || depth == 0) {
+          error = SP_ERROR_INVALID_CHAR;
+          handler_.on_error(error, std::string_view(src_iter, 1));
+          goto basic_parser_exit;
+        }
+
+        if (depth == 0) {
+          error = SP_ERROR_INVALID_CHAR;
+          handler_.on_error(error, std::string_view(src_iter, 1));
+          goto basic_parser_exit;
+        }
+
+        --depth;
+        mode = SP_FIND_NAME;
+        handler_.on_end_node();
+        continue;
+
+      case '#':
+      case ';':
+      case '\n':
+        if (mode == SP_READ_NAME) {
+          handler_.on_name(token());
+          reset_token();
+          handler_.on_value(std::string_view());
+        } else if (mode == SP_FIND_VALUE) {
+          handler_.on_value(std::string_view());
+        } else if (mode == SP_READ_VALUE) {
+          handler_.on_value(token());
+          reset_token();
+        }
+        mode = current_char == '#' ? SP_READ_COMMENT : SP_FIND_NAME;
+        continue;
+
+      case '\\':
+        spill_span();
+        in_escape = true;
+        continue;
+
+      default:
+        break;
+      }
+    }
+
+    if constexpr (trim_spaces) {
+      if (!escaped && (current_char == ' ' || current_char == '\t'))
+        ++num_spaces_trailing;
+      else
+        num_spaces_trailing = 0;
+    }
+
+    if (mode == SP_FIND_NAME)
+      mode = SP_READ_NAME;
+    else if (mode == SP_FIND_VALUE)
+      mode = SP_READ_VALUE;
+
+    if (span_begin == nullptr) {
+      if (buffer_.empty() && *src_iter == static_cast<char>(current_char))
+        span_begin = src_iter;
+      else
+        buffer_.push_back(static_cast<char>(current_char));
+    }
+
+    // Take the rest of a plain run in one go, as sparse_run does.
+    const char *const run_end = detail::scan_structural(src_iter + 1, src_end);
+    if (run_end - src_iter > 1) {
+      if (span_begin == nullptr)
+        buffer_.append(src_iter + 1, static_cast<size_t>(run_end - src_iter) - 1);
+
+      num_spaces_trailing = 0;
+      src_iter = run_end - 1;
+      last_char = src_iter[-1];
+      current_char = *src_iter;
+    }
+  }
+
+  spill_span();
+
+  basic_parser_exit:
+
+  num_spaces_trailing_ = num_spaces_trailing;
+  depth_ = depth;
+  mode_ = mode;
+  in_escape_ = in_escape;
+  last_char_ = current_char;
+
+  return error;
+}
+
+template <int Options, class Handler>
+sparse_error_t basic_parser<Options, Handler>::finish()
+{
+  static constexpr std::string_view incomplete_document = "Document is incomplete.";
+
+  sparse_error_t error = SP_NO_ERROR;
+  const std::string_view pending(buffer_.data(), buffer_.size() - num_spaces_trailing_);
+
+  if (mode_ == SP_READ_NAME) {
+    handler_.on_name(pending);
+    handler_.on_value(std::string_view());
+  } else if (mode_ == SP_READ_VALUE) {
+    handler_.on_value(pending);
+  } else if (mode_ == SP_FIND_VALUE) {
+    handler_.on_value(std::string_view());
+  }
+
+  if (depth_ != 0) {
+    error = SP_ERROR_INCOMPLETE_DOCUMENT;
+    handler_.on_error(error, incomplete_document);
+  }
+
+  buffer_.clear();
+  num_spaces_trailing_ = 0;
+  depth_ = 0;
+  mode_ = SP_FIND_NAME;
+  in_escape_ = false;
+  last_char_ = 0;
+
+  return error;
+}
+
+} // namespace sparse
+
+#endif /* end __CMT_SPARSE_BASIC_PARSER_HH__ include guard */
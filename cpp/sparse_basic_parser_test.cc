@@ -0,0 +1,137 @@
+#include "sparse_basic_parser.hh"
+#include <cstdio>
+#include <string>
+#include <utility>
+
+// Both parsers log events as "msg:length:token" so their output can be
+// compared directly.
+static void log_event(std::string &log, sparse_msg_t msg, std::string_view token)
+{
+  log += std::to_string((int)msg);
+  log += ':';
+  log += std::to_string(token.size());
+  log += ':';
+  log += token;
+}
+
+static void log_handler(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  // basic_parser doesn't pass the brace along with node events.
+  if (msg == SP_BEGIN_NODE || msg == SP_END_NODE)
+    end = begin;
+
+  log_event(*static_cast<std::string *>(context), msg, std::string_view(begin, begin == NULL ? 0 : (size_t)(end - begin)));
+}
+
+struct log_handler_t
+{
+  std::string log;
+
+  void on_name(std::string_view name) { log_event(log, SP_NAME, name); }
+  void on_value(std::string_view value) { log_event(log, SP_VALUE, value); }
+  void on_begin_node() { log_event(log, SP_BEGIN_NODE, std::string_view()); }
+  void on_end_node() { log_event(log, SP_END_NODE, std::string_view()); }
+  void on_error(sparse_error_t, std::string_view where) { log_event(log, SP_ERROR, where); }
+};
+
+static std::string log_c_parser(std::string_view src, sparse_options_t options)
+{
+  std::string log;
+  sparse_state_t state;
+
+  sparse_begin(&state, 0, options, log_handler, &log);
+  if (sparse_run(&state, src.data(), src.data() + src.size()) != SP_NO_ERROR)
+    state.callback = NULL;
+  sparse_end(&state);
+
+  return log;
+}
+
+// Runs the parser over src in pieces of chunk_size after an initial piece of
+// split bytes.
+template <int Options>
+static std::string log_basic_parser(std::string_view src, size_t split, size_t chunk_size)
+{
+  sparse::basic_parser<Options, log_handler_t> parser;
+  size_t offset = 0;
+  size_t length = split;
+
+  while (offset < src.size()) {
+    if (length > src.size() - offset)
+      length = src.size() - offset;
+
+    if (parser.parse(src.substr(offset, length)) != SP_NO_ERROR)
+      return std::move(parser.handler().log);
+
+    offset += length;
+    length = chunk_size;
+  }
+
+  parser.finish();
+  return std::move(parser.handler().log);
+}
+
+template <int Options>
+static int check_options(std::string_view src)
+{
+  const std::string expected = log_c_parser(src, (sparse_options_t)Options);
+  int failures = 0;
+
+  for (size_t chunk_size = 1; chunk_size < src.size() + 2; chunk_size += 3) {
+    for (size_t split = 1; split <= src.size(); split += chunk_size) {
+      if (log_basic_parser<Options>(src, split, chunk_size) != expected) {
+        std::fprintf(stderr, "Events differ for options %d at split %zu, chunk size %zu\n", Options, split, chunk_size);
+        ++failures;
+      }
+    }
+  }
+
+  return failures;
+}
+
+template <int... Options>
+static int check_all_options(std::string_view src, std::integer_sequence<int, Options...>)
+{
+  return (check_options<Options>(src) + ...);
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *const test_sources[] = {
+    "# This is a named root node (technically just a field with a node value):\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    # Incidentally, #s begin comments\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  clamp_v\n"
+    "}\n"
+    "\n"
+    "{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "fullscreen\n"
+    "fov 100\n"
+    "width 800; height 600\n",
+
+    "name  value\\  with\\ttrailing   \n"
+    "escaped\\ name {\\}\n"
+    "  a\t\tb  \\\\  \n"
+    "  { nested node }\n"
+    "}\n"
+    "last value",
+
+    "unbalanced { value }\n}\n",
+    "open { node\n",
+  };
+
+  int failures = 0;
+
+  for (const char *src : test_sources)
+    failures += check_all_options(src, std::make_integer_sequence<int, 16>());
+
+  return failures == 0 ? 0 : 1;
+}
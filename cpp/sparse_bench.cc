@@ -0,0 +1,504 @@
+/*
+  Throughput benchmark. Generates a few deterministic corpora with different
+  shapes and parses each through the C API (with and without SP_ZERO_COPY,
+  and with batched delivery), sparse_parser_t, and sparse_run fed in
+  fixed-size chunks. Results are
+  written to stdout as JSON so runs can be diffed or compared by a script.
+
+  Build with optimizations, e.g.:
+
+    c++ -std=c++11 -O2 -I. -x c sparse.c -x c sparse_scan.c -x c sparse_document.c \
+        -x c sparse_symbols.c -x c sparse_reader.c -x c sparse_file.c -x c sparse_writer.c \
+        -x c sparse_value.c -x c sparse_util.c -x c++ cpp/sparse.cc cpp/sparse_bench.cc \
+        -o sparse_bench
+
+  Usage: sparse_bench [--size MB] [--repeat N] [--seed N] [--corpus NAME]
+*/
+
+#include "sparse.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#if defined(__GLIBC__) && !defined(SP_BENCH_NO_ALLOC_HOOKS)
+#define SP_BENCH_ALLOC_HOOKS 1
+#include <malloc.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/* Allocation counting */
+
+static size_t bench_num_allocs = 0;
+static size_t bench_heap_bytes = 0;
+static size_t bench_peak_heap_bytes = 0;
+
+#ifdef SP_BENCH_ALLOC_HOOKS
+
+// Replaces the allocator for the whole process (the parser, libstdc++'s
+// operator new and all) so every allocation made during a run is counted.
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+static void bench_track_alloc(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  ++bench_num_allocs;
+  bench_heap_bytes += malloc_usable_size(ptr);
+  if (bench_heap_bytes > bench_peak_heap_bytes)
+    bench_peak_heap_bytes = bench_heap_bytes;
+}
+
+static void bench_track_free(void *ptr)
+{
+  if (ptr != NULL)
+    bench_heap_bytes -= malloc_usable_size(ptr);
+}
+
+void *malloc(size_t size)
+{
+  void *ptr = __libc_malloc(size);
+  bench_track_alloc(ptr);
+  return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+  void *ptr = __libc_calloc(count, size);
+  bench_track_alloc(ptr);
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  bench_track_free(ptr);
+  ptr = __libc_realloc(ptr, size);
+  bench_track_alloc(ptr);
+  return ptr;
+}
+
+void free(void *ptr)
+{
+  bench_track_free(ptr);
+  __libc_free(ptr);
+}
+
+} // extern "C"
+
+#endif /* SP_BENCH_ALLOC_HOOKS */
+
+static long peak_rss_kb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+  return -1;
+}
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+/* Corpus generation */
+
+// xorshift64*, so the same seed gives the same corpus everywhere.
+struct bench_random_t
+{
+  unsigned long long state;
+
+  explicit bench_random_t(unsigned long long seed) : state(seed != 0 ? seed : 1) {}
+
+  unsigned next(unsigned bound)
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (unsigned)((state * 2685821657736338717ULL) >> 33) % bound;
+  }
+};
+
+static void append_word(std::string &out, bench_random_t &random, unsigned min_length, unsigned max_length)
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz0123456789_./";
+  const unsigned length = min_length + random.next(max_length - min_length + 1);
+
+  for (unsigned index = 0; index < length; ++index)
+    out += letters[random.next(sizeof(letters) - 1)];
+}
+
+// Lots of short fields and small nodes, like a typical config file.
+static void generate_small_roots(std::string &out, bench_random_t &random)
+{
+  append_word(out, random, 4, 16);
+  if (random.next(3) == 0) {
+    out += " {\n";
+    for (unsigned field = random.next(4) + 1; field > 0; --field) {
+      out += "  ";
+      append_word(out, random, 3, 10);
+      out += ' ';
+      append_word(out, random, 1, 12);
+      out += '\n';
+    }
+    out += "}\n";
+  } else {
+    out += ' ';
+    append_word(out, random, 1, 16);
+    out += '\n';
+  }
+}
+
+static void generate_deep_nesting(std::string &out, bench_random_t &random)
+{
+  const unsigned depth = 32 + random.next(96);
+
+  for (unsigned level = 0; level < depth; ++level) {
+    out.append(level, ' ');
+    append_word(out, random, 1, 6);
+    out += " {\n";
+  }
+
+  out.append(depth, ' ');
+  append_word(out, random, 1, 6);
+  out += ' ';
+  append_word(out, random, 1, 6);
+  out += '\n';
+
+  for (unsigned level = depth; level > 0; --level) {
+    out.append(level - 1, ' ');
+    out += "}\n";
+  }
+}
+
+static void generate_long_values(std::string &out, bench_random_t &random)
+{
+  append_word(out, random, 4, 16);
+  out += ' ';
+  for (unsigned word = 256 + random.next(2048); word > 0; --word) {
+    append_word(out, random, 1, 12);
+    out += ' ';
+  }
+  append_word(out, random, 1, 12);
+  out += '\n';
+}
+
+static void generate_comment_heavy(std::string &out, bench_random_t &random)
+{
+  for (unsigned line = 1 + random.next(4); line > 0; --line) {
+    out += "# ";
+    for (unsigned word = 4 + random.next(12); word > 0; --word) {
+      append_word(out, random, 1, 10);
+      out += ' ';
+    }
+    out += '\n';
+  }
+
+  append_word(out, random, 4, 16);
+  out += ' ';
+  append_word(out, random, 1, 16);
+  out += " # ";
+  append_word(out, random, 8, 32);
+  out += '\n';
+}
+
+static void generate_escape_heavy(std::string &out, bench_random_t &random)
+{
+  static const char *const escapes[] = { "\\n", "\\t", "\\ ", "\\{", "\\}", "\\#", "\\;", "\\\\", "\\0" };
+
+  append_word(out, random, 2, 8);
+  out += escapes[random.next(3) + 2];
+  append_word(out, random, 2, 8);
+  out += ' ';
+  for (unsigned part = 4 + random.next(12); part > 0; --part) {
+    append_word(out, random, 1, 6);
+    out += escapes[random.next(sizeof(escapes) / sizeof(escapes[0]))];
+  }
+  out += '\n';
+}
+
+// Long runs of spaces and tabs everywhere, meant for SP_CONSUME_WHITESPACE.
+static void generate_whitespace(std::string &out, bench_random_t &random)
+{
+  static const char blanks[] = " \t";
+
+  out.append(random.next(32), blanks[random.next(2)]);
+  append_word(out, random, 2, 12);
+  out.append(1 + random.next(32), blanks[random.next(2)]);
+  for (unsigned word = 1 + random.next(6); word > 0; --word) {
+    append_word(out, random, 1, 8);
+    out.append(1 + random.next(16), blanks[random.next(2)]);
+  }
+  out += '\n';
+}
+
+typedef void (*bench_generator_fn_t)(std::string &out, bench_random_t &random);
+
+struct bench_corpus_t
+{
+  const char *name;
+  bench_generator_fn_t generate;
+  int options;
+};
+
+static const bench_corpus_t bench_corpora[] = {
+  { "small_roots", generate_small_roots, SP_DEFAULT_OPTIONS },
+  { "deep_nesting", generate_deep_nesting, SP_DEFAULT_OPTIONS },
+  { "long_values", generate_long_values, SP_DEFAULT_OPTIONS },
+  { "comment_heavy", generate_comment_heavy, SP_DEFAULT_OPTIONS },
+  { "escape_heavy", generate_escape_heavy, SP_DEFAULT_OPTIONS },
+  { "whitespace", generate_whitespace, SP_CONSUME_WHITESPACE | SP_TRIM_TRAILING_SPACES },
+};
+
+static std::string generate_corpus(const bench_corpus_t &corpus, size_t size, unsigned long long seed)
+{
+  bench_random_t random(seed);
+  std::string out;
+
+  out.reserve(size + 64 * 1024);
+  while (out.size() < size)
+    corpus.generate(out, random);
+
+  return out;
+}
+
+
+/* Runners */
+
+struct bench_counts_t
+{
+  size_t events;
+  size_t bytes;
+};
+
+static void count_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  bench_counts_t *counts = (bench_counts_t *)context;
+  ++counts->events;
+  counts->bytes += (size_t)(end - begin);
+  (void)msg;
+}
+
+// Returns false if the document didn't parse, which would make the numbers
+// meaningless.
+typedef bool (*bench_run_fn_t)(const std::string &src, int options, size_t chunk_size, bench_counts_t *counts);
+
+static bool run_c_api(const std::string &src, int options, size_t chunk_size, bench_counts_t *counts)
+{
+  sparse_state_t state;
+  const char *const src_end = src.data() + src.size();
+  const char *src_iter = src.data();
+  sparse_error_t error = sparse_begin(&state, 0, (sparse_options_t)options, count_event, counts);
+
+  if (chunk_size == 0)
+    chunk_size = src.size();
+
+  while (error == SP_NO_ERROR && src_iter != src_end) {
+    const size_t length = (size_t)(src_end - src_iter) < chunk_size ? (size_t)(src_end - src_iter) : chunk_size;
+    error = sparse_run(&state, src_iter, src_iter + length);
+    src_iter += length;
+  }
+
+  if (error == SP_NO_ERROR)
+    return sparse_end(&state) == SP_NO_ERROR;
+
+  sparse_end(&state);
+  return false;
+}
+
+static void count_batch(const sparse_record_t *records, size_t num_records, const char *data, void *context)
+{
+  bench_counts_t *counts = (bench_counts_t *)context;
+  size_t bytes = 0;
+  (void)data;
+
+  for (size_t index = 0; index < num_records; ++index)
+    bytes += records[index].length;
+
+  counts->events += num_records;
+  counts->bytes += bytes;
+}
+
+static bool run_c_batched(const std::string &src, int options, size_t chunk_size, bench_counts_t *counts)
+{
+  static sparse_record_t records[1024];
+  sparse_state_t state;
+  sparse_batch_t batch;
+  sparse_error_t error = sparse_begin_batched(&state, 0, (sparse_options_t)options, &batch, records,
+                                              sizeof(records) / sizeof(records[0]), count_batch, counts);
+  (void)chunk_size;
+
+  if (error == SP_NO_ERROR)
+    error = sparse_run(&state, src.data(), src.data() + src.size());
+
+  if (error == SP_NO_ERROR)
+    return sparse_end(&state) == SP_NO_ERROR;
+
+  sparse_end(&state);
+  return false;
+}
+
+static bool run_cpp_wrapper(const std::string &src, int options, size_t chunk_size, bench_counts_t *counts)
+{
+  (void)chunk_size;
+  try {
+    sparse_parser_t parser(count_event, counts, options);
+    parser.parse(src);
+    parser.finish();
+  } catch (sparse_exception_t &) {
+    return false;
+  }
+  return true;
+}
+
+struct bench_variant_t
+{
+  const char *api;
+  bench_run_fn_t run;
+  int extra_options;
+  size_t chunk_size;
+};
+
+static const bench_variant_t bench_variants[] = {
+  { "c", run_c_api, 0, 0 },
+  { "c_zero_copy", run_c_api, SP_ZERO_COPY, 0 },
+  { "c_batched", run_c_batched, 0, 0 },
+  { "cpp_parser", run_cpp_wrapper, 0, 0 },
+  { "c_chunked", run_c_api, 0, 64 },
+  { "c_chunked", run_c_api, 0, 4096 },
+  { "c_chunked", run_c_api, 0, 65536 },
+};
+
+struct bench_result_t
+{
+  double seconds;
+  bench_counts_t counts;
+  size_t num_allocs;
+  size_t peak_heap_bytes;
+  bool ok;
+};
+
+static bench_result_t run_variant(const bench_variant_t &variant, const std::string &src, int options, int repeat)
+{
+  bench_result_t result;
+  result.seconds = 0.0;
+  result.ok = true;
+
+  for (int run = 0; run < repeat && result.ok; ++run) {
+    bench_counts_t counts = { 0, 0 };
+    double start;
+    double seconds;
+
+    bench_num_allocs = 0;
+    bench_heap_bytes = 0;
+    bench_peak_heap_bytes = 0;
+
+    start = now_seconds();
+    result.ok = variant.run(src, options | variant.extra_options, variant.chunk_size, &counts);
+    seconds = now_seconds() - start;
+
+    // Keep the fastest run; allocations are the same for every run.
+    if (run == 0 || seconds < result.seconds) {
+      result.seconds = seconds;
+      result.counts = counts;
+      result.num_allocs = bench_num_allocs;
+      result.peak_heap_bytes = bench_peak_heap_bytes;
+    }
+  }
+
+  return result;
+}
+
+static void print_usage(const char *program)
+{
+  std::fprintf(stderr, "Usage: %s [--size MB] [--repeat N] [--seed N] [--corpus NAME]\n", program);
+}
+
+int main(int argc, char const *argv[])
+{
+  size_t size_mb = 16;
+  int repeat = 5;
+  unsigned long long seed = 1;
+  const char *only_corpus = NULL;
+  bool first_result = true;
+
+  for (int arg = 1; arg < argc; ++arg) {
+    if (arg + 1 < argc && std::strcmp(argv[arg], "--size") == 0) {
+      size_mb = (size_t)std::strtoul(argv[++arg], NULL, 10);
+    } else if (arg + 1 < argc && std::strcmp(argv[arg], "--repeat") == 0) {
+      repeat = std::atoi(argv[++arg]);
+    } else if (arg + 1 < argc && std::strcmp(argv[arg], "--seed") == 0) {
+      seed = std::strtoull(argv[++arg], NULL, 10);
+    } else if (arg + 1 < argc && std::strcmp(argv[arg], "--corpus") == 0) {
+      only_corpus = argv[++arg];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (size_mb == 0 || repeat <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::printf("{\n  \"size_mb\": %zu,\n  \"repeat\": %d,\n  \"seed\": %llu,\n", size_mb, repeat, seed);
+#ifdef SP_BENCH_ALLOC_HOOKS
+  std::printf("  \"allocations_counted\": true,\n");
+#else
+  std::printf("  \"allocations_counted\": false,\n");
+#endif
+  std::printf("  \"results\": [");
+
+  for (size_t corpus_index = 0; corpus_index < sizeof(bench_corpora) / sizeof(bench_corpora[0]); ++corpus_index) {
+    const bench_corpus_t &corpus = bench_corpora[corpus_index];
+
+    if (only_corpus != NULL && std::strcmp(only_corpus, corpus.name) != 0)
+      continue;
+
+    const std::string src = generate_corpus(corpus, size_mb * 1024 * 1024, seed);
+
+    for (size_t variant_index = 0; variant_index < sizeof(bench_variants) / sizeof(bench_variants[0]); ++variant_index) {
+      const bench_variant_t &variant = bench_variants[variant_index];
+      const bench_result_t result = run_variant(variant, src, corpus.options, repeat);
+
+      std::printf("%s\n    {\"corpus\": \"%s\", \"api\": \"%s\", \"chunk_size\": %zu, \"options\": %d, "
+                  "\"bytes\": %zu, \"ok\": %s, \"seconds\": %.6f, \"mb_per_s\": %.2f, "
+                  "\"events\": %zu, \"events_per_s\": %.0f, ",
+                  first_result ? "" : ",",
+                  corpus.name, variant.api, variant.chunk_size, corpus.options | variant.extra_options,
+                  src.size(), result.ok ? "true" : "false", result.seconds,
+                  (double)src.size() / result.seconds / 1e6,
+                  result.counts.events, (double)result.counts.events / result.seconds);
+#ifdef SP_BENCH_ALLOC_HOOKS
+      std::printf("\"allocations\": %zu, \"peak_heap_bytes\": %zu, ", result.num_allocs, result.peak_heap_bytes);
+#else
+      std::printf("\"allocations\": null, \"peak_heap_bytes\": null, ");
+#endif
+      std::printf("\"peak_rss_kb\": %ld}", peak_rss_kb());
+      std::fflush(stdout);
+      first_result = false;
+    }
+  }
+
+  std::printf("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,424 @@
+#include "sparse_cache.hh"
+#include "sparse_internal.h"
+#include <new>
+#include <string>
+#include <system_error>
+
+#ifdef SP_CACHE_INOTIFY
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+struct sparse_cache_snapshot_data_t
+{
+  sparse_document_t document;
+  std::atomic<size_t> refs;
+  uint64_t version;
+};
+
+// A cached file. Entries are only ever added to the path table, and are only
+// freed with the cache, so readers can walk it without locking.
+//
+// Readers count themselves in readers[epoch & 1] while they take a reference
+// to the current snapshot. After swapping in a new snapshot, a reload waits
+// until it has seen each count at 0, which means every reader that could
+// have seen the old snapshot has its reference, and only then drops the
+// cache's own reference to it. It flips epoch before waiting on each count
+// so that readers arriving meanwhile use the other one, and the wait is only
+// ever on the few readers that were already in the middle of taking a
+// reference.
+struct sparse_cache_entry_t
+{
+  std::string path;
+  std::string directory;
+  std::string file_name;
+
+  std::atomic<sparse_cache_snapshot_data_t *> current;
+  std::atomic<unsigned> epoch;
+  std::atomic<size_t> readers[2];
+
+  std::atomic<int> error;
+  uint64_t version;
+
+  // Set before the entry is added to the table and never changed after.
+  sparse_cache_entry_t *next;
+
+  explicit sparse_cache_entry_t(const std::string &path)
+  : path(path), current(NULL), epoch(0), error(SP_NO_ERROR), version(0), next(NULL)
+  {
+    const size_t slash = path.rfind('/');
+    directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    file_name = slash == std::string::npos ? path : path.substr(slash + 1);
+    readers[0].store(0);
+    readers[1].store(0);
+  }
+};
+
+static size_t sp_cache_bucket(const std::string &path)
+{
+  return (size_t)(sp_hash(SP_HASH_SEED, path.data(), path.data() + path.size()) % SP_CACHE_NUM_BUCKETS);
+}
+
+static void sp_cache_release(sparse_cache_snapshot_data_t *data)
+{
+  if (data != NULL && data->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    sparse_document_free(&data->document);
+    delete data;
+  }
+}
+
+static sparse_cache_snapshot_data_t *sp_cache_acquire(sparse_cache_entry_t *entry)
+{
+  std::atomic<size_t> &readers = entry->readers[entry->epoch.load() & 1];
+  sparse_cache_snapshot_data_t *data;
+
+  readers.fetch_add(1);
+  data = entry->current.load();
+  data->refs.fetch_add(1, std::memory_order_relaxed);
+  readers.fetch_sub(1, std::memory_order_release);
+
+  return data;
+}
+
+// Reloads are serialized by the cache's mutex, so there's only ever one of
+// these at a time for an entry.
+static void sp_cache_publish(sparse_cache_entry_t *entry, sparse_cache_snapshot_data_t *data)
+{
+  sparse_cache_snapshot_data_t *const old_data = entry->current.exchange(data);
+
+  for (int pass = 0; pass < 2; ++pass) {
+    const unsigned epoch = entry->epoch.fetch_add(1);
+    while (entry->readers[epoch & 1].load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+  }
+
+  sp_cache_release(old_data);
+}
+
+static sparse_error_t sp_cache_parse(const std::string &path, int options, uint64_t version,
+                                     sparse_cache_snapshot_data_t **result)
+{
+  sparse_cache_snapshot_data_t *data = new (std::nothrow) sparse_cache_snapshot_data_t;
+  sparse_state_t state;
+  sparse_error_t error;
+
+  if (data == NULL)
+    return SP_ERROR_NO_MEM;
+
+  data->refs.store(1);
+  data->version = version;
+
+  error = sparse_document_init(&data->document);
+  if (error != SP_NO_ERROR) {
+    delete data;
+    return error;
+  }
+
+  error = sparse_begin_document(&state, 0, (sparse_options_t)options, &data->document);
+  if (error == SP_NO_ERROR)
+    error = sp_parse_whole_file(&state, path.c_str());
+  if (error == SP_NO_ERROR)
+    error = sparse_document_error(&data->document);
+
+  if (error != SP_NO_ERROR) {
+    sparse_document_free(&data->document);
+    delete data;
+    return error;
+  }
+
+  *result = data;
+  return SP_NO_ERROR;
+}
+
+static void sp_cache_check_error(sparse_error_t error, const std::string &path) throw(sparse_exception_t)
+{
+  switch (error) {
+  case SP_NO_ERROR:
+    return;
+  case SP_ERROR_NO_MEM:
+    throw sparse_no_mem_error_t("Could not allocate memory for " + path + ".");
+  case SP_ERROR_INCOMPLETE_DOCUMENT:
+    throw sparse_incomplete_document_error_t(path + " is incomplete.");
+  case SP_ERROR_IO:
+    throw sparse_io_error_t("Could not read " + path + ".");
+  default:
+    // The file isn't kept in memory, so there's nowhere for an invalid
+    // character error to point.
+    throw sparse_exception_t("Invalid character encountered in " + path + ".");
+  }
+}
+
+
+/* Snapshots */
+
+sparse_cache_t::snapshot_t::snapshot_t(const snapshot_t &other)
+: data(other.data)
+{
+  if (data != NULL)
+    data->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+sparse_cache_t::snapshot_t &sparse_cache_t::snapshot_t::operator = (const snapshot_t &other)
+{
+  if (other.data != NULL)
+    other.data->refs.fetch_add(1, std::memory_order_relaxed);
+  sp_cache_release(data);
+  data = other.data;
+  return *this;
+}
+
+sparse_cache_t::snapshot_t &sparse_cache_t::snapshot_t::operator = (snapshot_t &&other)
+{
+  if (this != &other) {
+    sp_cache_release(data);
+    data = other.data;
+    other.data = NULL;
+  }
+  return *this;
+}
+
+sparse_cache_t::snapshot_t::~snapshot_t()
+{
+  sp_cache_release(data);
+}
+
+const sparse_document_t *sparse_cache_t::snapshot_t::document() const
+{
+  return data != NULL ? &data->document : NULL;
+}
+
+uint64_t sparse_cache_t::snapshot_t::version() const
+{
+  return data != NULL ? data->version : 0;
+}
+
+
+/* Cache */
+
+sparse_cache_t::sparse_cache_t(int options, bool watch)
+: options(options)
+{
+  for (size_t index = 0; index < SP_CACHE_NUM_BUCKETS; ++index)
+    buckets[index].store(NULL, std::memory_order_relaxed);
+
+#ifdef SP_CACHE_INOTIFY
+  inotify_fd = -1;
+  stop_fds[0] = stop_fds[1] = -1;
+
+  if (!watch)
+    return;
+
+  // Without inotify or a thread to read it, the cache just doesn't watch.
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0)
+    return;
+
+  if (pipe2(stop_fds, O_CLOEXEC) == 0) {
+    try {
+      watcher = std::thread(&sparse_cache_t::watch_loop, this);
+      return;
+    } catch (std::system_error &) {
+    }
+    close(stop_fds[0]);
+    close(stop_fds[1]);
+    stop_fds[0] = stop_fds[1] = -1;
+  }
+
+  close(inotify_fd);
+  inotify_fd = -1;
+#else
+  (void)watch;
+#endif
+}
+
+sparse_cache_t::~sparse_cache_t()
+{
+#ifdef SP_CACHE_INOTIFY
+  if (watcher.joinable()) {
+    const char stop = 0;
+    while (write(stop_fds[1], &stop, 1) < 0 && errno == EINTR)
+      ;
+    watcher.join();
+    close(stop_fds[0]);
+    close(stop_fds[1]);
+  }
+
+  if (inotify_fd >= 0)
+    close(inotify_fd);
+#endif
+
+  for (size_t index = 0; index < entries.size(); ++index) {
+    sp_cache_release(entries[index]->current.load());
+    delete entries[index];
+  }
+}
+
+sparse_cache_entry_t *sparse_cache_t::find(const std::string &path) const
+{
+  sparse_cache_entry_t *entry = buckets[sp_cache_bucket(path)].load(std::memory_order_acquire);
+
+  while (entry != NULL && entry->path != path)
+    entry = entry->next;
+
+  return entry;
+}
+
+sparse_cache_t::snapshot_t sparse_cache_t::get(const std::string &path) throw(sparse_exception_t)
+{
+  sparse_cache_entry_t *entry = find(path);
+
+  if (entry == NULL) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sparse_cache_snapshot_data_t *data;
+
+    // Someone else may have added it while this was waiting for the lock.
+    entry = find(path);
+    if (entry == NULL) {
+      sp_cache_check_error(sp_cache_parse(path, options, 1, &data), path);
+
+      try {
+        entry = new sparse_cache_entry_t(path);
+        entries.push_back(entry);
+      } catch (std::bad_alloc &) {
+        delete entry;
+        sp_cache_release(data);
+        throw sparse_no_mem_error_t("Could not allocate memory for " + path + ".");
+      }
+
+      entry->current.store(data);
+      entry->version = 1;
+
+      std::atomic<sparse_cache_entry_t *> &bucket = buckets[sp_cache_bucket(path)];
+      entry->next = bucket.load(std::memory_order_relaxed);
+      bucket.store(entry, std::memory_order_release);
+
+#ifdef SP_CACHE_INOTIFY
+      if (watcher.joinable())
+        watch(entry);
+#endif
+    }
+  }
+
+  return snapshot_t(sp_cache_acquire(entry));
+}
+
+sparse_error_t sparse_cache_t::reload(sparse_cache_entry_t *entry)
+{
+  sparse_cache_snapshot_data_t *data;
+  const sparse_error_t error = sp_cache_parse(entry->path, options, entry->version + 1, &data);
+
+  if (error == SP_NO_ERROR) {
+    ++entry->version;
+    sp_cache_publish(entry, data);
+  }
+
+  entry->error.store(error);
+  return error;
+}
+
+sparse_error_t sparse_cache_t::reload(const std::string &path)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  sparse_cache_entry_t *entry = find(path);
+
+  return entry != NULL ? reload(entry) : SP_ERROR_NOT_FOUND;
+}
+
+sparse_error_t sparse_cache_t::last_error(const std::string &path) const
+{
+  const sparse_cache_entry_t *entry = find(path);
+
+  return entry != NULL ? (sparse_error_t)entry->error.load() : SP_ERROR_NOT_FOUND;
+}
+
+bool sparse_cache_t::watching() const
+{
+#ifdef SP_CACHE_INOTIFY
+  return watcher.joinable();
+#else
+  return false;
+#endif
+}
+
+#ifdef SP_CACHE_INOTIFY
+
+// Called with the mutex held.
+void sparse_cache_t::watch(sparse_cache_entry_t *entry)
+{
+  int wd;
+
+  for (size_t index = 0; index < directories.size(); ++index) {
+    if (directories[index].second == entry->directory)
+      return;
+  }
+
+  // Writing a file in place ends with it being closed, and replacing it ends
+  // with a new one being moved over it.
+  wd = inotify_add_watch(inotify_fd, entry->directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd >= 0)
+    directories.push_back(std::make_pair(wd, entry->directory));
+}
+
+void sparse_cache_t::watch_loop()
+{
+  alignas(struct inotify_event) char buffer[4096];
+
+  for (;;) {
+    struct pollfd fds[2];
+    ssize_t size;
+
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fds[0];
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    if (fds[1].revents != 0)
+      return;
+
+    size = read(inotify_fd, buffer, sizeof(buffer));
+    if (size <= 0)
+      continue;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (ssize_t offset = 0; offset < size; ) {
+      const struct inotify_event *event = (const struct inotify_event *)(buffer + offset);
+      offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so any file could have changed.
+        for (size_t index = 0; index < entries.size(); ++index)
+          reload(entries[index]);
+        continue;
+      }
+
+      for (size_t index = 0; index < directories.size(); ++index) {
+        if (directories[index].first != event->wd)
+          continue;
+
+        if (event->mask & IN_IGNORED) {
+          directories.erase(directories.begin() + (std::ptrdiff_t)index);
+          break;
+        }
+
+        for (size_t entry = 0; entry < entries.size(); ++entry) {
+          if (event->len > 0 && entries[entry]->directory == directories[index].second
+              && entries[entry]->file_name == event->name)
+            reload(entries[entry]);
+        }
+        break;
+      }
+    }
+  }
+}
+
+#endif /* SP_CACHE_INOTIFY */
@@ -0,0 +1,113 @@
+#ifndef __CMT_SPARSE_CACHE_HH__
+#define __CMT_SPARSE_CACHE_HH__
+
+#include "sparse.hh"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Buckets in the cache's path table. Chains just get longer past this many
+// files, so it only needs to be about the number of files cached.
+#ifndef SP_CACHE_NUM_BUCKETS
+#define SP_CACHE_NUM_BUCKETS (256)
+#endif
+
+// Files are watched with inotify where there is one.
+#if defined(__linux__) && !defined(SP_CACHE_NO_INOTIFY)
+#define SP_CACHE_INOTIFY
+#endif
+
+struct sparse_cache_snapshot_data_t;
+struct sparse_cache_entry_t;
+
+/* Document cache */
+// Parses each file once and shares the result between threads. A snapshot of
+// a file's document never changes, and stays valid for as long as any handle
+// to it does. When a file changes, it's parsed again on the cache's watcher
+// thread and the new document replaces the old one for readers that come
+// after, while readers holding the old one keep it. Getting a snapshot of a
+// file that's already cached doesn't lock or wait on anything, so reloads
+// don't slow readers down.
+//
+// Files are cached under the path they're first asked for with, so two
+// different paths to the same file are cached twice. Changes are seen by
+// watching the directory a file is in, so files that are replaced by renaming
+// a new one over them (as most editors do) are reloaded too.
+class sparse_cache_t
+{
+public:
+  // A counted reference to one version of a file's document.
+  class snapshot_t
+  {
+  private:
+    sparse_cache_snapshot_data_t *data;
+
+    friend class sparse_cache_t;
+    explicit snapshot_t(sparse_cache_snapshot_data_t *data) : data(data) {}
+
+  public:
+    snapshot_t() : data(NULL) {}
+    snapshot_t(const snapshot_t &other);
+    snapshot_t(snapshot_t &&other) : data(other.data) { other.data = NULL; }
+    snapshot_t &operator = (const snapshot_t &other);
+    snapshot_t &operator = (snapshot_t &&other);
+    ~snapshot_t();
+
+    bool valid() const { return data != NULL; }
+    const sparse_document_t *document() const;
+    sparse_node_view_t root() const { return sparse_node_view_t(document(), SP_DOCUMENT_ROOT); }
+    // Counts the times the file was parsed, starting at 1.
+    uint64_t version() const;
+  };
+
+private:
+  int options;
+
+  // Held while adding files and reloading them, never while reading.
+  std::mutex mutex;
+  std::atomic<sparse_cache_entry_t *> buckets[SP_CACHE_NUM_BUCKETS];
+  std::vector<sparse_cache_entry_t *> entries;
+
+#ifdef SP_CACHE_INOTIFY
+  int inotify_fd;
+  int stop_fds[2];
+  // Watch descriptors and the directories they watch.
+  std::vector<std::pair<int, std::string> > directories;
+  std::thread watcher;
+
+  void watch(sparse_cache_entry_t *entry);
+  void watch_loop();
+#endif
+
+  sparse_cache_t(const sparse_cache_t &);
+  sparse_cache_t &operator = (const sparse_cache_t &);
+
+  sparse_cache_entry_t *find(const std::string &path) const;
+  sparse_error_t reload(sparse_cache_entry_t *entry);
+
+public:
+  // Files are parsed with options. If watch is false, or inotify isn't
+  // available, files are only parsed again when reload is called.
+  explicit sparse_cache_t(int options = SP_DEFAULT_OPTIONS, bool watch = true);
+  // Stops watching. Snapshots that are still held stay valid.
+  ~sparse_cache_t();
+
+  // Returns the latest snapshot of the file at path, parsing it first if it
+  // isn't cached yet. Throws if that first parse fails.
+  snapshot_t get(const std::string &path) throw(sparse_exception_t);
+
+  // Parses a cached file again now and, if that works, makes it the latest
+  // snapshot. Returns SP_ERROR_NOT_FOUND if path isn't cached.
+  sparse_error_t reload(const std::string &path);
+
+  // The result of the last time the file at path was parsed, so a reload
+  // that failed and left the old snapshot in place can be noticed.
+  sparse_error_t last_error(const std::string &path) const;
+
+  // True if files are reloaded on their own when they change.
+  bool watching() const;
+};
+
+#endif /* end __CMT_SPARSE_CACHE_HH__ include guard */
@@ -0,0 +1,196 @@
+#include "sparse_cache.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+static std::string temp_directory()
+{
+  char path[] = "/tmp/sparse_cache_test.XXXXXX";
+  return mkdtemp(path) != NULL ? std::string(path) : std::string();
+}
+
+// Writes a file in place, or writes another one and moves it over path the
+// way editors do.
+static void write_file(const std::string &path, const std::string &contents, bool replace = false)
+{
+  const std::string write_path = replace ? path + ".new" : path;
+  FILE *file = std::fopen(write_path.c_str(), "wb");
+  std::fwrite(contents.data(), 1, contents.size(), file);
+  std::fclose(file);
+  if (replace)
+    std::rename(write_path.c_str(), path.c_str());
+}
+
+static std::string value_of(const sparse_cache_t::snapshot_t &snapshot, const std::string &name)
+{
+  return snapshot.root().find(name).value_string();
+}
+
+static int check_reload(const std::string &directory)
+{
+  const std::string path = directory + "/reload.conf";
+  sparse_cache_t cache(SP_DEFAULT_OPTIONS, false);
+  int failures = 0;
+
+  write_file(path, "width 800\nheight 600\n");
+  sparse_cache_t::snapshot_t first = cache.get(path);
+  sparse_cache_t::snapshot_t again = cache.get(path);
+
+  if (value_of(first, "width") != "800" || first.version() != 1 || again.document() != first.document()) {
+    std::fprintf(stderr, "First get didn't parse the file once.\n");
+    ++failures;
+  }
+
+  write_file(path, "width 1024\nheight 768\n");
+  if (cache.reload(path) != SP_NO_ERROR) {
+    std::fprintf(stderr, "Reload failed.\n");
+    ++failures;
+  }
+
+  sparse_cache_t::snapshot_t second = cache.get(path);
+  if (value_of(second, "width") != "1024" || second.version() != 2 || value_of(first, "width") != "800") {
+    std::fprintf(stderr, "Reload didn't replace the snapshot or changed the old one.\n");
+    ++failures;
+  }
+
+  // A file that no longer parses leaves the last snapshot in place.
+  write_file(path, "width 1280 }\n");
+  if (cache.reload(path) != SP_ERROR_INVALID_CHAR || cache.last_error(path) != SP_ERROR_INVALID_CHAR
+      || cache.get(path).version() != 2) {
+    std::fprintf(stderr, "A failed reload replaced the snapshot.\n");
+    ++failures;
+  }
+
+  if (cache.reload(directory + "/missing.conf") != SP_ERROR_NOT_FOUND
+      || cache.last_error(directory + "/missing.conf") != SP_ERROR_NOT_FOUND) {
+    std::fprintf(stderr, "Reloading a file that isn't cached didn't fail.\n");
+    ++failures;
+  }
+
+  try {
+    cache.get(directory + "/missing.conf");
+    std::fprintf(stderr, "Getting a missing file didn't throw.\n");
+    ++failures;
+  } catch (sparse_io_error_t &) {
+  }
+
+  // Snapshots outlive the cache.
+  sparse_cache_t::snapshot_t kept;
+  write_file(directory + "/kept.conf", "kept 1\n");
+  {
+    sparse_cache_t other(SP_DEFAULT_OPTIONS, false);
+    kept = other.get(directory + "/kept.conf");
+  }
+  if (value_of(kept, "kept") != "1") {
+    std::fprintf(stderr, "Snapshot didn't outlive its cache.\n");
+    ++failures;
+  }
+
+  return failures;
+}
+
+static int check_watch(const std::string &directory)
+{
+  const std::string path = directory + "/watch.conf";
+  sparse_cache_t cache;
+  int failures = 0;
+
+  if (!cache.watching())
+    return 0;
+
+  write_file(path, "fov 90\n");
+  if (value_of(cache.get(path), "fov") != "90") {
+    std::fprintf(stderr, "Watched file didn't parse.\n");
+    return 1;
+  }
+
+  for (int replace = 0; replace < 2; ++replace) {
+    const std::string fov = replace ? "110" : "100";
+    write_file(path, "fov " + fov + "\n", replace != 0);
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (value_of(cache.get(path), "fov") != fov && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    if (value_of(cache.get(path), "fov") != fov) {
+      std::fprintf(stderr, "Watched file wasn't reloaded after being %s.\n", replace ? "replaced" : "written");
+      ++failures;
+    }
+  }
+
+  return failures;
+}
+
+// Readers keep getting snapshots while the file is reloaded under them. Each
+// should see a whole document, and never an older one than it saw before.
+static int check_concurrent_reads(const std::string &directory)
+{
+  const std::string path = directory + "/concurrent.conf";
+  const int num_reloads = 500;
+  sparse_cache_t cache(SP_DEFAULT_OPTIONS, false);
+  std::atomic<bool> done(false);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> readers;
+
+  write_file(path, "count 0\nend 0\n");
+  cache.get(path);
+
+  for (int index = 0; index < 4; ++index) {
+    readers.push_back(std::thread([&]() {
+      long last = 0;
+      while (!done.load()) {
+        sparse_cache_t::snapshot_t snapshot = cache.get(path);
+        const long count = std::atol(value_of(snapshot, "count").c_str());
+        if (count < last || value_of(snapshot, "end") != value_of(snapshot, "count"))
+          ++failures;
+        last = count;
+      }
+    }));
+  }
+
+  for (int count = 1; count <= num_reloads; ++count) {
+    const std::string value = std::to_string(count);
+    write_file(path, "count " + value + "\nend " + value + "\n");
+    cache.reload(path);
+  }
+
+  done.store(true);
+  for (size_t index = 0; index < readers.size(); ++index)
+    readers[index].join();
+
+  if (failures.load() != 0 || cache.get(path).version() != (uint64_t)num_reloads + 1) {
+    std::fprintf(stderr, "Readers saw %d bad snapshots.\n", failures.load());
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  const std::string directory = temp_directory();
+  int failures = 0;
+
+  if (directory.empty()) {
+    std::fprintf(stderr, "Could not create a temporary directory.\n");
+    return 1;
+  }
+
+  failures += check_reload(directory);
+  failures += check_watch(directory);
+  failures += check_concurrent_reads(directory);
+
+  const char *names[] = { "reload.conf", "watch.conf", "concurrent.conf", "kept.conf" };
+  for (size_t index = 0; index < sizeof(names) / sizeof(names[0]); ++index)
+    unlink((directory + "/" + names[index]).c_str());
+  rmdir(directory.c_str());
+
+  return failures == 0 ? 0 : 1;
+}
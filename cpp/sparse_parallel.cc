@@ -0,0 +1,652 @@
+#include "sparse_parallel.hh"
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// An event recorded by a worker for the ordered parse. Names and values that
+// point into the document are kept as pointers; anything else (escaped
+// tokens in the state's buffer, error messages) is copied.
+struct sparse_recorded_event_t
+{
+  sparse_msg_t msg;
+  const char *begin; // NULL if copied
+  size_t offset;
+  size_t length;
+};
+
+struct sparse_segment_t
+{
+  const char *src_begin;
+  const char *src_end;
+
+  std::vector<sparse_recorded_event_t> events;
+  std::string copies;
+
+  sparse_error_t error;
+  const char *error_begin;
+  const char *error_end;
+  bool no_mem;
+  bool done;
+
+  sparse_segment_t(const char *src_begin, const char *src_end)
+  : src_begin(src_begin), src_end(src_end), error(SP_NO_ERROR),
+    error_begin(NULL), error_end(NULL), no_mem(false), done(false) {}
+};
+
+struct sparse_parallel_run_t
+{
+  std::vector<sparse_segment_t> segments;
+  int options;
+
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  std::condition_variable segment_done;
+  size_t next_segment;
+  // Ordered parses only: workers stay at most max_ahead segments ahead of the
+  // last one replayed so memory use is bounded.
+  size_t num_replayed;
+  size_t max_ahead;
+  // Event arrays from segments already replayed, kept for reuse so each
+  // segment doesn't have to fault in fresh memory.
+  std::vector<std::vector<sparse_recorded_event_t> > spare_events;
+  // Unordered parses only: segments after this one aren't worth parsing.
+  size_t first_error;
+  bool abort;
+
+  sparse_parallel_run_t(int options)
+  : options(options), next_segment(0), num_replayed(0), max_ahead(0),
+    first_error((size_t)-1), abort(false) {}
+
+  // Stops the workers, waking any waiting for work.
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      abort = true;
+    }
+    work_ready.notify_all();
+  }
+};
+
+// Owns the worker threads and stops and joins them however the run ends. Run
+// is the state the workers share, which has a stop() for them to return on.
+template <class Run>
+class sparse_thread_group_t
+{
+private:
+  Run &run;
+  std::vector<std::thread> threads;
+
+public:
+  sparse_thread_group_t(Run &run) : run(run) {}
+
+  ~sparse_thread_group_t()
+  {
+    run.stop();
+
+    for (size_t index = 0; index < threads.size(); ++index)
+      threads[index].join();
+  }
+
+  // Starts up to count threads running fn(&run, thread index), numbered from
+  // 1. Fewer is fine since the calling thread works too, so running out of
+  // threads just means less parallelism.
+  template <class Fn>
+  void start(size_t count, Fn fn)
+  {
+    try {
+      for (size_t index = 0; index < count; ++index)
+        threads.push_back(std::thread(fn, &run, index + 1));
+    } catch (std::system_error &) {
+    }
+  }
+};
+
+static sparse_error_t sp_check_error(sparse_error_t error, const char *error_begin, const char *error_end) throw(sparse_exception_t)
+{
+  switch (error) {
+  case SP_NO_ERROR:
+    return error;
+  case SP_ERROR_NO_MEM:
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse buffer.");
+  case SP_ERROR_INVALID_CHAR:
+    throw sparse_invalid_char_error_t("Invalid character encountered.", error_begin, error_end);
+  case SP_ERROR_INCOMPLETE_DOCUMENT:
+    throw sparse_incomplete_document_error_t("Document is incomplete.");
+  default:
+    throw sparse_exception_t(std::string(error_begin, (size_t)(error_end - error_begin)));
+  }
+}
+
+static void sp_record_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sparse_segment_t *segment = (sparse_segment_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  sparse_recorded_event_t event;
+
+  if (segment->no_mem)
+    return;
+
+  event.msg = msg;
+  event.length = length;
+
+  try {
+    if (begin != NULL && begin >= segment->src_begin && end <= segment->src_end) {
+      event.begin = begin;
+      event.offset = 0;
+    } else {
+      event.begin = NULL;
+      event.offset = segment->copies.size();
+      if (length > 0)
+        segment->copies.append(begin, length);
+    }
+    segment->events.push_back(event);
+  } catch (std::bad_alloc &) {
+    segment->no_mem = true;
+  }
+}
+
+// Parses one segment with a fresh state. Only the last segment can end with
+// anything pending, but every segment is ended so the same code handles all
+// of them. Nothing is sent after an error, same as in sparse_run.
+static void sp_parse_segment(sparse_segment_t *segment, int options, sparse_fn_t callback, void *context)
+{
+  sparse_state_t state;
+  sparse_error_t error = sparse_begin(&state, 0, (sparse_options_t)options, callback, context);
+
+  if (error == SP_NO_ERROR) {
+    error = sparse_run(&state, segment->src_begin, segment->src_end);
+    if (error == SP_NO_ERROR) {
+      error = sparse_end(&state);
+    } else {
+      segment->error_begin = state.error_begin;
+      segment->error_end = state.error_end;
+      state.callback = NULL;
+      sparse_end(&state);
+    }
+  }
+
+  if (error == SP_NO_ERROR && segment->no_mem)
+    error = SP_ERROR_NO_MEM;
+  segment->error = error;
+}
+
+// Takes a spare event array if there is one. Call with the run's mutex held.
+static void sp_claim_segment(sparse_parallel_run_t *run, sparse_segment_t *segment)
+{
+  if (!run->spare_events.empty()) {
+    segment->events.swap(run->spare_events.back());
+    run->spare_events.pop_back();
+  }
+}
+
+static void sp_record_segment(sparse_segment_t *segment, int options)
+{
+  try {
+    segment->events.reserve((size_t)(segment->src_end - segment->src_begin) / 16);
+  } catch (std::bad_alloc &) {
+  }
+  sp_parse_segment(segment, options | SP_ZERO_COPY, sp_record_event, segment);
+}
+
+static void sp_split_segments(const char *src_begin, const char *src_end, size_t segment_size, std::vector<sparse_segment_t> &segments)
+{
+  sparse_splitter_t splitter;
+  const char *segment_begin = src_begin;
+
+  sparse_splitter_init(&splitter);
+
+  while ((size_t)(src_end - segment_begin) > segment_size) {
+    const char *split = sparse_splitter_next(&splitter, segment_begin, src_end, segment_begin + segment_size);
+    if (split == NULL)
+      break;
+
+    segments.push_back(sparse_segment_t(segment_begin, split));
+    segment_begin = split;
+  }
+
+  segments.push_back(sparse_segment_t(segment_begin, src_end));
+}
+
+static void sp_ordered_worker(sparse_parallel_run_t *run, size_t thread_index)
+{
+  std::unique_lock<std::mutex> lock(run->mutex);
+  (void)thread_index;
+
+  for (;;) {
+    while (!run->abort && run->next_segment < run->segments.size()
+           && run->next_segment >= run->num_replayed + run->max_ahead)
+      run->work_ready.wait(lock);
+
+    if (run->abort || run->next_segment >= run->segments.size())
+      return;
+
+    sparse_segment_t &segment = run->segments[run->next_segment++];
+    sp_claim_segment(run, &segment);
+    lock.unlock();
+    sp_record_segment(&segment, run->options);
+    lock.lock();
+
+    segment.done = true;
+    run->segment_done.notify_all();
+  }
+}
+
+static void sp_unordered_worker(sparse_parallel_run_t *run, size_t thread_index, sparse_fn_t callback, void *context)
+{
+  std::unique_lock<std::mutex> lock(run->mutex);
+  (void)thread_index;
+
+  while (!run->abort && run->next_segment < run->segments.size() && run->next_segment < run->first_error) {
+    const size_t index = run->next_segment++;
+    sparse_segment_t &segment = run->segments[index];
+
+    lock.unlock();
+    sp_parse_segment(&segment, run->options, callback, context);
+    lock.lock();
+
+    if (segment.error != SP_NO_ERROR && index < run->first_error)
+      run->first_error = index;
+  }
+}
+
+struct sparse_unordered_worker_t
+{
+  sparse_fn_t callback;
+  void *const *contexts;
+
+  void operator () (sparse_parallel_run_t *run, size_t thread_index) const
+  {
+    sp_unordered_worker(run, thread_index, callback, contexts[thread_index]);
+  }
+};
+
+
+sparse_parallel_parser_t::sparse_parallel_parser_t(int options, size_t num_threads, size_t min_segment_size)
+: options(options), num_threads(num_threads), min_segment_size(min_segment_size)
+{
+  if (this->num_threads == 0)
+    this->num_threads = std::thread::hardware_concurrency();
+  if (this->num_threads == 0)
+    this->num_threads = 1;
+  if (this->min_segment_size == 0)
+    this->min_segment_size = 1;
+}
+
+sparse_error_t sparse_parallel_parser_t::parse(const char *const src_begin, const char *const src_end,
+                                               sparse_fn_t callback, void *context) throw(sparse_exception_t)
+{
+  const size_t src_size = (size_t)(src_end - src_begin);
+  // A few segments per thread so one slow segment doesn't hold up the rest.
+  size_t segment_size = src_size / (num_threads * 4);
+  sparse_parallel_run_t run(options);
+
+  if (segment_size < min_segment_size)
+    segment_size = min_segment_size;
+
+  if (num_threads > 1)
+    sp_split_segments(src_begin, src_end, segment_size, run.segments);
+  else
+    run.segments.push_back(sparse_segment_t(src_begin, src_end));
+
+  // Nothing to split, so skip recording the events.
+  if (run.segments.size() == 1) {
+    sparse_segment_t &segment = run.segments[0];
+    sp_parse_segment(&segment, options, callback, context);
+    return sp_check_error(segment.error, segment.error_begin, segment.error_end);
+  }
+
+  run.max_ahead = num_threads * 2;
+
+  sparse_thread_group_t<sparse_parallel_run_t> workers(run);
+  workers.start(num_threads - 1, sp_ordered_worker);
+
+  for (size_t index = 0; index < run.segments.size(); ++index) {
+    sparse_segment_t &segment = run.segments[index];
+
+    {
+      std::unique_lock<std::mutex> lock(run.mutex);
+      if (run.next_segment == index) {
+        // No worker has gotten to it yet, so parse it here.
+        ++run.next_segment;
+        sp_claim_segment(&run, &segment);
+        lock.unlock();
+        sp_record_segment(&segment, options);
+      } else {
+        while (!segment.done)
+          run.segment_done.wait(lock);
+      }
+    }
+
+    for (size_t event_index = 0; event_index < segment.events.size(); ++event_index) {
+      const sparse_recorded_event_t &event = segment.events[event_index];
+      const char *begin = event.begin != NULL ? event.begin : segment.copies.data() + event.offset;
+      callback(event.msg, begin, begin + event.length, context);
+    }
+
+    if (segment.error != SP_NO_ERROR)
+      return sp_check_error(segment.error, segment.error_begin, segment.error_end);
+
+    segment.events.clear();
+    std::string().swap(segment.copies);
+
+    {
+      std::lock_guard<std::mutex> lock(run.mutex);
+      run.num_replayed = index + 1;
+      try {
+        run.spare_events.push_back(std::vector<sparse_recorded_event_t>());
+        run.spare_events.back().swap(segment.events);
+      } catch (std::bad_alloc &) {
+      }
+    }
+    run.work_ready.notify_all();
+  }
+
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_parallel_parser_t::parse_unordered(const char *const src_begin, const char *const src_end,
+                                                         sparse_fn_t callback, void *const *contexts) throw(sparse_exception_t)
+{
+  const size_t src_size = (size_t)(src_end - src_begin);
+  size_t segment_size = src_size / (num_threads * 4);
+  sparse_parallel_run_t run(options);
+  sparse_unordered_worker_t worker = { callback, contexts };
+
+  if (segment_size < min_segment_size)
+    segment_size = min_segment_size;
+
+  sp_split_segments(src_begin, src_end, segment_size, run.segments);
+
+  {
+    sparse_thread_group_t<sparse_parallel_run_t> workers(run);
+    if (run.segments.size() > 1)
+      workers.start(num_threads - 1, worker);
+    worker(&run, 0);
+  }
+
+  for (size_t index = 0; index < run.segments.size(); ++index) {
+    const sparse_segment_t &segment = run.segments[index];
+    if (segment.error != SP_NO_ERROR)
+      return sp_check_error(segment.error, segment.error_begin, segment.error_end);
+  }
+
+  return SP_NO_ERROR;
+}
+
+
+/* Batch parsing */
+
+// The inputs a thread has left, from begin to end. Its thread takes them from
+// the front and other threads steal from the back.
+struct sparse_many_range_t
+{
+  std::mutex mutex;
+  size_t begin;
+  size_t end;
+
+  sparse_many_range_t() : begin(0), end(0) {}
+};
+
+struct sparse_many_run_t
+{
+  const std::vector<sparse_input_t> &inputs;
+  int options;
+
+  std::vector<sparse_many_range_t> ranges;
+  std::vector<sparse_parse_result_t> results;
+
+  // Guards everything below.
+  std::mutex mutex;
+  std::condition_variable result_ready;
+  std::vector<char> done;
+  // Inputs in the order they were done, for SP_AS_COMPLETED.
+  std::vector<size_t> completed;
+  bool abort;
+
+  sparse_many_run_t(const std::vector<sparse_input_t> &inputs, int options, size_t num_threads)
+  : inputs(inputs), options(options), ranges(num_threads), results(inputs.size()),
+    done(inputs.size(), 0), abort(false)
+  {
+    completed.reserve(inputs.size());
+    std::memset(&results[0], 0, results.size() * sizeof(results[0]));
+
+    for (size_t index = 0; index < num_threads; ++index) {
+      ranges[index].begin = inputs.size() * index / num_threads;
+      ranges[index].end = inputs.size() * (index + 1) / num_threads;
+    }
+  }
+
+  // Documents that were never handed to the callback.
+  ~sparse_many_run_t()
+  {
+    for (size_t index = 0; index < results.size(); ++index)
+      sparse_document_free(&results[index].document);
+  }
+
+  // Workers never wait, so they see this at their next publish.
+  void stop()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    abort = true;
+  }
+};
+
+// The state a thread reuses for every input it parses. It's only begun again
+// if running out of memory left it without a buffer.
+struct sparse_many_state_t
+{
+  sparse_state_t state;
+  bool begun;
+
+  sparse_many_state_t() : begun(false) {}
+
+  ~sparse_many_state_t()
+  {
+    if (begun) {
+      state.callback = NULL;
+      sparse_end(&state);
+    }
+  }
+};
+
+static bool sp_many_take(sparse_many_run_t *run, size_t thread_index, size_t *index)
+{
+  const size_t num_ranges = run->ranges.size();
+
+  {
+    sparse_many_range_t &own = run->ranges[thread_index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.begin < own.end) {
+      *index = own.begin++;
+      return true;
+    }
+  }
+
+  for (size_t offset = 1; offset < num_ranges; ++offset) {
+    sparse_many_range_t &victim = run->ranges[(thread_index + offset) % num_ranges];
+    size_t begin;
+    size_t end;
+
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.begin == victim.end)
+        continue;
+      end = victim.end;
+      begin = victim.begin + (victim.end - victim.begin) / 2;
+      victim.end = begin;
+    }
+
+    *index = begin;
+    sparse_many_range_t &own = run->ranges[thread_index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.begin = begin + 1;
+    own.end = end;
+    return true;
+  }
+
+  return false;
+}
+
+static void sp_many_parse(sparse_many_run_t *run, sparse_many_state_t *many_state, size_t index)
+{
+  const sparse_input_t &input = run->inputs[index];
+  sparse_parse_result_t &result = run->results[index];
+  sparse_state_t *const state = &many_state->state;
+  sparse_error_t error = SP_NO_ERROR;
+
+  result.index = index;
+  result.error_offset = (size_t)-1;
+
+  if (!many_state->begun) {
+    error = sparse_begin(state, 0, (sparse_options_t)run->options, NULL, NULL);
+    many_state->begun = error == SP_NO_ERROR;
+  }
+
+  if (error == SP_NO_ERROR)
+    error = sparse_document_init(&result.document);
+
+  if (error == SP_NO_ERROR) {
+    // Names and values are copied into the document anyway.
+    sparse_reset(state, (sparse_options_t)(run->options | SP_ZERO_COPY), sparse_document_fn, &result.document);
+
+    if (input.data != NULL)
+      error = sparse_run(state, input.data, input.data + input.size);
+    else
+      error = sparse_parse_file(state, input.path.c_str());
+
+    if (error == SP_NO_ERROR) {
+      error = sparse_reset(state, (sparse_options_t)run->options, NULL, NULL);
+    } else {
+      if (error == SP_ERROR_INVALID_CHAR && input.data != NULL)
+        result.error_offset = (size_t)(state->error_begin - input.data);
+      state->callback = NULL;
+    }
+
+    if (error == SP_NO_ERROR)
+      error = sparse_document_error(&result.document);
+
+    if (state->buffer == NULL) {
+      sparse_end(state);
+      many_state->begun = false;
+    }
+  }
+
+  if (error != SP_NO_ERROR) {
+    sparse_document_free(&result.document);
+    std::memset(&result.document, 0, sizeof(result.document));
+  }
+
+  result.error = error;
+}
+
+// Marks an input done. Returns false if the run was stopped.
+static bool sp_many_publish(sparse_many_run_t *run, size_t index)
+{
+  {
+    std::lock_guard<std::mutex> lock(run->mutex);
+    run->done[index] = 1;
+    run->completed.push_back(index);
+    if (run->abort)
+      return false;
+  }
+  run->result_ready.notify_one();
+  return true;
+}
+
+static void sp_many_worker(sparse_many_run_t *run, size_t thread_index)
+{
+  sparse_many_state_t state;
+  size_t index;
+
+  while (sp_many_take(run, thread_index, &index)) {
+    sp_many_parse(run, &state, index);
+    if (!sp_many_publish(run, index))
+      return;
+  }
+}
+
+size_t sparse_parse_many(const std::vector<sparse_input_t> &inputs, sparse_result_fn_t callback, void *context,
+                         int options, sparse_delivery_t delivery, size_t num_threads) throw(sparse_no_mem_error_t)
+{
+  size_t num_delivered = 0;
+  size_t num_failed = 0;
+
+  if (inputs.empty())
+    return 0;
+
+  if (num_threads == 0)
+    num_threads = std::thread::hardware_concurrency();
+  if (num_threads == 0)
+    num_threads = 1;
+  if (num_threads > inputs.size())
+    num_threads = inputs.size();
+
+  std::unique_ptr<sparse_many_run_t> run_ptr;
+  try {
+    run_ptr.reset(new sparse_many_run_t(inputs, options, num_threads));
+  } catch (std::bad_alloc &) {
+    throw sparse_no_mem_error_t("Could not allocate memory for sparse batch.");
+  }
+
+  sparse_many_run_t &run = *run_ptr;
+  sparse_many_state_t state;
+  sparse_thread_group_t<sparse_many_run_t> workers(run);
+  bool parsing = true;
+
+  // Inputs of threads that don't start are stolen by the ones that do.
+  workers.start(num_threads - 1, sp_many_worker);
+
+  while (num_delivered < inputs.size()) {
+    size_t index;
+
+    // Parse here while there's anything left, handing over whatever's ready
+    // in between.
+    if (parsing && sp_many_take(&run, 0, &index)) {
+      sp_many_parse(&run, &state, index);
+      sp_many_publish(&run, index);
+    } else {
+      parsing = false;
+    }
+
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(run.mutex);
+        const size_t position = num_delivered;
+        if (delivery == SP_IN_INPUT_ORDER) {
+          index = position;
+          while (!parsing && !run.done[index])
+            run.result_ready.wait(lock);
+          if (!run.done[index])
+            break;
+        } else {
+          while (!parsing && run.completed.size() == position)
+            run.result_ready.wait(lock);
+          if (run.completed.size() == position)
+            break;
+          index = run.completed[position];
+        }
+      }
+
+      sparse_parse_result_t &result = run.results[index];
+      ++num_delivered;
+      if (result.error != SP_NO_ERROR)
+        ++num_failed;
+
+      if (!callback(result, context))
+        sparse_document_free(&result.document);
+      std::memset(&result.document, 0, sizeof(result.document));
+
+      if (num_delivered == inputs.size())
+        break;
+    }
+  }
+
+  return num_failed;
+}
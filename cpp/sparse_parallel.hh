@@ -0,0 +1,93 @@
+#ifndef __CMT_SPARSE_PARALLEL_HH__
+#define __CMT_SPARSE_PARALLEL_HH__
+
+#include "sparse.hh"
+#include "sparse_split.h"
+#include <vector>
+
+// Pieces smaller than this aren't worth handing to another thread.
+#define SP_PARALLEL_MIN_SEGMENT_SIZE (1024 * 1024)
+
+/* Parallel parser */
+// Parses a complete document in memory on several threads. The document is
+// cut at root newlines (see sparse_split.h) and each piece is parsed with its
+// own state.
+class sparse_parallel_parser_t
+{
+private:
+  int options;
+  size_t num_threads;
+  size_t min_segment_size;
+
+public:
+  // A num_threads of 0 uses one thread per core.
+  sparse_parallel_parser_t(int options = SP_DEFAULT_OPTIONS,
+                           size_t num_threads = 0,
+                           size_t min_segment_size = SP_PARALLEL_MIN_SEGMENT_SIZE);
+
+  size_t thread_count() const { return num_threads; }
+
+  // Sends every event to callback on the calling thread, in the same order and
+  // with the same contents as sparse_run followed by sparse_end would. Names
+  // and values are only valid during the callback. Throws the same exceptions
+  // as sparse_parser_t.
+  sparse_error_t parse(const char *const src_begin, const char *const src_end,
+                       sparse_fn_t callback, void *context) throw(sparse_exception_t);
+
+  // Calls callback from the worker threads as each piece is parsed, with
+  // contexts[i] (of thread_count()) on thread i. Every node is seen whole by a
+  // single thread, but pieces arrive in no particular order. If there's an
+  // error, pieces after it may or may not have been sent.
+  sparse_error_t parse_unordered(const char *const src_begin, const char *const src_end,
+                                 sparse_fn_t callback, void *const *contexts) throw(sparse_exception_t);
+};
+
+/* Batch parsing */
+// A document for sparse_parse_many: a file, read with sparse_parse_file, or a
+// string in memory, which has to outlive the call.
+struct sparse_input_t
+{
+  std::string path;
+  const char *data;
+  size_t size;
+
+  sparse_input_t(const std::string &path) : path(path), data(NULL), size(0) {}
+  sparse_input_t(const char *data, size_t size) : data(data), size(size) {}
+};
+
+// How one input went.
+struct sparse_parse_result_t
+{
+  // Position of the input in the list.
+  size_t index;
+  sparse_error_t error;
+  // Where the invalid character was in an input in memory, otherwise
+  // (size_t)-1.
+  size_t error_offset;
+  // The input's document. All zeroes if there was an error.
+  sparse_document_t document;
+};
+
+// Return true to keep result.document and free it yourself with
+// sparse_document_free. Otherwise it's freed when the callback returns.
+typedef bool (*sparse_result_fn_t)(sparse_parse_result_t &result, void *context);
+
+enum sparse_delivery_t {
+  SP_IN_INPUT_ORDER,
+  SP_AS_COMPLETED
+};
+
+// Parses each input into its own document on num_threads threads (0 for one
+// per core), the calling thread included. Each thread starts with an even
+// share of the inputs and takes half of what's left from another thread once
+// it runs out, so a few big inputs don't hold the rest up, and it reuses one
+// state (see sparse_reset) for every input it parses. callback is called on
+// the calling thread for every input, either in input order or in the order
+// they're done. An error in one input doesn't stop the others. Returns how
+// many inputs had errors. If callback throws, the rest of the inputs are
+// dropped and the exception is passed on once the threads have stopped.
+size_t sparse_parse_many(const std::vector<sparse_input_t> &inputs, sparse_result_fn_t callback, void *context,
+                         int options = SP_DEFAULT_OPTIONS, sparse_delivery_t delivery = SP_IN_INPUT_ORDER,
+                         size_t num_threads = 0) throw(sparse_no_mem_error_t);
+
+#endif /* end __CMT_SPARSE_PARALLEL_HH__ include guard */
@@ -0,0 +1,259 @@
+#include "sparse_parallel.hh"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  std::string &log = *(std::string *)context;
+  char header[32];
+  std::snprintf(header, sizeof(header), "%d:%zu:", (int)msg, (size_t)(end - begin));
+  log += header;
+  log.append(begin, (size_t)(end - begin));
+}
+
+static void count_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  (void)msg; (void)begin; (void)end;
+  ++*(size_t *)context;
+}
+
+static std::string log_sequential(const std::string &src, int options, sparse_error_t *error)
+{
+  std::string log;
+  sparse_state_t state;
+
+  sparse_begin(&state, 0, (sparse_options_t)options, log_event, &log);
+  *error = sparse_run(&state, src.data(), src.data() + src.size());
+  if (*error == SP_NO_ERROR) {
+    *error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  return log;
+}
+
+static std::string log_parallel(const std::string &src, int options, size_t num_threads, size_t segment_size, sparse_error_t *error)
+{
+  std::string log;
+  sparse_parallel_parser_t parser(options, num_threads, segment_size);
+
+  try {
+    *error = parser.parse(src.data(), src.data() + src.size(), log_event, &log);
+  } catch (sparse_invalid_char_error_t &) {
+    *error = SP_ERROR_INVALID_CHAR;
+  } catch (sparse_incomplete_document_error_t &) {
+    *error = SP_ERROR_INCOMPLETE_DOCUMENT;
+  } catch (sparse_exception_t &) {
+    *error = SP_ERROR_NO_MEM;
+  }
+
+  return log;
+}
+
+static int check_document(const std::string &src, int options)
+{
+  static const size_t thread_counts[] = { 1, 2, 4, 32 };
+  static const size_t segment_sizes[] = { 1, 7, 64, 1000 };
+  sparse_error_t expected_error;
+  const std::string expected = log_sequential(src, options, &expected_error);
+  int failures = 0;
+
+  for (size_t thread_index = 0; thread_index < sizeof(thread_counts) / sizeof(thread_counts[0]); ++thread_index) {
+    const size_t num_threads = thread_counts[thread_index];
+
+    for (size_t index = 0; index < sizeof(segment_sizes) / sizeof(segment_sizes[0]); ++index) {
+      sparse_error_t error;
+      const std::string actual = log_parallel(src, options, num_threads, segment_sizes[index], &error);
+
+      if (actual != expected || error != expected_error) {
+        std::fprintf(stderr, "Events differ for options %d with %zu threads and %zu byte segments\n",
+                     options, num_threads, segment_sizes[index]);
+        ++failures;
+      }
+    }
+  }
+
+  return failures;
+}
+
+static int check_unordered(const std::string &src, int options)
+{
+  size_t expected = 0;
+  std::vector<size_t> counts(4, 0);
+  std::vector<void *> contexts;
+
+  for (size_t index = 0; index < counts.size(); ++index)
+    contexts.push_back(&counts[index]);
+
+  {
+    sparse_state_t state;
+    sparse_begin(&state, 0, (sparse_options_t)options, count_event, &expected);
+    sparse_run(&state, src.data(), src.data() + src.size());
+    sparse_end(&state);
+  }
+
+  sparse_parallel_parser_t parser(options, counts.size(), 16);
+  parser.parse_unordered(src.data(), src.data() + src.size(), count_event, &contexts[0]);
+
+  if (counts[0] + counts[1] + counts[2] + counts[3] != expected) {
+    std::fprintf(stderr, "Unordered parse sent a different number of events\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+struct many_log_t
+{
+  std::vector<size_t> order;
+  std::vector<sparse_parse_result_t> results;
+  std::vector<std::string> values;
+  sparse_document_t kept;
+};
+
+static bool log_result(sparse_parse_result_t &result, void *context)
+{
+  many_log_t &log = *(many_log_t *)context;
+  const uint32_t field = result.error != SP_NO_ERROR ? SP_NO_NODE
+    : sparse_document_find(&result.document, SP_DOCUMENT_ROOT, "value", 5);
+
+  log.order.push_back(result.index);
+  log.results.push_back(result);
+  log.values.push_back(field == SP_NO_NODE ? std::string() : std::string(result.document.nodes[field].value));
+
+  // Keep one document to check it isn't freed.
+  if (result.index == 0 && result.error == SP_NO_ERROR) {
+    log.kept = result.document;
+    return true;
+  }
+  return false;
+}
+
+// Every input is delivered once, in order if asked, with its own document or
+// error, whatever the number of threads.
+static int check_many(void)
+{
+  static const size_t thread_counts[] = { 1, 2, 4, 32 };
+  char path[] = "/tmp/sparse_parallel_test.XXXXXX";
+  const int fd = mkstemp(path);
+  std::vector<std::string> sources;
+  std::vector<sparse_input_t> inputs;
+  int failures = 0;
+
+  if (fd < 0 || write(fd, "value from_file\n", 16) != 16) {
+    std::fprintf(stderr, "Could not write a temporary file\n");
+    return 1;
+  }
+  close(fd);
+
+  for (size_t index = 0; index < 200; ++index) {
+    std::string src = "value " + std::to_string(index) + "\n";
+    // Some inputs are much bigger than the rest.
+    if (index % 37 == 0)
+      src += std::string(100000, '#') + "\n";
+    if (index % 50 == 7)
+      src += "stray }\n";
+    sources.push_back(src);
+  }
+
+  for (size_t index = 0; index < sources.size(); ++index) {
+    if (index % 10 == 3)
+      inputs.push_back(sparse_input_t(index % 20 == 3 ? std::string(path) : std::string(path) + ".missing"));
+    else
+      inputs.push_back(sparse_input_t(sources[index].data(), sources[index].size()));
+  }
+
+  for (size_t thread_index = 0; thread_index < sizeof(thread_counts) / sizeof(thread_counts[0]); ++thread_index) {
+    for (int ordered = 0; ordered < 2; ++ordered) {
+      many_log_t log;
+      const size_t num_failed = sparse_parse_many(inputs, log_result, &log, SP_DEFAULT_OPTIONS,
+                                                  ordered ? SP_IN_INPUT_ORDER : SP_AS_COMPLETED,
+                                                  thread_counts[thread_index]);
+      std::vector<int> seen(inputs.size(), 0);
+      size_t expected_failed = 0;
+      bool right = log.order.size() == inputs.size();
+
+      for (size_t position = 0; right && position < log.order.size(); ++position) {
+        const size_t index = log.order[position];
+        const sparse_parse_result_t &result = log.results[position];
+        std::string expected_value = std::to_string(index);
+        sparse_error_t expected_error = SP_NO_ERROR;
+
+        if (index % 20 == 3) {
+          expected_value = "from_file";
+        } else if (index % 10 == 3) {
+          expected_error = SP_ERROR_IO;
+        } else if (index % 50 == 7) {
+          expected_error = SP_ERROR_INVALID_CHAR;
+          if (result.error_offset == (size_t)-1 || sources[index][result.error_offset] != '}')
+            right = false;
+        }
+
+        if (expected_error != SP_NO_ERROR) {
+          expected_value.clear();
+          ++expected_failed;
+        }
+
+        right = right && index < inputs.size() && !seen[index]++ && (!ordered || index == position)
+          && result.error == expected_error && log.values[position] == expected_value;
+      }
+
+      if (!right || num_failed != expected_failed
+          || sparse_document_find(&log.kept, SP_DOCUMENT_ROOT, "value", 5) == SP_NO_NODE) {
+        std::fprintf(stderr, "Batch parse with %zu threads %s went wrong\n", thread_counts[thread_index],
+                     ordered ? "in order" : "as completed");
+        ++failures;
+      }
+
+      sparse_document_free(&log.kept);
+    }
+  }
+
+  unlink(path);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  const std::string block =
+    "# Comment with a { brace and a \\ backslash\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u\n"
+    "}\n"
+    "escaped\\\nnewline value\\ with\\ttrailing   \n"
+    "{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "width 800; height 600\n";
+
+  // Segments are at least 1/128th of the document with 32 threads, so the
+  // small one gets split at nearly every line.
+  std::string src;
+  for (int index = 0; index < 50; ++index)
+    src += block;
+
+  int failures = 0;
+
+  for (int options = 0; options < 16; ++options) {
+    failures += check_document(block, options);
+    failures += check_document(block + "unclosed {\n  node value\n", options);
+    failures += check_document(src, options);
+    failures += check_document(src + "unclosed {\n  node value\n", options);
+    failures += check_document(src + "stray }\n" + src, options);
+    failures += check_unordered(src, options | SP_NAMELESS_ROOT_NODES);
+  }
+
+  failures += check_many();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#ifndef __CMT_SPARSE_PARSER_HH__
+#define __CMT_SPARSE_PARSER_HH__
+
+/*
+  Header-only C++17 wrapper for sparse_run that doesn't throw or allocate
+  beyond the state's buffer. Events go to any callable taking a message and a
+  std::string_view, passed by reference without being copied, and errors come
+  back as std::error_codes in sparse::error_category (sparse_error_t converts
+  to std::error_code directly), so bad input costs no more than a return.
+
+    sparse::parser parser(SP_TRIM_TRAILING_SPACES);
+    size_t num_names = 0;
+    auto count = [&](sparse_msg_t msg, std::string_view) { num_names += msg == SP_NAME; };
+
+    if (std::error_code error = parser.parse(src, count))
+      std::cerr << error.message() << ": " << parser.error_text() << '\n';
+    parser.finish(count);
+
+  Build sparse.c and sparse_scan.c with it (and sparse_file.c for
+  parse_file). Handlers mustn't throw, since events come from C code.
+*/
+
+#include "sparse.h"
+#include "sparse_file.h"
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace sparse {
+
+namespace detail {
+
+class error_category_impl : public std::error_category
+{
+public:
+  const char *name() const noexcept override { return "sparse"; }
+
+  std::string message(int code) const override
+  {
+    switch (code) {
+    case SP_NO_ERROR: return "No error";
+    case SP_ERROR_NO_MEM: return "Could not allocate memory";
+    case SP_ERROR_INVALID_CHAR: return "Invalid character encountered";
+    case SP_ERROR_INCOMPLETE_DOCUMENT: return "Document is incomplete";
+    case SP_ERROR_IO: return "Could not read the file";
+    case SP_ERROR_BAD_FORMAT: return "Input is not in the expected format";
+    case SP_ERROR_NOT_FOUND: return "No such field";
+    case SP_ERROR_STALE_INDEX: return "Index is out of date";
+    case SP_ERROR_INVALID_VALUE: return "Invalid value";
+    case SP_ERROR_OUT_OF_RANGE: return "Value out of range";
+    default: return "Unknown error";
+    }
+  }
+};
+
+} // namespace detail
+
+inline const std::error_category &error_category() noexcept
+{
+  static const detail::error_category_impl category;
+  return category;
+}
+
+} // namespace sparse
+
+namespace std {
+template <> struct is_error_code_enum<sparse_error_t> : true_type {};
+} // namespace std
+
+inline std::error_code make_error_code(sparse_error_t error) noexcept
+{
+  return std::error_code((int)error, sparse::error_category());
+}
+
+namespace sparse {
+
+// Non-owning reference to a callable, like std::function without the
+// allocation. The callable has to outlive the reference.
+template <class Signature>
+class function_ref;
+
+template <class Result, class... Args>
+class function_ref<Result(Args...)>
+{
+public:
+  template <class Callable,
+            class = std::enable_if_t<!std::is_same_v<std::decay_t<Callable>, function_ref>
+                                     && std::is_invocable_r_v<Result, Callable &, Args...>>>
+  function_ref(Callable &&callable) noexcept
+  : object_(const_cast<void *>(static_cast<const void *>(std::addressof(callable)))),
+    call_(&call<std::remove_reference_t<Callable>>)
+  {}
+
+  Result operator () (Args... args) const { return call_(object_, std::forward<Args>(args)...); }
+
+private:
+  template <class Callable>
+  static Result call(void *object, Args... args)
+  {
+    return (*static_cast<Callable *>(object))(std::forward<Args>(args)...);
+  }
+
+  void *object_;
+  Result (*call_)(void *, Args...);
+};
+
+using event_handler = function_ref<void(sparse_msg_t msg, std::string_view token)>;
+
+// Owns a sparse_state_t. Parsers can be moved but not copied, and can parse
+// any number of documents one after another, keeping their buffer.
+class parser
+{
+public:
+  // If the buffer can't be allocated, parsing returns SP_ERROR_NO_MEM.
+  explicit parser(int options = SP_DEFAULT_OPTIONS, size_t initial_buffer_capacity = 0,
+                  const sparse_allocator_t *allocator = nullptr) noexcept
+  : options_(options)
+  {
+    if (sparse_begin_with_allocator(&state_, initial_buffer_capacity, (sparse_options_t)options,
+                                    nullptr, nullptr, allocator) != SP_NO_ERROR)
+      std::memset(&state_, 0, sizeof(state_));
+  }
+
+  parser(parser &&other) noexcept
+  : state_(other.state_), options_(other.options_), failed_(other.failed_)
+  {
+    std::memset(&other.state_, 0, sizeof(other.state_));
+  }
+
+  parser &operator = (parser &&other) noexcept
+  {
+    if (this != &other) {
+      end();
+      state_ = other.state_;
+      options_ = other.options_;
+      failed_ = other.failed_;
+      std::memset(&other.state_, 0, sizeof(other.state_));
+    }
+    return *this;
+  }
+
+  parser(const parser &) = delete;
+  parser &operator = (const parser &) = delete;
+
+  // Drops the document being parsed, if any, without its last events.
+  ~parser() { end(); }
+
+  // Parses the next piece of the document. After an error, finish (or drop)
+  // the document before parsing another.
+  std::error_code parse(std::string_view src, event_handler on_event) noexcept
+  {
+    if (state_.buffer == nullptr)
+      return SP_ERROR_NO_MEM;
+    if (src.empty())
+      return SP_NO_ERROR;
+
+    begin_events(on_event);
+    return end_events(sparse_run(&state_, src.data(), src.data() + src.size()));
+  }
+
+  // Parses a whole file without reading it into memory (see sparse_parse_file).
+  std::error_code parse_file(const char *path, event_handler on_event) noexcept
+  {
+    if (state_.buffer == nullptr)
+      return SP_ERROR_NO_MEM;
+
+    begin_events(on_event);
+    return end_events(sparse_parse_file(&state_, path));
+  }
+
+  // Ends the document, sending its last events and SP_ERROR_INCOMPLETE_DOCUMENT
+  // if it is, and gets the parser ready for the next one.
+  std::error_code finish(event_handler on_event) noexcept
+  {
+    if (state_.buffer == nullptr)
+      return SP_ERROR_NO_MEM;
+
+    // A document that failed already sent its error.
+    begin_events(on_event);
+    if (failed_)
+      state_.callback = nullptr;
+    failed_ = false;
+    return sparse_reset(&state_, (sparse_options_t)options_, nullptr, nullptr);
+  }
+
+  // Ends the document without sending its last events.
+  void drop() noexcept
+  {
+    if (state_.buffer != nullptr)
+      sparse_reset(&state_, (sparse_options_t)options_, nullptr, nullptr);
+    failed_ = false;
+  }
+
+  // Where the last error happened, or a message saying what it was. For
+  // invalid characters, this points into the source.
+  std::string_view error_text() const noexcept
+  {
+    if (state_.error_begin == nullptr)
+      return std::string_view();
+    return std::string_view(state_.error_begin, (size_t)(state_.error_end - state_.error_begin));
+  }
+
+  int options() const noexcept { return options_; }
+
+private:
+  static void dispatch(sparse_msg_t msg, const char *begin, const char *end, void *context)
+  {
+    (*static_cast<const event_handler *>(context))(
+      msg, std::string_view(begin, begin == nullptr ? 0 : (size_t)(end - begin)));
+  }
+
+  void begin_events(const event_handler &on_event) noexcept
+  {
+    state_.callback = &dispatch;
+    state_.context = const_cast<event_handler *>(&on_event);
+  }
+
+  std::error_code end_events(sparse_error_t error) noexcept
+  {
+    state_.callback = nullptr;
+    state_.context = nullptr;
+    failed_ = failed_ || error != SP_NO_ERROR;
+    return error;
+  }
+
+  void end() noexcept
+  {
+    if (state_.buffer == nullptr)
+      return;
+    state_.callback = nullptr;
+    sparse_end(&state_);
+    std::memset(&state_, 0, sizeof(state_));
+  }
+
+  sparse_state_t state_;
+  int options_;
+  bool failed_ = false;
+};
+
+// Parses a complete document.
+inline std::error_code parse(std::string_view src, event_handler on_event, int options = SP_DEFAULT_OPTIONS) noexcept
+{
+  parser whole(options);
+  const std::error_code error = whole.parse(src, on_event);
+  const std::error_code finished = whole.finish(on_event);
+  return error ? error : finished;
+}
+
+} // namespace sparse
+
+#endif /* end __CMT_SPARSE_PARSER_HH__ include guard */
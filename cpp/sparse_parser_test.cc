@@ -0,0 +1,188 @@
+#include "sparse_parser.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <unistd.h>
+
+// Both parsers log events as "msg:length:token" so their output can be
+// compared directly.
+static void log_event(std::string &log, sparse_msg_t msg, std::string_view token)
+{
+  log += std::to_string((int)msg);
+  log += ':';
+  log += std::to_string(token.size());
+  log += ':';
+  log += token;
+}
+
+static void log_handler(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  log_event(*static_cast<std::string *>(context), msg, std::string_view(begin, begin == NULL ? 0 : (size_t)(end - begin)));
+}
+
+static std::string log_c_parser(std::string_view src, int options)
+{
+  std::string log;
+  sparse_state_t state;
+
+  sparse_begin(&state, 0, (sparse_options_t)options, log_handler, &log);
+  if (sparse_run(&state, src.data(), src.data() + src.size()) != SP_NO_ERROR)
+    state.callback = NULL;
+  sparse_end(&state);
+
+  return log;
+}
+
+static size_t num_allocs = 0;
+
+static void *counting_alloc(size_t size, void *user)
+{
+  (void)user;
+  ++num_allocs;
+  return std::malloc(size);
+}
+
+static void *counting_realloc(void *block, size_t size, void *user)
+{
+  (void)user;
+  ++num_allocs;
+  return std::realloc(block, size);
+}
+
+static void counting_free(void *block, void *user)
+{
+  (void)user;
+  std::free(block);
+}
+
+static const sparse_allocator_t counting_allocator = { counting_alloc, counting_realloc, counting_free, NULL };
+
+// Feeds src in pieces of chunk_size, moving the parser to a new one partway.
+static int check_chunks(std::string_view src, int options)
+{
+  const std::string expected = log_c_parser(src, options);
+  int failures = 0;
+
+  for (size_t chunk_size = 1; chunk_size < src.size() + 2; chunk_size += 3) {
+    std::string log;
+    auto on_event = [&log](sparse_msg_t msg, std::string_view token) { log_event(log, msg, token); };
+    sparse::parser first(options);
+    size_t offset = 0;
+    bool failed = false;
+
+    for (; offset < src.size() / 2 && !failed; offset += chunk_size)
+      failed = (bool)first.parse(src.substr(offset, chunk_size), on_event);
+
+    // A parser moved partway through a document carries on where it was.
+    sparse::parser second(std::move(first));
+    for (; offset < src.size() && !failed; offset += chunk_size)
+      failed = (bool)second.parse(src.substr(offset, chunk_size), on_event);
+    second.finish(on_event);
+
+    if (log != expected) {
+      std::fprintf(stderr, "Events differ for options %d, chunk size %zu:\n%s\nexpected:\n%s\n",
+                   options, chunk_size, log.c_str(), expected.c_str());
+      ++failures;
+    }
+  }
+
+  return failures;
+}
+
+static int check_errors()
+{
+  sparse::parser parser(SP_DEFAULT_OPTIONS, 0, &counting_allocator);
+  size_t num_events = 0;
+  auto count = [&num_events](sparse_msg_t, std::string_view) { ++num_events; };
+  int failures = 0;
+
+  const std::error_code invalid = parser.parse("unbalanced }\n", count);
+  if (invalid != SP_ERROR_INVALID_CHAR || invalid.category() != sparse::error_category()
+      || invalid.message() != "Invalid character encountered" || parser.error_text() != "}") {
+    std::fprintf(stderr, "Invalid character gave %d (%s) at \"%.*s\"\n", invalid.value(), invalid.message().c_str(),
+                 (int)parser.error_text().size(), parser.error_text().data());
+    ++failures;
+  }
+  parser.finish(count);
+
+  // Invalid characters in a file are kept past the end of the read.
+  char path[] = "/tmp/sparse_parser_test_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd != -1) {
+    static const char bad_file[] = "a {\n b c\n}\n}\n";
+    const bool written = write(fd, bad_file, sizeof(bad_file) - 1) == (ssize_t)(sizeof(bad_file) - 1);
+    close(fd);
+    if (!written || parser.parse_file(path, count) != SP_ERROR_INVALID_CHAR || parser.error_text() != "}") {
+      std::fprintf(stderr, "Invalid character in a file gave \"%.*s\"\n", (int)parser.error_text().size(),
+                   parser.error_text().data());
+      ++failures;
+    }
+    parser.finish(count);
+    unlink(path);
+  }
+
+  // The parser carries on with the next document, without allocating.
+  const size_t allocs_before = num_allocs;
+  num_events = 0;
+  if (parser.parse("open { node value\n", count) || parser.finish(count) != SP_ERROR_INCOMPLETE_DOCUMENT
+      || num_events != 5 || num_allocs != allocs_before) {
+    std::fprintf(stderr, "Incomplete document gave %zu events, %zu allocations\n", num_events, num_allocs - allocs_before);
+    ++failures;
+  }
+
+  num_events = 0;
+  if (sparse::parse("a 1; b 2; c {\n d\n}\n", count) || num_events != 9
+      || sparse::parse("}", count) != SP_ERROR_INVALID_CHAR) {
+    std::fprintf(stderr, "One-off parses failed\n");
+    ++failures;
+  }
+
+  // Moved-from parsers can't parse, but don't fail any other way.
+  sparse::parser moved(std::move(parser));
+  if (parser.parse("a b", count) != SP_ERROR_NO_MEM || moved.parse("a b", count)) {
+    std::fprintf(stderr, "Moving a parser failed\n");
+    ++failures;
+  }
+
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *const test_sources[] = {
+    "# This is a named root node (technically just a field with a node value):\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  clamp_v\n"
+    "}\n"
+    "{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "width 800; height 600\n",
+
+    "name  value\\  with\\ttrailing   \n"
+    "escaped\\ name {\\}\n"
+    "  a\t\tb  \\\\  \n"
+    "}\n"
+    "last value",
+
+    "unbalanced { value }\n}\n",
+    "open { node\n",
+  };
+
+  int failures = 0;
+
+  for (const char *src : test_sources) {
+    failures += check_chunks(src, SP_DEFAULT_OPTIONS);
+    failures += check_chunks(src, SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+  }
+  failures += check_errors();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include "sparse_pipeline.hh"
+#include "sparse_internal.h"
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+static const char *sp_errstr_no_mem = "Could not allocate memory for decompression.";
+
+// The ring shared by the two threads. Windows from first_full to
+// first_full + num_full (mod the number of windows) are waiting to be parsed;
+// the rest belong to the decompressing thread.
+struct sparse_pipeline_t
+{
+  sparse_decompressor_t decompressor;
+  std::vector<char> storage;
+  std::vector<size_t> sizes;
+  size_t window_size;
+
+  std::mutex mutex;
+  std::condition_variable window_filled;
+  std::condition_variable window_drained;
+  size_t first_full;
+  size_t num_full;
+  // Set by the decompressing thread once it's done, with any error.
+  bool finished;
+  sparse_error_t error;
+  // Set by the parsing thread to stop decompression early.
+  bool stopped;
+
+  sparse_pipeline_t(size_t num_windows, size_t window_size)
+  : storage(num_windows * window_size), sizes(num_windows), window_size(window_size),
+    first_full(0), num_full(0), finished(false), error(SP_NO_ERROR), stopped(false)
+  {
+    std::memset(&decompressor, 0, sizeof(decompressor));
+  }
+
+  char *window(size_t index) { return &storage[index * window_size]; }
+};
+
+static void sp_decompress_windows(sparse_pipeline_t *pipeline)
+{
+  const size_t num_windows = pipeline->sizes.size();
+  sparse_error_t error = SP_NO_ERROR;
+  size_t next = 0;
+  size_t size = 0;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(pipeline->mutex);
+      while (pipeline->num_full == num_windows && !pipeline->stopped)
+        pipeline->window_drained.wait(lock);
+      if (pipeline->stopped)
+        break;
+    }
+
+    // The window isn't touched by the parsing thread until it's counted as
+    // full, so it's filled without holding the lock.
+    error = sparse_decompressor_read(&pipeline->decompressor, pipeline->window(next), pipeline->window_size, &size);
+    if (error != SP_NO_ERROR || size == 0)
+      break;
+
+    std::lock_guard<std::mutex> lock(pipeline->mutex);
+    pipeline->sizes[next] = size;
+    ++pipeline->num_full;
+    next = (next + 1) % num_windows;
+    pipeline->window_filled.notify_one();
+  }
+
+  std::lock_guard<std::mutex> lock(pipeline->mutex);
+  pipeline->finished = true;
+  pipeline->error = error;
+  pipeline->window_filled.notify_one();
+}
+
+sparse_error_t sparse_parse_compressed_file_pipelined(sparse_state_t *state, const char *path,
+                                                      size_t num_windows, size_t window_size)
+{
+  if (num_windows < 2 || window_size == 0)
+    return sparse_parse_compressed_file(state, path);
+
+  sparse_pipeline_t *pipeline;
+  try {
+    pipeline = new sparse_pipeline_t(num_windows, window_size);
+  } catch (std::bad_alloc &) {
+    sp_send_error(state, sp_errstr_no_mem, sp_errstr_no_mem + std::strlen(sp_errstr_no_mem));
+    return SP_ERROR_NO_MEM;
+  }
+
+  sparse_error_t error = sparse_decompressor_open(&pipeline->decompressor, path);
+  std::thread decompressing;
+
+  if (error == SP_NO_ERROR) {
+    try {
+      decompressing = std::thread(sp_decompress_windows, pipeline);
+    } catch (std::system_error &) {
+      sparse_decompressor_close(&pipeline->decompressor);
+      delete pipeline;
+      return sparse_parse_compressed_file(state, path);
+    }
+  }
+
+  while (error == SP_NO_ERROR) {
+    size_t index;
+    {
+      std::unique_lock<std::mutex> lock(pipeline->mutex);
+      while (pipeline->num_full == 0 && !pipeline->finished)
+        pipeline->window_filled.wait(lock);
+      if (pipeline->num_full == 0) {
+        error = pipeline->error;
+        break;
+      }
+      index = pipeline->first_full;
+    }
+
+    // sparse_run copies any token still open at the end of the window into
+    // its buffer, so the window can be handed back afterward.
+    const char *window = pipeline->window(index);
+    error = sparse_run(state, window, window + pipeline->sizes[index]);
+
+    std::lock_guard<std::mutex> lock(pipeline->mutex);
+    pipeline->first_full = (index + 1) % num_windows;
+    --pipeline->num_full;
+    pipeline->stopped = error != SP_NO_ERROR;
+    pipeline->window_drained.notify_one();
+  }
+
+  if (decompressing.joinable())
+    decompressing.join();
+
+  // sparse_run sends its own errors, and stopping after one of them may have
+  // left the decompressor with one of its own.
+  if (error != SP_NO_ERROR && !pipeline->stopped && pipeline->decompressor.error_begin != NULL)
+    sp_send_error(state, pipeline->decompressor.error_begin, pipeline->decompressor.error_end);
+
+  sparse_decompressor_close(&pipeline->decompressor);
+  sp_detach_error(state, pipeline->storage.data(), pipeline->storage.data() + pipeline->storage.size());
+  delete pipeline;
+  return error;
+}
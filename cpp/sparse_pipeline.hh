@@ -0,0 +1,25 @@
+#ifndef __CMT_SPARSE_PIPELINE_HH__
+#define __CMT_SPARSE_PIPELINE_HH__
+
+#include "sparse_decompress.h"
+
+// Windows in the ring between the decompressing and parsing threads.
+#ifndef SP_PIPELINE_NUM_WINDOWS
+#define SP_PIPELINE_NUM_WINDOWS 4
+#endif
+
+/* Pipelined decompression */
+// Works like sparse_parse_compressed_file, but decompresses on a second thread
+// while the calling thread parses. The decompressing thread fills a ring of
+// num_windows windows of window_size bytes and sparse_run is called on each
+// as soon as it's full, so memory use is num_windows * window_size plus the
+// decompressor's, however big the file. Events are sent on the calling
+// thread. A parse error stops decompression; a decompression error is sent
+// after the events for everything decompressed before it. With fewer than two
+// windows, or if the thread can't be started, this is the same as
+// sparse_parse_compressed_file.
+sparse_error_t sparse_parse_compressed_file_pipelined(sparse_state_t *state, const char *path,
+                                                      size_t num_windows = SP_PIPELINE_NUM_WINDOWS,
+                                                      size_t window_size = SP_DECOMPRESS_WINDOW_SIZE);
+
+#endif /* end __CMT_SPARSE_PIPELINE_HH__ include guard */
@@ -0,0 +1,145 @@
+#include "sparse_pipeline.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <zlib.h>
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  std::string &log = *(std::string *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  std::snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log += header;
+  log.append(begin, length);
+}
+
+// Sets error_text, if given, to the state's error once the file's done.
+static sparse_error_t log_file(const char *path, size_t num_windows, size_t window_size, std::string &log,
+                               std::string *error_text = nullptr)
+{
+  sparse_state_t state;
+
+  log.clear();
+  sparse_begin(&state, 0, SP_DEFAULT_OPTIONS, log_event, &log);
+  sparse_error_t error = sparse_parse_compressed_file_pipelined(&state, path, num_windows, window_size);
+  if (error_text != nullptr) {
+    // Read here rather than in std::string, so sanitizers see it.
+    error_text->clear();
+    for (const char *c = state.error_begin; c != state.error_end; ++c)
+      error_text->push_back(*c);
+  }
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  return error;
+}
+
+static std::string log_string(const std::string &src)
+{
+  std::string log;
+  sparse_state_t state;
+
+  sparse_begin(&state, 0, SP_DEFAULT_OPTIONS, log_event, &log);
+  if (sparse_run(&state, src.data(), src.data() + src.size()) != SP_NO_ERROR)
+    state.callback = NULL;
+  sparse_end(&state);
+
+  return log;
+}
+
+static void write_gzip(const char *path, const std::string &src, size_t length)
+{
+  std::string compressed(compressBound((uLong)src.size()) + 64, '\0');
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  stream.next_in = (Bytef *)src.data();
+  stream.avail_in = (uInt)src.size();
+  stream.next_out = (Bytef *)&compressed[0];
+  stream.avail_out = (uInt)compressed.size();
+  deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+
+  const size_t size = compressed.size() - stream.avail_out;
+  FILE *file = std::fopen(path, "wb");
+  std::fwrite(compressed.data(), 1, length < size ? length : size, file);
+  std::fclose(file);
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  escaped\\ name a\\tvalue\\ \n"
+    "}\n"
+    "width 800; height 600\n";
+
+  char path[] = "/tmp/sparse_pipeline_test_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd == -1) {
+    std::fprintf(stderr, "Could not create a temporary file.\n");
+    return 1;
+  }
+  close(fd);
+
+  std::string src;
+  while (src.size() < 256 * 1024)
+    src += test_string;
+
+  const std::string expected = log_string(src);
+  std::string log;
+  int failures = 0;
+
+  write_gzip(path, src, (size_t)-1);
+  static const size_t window_sizes[] = { 1, 7, 4096, SP_DECOMPRESS_WINDOW_SIZE };
+  for (size_t num_windows = 1; num_windows <= 4; ++num_windows) {
+    for (size_t window_size : window_sizes) {
+      if (log_file(path, num_windows, window_size, log) != SP_NO_ERROR || log != expected) {
+        std::fprintf(stderr, "Events differ with %zu windows of %zu bytes.\n", num_windows, window_size);
+        ++failures;
+      }
+    }
+  }
+
+  // A parse error stops the decompressing thread, which may be waiting on a
+  // full ring. The error is still readable once the ring's gone.
+  const std::string invalid = src + "}\n" + src;
+  std::string error_text;
+  write_gzip(path, invalid, (size_t)-1);
+  if (log_file(path, 2, 4096, log, &error_text) != SP_ERROR_INVALID_CHAR || log != log_string(invalid)
+      || error_text != "}") {
+    std::fprintf(stderr, "Expected the same invalid character error as sparse_run, got \"%s\".\n", error_text.c_str());
+    ++failures;
+  }
+
+  // Events up to the end of what could be decompressed are sent before the
+  // error.
+  write_gzip(path, src, 1000);
+  const std::string truncated = "-1:34:Compressed data ends unexpectedly.";
+  if (log_file(path, 3, 64, log) != SP_ERROR_BAD_FORMAT || log.size() < 1000
+      || log.compare(log.size() - truncated.size(), truncated.size(), truncated) != 0) {
+    std::fprintf(stderr, "Expected a truncated gzip error.\n");
+    ++failures;
+  }
+
+  unlink(path);
+  if (log_file(path, 4, 4096, log) != SP_ERROR_IO || log != "-1:20:Could not open file.") {
+    std::fprintf(stderr, "Expected an IO error for a missing file, got %s.\n", log.c_str());
+    ++failures;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,633 @@
+#ifndef __CMT_SPARSE_SCHEMA_HH__
+#define __CMT_SPARSE_SCHEMA_HH__
+
+/*
+  Header-only C++17 binding of documents to structs. Describe a struct's
+  fields by specializing sparse::schema, and sparse::decode writes each value
+  straight into its member as sparse_run sends it, without building a
+  document first or copying names:
+
+    struct pass {
+      std::string map;
+      bool clamp_u = false;
+      std::array<double, 4> color = {};
+    };
+
+    struct material {
+      int priority = 0;
+      std::vector<pass> passes;
+    };
+
+    template <> struct sparse::schema<pass> {
+      static constexpr auto fields = sparse::fields(
+        SP_FIELD(pass, map), SP_FIELD(pass, clamp_u), SP_FIELD(pass, color));
+    };
+
+    template <> struct sparse::schema<material> {
+      static constexpr auto fields = sparse::fields(
+        SP_FIELD(material, priority), sparse::field("pass", &material::passes));
+    };
+
+    material mat;
+    std::error_code error = sparse::decode(src, mat);
+
+  Members can be bools, integers, floating point numbers, std::strings,
+  std::vectors or std::arrays of numbers (separated by spaces and tabs),
+  structs with schemas (read from nodes), and std::vectors of those (one
+  element per node). Numbers and bools are read by sparse_value.h. A bool
+  field given without a value, like clamp_u above, is true.
+
+  Names are looked up through a perfect hash built at compile time from the
+  schema, so each one costs a hash and one comparison.
+
+  Build sparse.c, sparse_scan.c and sparse_value.c with it.
+*/
+
+#include "sparse_parser.hh"
+#include "sparse_value.h"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define SP_FIELD(TYPE, MEMBER) (sparse::field(#MEMBER, &TYPE::MEMBER))
+
+namespace sparse {
+
+// Specialize with a static constexpr fields member made by sparse::fields.
+template <class T>
+struct schema;
+
+template <class Struct, class Member>
+struct field_t
+{
+  std::string_view name;
+  Member Struct::*member;
+};
+
+template <class Struct, class Member>
+constexpr field_t<Struct, Member> field(std::string_view name, Member Struct::*member)
+{
+  return field_t<Struct, Member>{ name, member };
+}
+
+template <class... Fields>
+constexpr std::tuple<Fields...> fields(Fields... fields)
+{
+  return std::tuple<Fields...>(fields...);
+}
+
+// What to do with fields a schema doesn't have. Skipped nodes are skipped
+// whole.
+enum class unknown_fields
+{
+  skip,
+  report  // Fail with SP_ERROR_NOT_FOUND.
+};
+
+// Reads a value into a member. Specialize for other member types.
+template <class T, class = void>
+struct value_traits;
+
+template <>
+struct value_traits<bool>
+{
+  static sparse_error_t decode(std::string_view value, bool &out)
+  {
+    int result;
+    if (value.empty()) {
+      out = true;
+      return SP_NO_ERROR;
+    }
+
+    const sparse_error_t error = sparse_parse_bool(value.data(), value.data() + value.size(), &result);
+    if (error == SP_NO_ERROR)
+      out = result != 0;
+    return error;
+  }
+};
+
+template <class T>
+struct value_traits<T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T>>>
+{
+  static sparse_error_t decode(std::string_view value, T &out)
+  {
+    int64_t result;
+    const sparse_error_t error = sparse_parse_int(value.data(), value.data() + value.size(), &result);
+    if (error != SP_NO_ERROR)
+      return error;
+    if (result < (int64_t)std::numeric_limits<T>::min() || result > (int64_t)std::numeric_limits<T>::max())
+      return SP_ERROR_OUT_OF_RANGE;
+    out = (T)result;
+    return SP_NO_ERROR;
+  }
+};
+
+template <class T>
+struct value_traits<T, std::enable_if_t<std::is_integral_v<T> && std::is_unsigned_v<T> && !std::is_same_v<T, bool>>>
+{
+  static sparse_error_t decode(std::string_view value, T &out)
+  {
+    uint64_t result;
+    const sparse_error_t error = sparse_parse_uint(value.data(), value.data() + value.size(), &result);
+    if (error != SP_NO_ERROR)
+      return error;
+    if (result > (uint64_t)std::numeric_limits<T>::max())
+      return SP_ERROR_OUT_OF_RANGE;
+    out = (T)result;
+    return SP_NO_ERROR;
+  }
+};
+
+template <class T>
+struct value_traits<T, std::enable_if_t<std::is_floating_point_v<T>>>
+{
+  static sparse_error_t decode(std::string_view value, T &out)
+  {
+    double result;
+    const sparse_error_t error = sparse_parse_double(value.data(), value.data() + value.size(), &result);
+    if (error != SP_NO_ERROR)
+      return error;
+    if (std::isfinite(result) && std::fabs(result) > (double)std::numeric_limits<T>::max())
+      return SP_ERROR_OUT_OF_RANGE;
+    out = (T)result;
+    return SP_NO_ERROR;
+  }
+};
+
+template <>
+struct value_traits<std::string>
+{
+  static sparse_error_t decode(std::string_view value, std::string &out)
+  {
+    out.assign(value.data(), value.size());
+    return SP_NO_ERROR;
+  }
+};
+
+namespace detail {
+
+inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+// Calls decode_item with each blank-separated piece of value, stopping at the
+// first error.
+template <class DecodeItem>
+sparse_error_t for_each_item(std::string_view value, DecodeItem &&decode_item)
+{
+  size_t index = 0;
+
+  while (index < value.size()) {
+    while (index < value.size() && is_blank(value[index]))
+      ++index;
+    if (index == value.size())
+      break;
+
+    const size_t begin = index;
+    while (index < value.size() && !is_blank(value[index]))
+      ++index;
+
+    const sparse_error_t error = decode_item(value.substr(begin, index - begin));
+    if (error != SP_NO_ERROR)
+      return error;
+  }
+
+  return SP_NO_ERROR;
+}
+
+} // namespace detail
+
+template <class T>
+struct value_traits<std::vector<T>, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+  static sparse_error_t decode(std::string_view value, std::vector<T> &out)
+  {
+    out.clear();
+    return detail::for_each_item(value, [&out](std::string_view item) {
+      T result;
+      const sparse_error_t error = value_traits<T>::decode(item, result);
+      if (error == SP_NO_ERROR)
+        out.push_back(result);
+      return error;
+    });
+  }
+};
+
+// Arrays need exactly as many numbers as they hold.
+template <class T, size_t N>
+struct value_traits<std::array<T, N>, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+  static sparse_error_t decode(std::string_view value, std::array<T, N> &out)
+  {
+    std::array<T, N> result = {};
+    size_t count = 0;
+    const sparse_error_t error = detail::for_each_item(value, [&result, &count](std::string_view item) {
+      if (count == N)
+        return SP_ERROR_INVALID_VALUE;
+      return value_traits<T>::decode(item, result[count++]);
+    });
+
+    if (error != SP_NO_ERROR)
+      return error;
+    if (count != N)
+      return SP_ERROR_INVALID_VALUE;
+    out = result;
+    return SP_NO_ERROR;
+  }
+};
+
+namespace detail {
+
+struct binding;
+
+// How one field is read: value is called for a value and node for a node,
+// which returns the object and binding for the node's fields. value fails
+// with SP_ERROR_INVALID_VALUE, and node returns NULL, if the field can't be
+// given that way.
+struct field_entry
+{
+  std::string_view name;
+  sparse_error_t (*value)(void *object, std::string_view value);
+  const binding *(*node)(void *object, void **child);
+};
+
+// A struct's fields and the perfect hash over their names. Names are first
+// hashed into buckets, and each bucket has a displacement that moves its
+// names into free slots of a table twice as big as the number of buckets
+// (hash and displace, as in CHD).
+struct binding
+{
+  const field_entry *fields;
+  size_t num_buckets;
+  const uint16_t *displacements;
+  size_t num_slots;
+  const uint8_t *slots;
+
+  const field_entry *find(std::string_view name) const;
+};
+
+#define SP_SCHEMA_NO_FIELD (0xFF)
+#define SP_SCHEMA_MAX_DISPLACEMENT (0xFFFF)
+
+// A constexpr twin of sp_hash (sparse_internal.h) from SP_HASH_SEED, cut to
+// 32 bits like the C callers do. It has to match that one.
+constexpr uint32_t name_hash(std::string_view name)
+{
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  for (char c : name) {
+    hash ^= (unsigned char)c;
+    hash *= UINT64_C(0x100000001b3);
+  }
+  return (uint32_t)hash;
+}
+
+constexpr uint32_t mix_hash(uint32_t hash)
+{
+  hash ^= hash >> 16;
+  hash *= UINT32_C(0x7feb352d);
+  hash ^= hash >> 15;
+  hash *= UINT32_C(0x846ca68b);
+  hash ^= hash >> 16;
+  return hash;
+}
+
+constexpr size_t name_bucket(uint32_t hash, size_t num_buckets)
+{
+  return (mix_hash(hash) >> 16) & (num_buckets - 1);
+}
+
+constexpr size_t name_slot(uint32_t hash, uint32_t displacement, size_t num_slots)
+{
+  return mix_hash(hash ^ (displacement * UINT32_C(0x9e3779b9))) & (num_slots - 1);
+}
+
+inline const field_entry *binding::find(std::string_view name) const
+{
+  const uint32_t hash = name_hash(name);
+  const uint16_t displacement = displacements[name_bucket(hash, num_buckets)];
+  const uint8_t index = slots[name_slot(hash, displacement, num_slots)];
+
+  if (index == SP_SCHEMA_NO_FIELD || fields[index].name != name)
+    return nullptr;
+  return &fields[index];
+}
+
+constexpr size_t num_hash_buckets(size_t num_fields)
+{
+  size_t count = 1;
+  while (count < num_fields)
+    count *= 2;
+  return count;
+}
+
+template <size_t NumFields>
+struct perfect_hash
+{
+  static constexpr size_t num_buckets = num_hash_buckets(NumFields);
+  static constexpr size_t num_slots = num_buckets * 2;
+
+  bool found = false;
+  std::array<uint16_t, num_buckets> displacements = {};
+  std::array<uint8_t, num_slots> slots = {};
+};
+
+// Places the biggest buckets first, while the table's emptiest. Fails if two
+// names are the same.
+template <size_t NumFields>
+constexpr perfect_hash<NumFields> make_perfect_hash(const std::array<std::string_view, NumFields> &names)
+{
+  using hash_t = perfect_hash<NumFields>;
+  hash_t result;
+  std::array<uint32_t, NumFields> hashes = {};
+  std::array<size_t, NumFields> buckets = {};
+  std::array<size_t, hash_t::num_buckets> bucket_sizes = {};
+
+  for (size_t slot = 0; slot < hash_t::num_slots; ++slot)
+    result.slots[slot] = SP_SCHEMA_NO_FIELD;
+
+  for (size_t index = 0; index < NumFields; ++index) {
+    for (size_t other = 0; other < index; ++other) {
+      if (names[other] == names[index])
+        return result;
+    }
+
+    hashes[index] = name_hash(names[index]);
+    buckets[index] = name_bucket(hashes[index], hash_t::num_buckets);
+    ++bucket_sizes[buckets[index]];
+  }
+
+  for (size_t size = NumFields; size > 0; --size) {
+    for (size_t bucket = 0; bucket < hash_t::num_buckets; ++bucket) {
+      if (bucket_sizes[bucket] != size)
+        continue;
+
+      uint32_t displacement = 0;
+      for (;; ++displacement) {
+        if (displacement > SP_SCHEMA_MAX_DISPLACEMENT)
+          return result;
+
+        std::array<uint8_t, hash_t::num_slots> slots = result.slots;
+        bool placed = true;
+        for (size_t index = 0; index < NumFields && placed; ++index) {
+          if (buckets[index] != bucket)
+            continue;
+          const size_t slot = name_slot(hashes[index], displacement, hash_t::num_slots);
+          placed = slots[slot] == SP_SCHEMA_NO_FIELD;
+          slots[slot] = (uint8_t)index;
+        }
+
+        if (placed) {
+          result.slots = slots;
+          result.displacements[bucket] = (uint16_t)displacement;
+          break;
+        }
+      }
+    }
+  }
+
+  result.found = true;
+  return result;
+}
+
+template <class T, class = void>
+struct has_schema : std::false_type {};
+
+template <class T>
+struct has_schema<T, std::void_t<decltype(schema<T>::fields)>> : std::true_type {};
+
+template <class T>
+struct is_node_vector : std::false_type {};
+
+template <class T>
+struct is_node_vector<std::vector<T>> : has_schema<T> {};
+
+template <class T>
+struct binding_of;
+
+template <class Member>
+sparse_error_t decode_value(Member &member, std::string_view value)
+{
+  if constexpr (has_schema<Member>::value || is_node_vector<Member>::value) {
+    (void)member;
+    (void)value;
+    return SP_ERROR_INVALID_VALUE;
+  } else {
+    return value_traits<Member>::decode(value, member);
+  }
+}
+
+template <class T, size_t Index>
+sparse_error_t field_value(void *object, std::string_view value)
+{
+  auto &member = static_cast<T *>(object)->*(std::get<Index>(schema<T>::fields).member);
+  return decode_value(member, value);
+}
+
+template <class T, size_t Index>
+const binding *field_node(void *object, void **child)
+{
+  auto &member = static_cast<T *>(object)->*(std::get<Index>(schema<T>::fields).member);
+  using member_t = std::remove_reference_t<decltype(member)>;
+
+  if constexpr (has_schema<member_t>::value) {
+    *child = &member;
+    return &binding_of<member_t>::value;
+  } else if constexpr (is_node_vector<member_t>::value) {
+    member.emplace_back();
+    *child = &member.back();
+    return &binding_of<typename member_t::value_type>::value;
+  } else {
+    (void)child;
+    return nullptr;
+  }
+}
+
+template <class T>
+struct binding_of
+{
+  static constexpr size_t num_fields = std::tuple_size_v<std::decay_t<decltype(schema<T>::fields)>>;
+  static_assert(num_fields < SP_SCHEMA_NO_FIELD, "Schemas can have at most 254 fields");
+
+  template <size_t... Indexes>
+  static constexpr std::array<std::string_view, num_fields> make_names(std::index_sequence<Indexes...>)
+  {
+    return { { std::get<Indexes>(schema<T>::fields).name... } };
+  }
+
+  template <size_t... Indexes>
+  static constexpr std::array<field_entry, num_fields> make_entries(std::index_sequence<Indexes...>)
+  {
+    return { { field_entry{ std::get<Indexes>(schema<T>::fields).name, &field_value<T, Indexes>, &field_node<T, Indexes> }... } };
+  }
+
+  static constexpr std::array<std::string_view, num_fields> names = make_names(std::make_index_sequence<num_fields>());
+  static constexpr perfect_hash<num_fields> hash = make_perfect_hash(names);
+  static_assert(hash.found, "Schema field names must be different");
+
+  static constexpr std::array<field_entry, num_fields> entries = make_entries(std::make_index_sequence<num_fields>());
+  static constexpr binding value = {
+    entries.data(), hash.num_buckets, hash.displacements.data(), hash.num_slots, hash.slots.data()
+  };
+};
+
+// The type-erased part of a decoder: a stack of the structs whose nodes are
+// open, and the field the last name picked out.
+class decode_state
+{
+public:
+  decode_state(void *root, const binding *root_binding, unknown_fields unknown)
+  : unknown_(unknown)
+  {
+    stack_.push_back(frame{ root, root_binding });
+  }
+
+  // Runs inside the parser's noexcept callbacks, so running out of memory
+  // while decoding a value or opening a node is an error rather than a throw.
+  void on_event(sparse_msg_t msg, std::string_view token) noexcept
+  {
+    if (error_ != SP_NO_ERROR)
+      return;
+
+    try {
+      handle_event(msg, token);
+    } catch (const std::bad_alloc &) {
+      error_ = SP_ERROR_NO_MEM;
+      error_field_.clear();
+    }
+  }
+
+  sparse_error_t error() const { return error_; }
+  // The field an error happened on.
+  std::string_view error_field() const { return error_field_; }
+
+private:
+  struct frame
+  {
+    void *object;
+    const binding *fields;
+  };
+
+  void handle_event(sparse_msg_t msg, std::string_view token)
+  {
+    switch (msg) {
+    case SP_NAME:
+      if (skip_depth_ == 0)
+        on_name(token);
+      break;
+
+    case SP_VALUE:
+      if (skip_depth_ == 0 && field_ != nullptr) {
+        const sparse_error_t error = field_->value(stack_.back().object, token);
+        if (error != SP_NO_ERROR)
+          fail(error, field_->name);
+      }
+      field_ = nullptr;
+      break;
+
+    case SP_BEGIN_NODE:
+      if (skip_depth_ > 0 || field_ == nullptr) {
+        ++skip_depth_;
+      } else {
+        void *child = nullptr;
+        const binding *child_binding = field_->node(stack_.back().object, &child);
+        if (child_binding == nullptr)
+          fail(SP_ERROR_INVALID_VALUE, field_->name);
+        else
+          stack_.push_back(frame{ child, child_binding });
+      }
+      field_ = nullptr;
+      break;
+
+    case SP_END_NODE:
+      if (skip_depth_ > 0)
+        --skip_depth_;
+      else if (stack_.size() > 1)
+        stack_.pop_back();
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  void on_name(std::string_view name)
+  {
+    field_ = stack_.back().fields->find(name);
+    if (field_ == nullptr && unknown_ == unknown_fields::report)
+      fail(SP_ERROR_NOT_FOUND, name);
+  }
+
+  void fail(sparse_error_t error, std::string_view field)
+  {
+    error_ = error;
+    error_field_.assign(field.data(), field.size());
+  }
+
+  std::vector<frame> stack_;
+  const field_entry *field_ = nullptr;
+  size_t skip_depth_ = 0;
+  unknown_fields unknown_;
+  sparse_error_t error_ = SP_NO_ERROR;
+  std::string error_field_;
+};
+
+} // namespace detail
+
+// Decodes a document fed in pieces into target.
+template <class T>
+class decoder
+{
+public:
+  explicit decoder(T &target, unknown_fields unknown = unknown_fields::skip, int options = SP_DEFAULT_OPTIONS)
+  : parser_(options), state_(&target, &detail::binding_of<T>::value, unknown)
+  {}
+
+  std::error_code parse(std::string_view src)
+  {
+    auto on_event = [this](sparse_msg_t msg, std::string_view token) { state_.on_event(msg, token); };
+    const std::error_code error = parser_.parse(src, on_event);
+    return error ? error : std::error_code(state_.error());
+  }
+
+  std::error_code finish()
+  {
+    auto on_event = [this](sparse_msg_t msg, std::string_view token) { state_.on_event(msg, token); };
+    const std::error_code error = parser_.finish(on_event);
+    return state_.error() != SP_NO_ERROR ? std::error_code(state_.error()) : error;
+  }
+
+  // For parse errors, where it happened. Otherwise the name of the field that
+  // was unknown or couldn't be read.
+  std::string_view error_text() const
+  {
+    return state_.error() != SP_NO_ERROR ? state_.error_field() : parser_.error_text();
+  }
+
+private:
+  parser parser_;
+  detail::decode_state state_;
+};
+
+// Decodes a complete document into target.
+template <class T>
+std::error_code decode(std::string_view src, T &target, unknown_fields unknown = unknown_fields::skip,
+                       int options = SP_DEFAULT_OPTIONS)
+{
+  decoder<T> whole(target, unknown, options);
+  const std::error_code error = whole.parse(src);
+  const std::error_code finished = whole.finish();
+  return error ? error : finished;
+}
+
+} // namespace sparse
+
+#endif /* end __CMT_SPARSE_SCHEMA_HH__ include guard */
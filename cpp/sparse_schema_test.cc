@@ -0,0 +1,236 @@
+#include "sparse_schema.hh"
+#include <cstdio>
+#include <new>
+#include <string>
+
+struct pass
+{
+  std::string map;
+  bool clamp_u = false;
+  bool clamp_v = false;
+  std::array<double, 4> color = {};
+  float scale = 1.0f;
+};
+
+struct material
+{
+  int priority = 0;
+  uint8_t sort = 0;
+  std::vector<int64_t> frames;
+  std::vector<pass> passes;
+  pass editor;
+};
+
+struct library
+{
+  std::string name;
+  std::vector<material> materials;
+};
+
+template <> struct sparse::schema<pass>
+{
+  static constexpr auto fields = sparse::fields(
+    SP_FIELD(pass, map), SP_FIELD(pass, clamp_u), SP_FIELD(pass, clamp_v), SP_FIELD(pass, color), SP_FIELD(pass, scale));
+};
+
+template <> struct sparse::schema<material>
+{
+  static constexpr auto fields = sparse::fields(
+    SP_FIELD(material, priority), SP_FIELD(material, sort), SP_FIELD(material, frames),
+    sparse::field("pass", &material::passes), SP_FIELD(material, editor));
+};
+
+template <> struct sparse::schema<library>
+{
+  static constexpr auto fields = sparse::fields(
+    SP_FIELD(library, name), sparse::field("material", &library::materials));
+};
+
+// Runs out of memory whenever it's decoded.
+struct greedy
+{
+};
+
+template <> struct sparse::value_traits<greedy>
+{
+  static sparse_error_t decode(std::string_view, greedy &) { throw std::bad_alloc(); }
+};
+
+struct greedy_holder
+{
+  greedy value;
+};
+
+template <> struct sparse::schema<greedy_holder>
+{
+  static constexpr auto fields = sparse::fields(SP_FIELD(greedy_holder, value));
+};
+
+static const char *const library_source =
+  "name base textures\n"
+  "material {\n"
+  "  priority -3\n"
+  "  sort 200\n"
+  "  frames 1 2  3\t5\n"
+  "  # Unknown fields and nodes are skipped by default.\n"
+  "  qer_editorimage textures/base/fl_tile1_ed.png\n"
+  "  deform { wave sin 0 1 }\n"
+  "  pass {\n"
+  "    map textures/base/fl_tile1.png\n"
+  "    clamp_u\n"
+  "    color 1 0.5 0.25 1\n"
+  "  }\n"
+  "  pass {\n"
+  "    map textures/base/fl_tile1_glow.png\n"
+  "    clamp_v on; scale 0.5\n"
+  "  }\n"
+  "  editor { map textures/base/fl_tile1_ed.png\n }\n"
+  "}\n"
+  "material { priority 4\n }\n";
+
+static int check_library(const library &lib, const char *how)
+{
+  if (lib.name != "base textures" || lib.materials.size() != 2) {
+    std::fprintf(stderr, "%s: library \"%s\" has %zu materials\n", how, lib.name.c_str(), lib.materials.size());
+    return 1;
+  }
+
+  const material &first = lib.materials[0];
+  if (first.priority != -3 || first.sort != 200 || first.frames != std::vector<int64_t>{ 1, 2, 3, 5 }
+      || first.passes.size() != 2 || first.editor.map != "textures/base/fl_tile1_ed.png"
+      || lib.materials[1].priority != 4 || !lib.materials[1].passes.empty()) {
+    std::fprintf(stderr, "%s: materials differ\n", how);
+    return 1;
+  }
+
+  const pass &base = first.passes[0];
+  const pass &glow = first.passes[1];
+  if (base.map != "textures/base/fl_tile1.png" || !base.clamp_u || base.clamp_v || base.color[1] != 0.5
+      || base.color[3] != 1.0 || base.scale != 1.0f || glow.map != "textures/base/fl_tile1_glow.png"
+      || glow.clamp_u || !glow.clamp_v || glow.scale != 0.5f) {
+    std::fprintf(stderr, "%s: passes differ\n", how);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int check_decoding()
+{
+  int failures = 0;
+
+  library whole;
+  if (sparse::decode(library_source, whole))
+    ++failures;
+  failures += check_library(whole, "Whole");
+
+  // Fed in pieces, the same way.
+  const std::string_view src(library_source);
+  for (size_t chunk_size = 1; chunk_size < 40; chunk_size += 7) {
+    library pieces;
+    sparse::decoder<library> decoder(pieces);
+    for (size_t offset = 0; offset < src.size(); offset += chunk_size) {
+      if (decoder.parse(src.substr(offset, chunk_size)))
+        ++failures;
+    }
+    if (decoder.finish())
+      ++failures;
+    failures += check_library(pieces, "Pieces");
+  }
+
+  return failures;
+}
+
+struct error_test
+{
+  const char *src;
+  sparse::unknown_fields unknown;
+  sparse_error_t error;
+  const char *error_text;
+};
+
+static int check_errors()
+{
+  static const error_test tests[] = {
+    { "material { qer_editorimage x\n }\n", sparse::unknown_fields::report, SP_ERROR_NOT_FOUND, "qer_editorimage" },
+    { "material { deform { }\n }\n", sparse::unknown_fields::report, SP_ERROR_NOT_FOUND, "deform" },
+    { "material { priority high\n }\n", sparse::unknown_fields::skip, SP_ERROR_INVALID_VALUE, "priority" },
+    { "material { sort 256\n }\n", sparse::unknown_fields::skip, SP_ERROR_OUT_OF_RANGE, "sort" },
+    { "material { pass { color 1 1 1\n } }\n", sparse::unknown_fields::skip, SP_ERROR_INVALID_VALUE, "color" },
+    { "material { pass { scale 1e39\n } }\n", sparse::unknown_fields::skip, SP_ERROR_OUT_OF_RANGE, "scale" },
+    { "material { pass textures/base/fl_tile1.png\n }\n", sparse::unknown_fields::skip, SP_ERROR_INVALID_VALUE, "pass" },
+    { "name { }\n", sparse::unknown_fields::skip, SP_ERROR_INVALID_VALUE, "name" },
+    { "material { }\n}\n", sparse::unknown_fields::skip, SP_ERROR_INVALID_CHAR, "}" },
+  };
+
+  int failures = 0;
+
+  for (const error_test &test : tests) {
+    library lib;
+    sparse::decoder<library> decoder(lib, test.unknown);
+    std::error_code error = decoder.parse(test.src);
+    if (!error)
+      error = decoder.finish();
+
+    if (error != test.error || decoder.error_text() != test.error_text) {
+      std::fprintf(stderr, "Decoding \"%s\" gave %d at \"%.*s\"\n", test.src, error.value(),
+                   (int)decoder.error_text().size(), decoder.error_text().data());
+      ++failures;
+    }
+  }
+
+  // An allocation failing in a value is an error, not an exception thrown
+  // through the parser.
+  greedy_holder holder;
+  if (sparse::decode("value x\n", holder) != SP_ERROR_NO_MEM) {
+    std::fprintf(stderr, "Expected running out of memory in a value to fail with SP_ERROR_NO_MEM\n");
+    ++failures;
+  }
+
+  return failures;
+}
+
+static constexpr std::array<std::string_view, 60> many_names = { {
+  "map", "clamp_u", "clamp_v", "blend", "color", "scale", "rotate", "translate", "alpha_test", "depth_write",
+  "depth_func", "cull", "polygon_offset", "sort", "program", "vertex_program", "fragment_program", "texture",
+  "cube_map", "video_map", "anim_map", "tc_gen", "tc_mod", "rgb_gen", "alpha_gen", "mask_color", "mask_alpha",
+  "mask_depth", "ignore_alpha", "detail", "nopicmip", "nomipmaps", "clamp", "zero_clamp", "alpha_zero_clamp",
+  "forcehigh_quality", "uncompressed", "highquality", "private", "twosided", "translucent", "discrete",
+  "noshadows", "nooverlays", "noselfshadow", "forceshadows", "noportalfog", "nofragment", "spectrum",
+  "decal_macro", "sort_after", "guisurf", "lightfalloff_image", "deform", "fog_light", "blend_light",
+  "ambient_light", "qer_editorimage", "description", "surface_type",
+} };
+
+static constexpr auto many_hash = sparse::detail::make_perfect_hash(many_names);
+static_assert(many_hash.found, "No perfect hash for many names");
+static_assert(!sparse::detail::make_perfect_hash(std::array<std::string_view, 3>{ { "a", "b", "a" } }).found,
+              "Duplicate names hashed");
+
+static int check_perfect_hash()
+{
+  int failures = 0;
+
+  for (size_t index = 0; index < many_names.size(); ++index) {
+    const uint32_t hash = sparse::detail::name_hash(many_names[index]);
+    const uint16_t displacement = many_hash.displacements[sparse::detail::name_bucket(hash, many_hash.num_buckets)];
+    if (many_hash.slots[sparse::detail::name_slot(hash, displacement, many_hash.num_slots)] != index) {
+      std::fprintf(stderr, "%.*s isn't in its slot\n", (int)many_names[index].size(), many_names[index].data());
+      ++failures;
+    }
+  }
+
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  int failures = 0;
+
+  failures += check_decoding();
+  failures += check_errors();
+  failures += check_perfect_hash();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -1,12 +1,28 @@
 #include "sparse.hh"
 #include <iostream>
 #include <string>
+#include <unistd.h>
 
 static void handler(sparse_msg_t msg, const char *start, const char *end, void *context)
 {
   std::clog << "MSG " << msg << " [" << std::string(start, (size_t)(end - start)) << ']' << std::endl;
 }
 
+// Exposes the buffer a parser got, to check it came from the pool.
+class buffer_parser_t : public sparse_parser_t
+{
+public:
+  buffer_parser_t(sparse_fn_t callback, void *context) : sparse_parser_t(callback, context) {}
+  const char *buffer_address() const { return buffer; }
+  size_t capacity() const { return buffer_capacity; }
+};
+
+static void count_event(sparse_msg_t msg, const char *start, const char *end, void *context)
+{
+  (void)msg; (void)start; (void)end;
+  ++*(size_t *)context;
+}
+
 int main(int argc, char const *argv[])
 {
   std::string test_source =
@@ -47,5 +63,151 @@ int main(int argc, char const *argv[])
 
   parser.finish();
 
+  // The invalid character is still readable once the file's been read.
+  char bad_path[] = "/tmp/sparse_test_XXXXXX";
+  const int bad_fd = mkstemp(bad_path);
+  if (bad_fd == -1) {
+    std::clog << "Could not create a temporary file" << std::endl;
+    return 1;
+  }
+  static const char bad_file[] = "a {\n b c\n}\n}\n";
+  const bool bad_written = write(bad_fd, bad_file, sizeof(bad_file) - 1) == (ssize_t)(sizeof(bad_file) - 1);
+  close(bad_fd);
+  bool caught = false;
+  {
+    size_t num_bad_events = 0;
+    sparse_parser_t bad_parser(count_event, &num_bad_events);
+    try {
+      bad_parser.parse_file(bad_path);
+    } catch (sparse_invalid_char_error_t &ex) {
+      caught = ex.error_string() == "}" && ex.error_end() - ex.error_begin() == 1 && *ex.error_begin() == '}';
+    }
+  }
+  unlink(bad_path);
+  if (!bad_written || !caught) {
+    std::clog << "Invalid character in a file wasn't reported" << std::endl;
+    return 1;
+  }
+
+  sparse_tree_t tree;
+  tree.parse(test_source, SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+
+  const sparse_node_view_t map = tree.root().find("materials/base/fl_tile1").find("0").find("map");
+  if (!map.valid() || map.value_string() != "textures/base/fl_tile1.png") {
+    std::clog << "Tree lookup failed" << std::endl;
+    return 1;
+  }
+
+  // Typed values read straight from the tree.
+  sparse_tree_t settings;
+  settings.parse("width 1920; scale -0.75; vsync on; color 1 0.5 0.25 1; title fast; materials { }\n");
+  const sparse_node_view_t color = settings.root().find("color");
+  if (settings.root().find("width").int_value() != 1920 || settings.root().find("scale").double_value() != -0.75
+      || !settings.root().find("vsync").bool_value() || color.double_values().size() != 4 || color.double_values()[1] != 0.5) {
+    std::clog << "Typed values differ" << std::endl;
+    return 1;
+  }
+
+  const char *const not_numbers[] = { "title", "materials", "color" };
+  for (size_t index = 0; index < sizeof(not_numbers) / sizeof(not_numbers[0]); ++index) {
+    try {
+      settings.root().find(not_numbers[index]).int_value();
+      std::clog << "Reading " << not_numbers[index] << " as an integer didn't throw" << std::endl;
+      return 1;
+    } catch (sparse_invalid_value_error_t &) {
+    }
+  }
+
+  // Names interned into a shared table can be looked up by symbol.
+  sparse_symbols_t symbols;
+  sparse_symbols_init(&symbols);
+  {
+    sparse_tree_t interned(&symbols);
+    interned.parse(test_source, SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+    const uint32_t map_symbol = sparse_symbols_find(&symbols, "map", 3);
+    const sparse_node_view_t interned_map = interned.root().find("materials/base/fl_tile1").find("0").find(map_symbol);
+    if (map_symbol == SP_NO_SYMBOL || interned_map.symbol() != map_symbol
+        || interned_map.value_string() != "textures/base/fl_tile1.png") {
+      std::clog << "Interned lookup failed" << std::endl;
+      return 1;
+    }
+  }
+  sparse_symbols_free(&symbols);
+
+  for (sparse_node_view_t field = tree.root().first_child(); field.valid(); field = field.next_sibling())
+    std::clog << "ROOT [" << field.name_string() << "] " << (field.is_node() ? "{...}" : field.value_string()) << std::endl;
+
+  // Pull just the root names, skipping every node's contents.
+  sparse_reader_t reader(test_source.data(), test_source.data() + test_source.size(),
+                         SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+  for (sparse_event_t event = reader.next(); event.msg != SP_END_DOCUMENT; event = reader.next()) {
+    if (event.msg == SP_NAME)
+      std::clog << "READ [" << std::string(event.begin, event.end) << ']' << std::endl;
+    else if (event.msg == SP_BEGIN_NODE)
+      reader.skip_node();
+  }
+
+  // Copy the document through a writer and check it still parses the same.
+  sparse_writer_t writer;
+  {
+    sparse_parser_t copier(sparse_writer_fn, writer.state(), SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+    copier.parse(test_source);
+    copier.finish();
+  }
+  writer.field("escaped", "{ value }; # ");
+  writer.finish();
+
+  sparse_tree_t copy;
+  copy.parse(writer.str(), SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES);
+  if (copy.root().find("materials/base/fl_tile1").find("0").find("map").value_string() != "textures/base/fl_tile1.png" ||
+      copy.root().find("escaped").value_string() != "{ value }; # ") {
+    std::clog << "Written document differs:" << std::endl << writer.str() << std::endl;
+    return 1;
+  }
+
+  // A parser on the same thread reuses the last one's grown buffer.
+  const std::string long_value = "name " + std::string(4096, 'v') + "\\ \n";
+  size_t num_events = 0;
+  const char *warm_buffer;
+  size_t warm_capacity;
+  {
+    buffer_parser_t first(count_event, &num_events);
+    first.parse(long_value);
+    first.finish();
+  }
+  {
+    buffer_parser_t second(count_event, &num_events);
+    warm_buffer = second.buffer_address();
+    warm_capacity = second.capacity();
+    second.parse("width 800; height 600\n");
+  }
+  // Statistics only cover what the parser parsed, not its pooled state.
+  {
+    size_t num_counted = 0;
+    sparse_parser_t counted(count_event, &num_counted);
+    counted.parse("width 800; height 600\n");
+    counted.finish();
+    const sparse_stats_t stats = counted.stats();
+#ifdef SP_STATS
+    const size_t expected_names = 2, expected_runs = 1;
+#else
+    const size_t expected_names = 0, expected_runs = 0;
+#endif
+    if (stats.msg_counts[SP_NAME + 1] != expected_names || stats.runs != expected_runs) {
+      std::clog << "Parser statistics were wrong" << std::endl;
+      return 1;
+    }
+    counted.reset_stats();
+    if (counted.stats().msg_counts[SP_NAME + 1] != 0) {
+      std::clog << "Parser statistics weren't reset" << std::endl;
+      return 1;
+    }
+  }
+  buffer_parser_t third(count_event, &num_events);
+  if (third.buffer_address() != warm_buffer || warm_capacity < 4096 || num_events != 6) {
+    std::clog << "Parsers didn't reuse a pooled buffer" << std::endl;
+    return 1;
+  }
+
   return 0;
-}
\ No newline at end of file
+}
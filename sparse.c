@@ -1,9 +1,21 @@
+#if defined(SP_STATS) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #include "sparse.h"
+#include "sparse_internal.h"
 #include <stdlib.h>
 #include <string.h>
 #ifdef __BLOCKS__
 #include <block.h>
 #endif
+#ifdef SP_STATS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,33 +25,108 @@ static const char *sp_empty_str = "";
 static const char *sp_errstr_no_mem = "Could not allocate memory for sparse buffer.";
 static const char *sp_errstr_incomplete_doc = "Document is incomplete.";
 
+/* Every byte value, at its own index, so an invalid char error can outlive
+   the input it was found in (see sp_detach_error). */
+static const char sp_every_char[] =
+  "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A\x0B\x0C\x0D\x0E\x0F"
+  "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1A\x1B\x1C\x1D\x1E\x1F"
+  "\x20\x21\x22\x23\x24\x25\x26\x27\x28\x29\x2A\x2B\x2C\x2D\x2E\x2F"
+  "\x30\x31\x32\x33\x34\x35\x36\x37\x38\x39\x3A\x3B\x3C\x3D\x3E\x3F"
+  "\x40\x41\x42\x43\x44\x45\x46\x47\x48\x49\x4A\x4B\x4C\x4D\x4E\x4F"
+  "\x50\x51\x52\x53\x54\x55\x56\x57\x58\x59\x5A\x5B\x5C\x5D\x5E\x5F"
+  "\x60\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6A\x6B\x6C\x6D\x6E\x6F"
+  "\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7A\x7B\x7C\x7D\x7E\x7F"
+  "\x80\x81\x82\x83\x84\x85\x86\x87\x88\x89\x8A\x8B\x8C\x8D\x8E\x8F"
+  "\x90\x91\x92\x93\x94\x95\x96\x97\x98\x99\x9A\x9B\x9C\x9D\x9E\x9F"
+  "\xA0\xA1\xA2\xA3\xA4\xA5\xA6\xA7\xA8\xA9\xAA\xAB\xAC\xAD\xAE\xAF"
+  "\xB0\xB1\xB2\xB3\xB4\xB5\xB6\xB7\xB8\xB9\xBA\xBB\xBC\xBD\xBE\xBF"
+  "\xC0\xC1\xC2\xC3\xC4\xC5\xC6\xC7\xC8\xC9\xCA\xCB\xCC\xCD\xCE\xCF"
+  "\xD0\xD1\xD2\xD3\xD4\xD5\xD6\xD7\xD8\xD9\xDA\xDB\xDC\xDD\xDE\xDF"
+  "\xE0\xE1\xE2\xE3\xE4\xE5\xE6\xE7\xE8\xE9\xEA\xEB\xEC\xED\xEE\xEF"
+  "\xF0\xF1\xF2\xF3\xF4\xF5\xF6\xF7\xF8\xF9\xFA\xFB\xFC\xFD\xFE\xFF";
+
+/* Record offsets and lengths are 32 bits. */
+#define SP_BATCH_MAX_DATA ((size_t)UINT32_MAX)
+
+/* Stores an event in the state's event array (see sparse_reader.c) and halts
+   sparse_run_partial once the current char is done. */
+#define SP_STORE_EVENT(MSG, BEGIN, END) {               \
+    sparse_event_t *const event_ = &events[state->num_events++]; \
+    event_->msg = (MSG);                                \
+    event_->begin = (BEGIN);                            \
+    event_->end = (END);                                \
+    state->halt = 1;                                    \
+  }
+
+/* Statistics (see sparse_stats_t). Bytes are counted once per trip through
+   sparse_run's loop, under the mode the parser is in once the char (or run
+   of chars) is done. */
+#ifdef SP_STATS
+#define SP_STATS_COUNT_MSG(MSG) (++state->stats.msg_counts[(MSG) + 1])
+#define SP_STATS_TIME_CALLBACK(CALL) {                  \
+    const uint64_t stats_begin_ = sp_stats_now();       \
+    CALL;                                               \
+    state->stats.callback_ns += sp_stats_now() - stats_begin_; \
+  }
+#define SP_STATS_COUNT_REALLOC(CAPACITY)                \
+  (++state->stats.buffer_reallocs,                      \
+   (state->stats.peak_buffer_capacity < (CAPACITY)      \
+    ? (state->stats.peak_buffer_capacity = (CAPACITY)) : 0))
+#define SP_STATS_COUNT_DEPTH() {                        \
+    if (state->stats.max_depth < depth)                 \
+      state->stats.max_depth = depth;                   \
+  }
+#define SP_STATS_COUNT_ESCAPE() (++state->stats.escapes)
+#define SP_STATS_BEGIN_CHAR() (stats_char = src_iter)
+#define SP_STATS_COUNT_CHARS(MODE) {                    \
+    state->stats.mode_bytes[(MODE)] += (uint64_t)(src_iter - stats_char); \
+    stats_char = src_iter;                              \
+  }
+#define SP_STATS_END_CHAR() (state->stats.mode_bytes[mode] += (uint64_t)(src_iter + 1 - stats_char))
+#else
+#define SP_STATS_COUNT_MSG(MSG) ((void)0)
+#define SP_STATS_TIME_CALLBACK(CALL) { CALL; }
+#define SP_STATS_COUNT_REALLOC(CAPACITY) ((void)0)
+#define SP_STATS_COUNT_DEPTH() ((void)0)
+#define SP_STATS_COUNT_ESCAPE() ((void)0)
+#define SP_STATS_BEGIN_CHAR() ((void)0)
+#define SP_STATS_COUNT_CHARS(MODE) ((void)0)
+#define SP_STATS_END_CHAR() ((void)0)
+#endif
+
 #ifdef __BLOCKS__
-#define SP_HAS_CALLBACK() (callback != NULL || block != NULL)
+#define SP_HAS_CALLBACK() (callback != NULL || block != NULL || events != NULL || batch != NULL)
 #define SP_SEND_MSG(MSG, BEGIN, END) {                  \
-    if (block != NULL) {                                \
-      block((MSG), (BEGIN), (END));                     \
+    SP_STATS_COUNT_MSG(MSG);                            \
+    if (events != NULL) {                               \
+      SP_STORE_EVENT((MSG), (BEGIN), (END));            \
+    } else if (batch != NULL) {                         \
+      sp_batch_add(state, batch, (MSG), (BEGIN), (END)); \
+    } else if (block != NULL) {                         \
+      SP_STATS_TIME_CALLBACK(block((MSG), (BEGIN), (END))); \
     } else if (callback != NULL) {                      \
-      callback((MSG), (BEGIN), (END), context);         \
+      SP_STATS_TIME_CALLBACK(callback((MSG), (BEGIN), (END), context)); \
     }                                                   \
   }
 #else
-#define SP_HAS_CALLBACK() (callback != NULL)
+#define SP_HAS_CALLBACK() (callback != NULL || events != NULL || batch != NULL)
 #define SP_SEND_MSG(MSG, BEGIN, END)  {                 \
-    if (callback != NULL) {                             \
-      callback((MSG), (BEGIN), (END), context);         \
+    SP_STATS_COUNT_MSG(MSG);                            \
+    if (events != NULL) {                               \
+      SP_STORE_EVENT((MSG), (BEGIN), (END));            \
+    } else if (batch != NULL) {                         \
+      sp_batch_add(state, batch, (MSG), (BEGIN), (END)); \
+    } else if (callback != NULL) {                      \
+      SP_STATS_TIME_CALLBACK(callback((MSG), (BEGIN), (END), context)); \
     }                                                   \
   }
 #endif
 
 #define SP_CHECK_FLAG(FLAGS, FLAG) (((FLAGS)&(FLAG)) == (FLAG))
-#define SP_ENSURE_BUFFER_SIZED(BUFFER, CURRENT, NEEDED) \
-  ((CURRENT) < (NEEDED)                                 \
-   ? (CURRENT = (CURRENT) * 2),                         \
-     (((CURRENT) < (NEEDED)                             \
-      ? (CURRENT = (NEEDED))                            \
-      : 0)),                                            \
-     (BUFFER = realloc(BUFFER, CURRENT))                \
-   : BUFFER)
+/* Grows the buffer to hold NEEDED chars, leaving the old one in place if it
+   can't. Only calls out when it has to grow. */
+#define SP_ENSURE_BUFFER_SIZED(NEEDED)                  \
+  (buffer_capacity >= (NEEDED) || sp_ensure_buffer(state, &buffer, &buffer_capacity, (NEEDED)))
 #define SP_RETURN_ERROR(ERRNAME, START, END) {          \
     state->error_begin = (START);                       \
     state->error_end = (END);                           \
@@ -50,8 +137,322 @@ static const char *sp_errstr_incomplete_doc = "Document is incomplete.";
     goto sparse_exit;                                   \
   }
 #define SP_ERRSTR_END(NAME) (NAME) + strlen((NAME))
+/* Sends the current name or value, either from the source string or the
+   buffer, and resets both for the next one. */
+#define SP_SEND_TOKEN(MSG) {                            \
+    if (span_begin != NULL) {                           \
+      SP_SEND_MSG((MSG), span_begin, src_iter - num_spaces_trailing); \
+      span_begin = NULL;                                \
+    } else {                                            \
+      SP_SEND_MSG((MSG), buffer, buffer + buffer_size - num_spaces_trailing); \
+    }                                                   \
+    buffer_size = 0;                                    \
+  }
+/* Copies a token being passed from the source string into the buffer, used
+   when the token is about to stop matching the source (or leave the chunk). */
+#define SP_SPILL_SPAN() {                               \
+    if (span_begin != NULL) {                           \
+      const size_t span_length = (size_t)(src_iter - span_begin); \
+      if (!SP_ENSURE_BUFFER_SIZED(span_length))         \
+        SP_RETURN_ERROR(SP_ERROR_NO_MEM, sp_errstr_no_mem, SP_ERRSTR_END(sp_errstr_no_mem)); \
+      memcpy(buffer, span_begin, span_length);          \
+      buffer_size = span_length;                        \
+      span_begin = NULL;                                \
+    }                                                   \
+  }
+/* Adds the char to the current token, either by starting a span over the
+   source string or by copying it into the buffer, then takes everything up to
+   the next structural char or whitespace along with it. */
+#define SP_BUFFER_TOKEN_CHAR() {                        \
+    if (SP_HAS_CALLBACK() && span_begin == NULL) {      \
+      if (zero_copy && buffer_size == 0 && *src_iter == (char)current_char) { \
+        span_begin = src_iter;                          \
+      } else {                                          \
+        if (!SP_ENSURE_BUFFER_SIZED(buffer_size + 1))   \
+          SP_RETURN_ERROR(SP_ERROR_NO_MEM, sp_errstr_no_mem, SP_ERRSTR_END(sp_errstr_no_mem)); \
+        buffer[buffer_size++] = (char)current_char;     \
+      }                                                 \
+    }                                                   \
+    run_end = sp_scan_structural(src_iter + 1, src_end); \
+    if (run_end - src_iter > 1) {                       \
+      const size_t run_length = (size_t)(run_end - src_iter) - 1; \
+      if (SP_HAS_CALLBACK() && span_begin == NULL) {    \
+        if (!SP_ENSURE_BUFFER_SIZED(buffer_size + run_length)) \
+          SP_RETURN_ERROR(SP_ERROR_NO_MEM, sp_errstr_no_mem, SP_ERRSTR_END(sp_errstr_no_mem)); \
+        memcpy(buffer + buffer_size, src_iter + 1, run_length); \
+        buffer_size += run_length;                      \
+      }                                                 \
+      num_spaces_trailing = 0;                          \
+      src_iter = run_end - 1;                           \
+      last_char = (int)src_iter[-1];                    \
+      current_char = (int)*src_iter;                    \
+    }                                                   \
+  }
+
+/*
+  sparse_run is a table-driven state machine. Each char is given a class, and
+  the parser's mode and the class pick a transition: the token to send first,
+  if any, what to do with the char, and the mode to go to. Classes cover
+  exactly the chars sp_scan_structural stops on, so runs of SP_CLASS_OTHER are
+  taken in bulk.
+*/
+typedef enum {
+  SP_CLASS_OTHER,
+  SP_CLASS_SPACE,
+  /* A space or tab after the same char, which SP_CONSUME_WHITESPACE drops. */
+  SP_CLASS_REPEATED_SPACE,
+  SP_CLASS_OPEN,
+  SP_CLASS_CLOSE,
+  SP_CLASS_END,
+  SP_CLASS_COMMENT,
+  SP_CLASS_ESCAPE,
+  SP_NUM_CLASSES
+} sp_char_class_t;
+
+static const unsigned char sp_char_classes[256] = {
+  ['\t'] = SP_CLASS_SPACE, [' '] = SP_CLASS_SPACE,
+  ['{'] = SP_CLASS_OPEN, ['}'] = SP_CLASS_CLOSE,
+  [';'] = SP_CLASS_END, ['\n'] = SP_CLASS_END,
+  ['#'] = SP_CLASS_COMMENT, ['\\'] = SP_CLASS_ESCAPE
+};
+
+typedef enum {
+  SP_ACT_NONE,
+  /* A space or tab dropped by SP_CONSUME_WHITESPACE, along with any more of
+     the same char that follow it. */
+  SP_ACT_SKIP,
+  /* Whitespace between tokens, skipped along with any that follows it. */
+  SP_ACT_SKIP_SPACES,
+  SP_ACT_BUFFER,
+  /* Buffer a space or tab, which is trimmed if it turns out to be trailing. */
+  SP_ACT_BUFFER_SPACE,
+  SP_ACT_EMPTY_VALUE,
+  SP_ACT_OPEN,
+  SP_ACT_OPEN_NAMELESS,
+  /* Nameless only at depth 0 (SP_NAMELESS_ROOT_NODES). */
+  SP_ACT_OPEN_NAMELESS_ROOT,
+  SP_ACT_CLOSE,
+  SP_ACT_ESCAPE,
+  SP_ACT_INVALID
+} sp_action_t;
+
+typedef struct s_sp_transition {
+  unsigned char send; /* SP_NAME or SP_VALUE to send the current token, or 0 */
+  unsigned char action;
+  unsigned char mode;
+} sp_transition_t;
+
+#define SP_TRANSITION(SEND, ACTION, MODE) { (SEND), (ACTION), (MODE) }
+
+/* Comments never reach the table, so it only has the first four modes. One
+   table for each way of handling nameless nodes, which is all the options
+   change: OPEN_NAMELESS is what a brace does where a name's expected. */
+#define SP_TRANSITION_TABLE(OPEN_NAMELESS) {                                  \
+    { /* SP_FIND_NAME */                                                      \
+      SP_TRANSITION(0, SP_ACT_BUFFER, SP_READ_NAME),                          \
+      SP_TRANSITION(0, SP_ACT_SKIP_SPACES, SP_FIND_NAME),                     \
+      SP_TRANSITION(0, SP_ACT_SKIP_SPACES, SP_FIND_NAME),                     \
+      SP_TRANSITION(0, (OPEN_NAMELESS), SP_FIND_NAME),                        \
+      SP_TRANSITION(0, SP_ACT_CLOSE, SP_FIND_NAME),                           \
+      SP_TRANSITION(0, SP_ACT_NONE, SP_FIND_NAME),                            \
+      SP_TRANSITION(0, SP_ACT_NONE, SP_READ_COMMENT),                         \
+      SP_TRANSITION(0, SP_ACT_ESCAPE, SP_FIND_NAME)                           \
+    },                                                                        \
+    { /* SP_READ_NAME */                                                      \
+      SP_TRANSITION(0, SP_ACT_BUFFER, SP_READ_NAME),                          \
+      SP_TRANSITION(SP_NAME, SP_ACT_NONE, SP_FIND_VALUE),                     \
+      SP_TRANSITION(0, SP_ACT_SKIP, SP_READ_NAME),                            \
+      SP_TRANSITION(SP_NAME, SP_ACT_OPEN, SP_FIND_NAME),                      \
+      SP_TRANSITION(0, SP_ACT_INVALID, SP_READ_NAME),                         \
+      SP_TRANSITION(SP_NAME, SP_ACT_EMPTY_VALUE, SP_FIND_NAME),               \
+      SP_TRANSITION(SP_NAME, SP_ACT_EMPTY_VALUE, SP_READ_COMMENT),            \
+      SP_TRANSITION(0, SP_ACT_ESCAPE, SP_READ_NAME)                           \
+    },                                                                        \
+    { /* SP_FIND_VALUE */                                                     \
+      SP_TRANSITION(0, SP_ACT_BUFFER, SP_READ_VALUE),                         \
+      SP_TRANSITION(0, SP_ACT_SKIP_SPACES, SP_FIND_VALUE),                    \
+      SP_TRANSITION(0, SP_ACT_SKIP_SPACES, SP_FIND_VALUE),                    \
+      SP_TRANSITION(0, SP_ACT_OPEN, SP_FIND_NAME),                            \
+      SP_TRANSITION(0, SP_ACT_INVALID, SP_FIND_VALUE),                        \
+      SP_TRANSITION(0, SP_ACT_EMPTY_VALUE, SP_FIND_NAME),                     \
+      SP_TRANSITION(0, SP_ACT_EMPTY_VALUE, SP_READ_COMMENT),                  \
+      SP_TRANSITION(0, SP_ACT_ESCAPE, SP_FIND_VALUE)                          \
+    },                                                                        \
+    { /* SP_READ_VALUE */                                                     \
+      SP_TRANSITION(0, SP_ACT_BUFFER, SP_READ_VALUE),                         \
+      SP_TRANSITION(0, SP_ACT_BUFFER_SPACE, SP_READ_VALUE),                   \
+      SP_TRANSITION(0, SP_ACT_SKIP, SP_READ_VALUE),                           \
+      SP_TRANSITION(SP_VALUE, (OPEN_NAMELESS), SP_FIND_NAME),                 \
+      SP_TRANSITION(SP_VALUE, SP_ACT_CLOSE, SP_FIND_NAME),                    \
+      SP_TRANSITION(SP_VALUE, SP_ACT_NONE, SP_FIND_NAME),                     \
+      SP_TRANSITION(SP_VALUE, SP_ACT_NONE, SP_READ_COMMENT),                  \
+      SP_TRANSITION(0, SP_ACT_ESCAPE, SP_READ_VALUE)                          \
+    }                                                                         \
+  }
+
+static const sp_transition_t sp_transitions[3][SP_READ_COMMENT][SP_NUM_CLASSES] = {
+  SP_TRANSITION_TABLE(SP_ACT_INVALID),
+  SP_TRANSITION_TABLE(SP_ACT_OPEN_NAMELESS_ROOT),
+  SP_TRANSITION_TABLE(SP_ACT_OPEN_NAMELESS)
+};
+
+#undef SP_TRANSITION_TABLE
+#undef SP_TRANSITION
+
+static void *sp_alloc(const sparse_state_t *state, size_t size)
+{
+  const sparse_allocator_t *const allocator = state->allocator;
+  return allocator != NULL ? allocator->alloc(size, allocator->user) : malloc(size);
+}
+
+static void *sp_realloc(const sparse_state_t *state, void *block, size_t size)
+{
+  const sparse_allocator_t *const allocator = state->allocator;
+  return allocator != NULL ? allocator->realloc(block, size, allocator->user) : realloc(block, size);
+}
+
+static void sp_free(const sparse_state_t *state, void *block)
+{
+  const sparse_allocator_t *const allocator = state->allocator;
+  if (block == NULL)
+    return;
+  if (allocator != NULL)
+    allocator->free(block, allocator->user);
+  else
+    free(block);
+}
+
+/* Grows *buffer to at least needed chars, doubling it where that's enough.
+   Returns 0 and leaves *buffer and *capacity as they were if it can't. */
+static int sp_ensure_buffer(sparse_state_t *state, char **buffer, size_t *capacity, size_t needed)
+{
+  size_t new_capacity = *capacity * 2;
+  char *resized;
+
+  if (*capacity >= needed)
+    return 1;
+  if (new_capacity < needed)
+    new_capacity = needed;
+
+  resized = (char *)sp_realloc(state, *buffer, new_capacity);
+  if (resized == NULL)
+    return 0;
+
+  SP_STATS_COUNT_REALLOC(new_capacity);
+  *buffer = resized;
+  *capacity = new_capacity;
+  return 1;
+}
+
+#ifdef SP_STATS
+static uint64_t sp_stats_now(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+#endif
+}
+#endif
+
+/* Hands the batch's records to its callback and empties it. */
+static void sp_batch_flush(sparse_state_t *state, sparse_batch_t *batch)
+{
+  (void)state;
+  if (batch->num_records > 0)
+    SP_STATS_TIME_CALLBACK(batch->callback(batch->records, batch->num_records,
+                                           batch->data != NULL ? batch->data : sp_empty_str, batch->context));
+
+  batch->num_records = 0;
+  batch->data_size = 0;
+}
+
+static void sp_batch_add(sparse_state_t *state, sparse_batch_t *batch, sparse_msg_t msg, const char *begin, const char *end)
+{
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  sparse_record_t *record;
+
+  if (batch->error != SP_NO_ERROR)
+    return;
+
+  /* With nowhere to keep records, each event is a batch of its own, pointing
+     straight at its string. */
+  if (batch->capacity == 0) {
+    sparse_record_t single;
+    if (length > SP_BATCH_MAX_DATA) {
+      batch->error = SP_ERROR_NO_MEM;
+      return;
+    }
+    single.msg = msg;
+    single.offset = 0;
+    single.length = (uint32_t)length;
+    SP_STATS_TIME_CALLBACK(batch->callback(&single, 1, begin != NULL ? begin : sp_empty_str, batch->context));
+    return;
+  }
+
+  if (batch->num_records == batch->capacity || SP_BATCH_MAX_DATA - batch->data_size < length)
+    sp_batch_flush(state, batch);
+
+  if (batch->data_capacity - batch->data_size < length) {
+    size_t capacity = batch->data_capacity * 2;
+    char *data;
+
+    if (capacity < batch->data_size + length)
+      capacity = batch->data_size + length;
+
+    data = length > SP_BATCH_MAX_DATA ? NULL : (char *)sp_realloc(state, batch->data, capacity);
+    if (data == NULL) {
+      batch->error = SP_ERROR_NO_MEM;
+      return;
+    }
+
+    batch->data = data;
+    batch->data_capacity = capacity;
+  }
+
+  if (length > 0)
+    memcpy(batch->data + batch->data_size, begin, length);
+
+  record = &batch->records[batch->num_records++];
+  record->msg = msg;
+  record->offset = (uint32_t)batch->data_size;
+  record->length = (uint32_t)length;
+  batch->data_size += length;
+}
+
+/* Flushes the batch, if any, at the end of sparse_run or sparse_end and
+   returns any error it ran into. */
+static sparse_error_t sp_batch_finish(sparse_state_t *state, sparse_error_t error)
+{
+  sparse_batch_t *const batch = state->batch;
+
+  if (batch == NULL)
+    return error;
+
+  sp_batch_flush(state, batch);
+
+  if (error == SP_NO_ERROR && batch->error != SP_NO_ERROR) {
+    error = batch->error;
+    state->error_begin = sp_errstr_no_mem;
+    state->error_end = SP_ERRSTR_END(sp_errstr_no_mem);
+  }
+
+  return error;
+}
 
 sparse_error_t sparse_begin(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_fn_t callback, void *context)
+{
+  return sparse_begin_with_allocator(state, initial_buffer_capacity, options, callback, context, NULL);
+}
+
+sparse_error_t sparse_begin_with_allocator(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                           sparse_fn_t callback, void *context, const sparse_allocator_t *allocator)
 {
   char *buffer = NULL;
 
@@ -61,11 +462,12 @@ sparse_error_t sparse_begin(sparse_state_t *state, size_t initial_buffer_capacit
   state->mode = SP_FIND_NAME;
   state->callback = callback;
   state->context = context;
+  state->allocator = allocator;
 
   if (initial_buffer_capacity == 0)
     initial_buffer_capacity = SP_DEFAULT_BUFFER_CAPACITY;
 
-  buffer = calloc(initial_buffer_capacity, sizeof(*buffer));
+  buffer = (char *)sp_alloc(state, initial_buffer_capacity);
 
   if (buffer == NULL) {
     state->error_begin = sp_errstr_no_mem;
@@ -75,10 +477,31 @@ sparse_error_t sparse_begin(sparse_state_t *state, size_t initial_buffer_capacit
 
   state->buffer = buffer;
   state->buffer_capacity = initial_buffer_capacity;
+#ifdef SP_STATS
+  state->stats.peak_buffer_capacity = initial_buffer_capacity;
+#endif
 
   return SP_NO_ERROR;
 }
 
+sparse_error_t sparse_begin_batched(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                    sparse_batch_t *batch, sparse_record_t *records, size_t capacity,
+                                    sparse_batch_fn_t callback, void *context)
+{
+  const sparse_error_t error = sparse_begin(state, initial_buffer_capacity, (sparse_options_t)(options | SP_ZERO_COPY), NULL, NULL);
+
+  if (error == SP_NO_ERROR) {
+    memset(batch, 0, sizeof(*batch));
+    batch->records = records;
+    batch->capacity = capacity;
+    batch->callback = callback;
+    batch->context = context;
+    state->batch = batch;
+  }
+
+  return error;
+}
+
 #ifdef __BLOCKS__
 sparse_error_t sparse_begin_using_block(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_block_t block)
 {
@@ -96,12 +519,17 @@ sparse_error_t sparse_begin_using_block(sparse_state_t *state, size_t initial_bu
 }
 #endif
 
-sparse_error_t sparse_end(sparse_state_t *state)
+sparse_error_t sp_end_document(sparse_state_t *state)
 {
   sparse_error_t error = SP_NO_ERROR;
+#ifdef SP_STATS
+  const uint64_t stats_begin = sp_stats_now();
+#endif
 
   sparse_fn_t callback = state->callback;
   void *context = state->context;
+  sparse_event_t *const events = state->events;
+  sparse_batch_t *const batch = state->batch;
 #ifdef __BLOCKS__
   sparse_block_t block = state->block;
 #endif
@@ -122,13 +550,39 @@ sparse_error_t sparse_end(sparse_state_t *state)
     state->error_end = SP_ERRSTR_END(sp_errstr_incomplete_doc);
   }
 
+  error = sp_batch_finish(state, error);
+
+#ifdef SP_STATS
+  state->stats.run_ns += sp_stats_now() - stats_begin;
+#endif
+
+  state->buffer_size = 0;
+  state->num_spaces_trailing = 0;
+  state->depth = 0;
+  state->mode = SP_FIND_NAME;
+  state->in_escape = 0;
+  state->last_char = 0;
+  state->halt = 0;
+
+  return error;
+}
+
+sparse_error_t sparse_end(sparse_state_t *state)
+{
+  const sparse_error_t error = sp_end_document(state);
+
 #ifdef __BLOCKS__
   if (state->block != NULL)
     Block_release(state->block);
 #endif
 
-  if (state->buffer != NULL)
-    free(state->buffer);
+  sp_free(state, state->buffer);
+
+  if (state->batch != NULL) {
+    sp_free(state, state->batch->data);
+    state->batch->data = NULL;
+    state->batch->data_capacity = 0;
+  }
 
   if (error != SP_NO_ERROR)
     memset(state, 0, sizeof(*state));
@@ -136,7 +590,155 @@ sparse_error_t sparse_end(sparse_state_t *state)
   return error;
 }
 
+sparse_error_t sparse_reset(sparse_state_t *state, sparse_options_t options, sparse_fn_t callback, void *context)
+{
+  const sparse_error_t error = sp_end_document(state);
+
+#ifdef __BLOCKS__
+  if (state->block != NULL)
+    Block_release(state->block);
+  state->block = NULL;
+#endif
+
+  if (state->batch != NULL) {
+    sp_free(state, state->batch->data);
+    state->batch->data = NULL;
+    state->batch->data_capacity = 0;
+    state->batch = NULL;
+  }
+
+  state->options = options;
+  state->callback = callback;
+  state->context = context;
+  state->events = NULL;
+  state->num_events = 0;
+
+  return error;
+}
+
+void sp_send_error(sparse_state_t *state, const char *error_begin, const char *error_end)
+{
+  sparse_fn_t callback = state->callback;
+  void *context = state->context;
+  sparse_event_t *const events = state->events;
+  sparse_batch_t *const batch = state->batch;
+#ifdef __BLOCKS__
+  sparse_block_t block = state->block;
+#endif
+
+  state->error_begin = error_begin;
+  state->error_end = error_end;
+  SP_SEND_MSG(SP_ERROR, error_begin, error_end);
+}
+
+void sp_detach_error(sparse_state_t *state, const char *begin, const char *end)
+{
+  if (state->error_begin == NULL || state->error_begin < begin || state->error_begin >= end)
+    return;
+
+  /* Only invalid chars point into the input, one char each. */
+  state->error_begin = &sp_every_char[(unsigned char)*state->error_begin];
+  state->error_end = state->error_begin + 1;
+}
+
+void sparse_halt(sparse_state_t *state)
+{
+  state->halt = 1;
+}
+
+int sparse_get_stats(const sparse_state_t *state, sparse_stats_t *stats)
+{
+#ifdef SP_STATS
+  *stats = state->stats;
+  return 1;
+#else
+  (void)state;
+  memset(stats, 0, sizeof(*stats));
+  return 0;
+#endif
+}
+
+void sparse_reset_stats(sparse_state_t *state)
+{
+#ifdef SP_STATS
+  memset(&state->stats, 0, sizeof(state->stats));
+  state->stats.peak_buffer_capacity = state->buffer_capacity;
+#else
+  (void)state;
+#endif
+}
+
+void sp_skip_begin(sparse_state_t *state, size_t *skip_depth)
+{
+  *skip_depth = 1;
+  state->buffer_size = 0;
+  state->num_spaces_trailing = 0;
+  if (state->mode != SP_READ_COMMENT)
+    state->mode = SP_FIND_NAME;
+}
+
+/* Comments and escapes are tracked in the state the same way sparse_run
+   tracks them so skipping can continue across inputs. */
+const char *sp_skip_node(sparse_state_t *state, size_t *skip_depth, const char *src_iter, const char *src_end)
+{
+  while (src_iter != src_end && *skip_depth > 0) {
+    if (state->mode == SP_READ_COMMENT) {
+      src_iter = sp_scan_newline(src_iter, src_end);
+      if (src_iter != src_end) {
+        state->mode = SP_FIND_NAME;
+        ++src_iter;
+      }
+      continue;
+    } else if (state->in_escape) {
+      state->in_escape = 0;
+      ++src_iter;
+      continue;
+    }
+
+    src_iter = sp_scan_braces(src_iter, src_end);
+    if (src_iter == src_end)
+      break;
+
+    switch (*src_iter) {
+    case '\\': state->in_escape = 1; break;
+    case '#': state->mode = SP_READ_COMMENT; break;
+    case '{': ++*skip_depth; break;
+    case '}': --*skip_depth; break;
+    default: break;
+    }
+
+    ++src_iter;
+  }
+
+  if (*skip_depth == 0) {
+    --state->depth;
+    state->last_char = '}';
+  }
+
+  return src_iter;
+}
+
+/* The char an escape sequence stands for. Anything else stands for itself. */
+static int sp_unescape(int escaped_char)
+{
+  switch (escaped_char) {
+  case 'n': return '\n';
+  case 'r': return '\r';
+  case 'a': return '\a';
+  case 'b': return '\b';
+  case 'f': return '\f';
+  case 't': return '\t';
+  case '0': return '\0';
+  default: return escaped_char;
+  }
+}
+
 sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, const char *src_end)
+{
+  return sparse_run_partial(state, src_begin, src_end, NULL);
+}
+
+sparse_error_t sparse_run_partial(sparse_state_t *state, const char *const src_begin, const char *src_end, const char **src_stop)
 {
   sparse_error_t error = SP_NO_ERROR;
 
@@ -145,8 +747,13 @@ sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, co
   const int trim_spaces = SP_CHECK_FLAG(options, SP_TRIM_TRAILING_SPACES);
   const int nameless_nodes = SP_CHECK_FLAG(options, SP_NAMELESS_NODES);
   const int nameless_roots = nameless_nodes || SP_CHECK_FLAG(options, SP_NAMELESS_ROOT_NODES);
+  const int zero_copy = SP_CHECK_FLAG(options, SP_ZERO_COPY);
 
   const char *src_iter = src_begin;
+  const char *run_end = NULL;
+  /* Start of the current token in the source string if it's being passed
+     without a copy (SP_ZERO_COPY), otherwise NULL and the token is in buffer. */
+  const char *span_begin = NULL;
 
   size_t buffer_capacity = state->buffer_capacity;
   size_t buffer_size = state->buffer_size;
@@ -160,20 +767,47 @@ sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, co
   int in_escape = state->in_escape;
 
   sparse_mode_t mode = state->mode;
+  const sp_transition_t (*const transitions)[SP_NUM_CLASSES] =
+    sp_transitions[nameless_nodes ? 2 : nameless_roots ? 1 : 0];
+  const sp_transition_t *transition;
+  int char_class;
 
   sparse_fn_t callback = state->callback;
   void *context = state->context;
+  sparse_event_t *const events = state->events;
+  sparse_batch_t *const batch = state->batch;
 #if __BLOCKS__
   sparse_block_t block = state->block;
 #endif
 
   size_t depth = state->depth;
 
+#ifdef SP_STATS
+  const uint64_t stats_begin = sp_stats_now();
+  const char *stats_char = src_iter;
+#endif
+
   /* If no end provided, try to guess where the end is */
   if (src_end == NULL)
     src_end = src_begin + strlen(src_begin);
 
-  for (; src_iter != src_end; ++src_iter) {
+  for (; src_iter != src_end; SP_STATS_END_CHAR(), ++src_iter) {
+    SP_STATS_BEGIN_CHAR();
+
+    if (mode == SP_READ_COMMENT) {
+      /* Jump to the newline ending the comment (or the last char in the chunk)
+         so only that char goes through the loop. */
+      run_end = sp_scan_newline(src_iter, src_end);
+      if (run_end == src_end)
+        run_end = src_end - 1;
+
+      if (run_end != src_iter) {
+        current_char = (int)run_end[-1];
+        src_iter = run_end;
+        SP_STATS_COUNT_CHARS(SP_READ_COMMENT);
+      }
+    }
+
     last_char = current_char;
     current_char = (int)*src_iter;
 
@@ -183,139 +817,124 @@ sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, co
 
       continue;
     } else if (in_escape) {
-      switch (current_char) {
-      case 'n': current_char = '\n'; break;
-      case 'r': current_char = '\r'; break;
-      case 'a': current_char = '\a'; break;
-      case 'b': current_char = '\b'; break;
-      case 'f': current_char = '\f'; break;
-      case 't': current_char = '\t'; break;
-      case '0': current_char = '\0'; break;
-      default: break;
-      }
+      /* The rest of an escape cut off at the end of the last chunk. Escaped
+         chars are buffered like any other, and never trimmed. */
+      current_char = sp_unescape(current_char);
       in_escape = 0;
-      goto sparse_buffer_char; // skip space trimming (space was escaped)
+      char_class = SP_CLASS_OTHER;
+    } else {
+      char_class = sp_char_classes[(unsigned char)current_char];
+      char_class += consume_whitespace & (char_class == SP_CLASS_SPACE) & (current_char == last_char);
     }
 
-    switch (current_char) {
-    case ' ':
-    case '\t':
-      if ((consume_whitespace && (last_char == current_char)) || mode == SP_FIND_NAME || mode == SP_FIND_VALUE) {
-        continue;
-      } else if (mode == SP_READ_NAME) {
-        mode = SP_FIND_VALUE;
-
-        SP_SEND_MSG(SP_NAME, buffer, buffer + buffer_size - num_spaces_trailing);
-        buffer_size = 0;
-        continue;
-      }
-      goto sparse_buffer_char_trim_spaces;
+    transition = &transitions[mode][char_class];
 
-    case '{': // open node
-      switch (mode) {
-      case SP_READ_NAME:
-        SP_SEND_MSG(SP_NAME, buffer, buffer + buffer_size - num_spaces_trailing);
-        buffer_size = 0;
+    if (transition->send != 0)
+      SP_SEND_TOKEN((sparse_msg_t)transition->send);
 
-      case SP_FIND_VALUE:
-        ++depth;
-        SP_SEND_MSG(SP_BEGIN_NODE, src_iter, src_iter + 1);
-        break;
+    switch ((sp_action_t)transition->action) {
+    case SP_ACT_NONE:
+      break;
 
-      case SP_READ_VALUE:
-        SP_SEND_MSG(SP_VALUE, buffer, buffer + buffer_size - num_spaces_trailing);
+    case SP_ACT_SKIP:
+      SP_SPILL_SPAN();
+      while (src_iter + 1 != src_end && src_iter[1] == (char)current_char)
+        ++src_iter;
+      last_char = current_char;
+      continue;
 
-      case SP_FIND_NAME:
-        if (nameless_nodes || (depth == 0 && nameless_roots)) {
-          ++depth;
-          SP_SEND_MSG(SP_NAME, sp_empty_str, sp_empty_str);
-          SP_SEND_MSG(SP_BEGIN_NODE, src_iter, src_iter + 1);
-          break;
-        }
+    case SP_ACT_SKIP_SPACES:
+      /* No token is open, so there's no span to spill. */
+      if (src_iter + 1 != src_end && sp_char_classes[(unsigned char)src_iter[1]] == SP_CLASS_SPACE) {
+        do {
+          ++src_iter;
+        } while (src_iter + 1 != src_end && sp_char_classes[(unsigned char)src_iter[1]] == SP_CLASS_SPACE);
+        last_char = (int)src_iter[-1];
+        current_char = (int)*src_iter;
+      }
+      continue;
 
-        default:
-        SP_RETURN_ERROR(SP_ERROR_INVALID_CHAR, src_iter, src_iter + 1);
+    case SP_ACT_ESCAPE:
+      SP_SPILL_SPAN();
+      SP_STATS_COUNT_ESCAPE();
+      if (src_iter + 1 == src_end) {
+        in_escape = 1;
         break;
       }
+      /* The escaped char is normally in the same chunk, so take it now rather
+         than going around the loop again. */
+      ++src_iter;
+      last_char = current_char;
+      current_char = sp_unescape((int)*src_iter);
+      transition = &transitions[mode][SP_CLASS_OTHER];
+      /* fall through */
+    case SP_ACT_BUFFER:
+      mode = (sparse_mode_t)transition->mode;
+      num_spaces_trailing = 0;
+      SP_BUFFER_TOKEN_CHAR();
+      break;
+
+    case SP_ACT_BUFFER_SPACE:
+      mode = (sparse_mode_t)transition->mode;
+      num_spaces_trailing += (size_t)trim_spaces;
+      SP_BUFFER_TOKEN_CHAR();
+      break;
 
-      mode = SP_FIND_NAME;
+    case SP_ACT_EMPTY_VALUE:
+      SP_SEND_MSG(SP_VALUE, sp_empty_str, sp_empty_str);
       break;
 
-    case '}':
-      if (mode == SP_READ_VALUE) {
-        SP_SEND_MSG(SP_VALUE, buffer, buffer + buffer_size - num_spaces_trailing);
-        buffer_size = 0;
-      } else if (mode != SP_FIND_NAME) {
+    case SP_ACT_OPEN_NAMELESS_ROOT:
+      if (depth != 0)
         SP_RETURN_ERROR(SP_ERROR_INVALID_CHAR, src_iter, src_iter + 1);
-      }
+      /* fall through */
+    case SP_ACT_OPEN_NAMELESS:
+      SP_SEND_MSG(SP_NAME, sp_empty_str, sp_empty_str);
+      /* fall through */
+    case SP_ACT_OPEN:
+      ++depth;
+      SP_STATS_COUNT_DEPTH();
+      SP_SEND_MSG(SP_BEGIN_NODE, src_iter, src_iter + 1);
+      break;
 
+    case SP_ACT_CLOSE:
       if (depth == 0)
         SP_RETURN_ERROR(SP_ERROR_INVALID_CHAR, src_iter, src_iter + 1);
-
       --depth;
-      mode = SP_FIND_NAME;
-
       SP_SEND_MSG(SP_END_NODE, src_iter, src_iter + 1);
       break;
 
-    case '#':
-    case ';':
-    case '\n':
-      switch (mode) {
-      case SP_READ_NAME:
-        SP_SEND_MSG(SP_NAME, buffer, buffer + buffer_size - num_spaces_trailing);
-        buffer_size = 0;
-
-      case SP_FIND_VALUE:
-        SP_SEND_MSG(SP_VALUE, sp_empty_str, sp_empty_str);
-        break;
-
-      case SP_READ_VALUE:
-        SP_SEND_MSG(SP_VALUE, buffer, buffer + buffer_size - num_spaces_trailing);
-        buffer_size = 0;
-        break;
-
-      default: break;
-      }
-
-      mode = current_char == '#' ? SP_READ_COMMENT : SP_FIND_NAME;
-      break;
-
-    case '\\':  // escape
-      in_escape = 1;
-      break;
-
+    case SP_ACT_INVALID:
     default:
-      sparse_buffer_char_trim_spaces:
-      if (trim_spaces) {
-        if (current_char == ' ' || current_char == '\t') {
-          ++num_spaces_trailing;
-        } else {
-          sparse_buffer_char:
-          num_spaces_trailing = 0;
-        }
-      }
-
-      if (mode == SP_FIND_NAME)
-        mode = SP_READ_NAME;
-      else if (mode == SP_FIND_VALUE)
-        mode = SP_READ_VALUE;
-
-      if (!SP_HAS_CALLBACK())
-        break;
-
-      buffer = SP_ENSURE_BUFFER_SIZED(buffer, buffer_capacity, buffer_size + 1);
+      SP_RETURN_ERROR(SP_ERROR_INVALID_CHAR, src_iter, src_iter + 1);
+    }
 
-      if (buffer == NULL)
-        SP_RETURN_ERROR(SP_ERROR_NO_MEM, sp_errstr_no_mem, SP_ERRSTR_END(sp_errstr_no_mem));
+    mode = (sparse_mode_t)transition->mode;
 
-      buffer[buffer_size++] = (char)current_char;
+    /* Only events set halt, and no token is left pending after one. */
+    if (src_stop != NULL && state->halt) {
+      SP_STATS_END_CHAR();
+      ++src_iter;
       break;
     }
   }
 
+  /* The source string isn't guaranteed to outlive this call. */
+  SP_SPILL_SPAN();
+
   sparse_exit:
 
+  if (src_stop != NULL)
+    *src_stop = src_iter;
+
+  error = sp_batch_finish(state, error);
+
+#ifdef SP_STATS
+  ++state->stats.runs;
+  state->stats.run_ns += sp_stats_now() - stats_begin;
+#endif
+
+  state->halt = 0;
   state->buffer = buffer;
   state->buffer_capacity = buffer_capacity;
   state->buffer_size = buffer_size;
@@ -323,7 +942,7 @@ sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, co
   state->depth = depth;
   state->mode = mode;
   state->in_escape = in_escape;
-  state->last_char = last_char;
+  state->last_char = current_char;
 
   return error;
 }
@@ -2,6 +2,7 @@
 #define __CMT_SPARSE_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define SP_DEFAULT_BUFFER_CAPACITY (128)
 
@@ -21,7 +22,13 @@ typedef enum {
   SP_NO_ERROR =                  0,
   SP_ERROR_NO_MEM =              1,
   SP_ERROR_INVALID_CHAR =        2,
-  SP_ERROR_INCOMPLETE_DOCUMENT = 3
+  SP_ERROR_INCOMPLETE_DOCUMENT = 3,
+  SP_ERROR_IO =                  4,
+  SP_ERROR_BAD_FORMAT =          5,
+  SP_ERROR_NOT_FOUND =           6,
+  SP_ERROR_STALE_INDEX =         7,
+  SP_ERROR_INVALID_VALUE =       8,
+  SP_ERROR_OUT_OF_RANGE =        9
 } sparse_error_t;
 
 typedef enum {
@@ -29,7 +36,9 @@ typedef enum {
   SP_BEGIN_NODE =  1,       // {
   SP_END_NODE =    2,       // }
   SP_NAME =        3,       // <FieldName> ...
-  SP_VALUE =       4        // FieldName <FieldValue>
+  SP_VALUE =       4,       // FieldName <FieldValue>
+  SP_NEED_INPUT =  5,       // Only returned by sparse_reader_next: feed the reader more input
+  SP_END_DOCUMENT = 6       // Only returned by sparse_reader_next: the document is complete
 } sparse_msg_t;
 
 typedef enum {
@@ -37,6 +46,7 @@ typedef enum {
   SP_TRIM_TRAILING_SPACES = 0x2,  // Trim trailing whitespace from the end of values.
   SP_NAMELESS_ROOT_NODES =  0x4,  // Allow root nodes to be nameless (callback will be given NULL strings for a root node's name).
   SP_NAMELESS_NODES =       0x8,  // Allow nameless nodes everywhere (not just root nodes - though this implies SP_NAMELESS_ROOT_NODES)
+  SP_ZERO_COPY =            0x10, // Pass names and values without escapes as pointers into the source string instead of copying them.
   SP_DEFAULT_OPTIONS = SP_TRIM_TRAILING_SPACES
 } sparse_options_t;
 
@@ -45,6 +55,76 @@ typedef void (^sparse_block_t)(sparse_msg_t msg, const char *begin, const char *
 #endif
 typedef void (*sparse_fn_t)(sparse_msg_t msg, const char *begin, const char *end, void *context);
 
+typedef struct s_sparse_event {
+  sparse_msg_t msg;
+  const char *begin;
+  const char *end;
+} sparse_event_t;
+
+/*
+  Compact event for batched delivery (see sparse_begin_batched). The event's
+  string is the length bytes at offset in the batch's data.
+*/
+typedef struct s_sparse_record {
+  sparse_msg_t msg;
+  uint32_t offset;
+  uint32_t length;
+} sparse_record_t;
+
+typedef void (*sparse_batch_fn_t)(const sparse_record_t *records, size_t num_records, const char *data, void *context);
+
+typedef struct s_sparse_batch {
+  /* Provided by the caller. */
+  sparse_record_t *records;
+  size_t capacity;
+  size_t num_records;
+
+  /* Every record's string, copied. Owned by the state and freed by sparse_end. */
+  char *data;
+  size_t data_size;
+  size_t data_capacity;
+
+  sparse_batch_fn_t callback;
+  void *context;
+
+  /* Set if data couldn't grow; later events are dropped. */
+  sparse_error_t error;
+} sparse_batch_t;
+
+/*
+  Memory functions for a state's buffers, in place of malloc, realloc and
+  free. Each is passed user. Must outlive any state using it.
+*/
+typedef struct s_sparse_allocator {
+  void *(*alloc)(size_t size, void *user);
+  void *(*realloc)(void *block, size_t size, void *user);
+  void (*free)(void *block, void *user);
+  void *user;
+} sparse_allocator_t;
+
+/*
+  Statistics kept by states when Sparse is built with SP_STATS defined. The
+  switch adds them to sparse_state_t, so define it for every file or none.
+  Events are counted by msg + 1, so SP_ERROR is msg_counts[0]. Times are in
+  nanoseconds: run_ns is all the time spent in sparse_run and in ending
+  documents, and callback_ns the part of it spent in callbacks (and blocks
+  and batch callbacks), so the parser's own time is the difference.
+*/
+#define SP_STATS_NUM_MODES (SP_READ_COMMENT + 1)
+#define SP_STATS_NUM_MSGS (SP_END_DOCUMENT + 2)
+
+typedef struct s_sparse_stats {
+  uint64_t mode_bytes[SP_STATS_NUM_MODES];
+  uint64_t msg_counts[SP_STATS_NUM_MSGS];
+  uint64_t buffer_reallocs;
+  size_t peak_buffer_capacity;
+  size_t max_depth;
+  uint64_t escapes;
+  uint64_t runs;
+  uint64_t run_ns;
+  uint64_t callback_ns;
+} sparse_stats_t;
+
 typedef struct s_sparse_state {
   char *buffer;
   const char *error_begin;
@@ -60,21 +140,75 @@ typedef struct s_sparse_state {
 
   int in_escape;
   int last_char;
+  int halt;
 
   void *context;
 
   sparse_fn_t callback;
+  /* If set, events are stored here instead of being sent to the callback and
+     sparse_run_partial stops after each one (used by sparse_reader.c). */
+  sparse_event_t *events;
+  size_t num_events;
+  /* If set, events are added to the batch instead of being sent to the
+     callback (see sparse_begin_batched). */
+  sparse_batch_t *batch;
+  /* NULL to use malloc, realloc and free. */
+  const sparse_allocator_t *allocator;
 #ifdef __BLOCKS__
   __unsafe_unretained sparse_block_t block;
 #endif
+#ifdef SP_STATS
+  sparse_stats_t stats;
+#endif
 } sparse_state_t;
 
 sparse_error_t sparse_begin(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_fn_t callback, void *context);
+/* Same as sparse_begin, but the state's buffers come from allocator. */
+sparse_error_t sparse_begin_with_allocator(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                           sparse_fn_t callback, void *context, const sparse_allocator_t *allocator);
 #ifdef __BLOCKS__
 sparse_error_t sparse_begin_using_block(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_block_t block);
 #endif
+/*
+  Begins a state that sends events to callback in batches rather than one
+  call per event. Records are added to the records array (of capacity
+  records) and their strings copied into a data buffer; the batch is handed
+  over whenever the array is full and at the end of every sparse_run and
+  sparse_end, then reused. With a capacity of 0, records can be NULL and
+  every event is handed over by itself as it happens, with data pointing at
+  its string. batch only needs to outlive the state. Always adds SP_ZERO_COPY
+  to options since strings are copied anyway.
+*/
+sparse_error_t sparse_begin_batched(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                    sparse_batch_t *batch, sparse_record_t *records, size_t capacity,
+                                    sparse_batch_fn_t callback, void *context);
 sparse_error_t sparse_end(sparse_state_t *state);
+/*
+  Ends the state's document the way sparse_end does, but keeps its buffer, at
+  whatever size it's grown to, and its allocator, and begins another document
+  with options, callback and context. Returns the error from ending the last
+  document, if any. A batched state stops being batched. Set the state's
+  callback to NULL first to drop a document without its last events, as after
+  an error.
+*/
+sparse_error_t sparse_reset(sparse_state_t *state, sparse_options_t options, sparse_fn_t callback, void *context);
 sparse_error_t sparse_run(sparse_state_t *state, const char *const src_begin, const char *src_end);
+/*
+  Same as sparse_run, but if the callback calls sparse_halt, returns once the
+  character that produced the event is done and stores where it stopped in
+  src_stop. Otherwise src_stop is set to the end of the string or the position
+  of an error.
+*/
+sparse_error_t sparse_run_partial(sparse_state_t *state, const char *const src_begin, const char *src_end, const char **src_stop);
+void sparse_halt(sparse_state_t *state);
+
+/*
+  Copies the state's statistics into stats and returns 1, or zeroes stats and
+  returns 0 if Sparse wasn't built with SP_STATS. Statistics add up across
+  documents until reset, and sparse_begin starts them at zero.
+*/
+int sparse_get_stats(const sparse_state_t *state, sparse_stats_t *stats);
+void sparse_reset_stats(sparse_state_t *state);
 
 #ifdef __cplusplus
 } // extern "C"
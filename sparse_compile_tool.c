@@ -0,0 +1,78 @@
+/*
+  Compiles documents to their binary form (see sparse_compiled.h) and turns
+  them back into text. Build it with sparse.c, sparse_scan.c,
+  sparse_document.c, sparse_symbols.c, sparse_file.c, sparse_writer.c,
+  sparse_util.c and sparse_compiled.c:
+
+    sparse_compile_tool compile FILE [COMPILED]
+    sparse_compile_tool decompile COMPILED
+
+  COMPILED defaults to FILE with SP_COMPILED_SUFFIX added. decompile writes
+  the document to standard output.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_compiled.h"
+
+static char *default_compiled_path(const char *path)
+{
+  const size_t length = strlen(path);
+  char *compiled_path = (char *)malloc(length + sizeof(SP_COMPILED_SUFFIX));
+  if (compiled_path != NULL) {
+    memcpy(compiled_path, path, length);
+    memcpy(compiled_path + length, SP_COMPILED_SUFFIX, sizeof(SP_COMPILED_SUFFIX));
+  }
+  return compiled_path;
+}
+
+static int usage(void)
+{
+  fprintf(stderr,
+          "usage: sparse_compile_tool compile FILE [COMPILED]\n"
+          "       sparse_compile_tool decompile COMPILED\n");
+  return 2;
+}
+
+int main(int argc, char const *argv[])
+{
+  sparse_error_t error;
+
+  if (argc < 3)
+    return usage();
+
+  if (strcmp(argv[1], "compile") == 0 && argc <= 4) {
+    char *compiled_path = argc == 4 ? NULL : default_compiled_path(argv[2]);
+    if (argc < 4 && compiled_path == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+    }
+    error = sparse_compile_file(argv[2], compiled_path != NULL ? compiled_path : argv[3], SP_DEFAULT_OPTIONS);
+    free(compiled_path);
+  } else if (strcmp(argv[1], "decompile") == 0 && argc == 3) {
+    sparse_compiled_t compiled;
+    sparse_writer_state_t writer;
+
+    error = sparse_compiled_open(&compiled, argv[2]);
+    if (error == SP_NO_ERROR) {
+      fflush(stdout);
+      error = sparse_writer_begin_fd(&writer, 1);
+      if (error == SP_NO_ERROR)
+        error = sparse_decompile(&compiled, &writer);
+      if (error == SP_NO_ERROR)
+        error = sparse_writer_end(&writer);
+      sparse_writer_free(&writer);
+    }
+    sparse_compiled_close(&compiled);
+
+    if (error == SP_ERROR_BAD_FORMAT)
+      fprintf(stderr, "%s: not a compiled document\n", argv[2]);
+  } else {
+    return usage();
+  }
+
+  if (error != SP_NO_ERROR && error != SP_ERROR_BAD_FORMAT)
+    fprintf(stderr, "%s: failed with error %d\n", argv[2], (int)error);
+
+  return error == SP_NO_ERROR ? 0 : 1;
+}
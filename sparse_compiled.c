@@ -0,0 +1,492 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sparse_compiled.h"
+#include "sparse_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SP_COMPILED_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Compiled layout, with every integer little-endian:
+
+    header   "SPARSEBN", u32 version, u32 node count, u32 strings size,
+             u32 reserved
+    nodes    u32 name offset, u32 name length, u32 value offset
+             (SP_COMPILED_NO_VALUE for nodes), u32 value length,
+             u32 first child, u32 next sibling
+    strings  every distinct name and value, each followed by a null, with the
+             empty string first
+*/
+#define SP_COMPILED_MAGIC "SPARSEBN"
+#define SP_COMPILED_MAGIC_SIZE (8)
+#define SP_COMPILED_VERSION (1)
+#define SP_COMPILED_HEADER_SIZE (24)
+#define SP_COMPILED_NODE_SIZE (24)
+#define SP_COMPILED_NO_VALUE ((uint32_t)0xFFFFFFFFu)
+
+/* A string already in the pool. Empty slots have a length of
+   SP_COMPILED_NO_VALUE. */
+typedef struct s_sp_pool_slot {
+  uint32_t hash;
+  uint32_t offset;
+  uint32_t length;
+} sp_pool_slot_t;
+
+typedef struct s_sp_string_pool {
+  char *data;
+  size_t size;
+  size_t capacity;
+
+  sp_pool_slot_t *slots;
+  size_t slots_mask;
+} sp_string_pool_t;
+
+/* What sp_compiled_write_file writes. */
+typedef struct s_sp_compiled_output {
+  const unsigned char *data;
+  size_t size;
+} sp_compiled_output_t;
+
+
+/* Compiling */
+
+static sparse_error_t sp_pool_init(sp_string_pool_t *pool, size_t num_strings)
+{
+  size_t num_slots = 64;
+  size_t index;
+
+  /* Keep the table under half full. */
+  while (num_slots < num_strings * 2)
+    num_slots *= 2;
+
+  memset(pool, 0, sizeof(*pool));
+  pool->capacity = 4096;
+  pool->data = (char *)malloc(pool->capacity);
+  pool->slots = (sp_pool_slot_t *)malloc(num_slots * sizeof(*pool->slots));
+  if (pool->data == NULL || pool->slots == NULL)
+    return SP_ERROR_NO_MEM;
+
+  for (index = 0; index < num_slots; ++index)
+    pool->slots[index].length = SP_COMPILED_NO_VALUE;
+  pool->slots_mask = num_slots - 1;
+
+  /* The empty string is at offset 0. */
+  pool->data[0] = '\0';
+  pool->size = 1;
+  return SP_NO_ERROR;
+}
+
+static void sp_pool_free(sp_string_pool_t *pool)
+{
+  free(pool->data);
+  free(pool->slots);
+}
+
+/* Stores the offset of the string in the pool, adding it if it isn't there. */
+static sparse_error_t sp_pool_add(sp_string_pool_t *pool, const char *string, uint32_t length, uint32_t *offset)
+{
+  const uint32_t hash = (uint32_t)sp_hash(SP_HASH_SEED, string, string + length);
+  size_t index = hash & pool->slots_mask;
+  sp_pool_slot_t *slot;
+
+  if (length == 0) {
+    *offset = 0;
+    return SP_NO_ERROR;
+  }
+
+  for (;; index = (index + 1) & pool->slots_mask) {
+    slot = &pool->slots[index];
+    if (slot->length == SP_COMPILED_NO_VALUE)
+      break;
+    if (slot->hash == hash && slot->length == length && memcmp(pool->data + slot->offset, string, length) == 0) {
+      *offset = slot->offset;
+      return SP_NO_ERROR;
+    }
+  }
+
+  /* Offsets are 32 bits. */
+  if ((size_t)length + 1 > (size_t)SP_COMPILED_NO_VALUE - pool->size)
+    return SP_ERROR_NO_MEM;
+
+  if (pool->size + length + 1 > pool->capacity) {
+    size_t capacity = pool->capacity * 2;
+    char *data;
+    while (capacity < pool->size + length + 1)
+      capacity *= 2;
+    data = (char *)realloc(pool->data, capacity);
+    if (data == NULL)
+      return SP_ERROR_NO_MEM;
+    pool->data = data;
+    pool->capacity = capacity;
+  }
+
+  memcpy(pool->data + pool->size, string, length);
+  pool->data[pool->size + length] = '\0';
+
+  slot->hash = hash;
+  slot->offset = (uint32_t)pool->size;
+  slot->length = length;
+  pool->size += length + 1;
+
+  *offset = slot->offset;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_compile(const sparse_document_t *doc, unsigned char **data, size_t *size)
+{
+  const size_t num_nodes = doc->num_nodes;
+  unsigned char *nodes;
+  unsigned char *out;
+  sp_string_pool_t pool;
+  sparse_error_t error;
+  size_t index;
+
+  *data = NULL;
+  *size = 0;
+
+  if (num_nodes >= SP_NO_NODE)
+    return SP_ERROR_NO_MEM;
+
+  nodes = (unsigned char *)malloc(num_nodes * SP_COMPILED_NODE_SIZE);
+  error = sp_pool_init(&pool, num_nodes * 2);
+  if (nodes == NULL && error == SP_NO_ERROR)
+    error = SP_ERROR_NO_MEM;
+
+  for (index = 0; error == SP_NO_ERROR && index < num_nodes; ++index) {
+    const sparse_node_t *node = &doc->nodes[index];
+    unsigned char *record = nodes + index * SP_COMPILED_NODE_SIZE;
+    uint32_t name_offset;
+    uint32_t value_offset = SP_COMPILED_NO_VALUE;
+
+    error = sp_pool_add(&pool, node->name, node->name_length, &name_offset);
+    if (error == SP_NO_ERROR && node->value != NULL)
+      error = sp_pool_add(&pool, node->value, node->value_length, &value_offset);
+
+    sp_put_u32(record, name_offset);
+    sp_put_u32(record + 4, node->name_length);
+    sp_put_u32(record + 8, value_offset);
+    sp_put_u32(record + 12, node->value != NULL ? node->value_length : 0);
+    sp_put_u32(record + 16, node->first_child);
+    sp_put_u32(record + 20, node->next_sibling);
+  }
+
+  if (error == SP_NO_ERROR) {
+    *size = SP_COMPILED_HEADER_SIZE + num_nodes * SP_COMPILED_NODE_SIZE + pool.size;
+    out = (unsigned char *)malloc(*size);
+    if (out == NULL) {
+      *size = 0;
+      error = SP_ERROR_NO_MEM;
+    } else {
+      memcpy(out, SP_COMPILED_MAGIC, SP_COMPILED_MAGIC_SIZE);
+      sp_put_u32(out + 8, SP_COMPILED_VERSION);
+      sp_put_u32(out + 12, (uint32_t)num_nodes);
+      sp_put_u32(out + 16, (uint32_t)pool.size);
+      sp_put_u32(out + 20, 0);
+      memcpy(out + SP_COMPILED_HEADER_SIZE, nodes, num_nodes * SP_COMPILED_NODE_SIZE);
+      memcpy(out + SP_COMPILED_HEADER_SIZE + num_nodes * SP_COMPILED_NODE_SIZE, pool.data, pool.size);
+      *data = out;
+    }
+  }
+
+  free(nodes);
+  sp_pool_free(&pool);
+  return error;
+}
+
+static int sp_compiled_write_file(FILE *stream, void *context)
+{
+  const sp_compiled_output_t *output = (const sp_compiled_output_t *)context;
+  return fwrite(output->data, 1, output->size, stream) == output->size;
+}
+
+sparse_error_t sparse_compile_file(const char *source_path, const char *compiled_path, sparse_options_t options)
+{
+  sparse_document_t doc;
+  sparse_state_t state;
+  sp_compiled_output_t output;
+  unsigned char *data = NULL;
+  size_t size;
+  sparse_error_t error = sparse_document_init(&doc);
+
+  if (error != SP_NO_ERROR)
+    return error;
+
+  error = sparse_begin_document(&state, 0, options, &doc);
+  if (error == SP_NO_ERROR)
+    error = sp_parse_whole_file(&state, source_path);
+  if (error == SP_NO_ERROR)
+    error = sparse_document_error(&doc);
+  if (error == SP_NO_ERROR)
+    error = sparse_compile(&doc, &data, &size);
+  sparse_document_free(&doc);
+
+  if (error == SP_NO_ERROR) {
+    output.data = data;
+    output.size = size;
+    error = sp_replace_file(compiled_path, sp_compiled_write_file, &output);
+  }
+
+  free(data);
+  return error;
+}
+
+
+/* Reading */
+
+sparse_error_t sparse_compiled_load(sparse_compiled_t *compiled, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint32_t num_nodes;
+  uint32_t strings_size;
+
+  compiled->data = bytes;
+  compiled->size = size;
+  compiled->mapped = 0;
+  compiled->owns_data = 0;
+  compiled->num_nodes = 0;
+  compiled->nodes = NULL;
+  compiled->strings = NULL;
+  compiled->strings_size = 0;
+
+  if (size < SP_COMPILED_HEADER_SIZE
+      || memcmp(bytes, SP_COMPILED_MAGIC, SP_COMPILED_MAGIC_SIZE) != 0
+      || sp_get_u32(bytes + 8) != SP_COMPILED_VERSION)
+    return SP_ERROR_BAD_FORMAT;
+
+  num_nodes = sp_get_u32(bytes + 12);
+  strings_size = sp_get_u32(bytes + 16);
+
+  /* There's always a root node and the empty string, and strings end with a
+     null, so no string can run off the end. */
+  if (num_nodes == 0 || num_nodes > (size - SP_COMPILED_HEADER_SIZE) / SP_COMPILED_NODE_SIZE
+      || strings_size == 0 || strings_size != size - SP_COMPILED_HEADER_SIZE - (size_t)num_nodes * SP_COMPILED_NODE_SIZE
+      || bytes[size - 1] != '\0')
+    return SP_ERROR_BAD_FORMAT;
+
+  compiled->num_nodes = num_nodes;
+  compiled->nodes = bytes + SP_COMPILED_HEADER_SIZE;
+  compiled->strings = (const char *)compiled->nodes + (size_t)num_nodes * SP_COMPILED_NODE_SIZE;
+  compiled->strings_size = strings_size;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_compiled_open(sparse_compiled_t *compiled, const char *path)
+{
+#ifdef SP_COMPILED_POSIX
+  struct stat info;
+  void *data;
+  int fd;
+  const int mapped = 1;
+#else
+  unsigned char *data;
+  long size;
+  FILE *stream;
+  const int mapped = 0;
+#endif
+  sparse_error_t error;
+
+  memset(compiled, 0, sizeof(*compiled));
+
+#ifdef SP_COMPILED_POSIX
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return SP_ERROR_IO;
+
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return SP_ERROR_IO;
+  }
+
+  if ((uint64_t)info.st_size < SP_COMPILED_HEADER_SIZE || (uint64_t)info.st_size > (size_t)-1) {
+    close(fd);
+    return SP_ERROR_BAD_FORMAT;
+  }
+
+  data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return SP_ERROR_IO;
+
+  error = sparse_compiled_load(compiled, data, (size_t)info.st_size);
+#else
+  stream = fopen(path, "rb");
+  if (stream == NULL)
+    return SP_ERROR_IO;
+
+  if (fseek(stream, 0, SEEK_END) != 0 || (size = ftell(stream)) < 0 || fseek(stream, 0, SEEK_SET) != 0) {
+    fclose(stream);
+    return SP_ERROR_IO;
+  }
+
+  if (size < SP_COMPILED_HEADER_SIZE) {
+    fclose(stream);
+    return SP_ERROR_BAD_FORMAT;
+  }
+
+  data = (unsigned char *)malloc((size_t)size);
+  if (data == NULL) {
+    fclose(stream);
+    return SP_ERROR_NO_MEM;
+  }
+
+  if (fread(data, 1, (size_t)size, stream) != (size_t)size) {
+    free(data);
+    fclose(stream);
+    return SP_ERROR_IO;
+  }
+
+  fclose(stream);
+  error = sparse_compiled_load(compiled, data, (size_t)size);
+#endif
+
+  /* Even if it isn't a compiled document, it's still to be released. */
+  compiled->mapped = mapped;
+  compiled->owns_data = !mapped;
+  return error;
+}
+
+void sparse_compiled_close(sparse_compiled_t *compiled)
+{
+  if (compiled->data != NULL) {
+#ifdef SP_COMPILED_POSIX
+    if (compiled->mapped)
+      munmap((void *)compiled->data, compiled->size);
+#endif
+    if (compiled->owns_data)
+      free((void *)compiled->data);
+  }
+
+  memset(compiled, 0, sizeof(*compiled));
+}
+
+static int sp_compiled_string(const sparse_compiled_t *compiled, uint32_t offset, uint32_t length, const char **string)
+{
+  if (offset >= compiled->strings_size || length >= compiled->strings_size - offset
+      || compiled->strings[offset + length] != '\0')
+    return 0;
+
+  *string = compiled->strings + offset;
+  return 1;
+}
+
+sparse_error_t sparse_compiled_node(const sparse_compiled_t *compiled, uint32_t index, sparse_node_t *node)
+{
+  const unsigned char *record;
+  uint32_t value_offset;
+
+  if (index >= compiled->num_nodes)
+    return SP_ERROR_BAD_FORMAT;
+
+  record = compiled->nodes + (size_t)index * SP_COMPILED_NODE_SIZE;
+  node->name_length = sp_get_u32(record + 4);
+  value_offset = sp_get_u32(record + 8);
+  node->value_length = sp_get_u32(record + 12);
+  node->first_child = sp_get_u32(record + 16);
+  node->next_sibling = sp_get_u32(record + 20);
+
+  if (!sp_compiled_string(compiled, sp_get_u32(record), node->name_length, &node->name))
+    return SP_ERROR_BAD_FORMAT;
+
+  if (value_offset == SP_COMPILED_NO_VALUE)
+    node->value = NULL;
+  else if (node->first_child != SP_NO_NODE || !sp_compiled_string(compiled, value_offset, node->value_length, &node->value))
+    return SP_ERROR_BAD_FORMAT;
+
+  /* Links only ever go forward, so walking a damaged document still ends. */
+  if ((node->first_child != SP_NO_NODE && node->first_child <= index)
+      || (node->next_sibling != SP_NO_NODE && node->next_sibling <= index))
+    return SP_ERROR_BAD_FORMAT;
+
+  return SP_NO_ERROR;
+}
+
+uint32_t sparse_compiled_find(const sparse_compiled_t *compiled, uint32_t parent, const char *name, size_t name_length)
+{
+  sparse_node_t node;
+  uint32_t index;
+
+  if (sparse_compiled_node(compiled, parent, &node) != SP_NO_ERROR)
+    return SP_NO_NODE;
+
+  for (index = node.first_child; index != SP_NO_NODE; index = node.next_sibling) {
+    if (sparse_compiled_node(compiled, index, &node) != SP_NO_ERROR)
+      return SP_NO_NODE;
+    if (node.name_length == name_length && memcmp(node.name, name, name_length) == 0)
+      return index;
+  }
+
+  return SP_NO_NODE;
+}
+
+sparse_error_t sparse_decompile(const sparse_compiled_t *compiled, sparse_writer_state_t *writer)
+{
+  /* The next sibling of each open node, to carry on with once it's closed. */
+  uint32_t *open_nodes = NULL;
+  size_t open_depth = 0;
+  size_t open_capacity = 0;
+  sparse_node_t node;
+  uint32_t index;
+  sparse_error_t error = sparse_compiled_node(compiled, SP_DOCUMENT_ROOT, &node);
+
+  index = node.first_child;
+
+  while (error == SP_NO_ERROR) {
+    if (index == SP_NO_NODE) {
+      if (open_depth == 0)
+        break;
+      error = sparse_writer_end_node(writer);
+      index = open_nodes[--open_depth];
+      continue;
+    }
+
+    error = sparse_compiled_node(compiled, index, &node);
+    if (error != SP_NO_ERROR)
+      break;
+
+    error = sparse_writer_name(writer, node.name, node.name_length);
+    if (error != SP_NO_ERROR)
+      break;
+
+    if (node.value != NULL) {
+      error = sparse_writer_value(writer, node.value, node.value_length);
+      index = node.next_sibling;
+      continue;
+    }
+
+    if (open_depth == open_capacity) {
+      const size_t capacity = open_capacity == 0 ? 16 : open_capacity * 2;
+      uint32_t *resized = (uint32_t *)realloc(open_nodes, capacity * sizeof(*open_nodes));
+      if (resized == NULL) {
+        error = SP_ERROR_NO_MEM;
+        break;
+      }
+      open_nodes = resized;
+      open_capacity = capacity;
+    }
+
+    open_nodes[open_depth++] = node.next_sibling;
+    error = sparse_writer_begin_node(writer);
+    index = node.first_child;
+  }
+
+  free(open_nodes);
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,85 @@
+#ifndef __CMT_SPARSE_COMPILED_H__
+#define __CMT_SPARSE_COMPILED_H__
+
+#include "sparse.h"
+#include "sparse_document.h"
+#include "sparse_writer.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Suffix sparse_compile_tool adds to a file's path to name its compiled form. */
+#define SP_COMPILED_SUFFIX ".spc"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A document compiled to a binary form that's used where it lies, so loading
+  one is a matter of mapping it rather than parsing it. It's the node array of
+  a sparse_document_t with string offsets in place of pointers, followed by a
+  pool of null-terminated strings in which every distinct name and value is
+  stored once. Nothing in it needs fixing up, and walking it doesn't allocate.
+
+  Nodes are stored in document order, so a node's children and following
+  siblings always come after it. Opening a compiled document only checks its
+  header; each node is checked as it's read, so a damaged file gives
+  SP_ERROR_BAD_FORMAT rather than a crash, however much of it is used.
+*/
+typedef struct s_sparse_compiled {
+  const unsigned char *data;
+  size_t size;
+  /* Set if sparse_compiled_open mapped data or read it into memory. */
+  int mapped;
+  int owns_data;
+
+  uint32_t num_nodes;
+  const unsigned char *nodes;
+  const char *strings;
+  size_t strings_size;
+} sparse_compiled_t;
+
+/*
+  Compiles doc. On success, *data is a malloc'd buffer of *size bytes holding
+  the compiled document.
+*/
+sparse_error_t sparse_compile(const sparse_document_t *doc, unsigned char **data, size_t *size);
+
+/*
+  Parses the file at source_path with options and writes its compiled form to
+  compiled_path, replacing anything already there. Like sparse_index_build,
+  it's written to a temporary file that's renamed into place.
+*/
+sparse_error_t sparse_compile_file(const char *source_path, const char *compiled_path, sparse_options_t options);
+
+/*
+  Maps the compiled document at path. Returns SP_ERROR_BAD_FORMAT if it isn't
+  one (or was compiled by an incompatible version). Close it with
+  sparse_compiled_close whatever this returns.
+*/
+sparse_error_t sparse_compiled_open(sparse_compiled_t *compiled, const char *path);
+/* Uses size bytes at data, which must outlive compiled, without copying. */
+sparse_error_t sparse_compiled_load(sparse_compiled_t *compiled, const void *data, size_t size);
+void sparse_compiled_close(sparse_compiled_t *compiled);
+
+/*
+  Stores node index (SP_DOCUMENT_ROOT is the nameless node holding the root
+  fields) in *node, the same way a sparse_document_t would have it. Names and
+  values point into the compiled document. Returns SP_ERROR_BAD_FORMAT if
+  there's no such node or it's damaged.
+*/
+sparse_error_t sparse_compiled_node(const sparse_compiled_t *compiled, uint32_t index, sparse_node_t *node);
+/* Returns the index of parent's first child named name, or SP_NO_NODE. */
+uint32_t sparse_compiled_find(const sparse_compiled_t *compiled, uint32_t parent, const char *name, size_t name_length);
+
+/*
+  Writes the document back out as text. Doesn't end the writer, so call
+  sparse_writer_end afterward.
+*/
+sparse_error_t sparse_decompile(const sparse_compiled_t *compiled, sparse_writer_state_t *writer);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_COMPILED_H__ include guard */
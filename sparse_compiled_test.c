@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sparse_compiled.h"
+
+static int write_file(const char *path, const char *src);
+static int same_node(const sparse_node_t *left, const sparse_node_t *right);
+static int check_nodes(const sparse_document_t *doc, const sparse_compiled_t *compiled);
+static int check_decompile(const sparse_compiled_t *compiled, const unsigned char *data, size_t size, sparse_options_t options);
+static int check_damage(const unsigned char *data, size_t size);
+
+static int write_file(const char *path, const char *src)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return 0;
+  fwrite(src, 1, strlen(src), file);
+  return fclose(file) == 0;
+}
+
+static int same_node(const sparse_node_t *left, const sparse_node_t *right)
+{
+  if (left->name_length != right->name_length || memcmp(left->name, right->name, left->name_length) != 0
+      || left->first_child != right->first_child || left->next_sibling != right->next_sibling
+      || (left->value == NULL) != (right->value == NULL))
+    return 0;
+
+  return left->value == NULL
+    || (left->value_length == right->value_length && memcmp(left->value, right->value, left->value_length) == 0);
+}
+
+/* Every node of the compiled document should match the one it came from. */
+static int check_nodes(const sparse_document_t *doc, const sparse_compiled_t *compiled)
+{
+  sparse_node_t node;
+  uint32_t index;
+
+  if (compiled->num_nodes != doc->num_nodes) {
+    fprintf(stderr, "Expected %zu nodes, got %u.\n", doc->num_nodes, (unsigned)compiled->num_nodes);
+    return 1;
+  }
+
+  for (index = 0; index < compiled->num_nodes; ++index) {
+    if (sparse_compiled_node(compiled, index, &node) != SP_NO_ERROR || !same_node(&doc->nodes[index], &node)
+        || node.name[node.name_length] != '\0' || (node.value != NULL && node.value[node.value_length] != '\0')) {
+      fprintf(stderr, "Node %u differs.\n", (unsigned)index);
+      return 1;
+    }
+  }
+
+  if (sparse_compiled_node(compiled, compiled->num_nodes, &node) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for a node past the end.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Decompiling, parsing that and compiling it again should give back the same
+   bytes. */
+static int check_decompile(const sparse_compiled_t *compiled, const unsigned char *data, size_t size, sparse_options_t options)
+{
+  sparse_writer_state_t writer;
+  sparse_document_t doc;
+  unsigned char *recompiled = NULL;
+  size_t recompiled_size = 0;
+  sparse_error_t error;
+  int failures = 0;
+
+  sparse_writer_begin(&writer, NULL, 0);
+  error = sparse_decompile(compiled, &writer);
+  if (error == SP_NO_ERROR)
+    error = sparse_writer_end(&writer);
+  if (error == SP_NO_ERROR)
+    error = sparse_document_parse(&doc, writer.buffer, writer.buffer + writer.size, options);
+  if (error == SP_NO_ERROR)
+    error = sparse_compile(&doc, &recompiled, &recompiled_size);
+
+  if (error != SP_NO_ERROR || recompiled_size != size || memcmp(recompiled, data, size) != 0) {
+    fprintf(stderr, "Decompiled document differs with options %d (error %d):\n%.*s\n",
+            (int)options, (int)error, (int)writer.size, writer.buffer);
+    ++failures;
+  }
+
+  sparse_document_free(&doc);
+  sparse_writer_free(&writer);
+  free(recompiled);
+  return failures;
+}
+
+static int check_damage(const unsigned char *data, size_t size)
+{
+  unsigned char *damaged = (unsigned char *)malloc(size);
+  sparse_compiled_t compiled;
+  sparse_node_t node;
+  uint32_t index;
+  int failures = 0;
+
+  memcpy(damaged, data, size);
+  damaged[0] = 'X';
+  if (sparse_compiled_load(&compiled, damaged, size) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for the wrong magic.\n");
+    ++failures;
+  }
+
+  memcpy(damaged, data, size);
+  if (sparse_compiled_load(&compiled, damaged, size - 1) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for a truncated document.\n");
+    ++failures;
+  }
+
+  /* Point the root's first child back at the root. */
+  damaged[24 + 16] = 0;
+  if (sparse_compiled_load(&compiled, damaged, size) != SP_NO_ERROR
+      || sparse_compiled_node(&compiled, SP_DOCUMENT_ROOT, &node) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for a link that goes backward.\n");
+    ++failures;
+  }
+
+  /* Every string offset past the end of the strings. */
+  memcpy(damaged, data, size);
+  sparse_compiled_load(&compiled, damaged, size);
+  for (index = 1; index < compiled.num_nodes; ++index)
+    memset(damaged + 24 + index * 24, 0x7f, 4);
+  for (index = 1; index < compiled.num_nodes; ++index) {
+    if (sparse_compiled_node(&compiled, index, &node) != SP_ERROR_BAD_FORMAT) {
+      fprintf(stderr, "Expected a bad format error for a string out of range.\n");
+      ++failures;
+      break;
+    }
+  }
+
+  free(damaged);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "    blend { src one; dst one }\n"
+    "  }\n"
+    "  1 { map textures/base/fl_tile1.png }\n"
+    "  clamp_u\n"
+    "}\n"
+    "escaped\\\nname value\\ with\\ttrailing\\0   \n"
+    "width 800; height 600\n"
+    "nested { a { b { c d } } } fov 100\n";
+
+  /* Appended when nameless nodes are allowed. */
+  static const char *nameless_string =
+    "{\n"
+    "  reason_for_using none\n"
+    "  { nested nameless }\n"
+    "}\n";
+
+  char src[1024];
+  char path[] = "/tmp/sparse_compiled_test_XXXXXX";
+  char compiled_path[64];
+  sparse_compiled_t compiled;
+  sparse_document_t doc;
+  unsigned char *data;
+  size_t size;
+  uint32_t index;
+  int failures = 0;
+  int options;
+  int fd;
+
+  for (options = 0; options < 16; ++options) {
+    snprintf(src, sizeof(src), "%s%s", test_string, (options & SP_NAMELESS_NODES) ? nameless_string : "");
+
+    if (sparse_document_parse(&doc, src, src + strlen(src), (sparse_options_t)options) != SP_NO_ERROR
+        || sparse_compile(&doc, &data, &size) != SP_NO_ERROR
+        || sparse_compiled_load(&compiled, data, size) != SP_NO_ERROR) {
+      fprintf(stderr, "Could not compile with options %d.\n", options);
+      ++failures;
+      sparse_document_free(&doc);
+      continue;
+    }
+
+    failures += check_nodes(&doc, &compiled);
+    failures += check_decompile(&compiled, data, size, (sparse_options_t)options);
+
+    sparse_document_free(&doc);
+    sparse_compiled_close(&compiled);
+    free(data);
+  }
+
+  /* Strings that show up more than once are stored once. */
+  sparse_document_parse(&doc, test_string, NULL, SP_DEFAULT_OPTIONS);
+  sparse_compile(&doc, &data, &size);
+  sparse_compiled_load(&compiled, data, size);
+  {
+    sparse_node_t first;
+    sparse_node_t second;
+    sparse_compiled_node(&compiled, sparse_compiled_find(&compiled, sparse_compiled_find(&compiled,
+      sparse_compiled_find(&compiled, SP_DOCUMENT_ROOT, "materials/base/fl_tile1", 23), "0", 1), "map", 3), &first);
+    sparse_compiled_node(&compiled, sparse_compiled_find(&compiled, sparse_compiled_find(&compiled,
+      sparse_compiled_find(&compiled, SP_DOCUMENT_ROOT, "materials/base/fl_tile1", 23), "1", 1), "map", 3), &second);
+    if (first.name != second.name || first.value == NULL || first.value != second.value
+        || strcmp(first.value, "textures/base/fl_tile1.png") != 0) {
+      fprintf(stderr, "Expected repeated strings to be shared.\n");
+      ++failures;
+    }
+  }
+  if (sparse_compiled_find(&compiled, SP_DOCUMENT_ROOT, "fov", 3) == SP_NO_NODE
+      || sparse_compiled_find(&compiled, SP_DOCUMENT_ROOT, "missing", 7) != SP_NO_NODE) {
+    fprintf(stderr, "Root lookups failed.\n");
+    ++failures;
+  }
+  failures += check_damage(data, size);
+  sparse_compiled_close(&compiled);
+  sparse_document_free(&doc);
+
+  /* Compiling a file and mapping the result. */
+  fd = mkstemp(path);
+  if (fd == -1) {
+    fprintf(stderr, "Could not create a temporary file.\n");
+    return 1;
+  }
+  close(fd);
+  snprintf(compiled_path, sizeof(compiled_path), "%s%s", path, SP_COMPILED_SUFFIX);
+  write_file(path, test_string);
+
+  if (sparse_compile_file(path, compiled_path, SP_DEFAULT_OPTIONS) != SP_NO_ERROR
+      || sparse_compiled_open(&compiled, compiled_path) != SP_NO_ERROR
+      || compiled.size != size || memcmp(compiled.data, data, size) != 0) {
+    fprintf(stderr, "Compiled file differs from the compiled string.\n");
+    ++failures;
+  }
+  index = sparse_compiled_find(&compiled, SP_DOCUMENT_ROOT, "width", 5);
+  {
+    sparse_node_t node;
+    if (sparse_compiled_node(&compiled, index, &node) != SP_NO_ERROR || strcmp(node.value, "800") != 0) {
+      fprintf(stderr, "Expected width to be 800.\n");
+      ++failures;
+    }
+  }
+  sparse_compiled_close(&compiled);
+  free(data);
+
+  if (sparse_compiled_open(&compiled, path) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for a text file.\n");
+    ++failures;
+  }
+  sparse_compiled_close(&compiled);
+
+  write_file(path, "unclosed {\n");
+  if (sparse_compile_file(path, compiled_path, SP_DEFAULT_OPTIONS) != SP_ERROR_INCOMPLETE_DOCUMENT) {
+    fprintf(stderr, "Expected an incomplete document error.\n");
+    ++failures;
+  }
+
+  unlink(path);
+  unlink(compiled_path);
+
+  if (sparse_compile_file(path, compiled_path, SP_DEFAULT_OPTIONS) != SP_ERROR_IO) {
+    fprintf(stderr, "Expected an IO error for a missing file.\n");
+    ++failures;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
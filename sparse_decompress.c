@@ -0,0 +1,326 @@
+#include "sparse_decompress.h"
+#include "sparse_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SP_NO_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef SP_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Compressed input is read in pieces of this size, big enough to tell the
+   format from the first one. */
+#define SP_DECOMPRESS_INPUT_SIZE (SP_DECOMPRESS_WINDOW_SIZE < 16 ? 16 : SP_DECOMPRESS_WINDOW_SIZE)
+
+static const char *sp_errstr_open = "Could not open file.";
+static const char *sp_errstr_read = "Could not read file.";
+static const char *sp_errstr_no_mem = "Could not allocate memory for decompression.";
+static const char *sp_errstr_unsupported = "Compression format not supported by this build.";
+#if !defined(SP_NO_ZLIB) || defined(SP_ZSTD)
+static const char *sp_errstr_corrupt = "Compressed data is corrupt.";
+static const char *sp_errstr_truncated = "Compressed data ends unexpectedly.";
+#endif
+
+static sparse_error_t sp_decompress_error(sparse_decompressor_t *decompressor, sparse_error_t error, const char *message)
+{
+  decompressor->error_begin = message;
+  decompressor->error_end = message + strlen(message);
+  return error;
+}
+
+/* Reads more compressed input once the buffer's empty. */
+static sparse_error_t sp_refill_input(sparse_decompressor_t *decompressor)
+{
+  if (decompressor->input_begin < decompressor->input_end || decompressor->input_finished)
+    return SP_NO_ERROR;
+
+  decompressor->input_begin = 0;
+  decompressor->input_end = fread(decompressor->input, 1, SP_DECOMPRESS_INPUT_SIZE, decompressor->file);
+  if (decompressor->input_end < SP_DECOMPRESS_INPUT_SIZE) {
+    if (ferror(decompressor->file))
+      return sp_decompress_error(decompressor, SP_ERROR_IO, sp_errstr_read);
+    decompressor->input_finished = 1;
+  }
+
+  return SP_NO_ERROR;
+}
+
+sparse_compression_t sparse_detect_compression(const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+
+  if (size >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B)
+    return SP_COMPRESSION_GZIP;
+  if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD)
+    return SP_COMPRESSION_ZSTD;
+  return SP_COMPRESSION_NONE;
+}
+
+sparse_error_t sparse_decompressor_open(sparse_decompressor_t *decompressor, const char *path)
+{
+  sparse_error_t error;
+
+  memset(decompressor, 0, sizeof(*decompressor));
+
+  decompressor->input = (unsigned char *)malloc(SP_DECOMPRESS_INPUT_SIZE);
+  if (decompressor->input == NULL)
+    return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+
+  decompressor->file = fopen(path, "rb");
+  if (decompressor->file == NULL)
+    return sp_decompress_error(decompressor, SP_ERROR_IO, sp_errstr_open);
+
+  if ((error = sp_refill_input(decompressor)) != SP_NO_ERROR)
+    return error;
+
+  decompressor->compression = sparse_detect_compression(decompressor->input, decompressor->input_end);
+
+  switch (decompressor->compression) {
+  case SP_COMPRESSION_NONE:
+    break;
+
+  case SP_COMPRESSION_GZIP: {
+#ifndef SP_NO_ZLIB
+    z_stream *stream = (z_stream *)calloc(1, sizeof(z_stream));
+    if (stream == NULL)
+      return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+    /* 15 + 16 only accepts gzip, with the largest window. */
+    if (inflateInit2(stream, 15 + 16) != Z_OK) {
+      free(stream);
+      return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+    }
+    decompressor->stream = stream;
+    break;
+#else
+    return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_unsupported);
+#endif
+  }
+
+  case SP_COMPRESSION_ZSTD: {
+#ifdef SP_ZSTD
+    ZSTD_DStream *stream = ZSTD_createDStream();
+    if (stream == NULL)
+      return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+    decompressor->stream = stream;
+    if (ZSTD_isError(ZSTD_initDStream(stream)))
+      return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+    break;
+#else
+    return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_unsupported);
+#endif
+  }
+  }
+
+  return SP_NO_ERROR;
+}
+
+static sparse_error_t sp_read_uncompressed(sparse_decompressor_t *decompressor, char *window, size_t capacity, size_t *size)
+{
+  const size_t available = decompressor->input_end - decompressor->input_begin;
+  const size_t length = available < capacity - *size ? available : capacity - *size;
+
+  if (available == 0) {
+    decompressor->output_finished = 1;
+    return SP_NO_ERROR;
+  }
+
+  memcpy(window + *size, decompressor->input + decompressor->input_begin, length);
+  decompressor->input_begin += length;
+  *size += length;
+  return SP_NO_ERROR;
+}
+
+#ifndef SP_NO_ZLIB
+
+static sparse_error_t sp_read_gzip(sparse_decompressor_t *decompressor, char *window, size_t capacity, size_t *size)
+{
+  z_stream *stream = (z_stream *)decompressor->stream;
+  int result;
+
+  if (decompressor->frame_finished) {
+    /* Whatever follows a member is another member. */
+    if (decompressor->input_begin == decompressor->input_end) {
+      decompressor->output_finished = 1;
+      return SP_NO_ERROR;
+    }
+    inflateReset(stream);
+    decompressor->frame_finished = 0;
+  }
+
+  stream->next_in = decompressor->input + decompressor->input_begin;
+  stream->avail_in = (uInt)(decompressor->input_end - decompressor->input_begin);
+  stream->next_out = (Bytef *)(window + *size);
+  stream->avail_out = (uInt)(capacity - *size);
+
+  result = inflate(stream, Z_NO_FLUSH);
+
+  decompressor->input_begin = decompressor->input_end - stream->avail_in;
+  *size = capacity - stream->avail_out;
+
+  switch (result) {
+  case Z_OK:
+    return SP_NO_ERROR;
+  case Z_STREAM_END:
+    decompressor->frame_finished = 1;
+    return SP_NO_ERROR;
+  case Z_BUF_ERROR:
+    /* No progress: there's room for output, so it's waiting on input. */
+    if (decompressor->input_finished)
+      return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_truncated);
+    return SP_NO_ERROR;
+  case Z_MEM_ERROR:
+    return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+  default:
+    return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_corrupt);
+  }
+}
+
+#endif /* SP_NO_ZLIB */
+
+#ifdef SP_ZSTD
+
+static sparse_error_t sp_read_zstd(sparse_decompressor_t *decompressor, char *window, size_t capacity, size_t *size)
+{
+  ZSTD_inBuffer input;
+  ZSTD_outBuffer output;
+  size_t result;
+
+  if (decompressor->frame_finished && decompressor->input_begin == decompressor->input_end) {
+    decompressor->output_finished = 1;
+    return SP_NO_ERROR;
+  }
+
+  input.src = decompressor->input + decompressor->input_begin;
+  input.size = decompressor->input_end - decompressor->input_begin;
+  input.pos = 0;
+  output.dst = window + *size;
+  output.size = capacity - *size;
+  output.pos = 0;
+
+  result = ZSTD_decompressStream((ZSTD_DStream *)decompressor->stream, &output, &input);
+  if (ZSTD_isError(result)) {
+    if (ZSTD_getErrorCode(result) == ZSTD_error_memory_allocation)
+      return sp_decompress_error(decompressor, SP_ERROR_NO_MEM, sp_errstr_no_mem);
+    return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_corrupt);
+  }
+
+  decompressor->input_begin += input.pos;
+  *size += output.pos;
+  /* The next frame, if any, starts by itself. */
+  decompressor->frame_finished = result == 0;
+
+  /* Out of input partway through a frame with nothing left to flush. */
+  if (!decompressor->frame_finished && output.pos == 0 && decompressor->input_finished
+      && decompressor->input_begin == decompressor->input_end)
+    return sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_truncated);
+
+  return SP_NO_ERROR;
+}
+
+#endif /* SP_ZSTD */
+
+sparse_error_t sparse_decompressor_read(sparse_decompressor_t *decompressor, char *window, size_t capacity, size_t *size)
+{
+  sparse_error_t error = SP_NO_ERROR;
+
+  *size = 0;
+
+  while (error == SP_NO_ERROR && *size < capacity && !decompressor->output_finished) {
+    if ((error = sp_refill_input(decompressor)) != SP_NO_ERROR)
+      break;
+
+    switch (decompressor->compression) {
+    case SP_COMPRESSION_NONE:
+      error = sp_read_uncompressed(decompressor, window, capacity, size);
+      break;
+#ifndef SP_NO_ZLIB
+    case SP_COMPRESSION_GZIP:
+      error = sp_read_gzip(decompressor, window, capacity, size);
+      break;
+#endif
+#ifdef SP_ZSTD
+    case SP_COMPRESSION_ZSTD:
+      error = sp_read_zstd(decompressor, window, capacity, size);
+      break;
+#endif
+    default:
+      error = sp_decompress_error(decompressor, SP_ERROR_BAD_FORMAT, sp_errstr_unsupported);
+      break;
+    }
+  }
+
+  return error;
+}
+
+void sparse_decompressor_close(sparse_decompressor_t *decompressor)
+{
+  if (decompressor->stream != NULL) {
+    switch (decompressor->compression) {
+#ifndef SP_NO_ZLIB
+    case SP_COMPRESSION_GZIP:
+      inflateEnd((z_stream *)decompressor->stream);
+      free(decompressor->stream);
+      break;
+#endif
+#ifdef SP_ZSTD
+    case SP_COMPRESSION_ZSTD:
+      ZSTD_freeDStream((ZSTD_DStream *)decompressor->stream);
+      break;
+#endif
+    default:
+      break;
+    }
+  }
+
+  if (decompressor->file != NULL)
+    fclose(decompressor->file);
+  free(decompressor->input);
+
+  decompressor->stream = NULL;
+  decompressor->file = NULL;
+  decompressor->input = NULL;
+}
+
+sparse_error_t sparse_parse_compressed_file(sparse_state_t *state, const char *path)
+{
+  sparse_decompressor_t decompressor;
+  sparse_error_t error;
+  char *window = (char *)malloc(SP_DECOMPRESS_WINDOW_SIZE);
+  size_t size = 0;
+
+  if (window == NULL) {
+    sp_send_error(state, sp_errstr_no_mem, sp_errstr_no_mem + strlen(sp_errstr_no_mem));
+    return SP_ERROR_NO_MEM;
+  }
+
+  /* sparse_run sends its own errors, so any error the decompressor has a
+     message for is one of its own. */
+  error = sparse_decompressor_open(&decompressor, path);
+  while (error == SP_NO_ERROR
+         && (error = sparse_decompressor_read(&decompressor, window, SP_DECOMPRESS_WINDOW_SIZE, &size)) == SP_NO_ERROR
+         && size > 0) {
+    /* sparse_run copies any token still open at the end of the window into
+       its buffer, so the window can be reused. */
+    error = sparse_run(state, window, window + size);
+  }
+
+  if (decompressor.error_begin != NULL)
+    sp_send_error(state, decompressor.error_begin, decompressor.error_end);
+
+  sparse_decompressor_close(&decompressor);
+  sp_detach_error(state, window, window + SP_DECOMPRESS_WINDOW_SIZE);
+  free(window);
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
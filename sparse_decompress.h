@@ -0,0 +1,85 @@
+#ifndef __CMT_SPARSE_DECOMPRESS_H__
+#define __CMT_SPARSE_DECOMPRESS_H__
+
+#include "sparse.h"
+#include <stdio.h>
+
+/* Size of the window sparse_parse_compressed_file decompresses into, and of
+   each read of compressed data from the file. */
+#ifndef SP_DECOMPRESS_WINDOW_SIZE
+#define SP_DECOMPRESS_WINDOW_SIZE (64 * 1024)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Formats a decompressor can read. gzip needs zlib, unless built with
+  SP_NO_ZLIB defined. Zstandard needs libzstd and SP_ZSTD defined. Files in a
+  format the build can't read fail with SP_ERROR_BAD_FORMAT.
+*/
+typedef enum {
+  SP_COMPRESSION_NONE,
+  SP_COMPRESSION_GZIP,
+  SP_COMPRESSION_ZSTD
+} sparse_compression_t;
+
+/*
+  Streaming decompressor for a file. Memory use is fixed: one buffer of
+  compressed input plus the decompressor's own state, whatever the size of
+  the file.
+*/
+typedef struct s_sparse_decompressor {
+  FILE *file;
+  sparse_compression_t compression;
+
+  /* Compressed input read from the file, from input_begin to input_end. */
+  unsigned char *input;
+  size_t input_begin;
+  size_t input_end;
+  int input_finished;
+
+  /* z_stream or ZSTD_DStream. */
+  void *stream;
+  /* Set between gzip members or zstd frames, where the file may end. */
+  int frame_finished;
+  int output_finished;
+
+  /* Describes the last error. */
+  const char *error_begin;
+  const char *error_end;
+} sparse_decompressor_t;
+
+/* Guesses a format from the first few bytes of a file. */
+sparse_compression_t sparse_detect_compression(const void *data, size_t size);
+
+/*
+  Opens the file at path and works out its format. Returns SP_ERROR_IO if the
+  file can't be opened or read and SP_ERROR_BAD_FORMAT if the build can't
+  read it. Close the decompressor even if this fails.
+*/
+sparse_error_t sparse_decompressor_open(sparse_decompressor_t *decompressor, const char *path);
+/*
+  Decompresses up to capacity bytes into window, filling it unless the file
+  ends first, and sets *size to how many. *size is 0 once everything's been
+  read. Returns SP_ERROR_IO if the file can't be read and
+  SP_ERROR_BAD_FORMAT if the data is corrupt or cut short.
+*/
+sparse_error_t sparse_decompressor_read(sparse_decompressor_t *decompressor, char *window, size_t capacity, size_t *size);
+void sparse_decompressor_close(sparse_decompressor_t *decompressor);
+
+/*
+  Runs a file that may be compressed through sparse_run, one window of
+  SP_DECOMPRESS_WINDOW_SIZE bytes at a time, so the decompressed document is
+  never in memory all at once. Like sparse_parse_file, this doesn't end the
+  state. Errors are sent to the state's callback and returned as
+  sparse_decompressor_open and sparse_decompressor_read return them.
+*/
+sparse_error_t sparse_parse_compressed_file(sparse_state_t *state, const char *path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_DECOMPRESS_H__ include guard */
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "sparse_decompress.h"
+
+#ifdef SP_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+  Build with a small window, e.g. -DSP_DECOMPRESS_WINDOW_SIZE=7, so compressed
+  input and decompressed output are both cut at odd places. Build with
+  SP_ZSTD (and -lzstd) to test Zstandard files as well.
+*/
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static sparse_error_t log_file_events(event_log_t *log, const char *path, sparse_options_t options);
+static void write_file(const char *path, const void *data, size_t size);
+static size_t gzip_data(const char *src, size_t src_size, unsigned char *out, size_t capacity);
+static int check_file(const char *path, const char *what, const char *src, size_t src_size,
+                      const event_log_t *expected, sparse_error_t expected_error);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static sparse_error_t log_file_events(event_log_t *log, const char *path, sparse_options_t options)
+{
+  sparse_state_t state;
+  sparse_error_t error;
+
+  log->size = 0;
+  sparse_begin(&state, 0, options, log_event, log);
+  error = sparse_parse_compressed_file(&state, path);
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  return error;
+}
+
+static void write_file(const char *path, const void *data, size_t size)
+{
+  FILE *file = fopen(path, "wb");
+  fwrite(data, 1, size, file);
+  fclose(file);
+}
+
+static size_t gzip_data(const char *src, size_t src_size, unsigned char *out, size_t capacity)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+  stream.next_in = (Bytef *)src;
+  stream.avail_in = (uInt)src_size;
+  stream.next_out = out;
+  stream.avail_out = (uInt)capacity;
+  deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  return capacity - stream.avail_out;
+}
+
+/* Checks the file's events match expected, or that it fails with
+   expected_error, and that reading it in small pieces gives back src. */
+static int check_file(const char *path, const char *what, const char *src, size_t src_size,
+                      const event_log_t *expected, sparse_error_t expected_error)
+{
+  const sparse_options_t options = (sparse_options_t)(SP_TRIM_TRAILING_SPACES | SP_ZERO_COPY);
+  event_log_t actual = { NULL, 0, 0 };
+  int failures = 0;
+  size_t capacity;
+  sparse_error_t error = log_file_events(&actual, path, options);
+
+  if (error != expected_error) {
+    fprintf(stderr, "%s: expected error %d, got %d.\n", what, (int)expected_error, (int)error);
+    ++failures;
+  } else if (error == SP_NO_ERROR
+             && (actual.size != expected->size
+                 || (actual.size > 0 && memcmp(actual.data, expected->data, actual.size) != 0))) {
+    fprintf(stderr, "%s: events differ from the string's.\n", what);
+    ++failures;
+  }
+
+  for (capacity = 1; error == SP_NO_ERROR && capacity < 40; capacity += 13) {
+    sparse_decompressor_t decompressor;
+    char *output = malloc(src_size + capacity);
+    size_t output_size = 0;
+    size_t size = 0;
+
+    if (sparse_decompressor_open(&decompressor, path) == SP_NO_ERROR) {
+      while (sparse_decompressor_read(&decompressor, output + output_size, capacity, &size) == SP_NO_ERROR
+             && size > 0 && output_size + size <= src_size)
+        output_size += size;
+    }
+    sparse_decompressor_close(&decompressor);
+
+    if (size != 0 || output_size != src_size || (src_size > 0 && memcmp(output, src, src_size) != 0)) {
+      fprintf(stderr, "%s: reading %zu bytes at a time gave %zu bytes.\n", what, capacity, output_size);
+      ++failures;
+    }
+    free(output);
+  }
+
+  free(actual.data);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    # Incidentally, #s begin comments\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  escaped\\ name a\\tvalue\\ \n"
+    "}\n"
+    "width 800; height 600\n";
+
+  const sparse_options_t options = (sparse_options_t)(SP_TRIM_TRAILING_SPACES | SP_ZERO_COPY);
+  event_log_t expected = { NULL, 0, 0 };
+  char path[] = "/tmp/sparse_decompress_test_XXXXXX";
+  char *src;
+  size_t src_size = 0;
+  unsigned char *compressed;
+  size_t compressed_size;
+  size_t capacity;
+  int failures = 0;
+  int fd = mkstemp(path);
+
+  if (fd == -1) {
+    fprintf(stderr, "Could not create a temporary file.\n");
+    return 1;
+  }
+  close(fd);
+
+  /* Long enough to span several windows, which end mid-token. */
+  src = malloc(strlen(test_string) * 200 + 1);
+  src[0] = '\0';
+  while (src_size < strlen(test_string) * 200) {
+    strcat(src, test_string);
+    src_size += strlen(test_string);
+  }
+
+  capacity = src_size * 2 + 1024;
+  compressed = malloc(capacity);
+
+  {
+    sparse_state_t state;
+    sparse_begin(&state, 0, options, log_event, &expected);
+    sparse_run(&state, src, src + src_size);
+    sparse_end(&state);
+  }
+
+  write_file(path, src, src_size);
+  failures += check_file(path, "Uncompressed", src, src_size, &expected, SP_NO_ERROR);
+
+  compressed_size = gzip_data(src, src_size, compressed, capacity);
+  write_file(path, compressed, compressed_size);
+  failures += check_file(path, "gzip", src, src_size, &expected, SP_NO_ERROR);
+
+  /* Cut off partway through. */
+  write_file(path, compressed, compressed_size - 10);
+  failures += check_file(path, "Truncated gzip", src, src_size, &expected, SP_ERROR_BAD_FORMAT);
+
+  /* Breaks the CRC check, if nothing else. */
+  compressed[compressed_size / 2] ^= 0x55;
+  write_file(path, compressed, compressed_size);
+  failures += check_file(path, "Corrupt gzip", src, src_size, &expected, SP_ERROR_BAD_FORMAT);
+
+  /* Concatenated members decompress as one file, split here mid-token. */
+  compressed_size = gzip_data(src, src_size / 3, compressed, capacity);
+  compressed_size += gzip_data(src + src_size / 3, src_size - src_size / 3, compressed + compressed_size,
+                               capacity - compressed_size);
+  write_file(path, compressed, compressed_size);
+  failures += check_file(path, "Multi-member gzip", src, src_size, &expected, SP_NO_ERROR);
+
+#ifdef SP_ZSTD
+  compressed_size = ZSTD_compress(compressed, capacity, src, src_size, 3);
+  write_file(path, compressed, compressed_size);
+  failures += check_file(path, "zstd", src, src_size, &expected, SP_NO_ERROR);
+
+  write_file(path, compressed, compressed_size - 10);
+  failures += check_file(path, "Truncated zstd", src, src_size, &expected, SP_ERROR_BAD_FORMAT);
+
+  compressed_size = ZSTD_compress(compressed, capacity, src, src_size / 3, 3);
+  compressed_size += ZSTD_compress(compressed + compressed_size, capacity - compressed_size,
+                                   src + src_size / 3, src_size - src_size / 3, 3);
+  write_file(path, compressed, compressed_size);
+  failures += check_file(path, "Multi-frame zstd", src, src_size, &expected, SP_NO_ERROR);
+#else
+  {
+    static const unsigned char zstd_magic[] = { 0x28, 0xB5, 0x2F, 0xFD, 0x00 };
+    write_file(path, zstd_magic, sizeof(zstd_magic));
+    failures += check_file(path, "zstd without SP_ZSTD", src, src_size, &expected, SP_ERROR_BAD_FORMAT);
+  }
+#endif
+
+  /* The invalid char is still readable once the window it was in is gone. */
+  {
+    static const char invalid[] = "a {\n b c\n}\n}\n";
+    sparse_state_t state;
+    compressed_size = gzip_data(invalid, sizeof(invalid) - 1, compressed, capacity);
+    write_file(path, compressed, compressed_size);
+    sparse_begin(&state, 0, options, NULL, NULL);
+    if (sparse_parse_compressed_file(&state, path) != SP_ERROR_INVALID_CHAR
+        || state.error_end - state.error_begin != 1 || *state.error_begin != '}') {
+      fprintf(stderr, "Invalid gzip: expected the invalid character to outlive the window.\n");
+      ++failures;
+    }
+    sparse_end(&state);
+  }
+
+  write_file(path, "", 0);
+  {
+    event_log_t empty = { NULL, 0, 0 };
+    failures += check_file(path, "Empty", "", 0, &empty, SP_NO_ERROR);
+  }
+
+  unlink(path);
+  failures += check_file(path, "Missing", src, src_size, &expected, SP_ERROR_IO);
+
+  free(compressed);
+  free(src);
+  free(expected.data);
+
+  return failures == 0 ? 0 : 1;
+}
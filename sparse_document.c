@@ -0,0 +1,320 @@
+#include "sparse_document.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_ARENA_BLOCK_CAPACITY (64 * 1024)
+#define SP_DEFAULT_NODES_CAPACITY (64)
+
+struct s_sparse_arena_block {
+  struct s_sparse_arena_block *next;
+  size_t size;
+  size_t capacity;
+  char data[];
+};
+
+static const char *sp_empty_value = "";
+
+/* Copies [begin, end) into the arena with a null terminator. */
+static const char *sp_arena_copy(sparse_document_t *doc, const char *begin, size_t length)
+{
+  struct s_sparse_arena_block *block = doc->arena;
+  char *copy;
+
+  if (block == NULL || block->capacity - block->size < length + 1) {
+    size_t capacity = SP_ARENA_BLOCK_CAPACITY;
+    if (capacity < length + 1)
+      capacity = length + 1;
+
+    block = malloc(sizeof(*block) + capacity);
+    if (block == NULL)
+      return NULL;
+
+    block->size = 0;
+    block->capacity = capacity;
+
+    /* Oversized strings get a block of their own behind the current one so
+       the rest of the current block can still be used. */
+    if (doc->arena != NULL && capacity > SP_ARENA_BLOCK_CAPACITY) {
+      block->next = doc->arena->next;
+      doc->arena->next = block;
+    } else {
+      block->next = doc->arena;
+      doc->arena = block;
+    }
+  }
+
+  copy = block->data + block->size;
+  memcpy(copy, begin, length);
+  copy[length] = '\0';
+  block->size += length + 1;
+  return copy;
+}
+
+static uint32_t sp_document_add_node(sparse_document_t *doc)
+{
+  sparse_node_t *node;
+
+  if (doc->num_nodes == doc->nodes_capacity) {
+    const size_t capacity = doc->nodes_capacity * 2;
+    sparse_node_t *nodes;
+
+    if (capacity >= SP_NO_NODE)
+      return SP_NO_NODE;
+
+    if (doc->name_symbols != NULL) {
+      uint32_t *name_symbols = realloc(doc->name_symbols, capacity * sizeof(*name_symbols));
+      if (name_symbols == NULL)
+        return SP_NO_NODE;
+      doc->name_symbols = name_symbols;
+    }
+
+    nodes = realloc(doc->nodes, capacity * sizeof(*nodes));
+    if (nodes == NULL)
+      return SP_NO_NODE;
+    doc->nodes = nodes;
+    doc->nodes_capacity = capacity;
+  }
+
+  if (doc->name_symbols != NULL)
+    doc->name_symbols[doc->num_nodes] = SP_NO_SYMBOL;
+
+  node = &doc->nodes[doc->num_nodes];
+  node->name = sp_empty_value;
+  node->value = NULL;
+  node->name_length = 0;
+  node->value_length = 0;
+  node->first_child = SP_NO_NODE;
+  node->next_sibling = SP_NO_NODE;
+  return (uint32_t)doc->num_nodes++;
+}
+
+sparse_error_t sparse_document_init(sparse_document_t *doc)
+{
+  memset(doc, 0, sizeof(*doc));
+
+  doc->nodes = malloc(SP_DEFAULT_NODES_CAPACITY * sizeof(*doc->nodes));
+  doc->open_nodes = malloc(16 * 2 * sizeof(*doc->open_nodes));
+
+  if (doc->nodes == NULL || doc->open_nodes == NULL) {
+    sparse_document_free(doc);
+    return SP_ERROR_NO_MEM;
+  }
+
+  doc->nodes_capacity = SP_DEFAULT_NODES_CAPACITY;
+  doc->open_capacity = 16;
+
+  sp_document_add_node(doc);
+  doc->open_nodes[0] = SP_DOCUMENT_ROOT;
+  doc->open_nodes[1] = SP_NO_NODE;
+  doc->open_depth = 1;
+
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_document_init_interned(sparse_document_t *doc, sparse_symbols_t *symbols)
+{
+  sparse_error_t error = sparse_document_init(doc);
+
+  if (error != SP_NO_ERROR)
+    return error;
+
+  doc->name_symbols = malloc(doc->nodes_capacity * sizeof(*doc->name_symbols));
+  if (doc->name_symbols == NULL) {
+    sparse_document_free(doc);
+    return SP_ERROR_NO_MEM;
+  }
+
+  doc->symbols = symbols;
+  doc->name_symbols[SP_DOCUMENT_ROOT] = SP_NO_SYMBOL;
+  return SP_NO_ERROR;
+}
+
+void sparse_document_free(sparse_document_t *doc)
+{
+  struct s_sparse_arena_block *block = doc->arena;
+
+  while (block != NULL) {
+    struct s_sparse_arena_block *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  free(doc->nodes);
+  free(doc->name_symbols);
+  free(doc->open_nodes);
+  memset(doc, 0, sizeof(*doc));
+}
+
+void sparse_document_fn(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sparse_document_t *doc = (sparse_document_t *)context;
+  const size_t length = (size_t)(end - begin);
+  uint32_t *open;
+  uint32_t index;
+  sparse_node_t *node;
+
+  if (doc->error != SP_NO_ERROR)
+    return;
+
+  open = &doc->open_nodes[(doc->open_depth - 1) * 2];
+
+  switch (msg) {
+  case SP_NAME:
+    index = sp_document_add_node(doc);
+    if (index == SP_NO_NODE)
+      goto sparse_document_no_mem;
+
+    node = &doc->nodes[index];
+    if (doc->symbols != NULL) {
+      uint32_t symbol;
+      size_t symbol_length;
+      if (sparse_symbols_intern(doc->symbols, begin, length, &symbol) != SP_NO_ERROR)
+        goto sparse_document_no_mem;
+      node->name = sparse_symbols_name(doc->symbols, symbol, &symbol_length);
+      node->name_length = (uint32_t)symbol_length;
+      doc->name_symbols[index] = symbol;
+    } else if (length > 0) {
+      node->name = sp_arena_copy(doc, begin, length);
+      if (node->name == NULL)
+        goto sparse_document_no_mem;
+      node->name_length = (uint32_t)length;
+    }
+
+    if (open[1] == SP_NO_NODE)
+      doc->nodes[open[0]].first_child = index;
+    else
+      doc->nodes[open[1]].next_sibling = index;
+    open[1] = index;
+    break;
+
+  case SP_VALUE:
+    node = &doc->nodes[open[1]];
+    node->value = length > 0 ? sp_arena_copy(doc, begin, length) : sp_empty_value;
+    if (node->value == NULL)
+      goto sparse_document_no_mem;
+    node->value_length = (uint32_t)length;
+    break;
+
+  case SP_BEGIN_NODE:
+    if (doc->open_depth == doc->open_capacity) {
+      const size_t capacity = doc->open_capacity * 2;
+      uint32_t *open_nodes = realloc(doc->open_nodes, capacity * 2 * sizeof(*open_nodes));
+      if (open_nodes == NULL)
+        goto sparse_document_no_mem;
+      doc->open_nodes = open_nodes;
+      doc->open_capacity = capacity;
+      open = &doc->open_nodes[(doc->open_depth - 1) * 2];
+    }
+
+    open[2] = open[1];
+    open[3] = SP_NO_NODE;
+    ++doc->open_depth;
+    break;
+
+  case SP_END_NODE:
+    if (doc->open_depth > 1)
+      --doc->open_depth;
+    break;
+
+  default:
+    break;
+  }
+
+  return;
+
+  sparse_document_no_mem:
+  doc->error = SP_ERROR_NO_MEM;
+}
+
+sparse_error_t sparse_begin_document(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_document_t *doc)
+{
+  /* Everything's copied into the arena anyway, so skip the state's buffer. */
+  return sparse_begin(state, initial_buffer_capacity, (sparse_options_t)(options | SP_ZERO_COPY), sparse_document_fn, doc);
+}
+
+sparse_error_t sparse_document_error(const sparse_document_t *doc)
+{
+  return doc->error;
+}
+
+sparse_error_t sparse_document_parse(sparse_document_t *doc, const char *src_begin, const char *src_end, sparse_options_t options)
+{
+  return sparse_document_parse_interned(doc, NULL, src_begin, src_end, options);
+}
+
+sparse_error_t sparse_document_parse_interned(sparse_document_t *doc, sparse_symbols_t *symbols,
+                                              const char *src_begin, const char *src_end, sparse_options_t options)
+{
+  sparse_state_t state;
+  sparse_error_t error = symbols != NULL ? sparse_document_init_interned(doc, symbols) : sparse_document_init(doc);
+
+  if (error != SP_NO_ERROR)
+    return error;
+
+  error = sparse_begin_document(&state, 0, options, doc);
+  if (error != SP_NO_ERROR) {
+    sparse_document_free(doc);
+    return error;
+  }
+
+  error = sparse_run(&state, src_begin, src_end);
+  if (error == SP_NO_ERROR)
+    error = sparse_end(&state);
+  else
+    sparse_end(&state);
+
+  return error != SP_NO_ERROR ? error : doc->error;
+}
+
+const sparse_node_t *sparse_document_node(const sparse_document_t *doc, uint32_t index)
+{
+  return index < doc->num_nodes ? &doc->nodes[index] : NULL;
+}
+
+uint32_t sparse_document_find(const sparse_document_t *doc, uint32_t parent, const char *name, size_t name_length)
+{
+  uint32_t index = doc->nodes[parent].first_child;
+
+  /* Names nobody interned aren't in the document, and the rest only need
+     their symbols compared. */
+  if (doc->symbols != NULL) {
+    const uint32_t symbol = sparse_symbols_find(doc->symbols, name, name_length);
+    return symbol == SP_NO_SYMBOL ? SP_NO_NODE : sparse_document_find_symbol(doc, parent, symbol);
+  }
+
+  for (; index != SP_NO_NODE; index = doc->nodes[index].next_sibling) {
+    const sparse_node_t *node = &doc->nodes[index];
+    if (node->name_length == name_length && memcmp(node->name, name, name_length) == 0)
+      return index;
+  }
+
+  return SP_NO_NODE;
+}
+
+uint32_t sparse_document_symbol(const sparse_document_t *doc, uint32_t index)
+{
+  return doc->name_symbols != NULL && index < doc->num_nodes ? doc->name_symbols[index] : SP_NO_SYMBOL;
+}
+
+uint32_t sparse_document_find_symbol(const sparse_document_t *doc, uint32_t parent, uint32_t symbol)
+{
+  uint32_t index = doc->nodes[parent].first_child;
+
+  if (doc->name_symbols == NULL)
+    return SP_NO_NODE;
+
+  for (; index != SP_NO_NODE; index = doc->nodes[index].next_sibling) {
+    if (doc->name_symbols[index] == symbol)
+      return index;
+  }
+
+  return SP_NO_NODE;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
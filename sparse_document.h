@@ -0,0 +1,90 @@
+#ifndef __CMT_SPARSE_DOCUMENT_H__
+#define __CMT_SPARSE_DOCUMENT_H__
+
+#include "sparse.h"
+#include "sparse_symbols.h"
+#include <stdint.h>
+
+#define SP_NO_NODE ((uint32_t)0xFFFFFFFFu)
+#define SP_DOCUMENT_ROOT ((uint32_t)0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A field in a document. Fields with a value have a non-NULL value (possibly
+  empty) and no children, fields opening a node have a NULL value. Names and
+  values are null-terminated copies owned by the document. Nodes are linked by
+  index into the document's node array, using SP_NO_NODE for no node.
+*/
+typedef struct s_sparse_node {
+  const char *name;
+  const char *value;
+  uint32_t name_length;
+  uint32_t value_length;
+  uint32_t first_child;
+  uint32_t next_sibling;
+} sparse_node_t;
+
+struct s_sparse_arena_block;
+
+typedef struct s_sparse_document {
+  /* nodes[SP_DOCUMENT_ROOT] is a nameless node holding the root fields. */
+  sparse_node_t *nodes;
+  size_t num_nodes;
+  size_t nodes_capacity;
+
+  struct s_sparse_arena_block *arena;
+
+  /* If set, names are interned here instead of being copied into the arena,
+     so node names point into the table, and name_symbols holds each node's
+     symbol alongside nodes. The table has to outlive the document. */
+  sparse_symbols_t *symbols;
+  uint32_t *name_symbols;
+
+  /* Builder state: for each open node, its index and its last child. */
+  uint32_t *open_nodes;
+  size_t open_depth;
+  size_t open_capacity;
+
+  /* Set if the document ran out of memory while being built. */
+  sparse_error_t error;
+} sparse_document_t;
+
+sparse_error_t sparse_document_init(sparse_document_t *doc);
+/* Initializes doc to intern its names into symbols. */
+sparse_error_t sparse_document_init_interned(sparse_document_t *doc, sparse_symbols_t *symbols);
+void sparse_document_free(sparse_document_t *doc);
+
+/*
+  Begins a state that builds doc from the events sparse_run produces. doc must
+  be initialized and should be empty. Check sparse_document_error after running
+  the state for allocation failures in the document itself.
+*/
+sparse_error_t sparse_begin_document(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options, sparse_document_t *doc);
+/* The sparse_fn_t used by sparse_begin_document (context is the document). */
+void sparse_document_fn(sparse_msg_t msg, const char *begin, const char *end, void *context);
+sparse_error_t sparse_document_error(const sparse_document_t *doc);
+
+/* Initializes doc and parses a complete document into it. Free doc
+   afterward, even if this fails. */
+sparse_error_t sparse_document_parse(sparse_document_t *doc, const char *src_begin, const char *src_end, sparse_options_t options);
+/* Same as sparse_document_parse, but interns the document's names into symbols. */
+sparse_error_t sparse_document_parse_interned(sparse_document_t *doc, sparse_symbols_t *symbols,
+                                              const char *src_begin, const char *src_end, sparse_options_t options);
+
+const sparse_node_t *sparse_document_node(const sparse_document_t *doc, uint32_t index);
+/* Returns the index of parent's first child named name, or SP_NO_NODE. */
+uint32_t sparse_document_find(const sparse_document_t *doc, uint32_t parent, const char *name, size_t name_length);
+/* The symbol of the node's name, or SP_NO_SYMBOL if the document doesn't
+   intern its names. */
+uint32_t sparse_document_symbol(const sparse_document_t *doc, uint32_t index);
+/* Same as sparse_document_find for a name's symbol in an interned document. */
+uint32_t sparse_document_find_symbol(const sparse_document_t *doc, uint32_t parent, uint32_t symbol);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_DOCUMENT_H__ include guard */
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_document.h"
+
+static void print_node(const sparse_document_t *doc, uint32_t index, int indent);
+static int expect_value(const sparse_document_t *doc, const char *const *path, size_t path_length, const char *expected);
+
+static void print_node(const sparse_document_t *doc, uint32_t index, int indent)
+{
+  const sparse_node_t *node = sparse_document_node(doc, index);
+  uint32_t child;
+
+  if (node->value != NULL) {
+    printf("%*s[%s] = [%s]\n", indent, "", node->name, node->value);
+    return;
+  }
+
+  printf("%*s[%s] {\n", indent, "", node->name);
+  for (child = node->first_child; child != SP_NO_NODE; child = sparse_document_node(doc, child)->next_sibling)
+    print_node(doc, child, indent + 2);
+  printf("%*s}\n", indent, "");
+}
+
+/* Follows path from the root and compares the value found with expected. */
+static int expect_value(const sparse_document_t *doc, const char *const *path, size_t path_length, const char *expected)
+{
+  uint32_t index = SP_DOCUMENT_ROOT;
+  size_t path_index;
+  const sparse_node_t *node;
+
+  for (path_index = 0; path_index < path_length && index != SP_NO_NODE; ++path_index)
+    index = sparse_document_find(doc, index, path[path_index], strlen(path[path_index]));
+
+  node = index == SP_NO_NODE ? NULL : sparse_document_node(doc, index);
+  if (node == NULL || node->value == NULL || strcmp(node->value, expected) != 0) {
+    fprintf(stderr, "Expected [%s] at %s/...\n", expected, path[0]);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "# This is a named root node (technically just a field with a node value):\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    # Incidentally, #s begin comments\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  clamp_v\n"
+    "}\n"
+    "\n"
+    "# And this is a nameless root node (requires SP_NAMELESS_ROOT_NODES):\n"
+    "{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "\n"
+    "# And you can just pop down stuff anywhere in the root, really\n"
+    "fullscreen\n"
+    "fov 100\n"
+    "\n"
+    "# Semicolons can terminate a value and tell the parser to go onto a new field\n"
+    "width 800; height 600\n";
+
+  static const char *const map_path[] = { "materials/base/fl_tile1", "0", "map" };
+  static const char *const clamp_path[] = { "materials/base/fl_tile1", "clamp_v" };
+  static const char *const nameless_path[] = { "", "reason_for_using" };
+  static const char *const height_path[] = { "height" };
+
+  sparse_document_t doc;
+  sparse_options_t options = SP_CONSUME_WHITESPACE | SP_TRIM_TRAILING_SPACES | SP_NAMELESS_ROOT_NODES;
+  int failures = 0;
+
+  if (sparse_document_parse(&doc, test_string, NULL, options) != SP_NO_ERROR) {
+    fprintf(stderr, "Failed to parse document.\n");
+    return 1;
+  }
+
+  print_node(&doc, SP_DOCUMENT_ROOT, 0);
+
+  failures += expect_value(&doc, map_path, 3, "textures/base/fl_tile1.png");
+  failures += expect_value(&doc, clamp_path, 2, "");
+  failures += expect_value(&doc, nameless_path, 2, "none");
+  failures += expect_value(&doc, height_path, 1, "600");
+
+  sparse_document_free(&doc);
+
+  if (sparse_document_parse(&doc, "unclosed {\n  node\n", NULL, options) != SP_ERROR_INCOMPLETE_DOCUMENT) {
+    fprintf(stderr, "Expected an incomplete document.\n");
+    ++failures;
+  }
+  sparse_document_free(&doc);
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sparse_file.h"
+#include "sparse_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SP_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_FILE_READ_SIZE (64 * 1024)
+
+static const char *sp_errstr_open = "Could not open file.";
+static const char *sp_errstr_read = "Could not read file.";
+static const char *sp_errstr_no_mem = "Could not allocate memory for file buffer.";
+
+static sparse_error_t sp_file_error(sparse_state_t *state, const char *message)
+{
+  sp_send_error(state, message, message + strlen(message));
+  return SP_ERROR_IO;
+}
+
+/* Reads the stream in SP_FILE_READ_SIZE pieces. */
+static sparse_error_t sp_parse_stream(sparse_state_t *state, FILE *stream)
+{
+  sparse_error_t error = SP_NO_ERROR;
+  char *read_buffer = (char *)malloc(SP_FILE_READ_SIZE);
+  size_t read_size;
+
+  if (read_buffer == NULL) {
+    sp_send_error(state, sp_errstr_no_mem, sp_errstr_no_mem + strlen(sp_errstr_no_mem));
+    return SP_ERROR_NO_MEM;
+  }
+
+  while (error == SP_NO_ERROR && (read_size = fread(read_buffer, 1, SP_FILE_READ_SIZE, stream)) > 0)
+    error = sparse_run(state, read_buffer, read_buffer + read_size);
+
+  if (error == SP_NO_ERROR && ferror(stream))
+    error = sp_file_error(state, sp_errstr_read);
+
+  sp_detach_error(state, read_buffer, read_buffer + SP_FILE_READ_SIZE);
+  free(read_buffer);
+  return error;
+}
+
+#ifdef SP_FILE_MMAP
+
+static sparse_error_t sp_parse_mapped(sparse_state_t *state, int fd, size_t file_size)
+{
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t window_size = (SP_FILE_WINDOW_SIZE + page_size - 1) / page_size * page_size;
+  sparse_error_t error = SP_NO_ERROR;
+  size_t offset;
+
+  for (offset = 0; error == SP_NO_ERROR && offset < file_size; offset += window_size) {
+    const size_t length = file_size - offset < window_size ? file_size - offset : window_size;
+    const char *window = (const char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+
+    if (window == (const char *)MAP_FAILED)
+      return sp_file_error(state, sp_errstr_read);
+
+    posix_madvise((void *)window, length, POSIX_MADV_SEQUENTIAL);
+    posix_madvise((void *)window, length, POSIX_MADV_WILLNEED);
+
+    /* sparse_run copies any token still open at the end of the window into
+       its buffer, and an error found in it is copied out, so nothing points
+       into the window once it's unmapped. */
+    error = sparse_run(state, window, window + length);
+    sp_detach_error(state, window, window + length);
+
+    munmap((void *)window, length);
+  }
+
+  return error;
+}
+
+sparse_error_t sparse_parse_file(sparse_state_t *state, const char *path)
+{
+  struct stat info;
+  sparse_error_t error;
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1)
+    return sp_file_error(state, sp_errstr_open);
+
+  if (fstat(fd, &info) != 0) {
+    error = sp_file_error(state, sp_errstr_read);
+  } else if (S_ISREG(info.st_mode)) {
+    error = sp_parse_mapped(state, fd, (size_t)info.st_size);
+  } else {
+    FILE *stream = fdopen(fd, "rb");
+    if (stream == NULL) {
+      error = sp_file_error(state, sp_errstr_open);
+    } else {
+      error = sp_parse_stream(state, stream);
+      fclose(stream);
+      return error;
+    }
+  }
+
+  close(fd);
+  return error;
+}
+
+#else
+
+sparse_error_t sparse_parse_file(sparse_state_t *state, const char *path)
+{
+  sparse_error_t error;
+  FILE *stream = fopen(path, "rb");
+
+  if (stream == NULL)
+    return sp_file_error(state, sp_errstr_open);
+
+  error = sp_parse_stream(state, stream);
+  fclose(stream);
+  return error;
+}
+
+#endif /* SP_FILE_MMAP */
+
+sparse_error_t sp_parse_whole_file(sparse_state_t *state, const char *path)
+{
+  sparse_error_t error = sparse_parse_file(state, path);
+
+  if (error == SP_NO_ERROR)
+    return sparse_end(state);
+
+  state->callback = NULL;
+  sparse_end(state);
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
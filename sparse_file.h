@@ -0,0 +1,31 @@
+#ifndef __CMT_SPARSE_FILE_H__
+#define __CMT_SPARSE_FILE_H__
+
+#include "sparse.h"
+
+/* Size of each piece of a file mapped and parsed at once (rounded up to a
+   multiple of the page size). */
+#ifndef SP_FILE_WINDOW_SIZE
+#define SP_FILE_WINDOW_SIZE (32 * 1024 * 1024)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Runs the file at path through sparse_run without reading it into memory
+  first. Regular files are mapped one window at a time, with each window
+  unmapped before the next is mapped, so files larger than memory can be
+  parsed. Anything else (pipes and so on) and platforms without mmap are read
+  in pieces instead. Like sparse_run, this doesn't end the state, so call
+  sparse_end afterward. Returns SP_ERROR_IO if the file can't be opened or
+  read.
+*/
+sparse_error_t sparse_parse_file(sparse_state_t *state, const char *path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_FILE_H__ include guard */
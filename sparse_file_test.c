@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sparse_file.h"
+
+/*
+  Build with a small window, e.g. -DSP_FILE_WINDOW_SIZE=1, so the test file
+  spans several windows and tokens get cut at window boundaries.
+*/
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static sparse_error_t log_file_events(event_log_t *log, const char *path, sparse_options_t options);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static sparse_error_t log_file_events(event_log_t *log, const char *path, sparse_options_t options)
+{
+  sparse_state_t state;
+  sparse_error_t error;
+
+  log->size = 0;
+  sparse_begin(&state, 0, options, log_event, log);
+  error = sparse_parse_file(&state, path);
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  return error;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    # Incidentally, #s begin comments\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  escaped\\ name a\\tvalue\\ \n"
+    "}\n"
+    "width 800; height 600\n";
+
+  const sparse_options_t options = (sparse_options_t)(SP_TRIM_TRAILING_SPACES | SP_ZERO_COPY);
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t actual = { NULL, 0, 0 };
+  char path[] = "/tmp/sparse_file_test_XXXXXX";
+  char *src;
+  size_t src_size = 0;
+  int failures = 0;
+  int fd = mkstemp(path);
+  FILE *file;
+
+  if (fd == -1) {
+    fprintf(stderr, "Could not create a temporary file.\n");
+    return 1;
+  }
+
+  /* Several pages' worth, at an odd length so windows end mid-token. */
+  src = malloc(strlen(test_string) * 200 + 1);
+  src[0] = '\0';
+  while (src_size < strlen(test_string) * 200) {
+    strcat(src, test_string);
+    src_size += strlen(test_string);
+  }
+
+  file = fdopen(fd, "wb");
+  fwrite(src, 1, src_size, file);
+  fclose(file);
+
+  {
+    sparse_state_t state;
+    sparse_begin(&state, 0, options, log_event, &expected);
+    sparse_run(&state, src, src + src_size);
+    sparse_end(&state);
+  }
+
+  if (log_file_events(&actual, path, options) != SP_NO_ERROR
+      || actual.size != expected.size || memcmp(actual.data, expected.data, actual.size) != 0) {
+    fprintf(stderr, "Events from the file differ from the string's.\n");
+    ++failures;
+  }
+
+  if (log_file_events(&actual, "/dev/null", options) != SP_NO_ERROR || actual.size != 0) {
+    fprintf(stderr, "Expected no events from /dev/null.\n");
+    ++failures;
+  }
+
+  /* The file is gone by the time an invalid char can be read back, so the
+     state has to keep its own copy. */
+  file = fopen(path, "wb");
+  fputs("a {\n b c\n}\n}\n", file);
+  fclose(file);
+  {
+    sparse_state_t state;
+    sparse_begin(&state, 0, options, NULL, NULL);
+    if (sparse_parse_file(&state, path) != SP_ERROR_INVALID_CHAR
+        || state.error_end - state.error_begin != 1 || *state.error_begin != '}') {
+      fprintf(stderr, "Expected the invalid character to outlive the file's window.\n");
+      ++failures;
+    }
+    sparse_end(&state);
+  }
+
+  unlink(path);
+
+  if (log_file_events(&actual, path, options) != SP_ERROR_IO) {
+    fprintf(stderr, "Expected an IO error for a missing file.\n");
+    ++failures;
+  }
+
+  free(src);
+  free(expected.data);
+  free(actual.data);
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,441 @@
+#include "sparse_incremental.h"
+#include "sparse_internal.h"
+#include "sparse_split.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The part of the document being parsed again and the roots found in it. */
+typedef struct s_sp_reparse {
+  sparse_incremental_t *inc;
+
+  sparse_root_t *roots;
+  size_t num_roots;
+  size_t roots_capacity;
+
+  /* Roots from first_open on are in the range being read. */
+  size_t range_begin;
+  size_t first_open;
+  size_t depth;
+
+  sparse_fn_t callback;
+  void *context;
+
+  /* Set if the roots or names couldn't grow. */
+  sparse_error_t error;
+} sp_reparse_t;
+
+/* For matching the roots an edit replaced with the ones that replaced them. */
+typedef struct s_sp_root_item {
+  const char *name;
+  size_t name_length;
+  uint64_t hash;
+  size_t order;
+} sp_root_item_t;
+
+static int sp_compare_names(const char *left, size_t left_length, const char *right, size_t right_length)
+{
+  const size_t length = left_length < right_length ? left_length : right_length;
+  const int order = length == 0 ? 0 : memcmp(left, right, length);
+  if (order != 0)
+    return order;
+  return left_length < right_length ? -1 : (left_length > right_length ? 1 : 0);
+}
+
+static int sp_compare_root_items(const void *left, const void *right)
+{
+  const sp_root_item_t *left_item = (const sp_root_item_t *)left;
+  const sp_root_item_t *right_item = (const sp_root_item_t *)right;
+  const int order = sp_compare_names(left_item->name, left_item->name_length, right_item->name, right_item->name_length);
+
+  if (order != 0)
+    return order;
+  return left_item->order < right_item->order ? -1 : (left_item->order > right_item->order ? 1 : 0);
+}
+
+static int sp_append_name(sparse_incremental_t *inc, const char *name, size_t length)
+{
+  if (inc->names_size + length > inc->names_capacity) {
+    size_t capacity = inc->names_capacity == 0 ? 1024 : inc->names_capacity * 2;
+    char *names;
+    while (capacity < inc->names_size + length)
+      capacity *= 2;
+    names = (char *)realloc(inc->names, capacity);
+    if (names == NULL)
+      return 0;
+    inc->names = names;
+    inc->names_capacity = capacity;
+  }
+
+  if (length > 0)
+    memcpy(inc->names + inc->names_size, name, length);
+  inc->names_size += length;
+  return 1;
+}
+
+static void sp_reparse_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sp_reparse_t *reparse = (sp_reparse_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  const unsigned char msg_byte = (unsigned char)msg;
+  sparse_root_t *root;
+
+  if (reparse->callback != NULL)
+    reparse->callback(msg, begin, end, reparse->context);
+
+  if (msg == SP_ERROR || reparse->error != SP_NO_ERROR)
+    return;
+
+  if (msg == SP_NAME && reparse->depth == 0) {
+    if (reparse->num_roots == reparse->roots_capacity) {
+      const size_t capacity = reparse->roots_capacity == 0 ? 16 : reparse->roots_capacity * 2;
+      sparse_root_t *roots = (sparse_root_t *)realloc(reparse->roots, capacity * sizeof(*roots));
+      if (roots == NULL) {
+        reparse->error = SP_ERROR_NO_MEM;
+        return;
+      }
+      reparse->roots = roots;
+      reparse->roots_capacity = capacity;
+    }
+
+    root = &reparse->roots[reparse->num_roots++];
+    root->range_begin = reparse->range_begin;
+    root->range_end = reparse->range_begin;
+    root->hash = SP_HASH_SEED;
+    root->name_offset = reparse->inc->names_size;
+    root->name_length = length;
+
+    if (!sp_append_name(reparse->inc, begin, length)) {
+      reparse->error = SP_ERROR_NO_MEM;
+      return;
+    }
+  }
+
+  /* Anything before the first root (which could only be an error) is left
+     out. */
+  if (reparse->num_roots == 0)
+    return;
+
+  root = &reparse->roots[reparse->num_roots - 1];
+  root->hash = sp_hash(root->hash, (const char *)&msg_byte, (const char *)&msg_byte + 1);
+  root->hash = sp_hash(root->hash, (const char *)&length, (const char *)&length + sizeof(length));
+  root->hash = sp_hash(root->hash, begin, end);
+
+  if (msg == SP_BEGIN_NODE)
+    ++reparse->depth;
+  else if (msg == SP_END_NODE && reparse->depth > 0)
+    --reparse->depth;
+}
+
+/* Closes the range being read at range_end and starts the next one there. */
+static void sp_reparse_end_range(sp_reparse_t *reparse, size_t range_end)
+{
+  size_t index;
+
+  for (index = reparse->first_open; index < reparse->num_roots; ++index)
+    reparse->roots[index].range_end = range_end;
+
+  reparse->first_open = reparse->num_roots;
+  reparse->range_begin = range_end;
+}
+
+/* Index of the first root whose range begins at or after offset. */
+static size_t sp_first_root_from(const sparse_incremental_t *inc, size_t offset)
+{
+  size_t low = 0;
+  size_t high = inc->num_roots;
+
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (inc->roots[middle].range_begin < offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+/* True if the old document was cut at offset, so its state there was a fresh
+   one. */
+static int sp_is_boundary(const sparse_incremental_t *inc, size_t offset)
+{
+  const size_t index = sp_first_root_from(inc, offset);
+
+  return offset == inc->size
+    || (index < inc->num_roots && inc->roots[index].range_begin == offset)
+    || (index > 0 && inc->roots[index - 1].range_end == offset);
+}
+
+/*
+  Where to start parsing again: the last place before the edit that the old
+  document was cut. The end of the last range only counts if a newline ended
+  it, not the end of the document.
+*/
+static size_t sp_restart_offset(const sparse_incremental_t *inc, size_t edit_begin)
+{
+  const size_t index = sp_first_root_from(inc, edit_begin + 1);
+  const sparse_root_t *root;
+
+  if (index == 0)
+    return 0;
+
+  root = &inc->roots[index - 1];
+  if (root->range_end <= edit_begin && root->range_end < inc->size)
+    return root->range_end;
+  return root->range_begin;
+}
+
+/*
+  Parses src from start until it's cut at a root newline that lines up with
+  one in the old document, or until the end. Stores the old document's offset
+  where it lined up in *old_stop.
+*/
+static sparse_error_t sp_reparse_run(sp_reparse_t *reparse, const char *src, size_t size, size_t start,
+                                     const sparse_edit_t *edit, size_t *old_stop)
+{
+  const sparse_incremental_t *inc = reparse->inc;
+  const char *src_end = src + size;
+  const char *src_iter = src + start;
+  const char *split;
+  sparse_splitter_t splitter;
+  sparse_state_t state;
+  sparse_error_t error;
+
+  error = sparse_begin(&state, 0, inc->options, sp_reparse_event, reparse);
+  if (error != SP_NO_ERROR) {
+    *old_stop = inc->size;
+    return error;
+  }
+
+  sparse_splitter_init(&splitter);
+  reparse->range_begin = start;
+
+  while ((split = sparse_splitter_next(&splitter, src_iter, src_end, src_iter)) != NULL) {
+    const size_t offset = (size_t)(split - src);
+
+    error = sparse_run(&state, src_iter, split);
+    if (error != SP_NO_ERROR)
+      break;
+
+    sp_reparse_end_range(reparse, offset);
+    src_iter = split;
+
+    /* Everything from here on is the same as it was, and so is the state. */
+    if (offset >= edit->new_end && sp_is_boundary(inc, offset - edit->new_end + edit->old_end)) {
+      *old_stop = offset - edit->new_end + edit->old_end;
+      state.callback = NULL;
+      sparse_end(&state);
+      return reparse->error;
+    }
+  }
+
+  if (error == SP_NO_ERROR && src_iter != src_end)
+    error = sparse_run(&state, src_iter, src_end);
+
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  sp_reparse_end_range(reparse, size);
+  *old_stop = inc->size;
+  return error != SP_NO_ERROR ? error : reparse->error;
+}
+
+/* Matches the old roots to the new ones by name and reports the differences. */
+static sparse_error_t sp_report_changes(const sparse_incremental_t *inc, const sparse_root_t *old_roots, size_t num_old,
+                                        const sparse_root_t *new_roots, size_t num_new,
+                                        sparse_change_fn_t change_fn, void *change_context)
+{
+  sp_root_item_t *items = (sp_root_item_t *)malloc((num_old + num_new + 1) * sizeof(*items));
+  sp_root_item_t *old_items = items;
+  sp_root_item_t *new_items = items + num_old;
+  size_t old_index = 0;
+  size_t new_index = 0;
+  size_t index;
+
+  if (items == NULL)
+    return SP_ERROR_NO_MEM;
+
+  for (index = 0; index < num_old + num_new; ++index) {
+    const sparse_root_t *root = index < num_old ? &old_roots[index] : &new_roots[index - num_old];
+    items[index].name = inc->names + root->name_offset;
+    items[index].name_length = root->name_length;
+    items[index].hash = root->hash;
+    items[index].order = index;
+  }
+
+  qsort(old_items, num_old, sizeof(*items), sp_compare_root_items);
+  qsort(new_items, num_new, sizeof(*items), sp_compare_root_items);
+
+  while (old_index < num_old || new_index < num_new) {
+    const sp_root_item_t *old_item = &old_items[old_index];
+    const sp_root_item_t *new_item = &new_items[new_index];
+    const int order = old_index == num_old ? 1
+      : new_index == num_new ? -1
+      : sp_compare_names(old_item->name, old_item->name_length, new_item->name, new_item->name_length);
+
+    if (order < 0) {
+      change_fn(SP_ROOT_REMOVED, old_item->name, old_item->name_length, change_context);
+      ++old_index;
+    } else if (order > 0) {
+      change_fn(SP_ROOT_ADDED, new_item->name, new_item->name_length, change_context);
+      ++new_index;
+    } else {
+      if (old_item->hash != new_item->hash)
+        change_fn(SP_ROOT_CHANGED, new_item->name, new_item->name_length, change_context);
+      ++old_index;
+      ++new_index;
+    }
+  }
+
+  free(items);
+  return SP_NO_ERROR;
+}
+
+/* Drops names no root uses any more once they outweigh the ones in use. */
+static void sp_compact_names(sparse_incremental_t *inc)
+{
+  const size_t capacity = inc->names_size - inc->names_garbage + 1;
+  char *names;
+  size_t size = 0;
+  size_t index;
+
+  if (inc->names_garbage <= inc->names_size / 2)
+    return;
+
+  names = (char *)malloc(capacity);
+  if (names == NULL)
+    return;
+
+  for (index = 0; index < inc->num_roots; ++index) {
+    sparse_root_t *root = &inc->roots[index];
+    if (root->name_length > 0)
+      memcpy(names + size, inc->names + root->name_offset, root->name_length);
+    root->name_offset = size;
+    size += root->name_length;
+  }
+
+  free(inc->names);
+  inc->names = names;
+  inc->names_size = size;
+  inc->names_capacity = capacity;
+  inc->names_garbage = 0;
+}
+
+sparse_error_t sparse_incremental_update(sparse_incremental_t *inc, const char *src, size_t size, const sparse_edit_t *edit,
+                                         sparse_fn_t callback, void *context,
+                                         sparse_change_fn_t change_fn, void *change_context)
+{
+  const size_t names_size = inc->names_size;
+  sparse_edit_t whole = { 0, 0, 0 };
+  sp_reparse_t reparse;
+  size_t first_old;
+  size_t end_old;
+  size_t old_stop;
+  size_t num_roots;
+  size_t index;
+  size_t start;
+  sparse_error_t error;
+
+  /* An edit that doesn't fit the two documents is taken to be all of it. */
+  if (edit->begin > edit->old_end || edit->old_end > inc->size || edit->begin > edit->new_end
+      || edit->new_end > size || size - edit->new_end != inc->size - edit->old_end) {
+    whole.old_end = inc->size;
+    whole.new_end = size;
+    edit = &whole;
+  }
+
+  memset(&reparse, 0, sizeof(reparse));
+  reparse.inc = inc;
+  reparse.callback = callback;
+  reparse.context = context;
+  reparse.error = SP_NO_ERROR;
+
+  start = sp_restart_offset(inc, edit->begin);
+  error = sp_reparse_run(&reparse, src, size, start, edit, &old_stop);
+
+  first_old = sp_first_root_from(inc, start);
+  end_old = sp_first_root_from(inc, old_stop);
+  num_roots = inc->num_roots - (end_old - first_old) + reparse.num_roots;
+
+  if (error == SP_NO_ERROR && change_fn != NULL)
+    error = sp_report_changes(inc, inc->roots + first_old, end_old - first_old,
+                              reparse.roots, reparse.num_roots, change_fn, change_context);
+
+  if (error == SP_NO_ERROR && num_roots > inc->roots_capacity) {
+    size_t capacity = inc->roots_capacity == 0 ? 16 : inc->roots_capacity * 2;
+    sparse_root_t *roots;
+    while (capacity < num_roots)
+      capacity *= 2;
+    roots = (sparse_root_t *)realloc(inc->roots, capacity * sizeof(*roots));
+    if (roots == NULL) {
+      error = SP_ERROR_NO_MEM;
+    } else {
+      inc->roots = roots;
+      inc->roots_capacity = capacity;
+    }
+  }
+
+  if (error != SP_NO_ERROR) {
+    inc->names_size = names_size;
+    free(reparse.roots);
+    return error;
+  }
+
+  for (index = first_old; index < end_old; ++index)
+    inc->names_garbage += inc->roots[index].name_length;
+
+  /* Replace the roots that were parsed again, and move the ones after them to
+     where they are in the new document. */
+  if (end_old - first_old != reparse.num_roots)
+    memmove(inc->roots + first_old + reparse.num_roots, inc->roots + end_old,
+            (inc->num_roots - end_old) * sizeof(*inc->roots));
+  if (reparse.num_roots > 0)
+    memcpy(inc->roots + first_old, reparse.roots, reparse.num_roots * sizeof(*inc->roots));
+
+  if (edit->new_end != edit->old_end) {
+    for (index = first_old + reparse.num_roots; index < num_roots; ++index) {
+      inc->roots[index].range_begin = inc->roots[index].range_begin - edit->old_end + edit->new_end;
+      inc->roots[index].range_end = inc->roots[index].range_end - edit->old_end + edit->new_end;
+    }
+  }
+
+  inc->num_roots = num_roots;
+  inc->size = size;
+  free(reparse.roots);
+
+  sp_compact_names(inc);
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_incremental_parse(sparse_incremental_t *inc, const char *src, size_t size, sparse_options_t options,
+                                        sparse_fn_t callback, void *context)
+{
+  sparse_edit_t edit;
+
+  memset(inc, 0, sizeof(*inc));
+  inc->options = options;
+
+  edit.begin = 0;
+  edit.old_end = 0;
+  edit.new_end = size;
+  return sparse_incremental_update(inc, src, size, &edit, callback, context, NULL, NULL);
+}
+
+void sparse_incremental_free(sparse_incremental_t *inc)
+{
+  free(inc->roots);
+  free(inc->names);
+  memset(inc, 0, sizeof(*inc));
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
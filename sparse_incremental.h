@@ -0,0 +1,92 @@
+#ifndef __CMT_SPARSE_INCREMENTAL_H__
+#define __CMT_SPARSE_INCREMENTAL_H__
+
+#include "sparse.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  SP_ROOT_ADDED =   1,
+  SP_ROOT_REMOVED = 2,
+  SP_ROOT_CHANGED = 3
+} sparse_change_t;
+
+/* Reports a root field that an edit added, removed or changed. */
+typedef void (*sparse_change_fn_t)(sparse_change_t change, const char *name, size_t name_length, void *context);
+
+/*
+  An edit to a document: the bytes from begin to old_end were replaced with
+  the bytes from begin to new_end.
+*/
+typedef struct s_sparse_edit {
+  size_t begin;
+  size_t old_end;
+  size_t new_end;
+} sparse_edit_t;
+
+/*
+  A root field, the range of the document it's in, and a hash of its events,
+  so edits to whitespace and comments don't count as changes.
+*/
+typedef struct s_sparse_root {
+  size_t range_begin;
+  size_t range_end;
+  uint64_t hash;
+  size_t name_offset;
+  size_t name_length;
+} sparse_root_t;
+
+/*
+  What's needed to re-parse a document after an edit without starting over:
+  where each root field is and what it held. Ranges are cut at root
+  newlines (see sparse_split.h), where a parser's state is the same as a fresh
+  one, so those are the points to restart from and to stop at. An update only
+  parses from the last of those before the edit to the first one after it
+  where the new document lines up with the old one, so it costs about as much
+  as the ranges the edit touched, whatever the size of the document.
+*/
+typedef struct s_sparse_incremental {
+  sparse_options_t options;
+  size_t size;
+
+  sparse_root_t *roots;
+  size_t num_roots;
+  size_t roots_capacity;
+
+  /* Root names, one after another. Names of roots that were replaced stay
+     until there's more of them than of live names. */
+  char *names;
+  size_t names_size;
+  size_t names_capacity;
+  size_t names_garbage;
+} sparse_incremental_t;
+
+/*
+  Parses a whole document with options, sending its events to callback (which
+  may be NULL), and records where its root fields are. Free inc with
+  sparse_incremental_free whatever this returns.
+*/
+sparse_error_t sparse_incremental_parse(sparse_incremental_t *inc, const char *src, size_t size, sparse_options_t options,
+                                        sparse_fn_t callback, void *context);
+
+/*
+  Re-parses src, the document inc was last given with edit applied, and
+  sends callback the events of just the part that was parsed again, which
+  always covers whole root fields. Then sends change_fn each root field that
+  was added, removed or changed, matching root fields by name. If parsing
+  fails, inc is left describing the document as it was before the edit.
+*/
+sparse_error_t sparse_incremental_update(sparse_incremental_t *inc, const char *src, size_t size, const sparse_edit_t *edit,
+                                         sparse_fn_t callback, void *context,
+                                         sparse_change_fn_t change_fn, void *change_context);
+
+void sparse_incremental_free(sparse_incremental_t *inc);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_INCREMENTAL_H__ include guard */
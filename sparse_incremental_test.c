@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_incremental.h"
+
+#define MAX_CHANGES (256)
+#define NUM_EDITS (3000)
+
+typedef struct s_change_log {
+  char entries[MAX_CHANGES][64];
+  size_t num_entries;
+} change_log_t;
+
+typedef struct s_event_count {
+  size_t depth;
+  size_t roots;
+} event_count_t;
+
+static void log_change(sparse_change_t change, const char *name, size_t name_length, void *context);
+static void count_roots(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static int compare_entries(const void *left, const void *right);
+static void expected_changes(const sparse_incremental_t *before, const sparse_incremental_t *after, change_log_t *log);
+static int same_roots(const sparse_incremental_t *left, const sparse_incremental_t *right);
+static int has_duplicates(const sparse_incremental_t *inc);
+static int check_update(sparse_incremental_t *inc, const char *old_src, const char *new_src, const sparse_edit_t *edit,
+                        size_t max_roots_parsed, sparse_error_t *result);
+static int check_random_edits(void);
+
+static void log_change(sparse_change_t change, const char *name, size_t name_length, void *context)
+{
+  change_log_t *log = (change_log_t *)context;
+  if (log->num_entries < MAX_CHANGES)
+    snprintf(log->entries[log->num_entries++], sizeof(log->entries[0]), "%d:%.*s", (int)change, (int)name_length, name);
+}
+
+static void count_roots(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_count_t *count = (event_count_t *)context;
+  (void)begin; (void)end;
+
+  if (msg == SP_NAME && count->depth == 0)
+    ++count->roots;
+  else if (msg == SP_BEGIN_NODE)
+    ++count->depth;
+  else if (msg == SP_END_NODE && count->depth > 0)
+    --count->depth;
+}
+
+static int compare_entries(const void *left, const void *right)
+{
+  return strcmp((const char *)left, (const char *)right);
+}
+
+/* The changes between two documents whose root names are all different. */
+static void expected_changes(const sparse_incremental_t *before, const sparse_incremental_t *after, change_log_t *log)
+{
+  size_t index;
+  size_t other;
+
+  for (index = 0; index < before->num_roots; ++index) {
+    const sparse_root_t *root = &before->roots[index];
+    for (other = 0; other < after->num_roots; ++other) {
+      const sparse_root_t *match = &after->roots[other];
+      if (match->name_length == root->name_length
+          && memcmp(after->names + match->name_offset, before->names + root->name_offset, root->name_length) == 0)
+        break;
+    }
+
+    if (other == after->num_roots)
+      log_change(SP_ROOT_REMOVED, before->names + root->name_offset, root->name_length, log);
+    else if (after->roots[other].hash != root->hash)
+      log_change(SP_ROOT_CHANGED, before->names + root->name_offset, root->name_length, log);
+  }
+
+  for (index = 0; index < after->num_roots; ++index) {
+    const sparse_root_t *root = &after->roots[index];
+    for (other = 0; other < before->num_roots; ++other) {
+      const sparse_root_t *match = &before->roots[other];
+      if (match->name_length == root->name_length
+          && memcmp(before->names + match->name_offset, after->names + root->name_offset, root->name_length) == 0)
+        break;
+    }
+
+    if (other == before->num_roots)
+      log_change(SP_ROOT_ADDED, after->names + root->name_offset, root->name_length, log);
+  }
+}
+
+static int same_roots(const sparse_incremental_t *left, const sparse_incremental_t *right)
+{
+  size_t index;
+
+  if (left->num_roots != right->num_roots || left->size != right->size)
+    return 0;
+
+  for (index = 0; index < left->num_roots; ++index) {
+    const sparse_root_t *left_root = &left->roots[index];
+    const sparse_root_t *right_root = &right->roots[index];
+    if (left_root->range_begin != right_root->range_begin || left_root->range_end != right_root->range_end
+        || left_root->hash != right_root->hash || left_root->name_length != right_root->name_length
+        || memcmp(left->names + left_root->name_offset, right->names + right_root->name_offset, left_root->name_length) != 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+static int has_duplicates(const sparse_incremental_t *inc)
+{
+  size_t index;
+  size_t other;
+
+  for (index = 0; index < inc->num_roots; ++index) {
+    for (other = index + 1; other < inc->num_roots; ++other) {
+      if (inc->roots[index].name_length == inc->roots[other].name_length
+          && memcmp(inc->names + inc->roots[index].name_offset, inc->names + inc->roots[other].name_offset,
+                    inc->roots[index].name_length) == 0)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Applies an edit to inc and checks it ends up the same as parsing new_src
+  from scratch, that it reports the same changes as comparing the two, and, if
+  max_roots_parsed isn't 0, that it parsed no more than that many roots again.
+*/
+static int check_update(sparse_incremental_t *inc, const char *old_src, const char *new_src, const sparse_edit_t *edit,
+                        size_t max_roots_parsed, sparse_error_t *result)
+{
+  sparse_incremental_t before;
+  sparse_incremental_t after;
+  change_log_t changes;
+  change_log_t expected;
+  event_count_t count = { 0, 0 };
+  sparse_error_t error;
+  sparse_error_t full_error;
+  int failures = 0;
+
+  sparse_incremental_parse(&before, old_src, strlen(old_src), inc->options, NULL, NULL);
+  full_error = sparse_incremental_parse(&after, new_src, strlen(new_src), inc->options, NULL, NULL);
+
+  memset(&changes, 0, sizeof(changes));
+  memset(&expected, 0, sizeof(expected));
+  error = sparse_incremental_update(inc, new_src, strlen(new_src), edit, count_roots, &count, log_change, &changes);
+  if (result != NULL)
+    *result = error;
+
+  if (error != full_error) {
+    fprintf(stderr, "Update gave error %d, parsing gave %d:\n%s\n", (int)error, (int)full_error, new_src);
+    ++failures;
+  } else if (error != SP_NO_ERROR) {
+    if (!same_roots(inc, &before)) {
+      fprintf(stderr, "A failed update changed the roots:\n%s\n", new_src);
+      ++failures;
+    }
+  } else if (!same_roots(inc, &after)) {
+    fprintf(stderr, "Updated roots differ from parsing:\n%s\n", new_src);
+    ++failures;
+  } else if (max_roots_parsed > 0 && count.roots > max_roots_parsed) {
+    fprintf(stderr, "Parsed %zu roots again, expected at most %zu.\n", count.roots, max_roots_parsed);
+    ++failures;
+  } else if (!has_duplicates(&before) && !has_duplicates(&after)) {
+    expected_changes(&before, &after, &expected);
+    qsort(changes.entries, changes.num_entries, sizeof(changes.entries[0]), compare_entries);
+    qsort(expected.entries, expected.num_entries, sizeof(expected.entries[0]), compare_entries);
+    if (changes.num_entries != expected.num_entries
+        || memcmp(changes.entries, expected.entries, changes.num_entries * sizeof(changes.entries[0])) != 0) {
+      size_t entry;
+      fprintf(stderr, "Reported %zu changes, expected %zu:\n%s\n", changes.num_entries, expected.num_entries, new_src);
+      for (entry = 0; entry < changes.num_entries; ++entry)
+        fprintf(stderr, "  got %s\n", changes.entries[entry]);
+      for (entry = 0; entry < expected.num_entries; ++entry)
+        fprintf(stderr, "  expected %s\n", expected.entries[entry]);
+      ++failures;
+    }
+  }
+
+  sparse_incremental_free(&before);
+  sparse_incremental_free(&after);
+  return failures;
+}
+
+/* Random edits, many of which break the document, to a document with every
+   kind of root field. */
+static int check_random_edits(void)
+{
+  static const char inserts[] = "ab {}#;\\\n";
+  char *src = (char *)malloc(65536);
+  char *edited = (char *)malloc(65536);
+  unsigned long seed = 12345;
+  sparse_incremental_t inc;
+  sparse_error_t error;
+  size_t size = 0;
+  int failures = 0;
+  int index;
+
+  for (index = 0; index < 40; ++index) {
+    switch (index % 4) {
+    case 0: size += (size_t)sprintf(src + size, "field%d value %d\n", index, index); break;
+    case 1: size += (size_t)sprintf(src + size, "node%d {\n  a 1\n  b { c %d }\n}\n", index, index); break;
+    case 2: size += (size_t)sprintf(src + size, "# comment {\nline%d x\\ y; other%d z\n", index, index); break;
+    default: size += (size_t)sprintf(src + size, "\nesc%d a\\\nb\n", index); break;
+    }
+  }
+
+  sparse_incremental_parse(&inc, src, size, (sparse_options_t)(SP_TRIM_TRAILING_SPACES | SP_CONSUME_WHITESPACE), NULL, NULL);
+
+  for (index = 0; index < NUM_EDITS && failures == 0; ++index) {
+    sparse_edit_t edit;
+    size_t removed;
+    size_t added;
+    size_t new_size;
+
+    seed = seed * 1103515245 + 12345;
+    edit.begin = (size_t)(seed >> 8) % (size + 1);
+    seed = seed * 1103515245 + 12345;
+    removed = (size_t)(seed >> 8) % 3;
+    if (removed > size - edit.begin)
+      removed = size - edit.begin;
+    seed = seed * 1103515245 + 12345;
+    added = (size_t)(seed >> 8) % 4;
+
+    memcpy(edited, src, edit.begin);
+    seed = seed * 1103515245 + 12345;
+    memset(edited + edit.begin, inserts[(seed >> 8) % (sizeof(inserts) - 1)], added);
+    memcpy(edited + edit.begin + added, src + edit.begin + removed, size - edit.begin - removed);
+    new_size = size - removed + added;
+    edited[new_size] = '\0';
+
+    edit.old_end = edit.begin + removed;
+    edit.new_end = edit.begin + added;
+
+    failures += check_update(&inc, src, edited, &edit, 0, &error);
+
+    /* Keep edits that still parse, so the document drifts away from where it
+       started. */
+    if (error == SP_NO_ERROR) {
+      memcpy(src, edited, new_size + 1);
+      size = new_size;
+    }
+  }
+
+  sparse_incremental_free(&inc);
+  free(src);
+  free(edited);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u\n"
+    "}\n"
+    "# A comment\n"
+    "width 800; height 600\n"
+    "materials/base/fl_tile2 {\n"
+    "  0 { map textures/base/fl_tile2.png }\n"
+    "}\n"
+    "fov 100";
+
+  char edited[1024];
+  sparse_incremental_t inc;
+  sparse_edit_t edit;
+  int failures = 0;
+  const char *at;
+
+  sparse_incremental_parse(&inc, test_string, strlen(test_string), SP_DEFAULT_OPTIONS, NULL, NULL);
+
+  /* Changing a value in one node only parses that node again. */
+  at = strstr(test_string, "fl_tile2.png");
+  snprintf(edited, sizeof(edited), "%.*s3%s", (int)(at - test_string + 7), test_string, at + 8);
+  edit.begin = (size_t)(at - test_string + 7);
+  edit.old_end = edit.begin + 1;
+  edit.new_end = edit.begin + 1;
+  failures += check_update(&inc, test_string, edited, &edit, 1, NULL);
+
+  /* Comments and whitespace aren't changes. */
+  sparse_incremental_free(&inc);
+  sparse_incremental_parse(&inc, test_string, strlen(test_string), SP_DEFAULT_OPTIONS, NULL, NULL);
+  at = strstr(test_string, "# A comment");
+  snprintf(edited, sizeof(edited), "%.*s# A longer comment%s", (int)(at - test_string), test_string, at + 11);
+  edit.begin = (size_t)(at - test_string + 2);
+  edit.old_end = edit.begin;
+  edit.new_end = edit.begin + 7;
+  failures += check_update(&inc, test_string, edited, &edit, 1, NULL);
+
+  /* Adding to the last field, which has no newline after it. */
+  sparse_incremental_free(&inc);
+  sparse_incremental_parse(&inc, test_string, strlen(test_string), SP_DEFAULT_OPTIONS, NULL, NULL);
+  snprintf(edited, sizeof(edited), "%s0\nfar 1000\n", test_string);
+  edit.begin = strlen(test_string);
+  edit.old_end = edit.begin;
+  edit.new_end = strlen(edited);
+  failures += check_update(&inc, test_string, edited, &edit, 2, NULL);
+
+  /* Opening a brace that's never closed fails and leaves inc as it was. */
+  sparse_incremental_free(&inc);
+  sparse_incremental_parse(&inc, test_string, strlen(test_string), SP_DEFAULT_OPTIONS, NULL, NULL);
+  snprintf(edited, sizeof(edited), "{%s", test_string);
+  edit.begin = 0;
+  edit.old_end = 0;
+  edit.new_end = 1;
+  failures += check_update(&inc, test_string, edited, &edit, 0, NULL);
+
+  /* An edit that doesn't fit is taken to be the whole document. */
+  edit.new_end = 100;
+  failures += check_update(&inc, test_string, "width 1024\n", &edit, 0, NULL);
+
+  sparse_incremental_free(&inc);
+
+  failures += check_random_edits();
+
+  return failures == 0 ? 0 : 1;
+}
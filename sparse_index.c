@@ -0,0 +1,712 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sparse_index.h"
+#include "sparse_internal.h"
+#include "sparse_split.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SP_INDEX_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Index layout, with every integer little-endian:
+
+    header   "SPARSEIX", u32 version, u32 options, u64 file size,
+             i64 mtime seconds, u32 mtime nanoseconds, u32 reserved,
+             u64 entry count, u64 names size
+    entries  u64 range begin, u64 range end, u64 range hash,
+             u32 name offset, u32 name length
+             (sorted by name, then by range begin)
+    names    every name, one after another
+*/
+#define SP_INDEX_MAGIC "SPARSEIX"
+#define SP_INDEX_MAGIC_SIZE (8)
+#define SP_INDEX_VERSION (1)
+#define SP_INDEX_HEADER_SIZE (56)
+#define SP_INDEX_ENTRY_SIZE (32)
+
+typedef struct s_sp_file_stamp {
+  uint64_t size;
+  int64_t mtime_sec;
+  uint32_t mtime_nsec;
+} sp_file_stamp_t;
+
+typedef struct s_sp_index_entry {
+  uint64_t range_begin;
+  uint64_t range_end;
+  uint64_t hash;
+  uint32_t name_offset;
+  uint32_t name_length;
+} sp_index_entry_t;
+
+typedef struct s_sp_index_builder {
+  sp_index_entry_t *entries;
+  size_t num_entries;
+  size_t entries_capacity;
+
+  char *names;
+  size_t names_size;
+  size_t names_capacity;
+
+  size_t depth;
+  /* The range being read. Entries from first_entry on are in it. */
+  uint64_t range_begin;
+  uint64_t range_hash;
+  size_t first_entry;
+
+  /* Set if the entries or names couldn't grow. */
+  sparse_error_t error;
+} sp_index_builder_t;
+
+typedef struct s_sp_index_sort_item {
+  const char *name;
+  const sp_index_entry_t *entry;
+} sp_index_sort_item_t;
+
+typedef struct s_sp_index_filter {
+  const char *name;
+  size_t name_length;
+  size_t depth;
+  /* 0 until the field is found, 1 while it's being sent, 2 once it's done. */
+  int found;
+  sparse_fn_t callback;
+  void *context;
+} sp_index_filter_t;
+
+/* What sp_index_write_file writes. */
+typedef struct s_sp_index_output {
+  const sp_index_builder_t *builder;
+  const sp_index_sort_item_t *items;
+  const sp_file_stamp_t *stamp;
+  sparse_options_t options;
+} sp_index_output_t;
+
+static int sp_compare_names(const char *left, size_t left_length, const char *right, size_t right_length)
+{
+  const size_t length = left_length < right_length ? left_length : right_length;
+  const int order = length == 0 ? 0 : memcmp(left, right, length);
+  if (order != 0)
+    return order;
+  return left_length < right_length ? -1 : (left_length > right_length ? 1 : 0);
+}
+
+static int sp_stamp_file(const char *path, sp_file_stamp_t *stamp)
+{
+  struct stat info;
+
+  if (stat(path, &info) != 0)
+    return 0;
+
+  stamp->size = (uint64_t)info.st_size;
+  stamp->mtime_sec = (int64_t)info.st_mtime;
+#if defined(__APPLE__)
+  stamp->mtime_nsec = (uint32_t)info.st_mtimespec.tv_nsec;
+#elif defined(SP_INDEX_POSIX)
+  stamp->mtime_nsec = (uint32_t)info.st_mtim.tv_nsec;
+#else
+  stamp->mtime_nsec = 0;
+#endif
+  return 1;
+}
+
+static int sp_same_stamp(const sp_file_stamp_t *left, const sp_file_stamp_t *right)
+{
+  return left->size == right->size && left->mtime_sec == right->mtime_sec && left->mtime_nsec == right->mtime_nsec;
+}
+
+
+/* Building */
+
+static void sp_index_add_name(sp_index_builder_t *builder, const char *begin, const char *end)
+{
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  sp_index_entry_t *entry;
+
+  if (builder->error != SP_NO_ERROR)
+    return;
+
+  /* Name offsets and lengths are 32 bits in the index. */
+  if (length > UINT32_MAX - builder->names_size) {
+    builder->error = SP_ERROR_NO_MEM;
+    return;
+  }
+
+  if (builder->num_entries == builder->entries_capacity) {
+    const size_t capacity = builder->entries_capacity == 0 ? 64 : builder->entries_capacity * 2;
+    sp_index_entry_t *entries = (sp_index_entry_t *)realloc(builder->entries, capacity * sizeof(*entries));
+    if (entries == NULL) {
+      builder->error = SP_ERROR_NO_MEM;
+      return;
+    }
+    builder->entries = entries;
+    builder->entries_capacity = capacity;
+  }
+
+  if (builder->names_size + length > builder->names_capacity) {
+    size_t capacity = builder->names_capacity == 0 ? 1024 : builder->names_capacity * 2;
+    char *names;
+    while (capacity < builder->names_size + length)
+      capacity *= 2;
+    names = (char *)realloc(builder->names, capacity);
+    if (names == NULL) {
+      builder->error = SP_ERROR_NO_MEM;
+      return;
+    }
+    builder->names = names;
+    builder->names_capacity = capacity;
+  }
+
+  entry = &builder->entries[builder->num_entries++];
+  entry->range_begin = builder->range_begin;
+  entry->range_end = builder->range_begin;
+  entry->hash = 0;
+  entry->name_offset = (uint32_t)builder->names_size;
+  entry->name_length = (uint32_t)length;
+
+  if (length > 0)
+    memcpy(builder->names + builder->names_size, begin, length);
+  builder->names_size += length;
+}
+
+static void sp_index_add_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sp_index_builder_t *builder = (sp_index_builder_t *)context;
+
+  switch (msg) {
+  case SP_BEGIN_NODE:
+    ++builder->depth;
+    break;
+  case SP_END_NODE:
+    if (builder->depth > 0)
+      --builder->depth;
+    break;
+  case SP_NAME:
+    if (builder->depth == 0)
+      sp_index_add_name(builder, begin, end);
+    break;
+  default:
+    break;
+  }
+}
+
+/* Closes the range being read at range_end and starts the next one there. */
+static void sp_index_end_range(sp_index_builder_t *builder, uint64_t range_end)
+{
+  size_t index;
+
+  for (index = builder->first_entry; index < builder->num_entries; ++index) {
+    builder->entries[index].range_end = range_end;
+    builder->entries[index].hash = builder->range_hash;
+  }
+
+  builder->first_entry = builder->num_entries;
+  builder->range_begin = range_end;
+  builder->range_hash = SP_HASH_SEED;
+}
+
+/*
+  Runs a piece of the file through the state, closing a range at every root
+  newline. The state is at the root with nothing pending after each of those,
+  so every event for a range is sent before the range is closed.
+*/
+static sparse_error_t sp_index_run(sparse_state_t *state, sp_index_builder_t *builder, sparse_splitter_t *splitter,
+                                   const char *src_begin, const char *src_end, uint64_t src_offset)
+{
+  const char *src_iter = src_begin;
+  const char *split;
+  sparse_error_t error;
+
+  while ((split = sparse_splitter_next(splitter, src_iter, src_end, src_iter)) != NULL) {
+    builder->range_hash = sp_hash(builder->range_hash, src_iter, split);
+    error = sparse_run(state, src_iter, split);
+    if (error != SP_NO_ERROR)
+      return error;
+
+    sp_index_end_range(builder, src_offset + (uint64_t)(split - src_begin));
+    src_iter = split;
+  }
+
+  builder->range_hash = sp_hash(builder->range_hash, src_iter, src_end);
+  return sparse_run(state, src_iter, src_end);
+}
+
+static int sp_index_compare_items(const void *left, const void *right)
+{
+  const sp_index_sort_item_t *left_item = (const sp_index_sort_item_t *)left;
+  const sp_index_sort_item_t *right_item = (const sp_index_sort_item_t *)right;
+  const int order = sp_compare_names(left_item->name, left_item->entry->name_length,
+                                     right_item->name, right_item->entry->name_length);
+
+  if (order != 0)
+    return order;
+  if (left_item->entry->range_begin != right_item->entry->range_begin)
+    return left_item->entry->range_begin < right_item->entry->range_begin ? -1 : 1;
+  return 0;
+}
+
+static int sp_index_write_file(FILE *stream, void *context)
+{
+  const sp_index_output_t *output = (const sp_index_output_t *)context;
+  const sp_index_builder_t *builder = output->builder;
+  unsigned char header[SP_INDEX_HEADER_SIZE];
+  unsigned char record[SP_INDEX_ENTRY_SIZE];
+  size_t index;
+
+  memcpy(header, SP_INDEX_MAGIC, SP_INDEX_MAGIC_SIZE);
+  sp_put_u32(header + 8, SP_INDEX_VERSION);
+  sp_put_u32(header + 12, (uint32_t)output->options);
+  sp_put_u64(header + 16, output->stamp->size);
+  sp_put_u64(header + 24, (uint64_t)output->stamp->mtime_sec);
+  sp_put_u32(header + 32, output->stamp->mtime_nsec);
+  sp_put_u32(header + 36, 0);
+  sp_put_u64(header + 40, (uint64_t)builder->num_entries);
+  sp_put_u64(header + 48, (uint64_t)builder->names_size);
+
+  if (fwrite(header, 1, sizeof(header), stream) != sizeof(header))
+    return 0;
+
+  for (index = 0; index < builder->num_entries; ++index) {
+    const sp_index_entry_t *entry = output->items[index].entry;
+    sp_put_u64(record, entry->range_begin);
+    sp_put_u64(record + 8, entry->range_end);
+    sp_put_u64(record + 16, entry->hash);
+    sp_put_u32(record + 24, entry->name_offset);
+    sp_put_u32(record + 28, entry->name_length);
+    if (fwrite(record, 1, sizeof(record), stream) != sizeof(record))
+      return 0;
+  }
+
+  return builder->names_size == 0 || fwrite(builder->names, 1, builder->names_size, stream) == builder->names_size;
+}
+
+static sparse_error_t sp_index_write(const sp_index_builder_t *builder, const sp_file_stamp_t *stamp,
+                                     sparse_options_t options, const char *index_path)
+{
+  sp_index_sort_item_t *items = (sp_index_sort_item_t *)malloc((builder->num_entries + 1) * sizeof(*items));
+  sp_index_output_t output;
+  sparse_error_t error;
+  size_t index;
+
+  if (items == NULL)
+    return SP_ERROR_NO_MEM;
+
+  for (index = 0; index < builder->num_entries; ++index) {
+    items[index].name = builder->names + builder->entries[index].name_offset;
+    items[index].entry = &builder->entries[index];
+  }
+  qsort(items, builder->num_entries, sizeof(*items), sp_index_compare_items);
+
+  output.builder = builder;
+  output.items = items;
+  output.stamp = stamp;
+  output.options = options;
+  error = sp_replace_file(index_path, sp_index_write_file, &output);
+
+  free(items);
+  return error;
+}
+
+sparse_error_t sparse_index_build(const char *source_path, const char *index_path, sparse_options_t options)
+{
+  sp_index_builder_t builder;
+  sp_file_stamp_t stamp;
+  sp_file_stamp_t stamp_after;
+  sparse_splitter_t splitter;
+  sparse_state_t state;
+  sparse_error_t error;
+  uint64_t offset = 0;
+  size_t read_size;
+  char *read_buffer;
+  FILE *stream;
+
+  options = (sparse_options_t)(options & ~SP_ZERO_COPY);
+
+  stream = fopen(source_path, "rb");
+  if (stream == NULL)
+    return SP_ERROR_IO;
+
+  if (!sp_stamp_file(source_path, &stamp)) {
+    fclose(stream);
+    return SP_ERROR_IO;
+  }
+
+  read_buffer = (char *)malloc(SP_INDEX_READ_SIZE);
+  if (read_buffer == NULL) {
+    fclose(stream);
+    return SP_ERROR_NO_MEM;
+  }
+
+  memset(&builder, 0, sizeof(builder));
+  builder.error = SP_NO_ERROR;
+  builder.range_hash = SP_HASH_SEED;
+  sparse_splitter_init(&splitter);
+
+  /* Names are copied into the builder, so nothing needs copying for them. */
+  error = sparse_begin(&state, 0, (sparse_options_t)(options | SP_ZERO_COPY), sp_index_add_event, &builder);
+  if (error == SP_NO_ERROR) {
+    while (error == SP_NO_ERROR && (read_size = fread(read_buffer, 1, SP_INDEX_READ_SIZE, stream)) > 0) {
+      error = sp_index_run(&state, &builder, &splitter, read_buffer, read_buffer + read_size, offset);
+      offset += read_size;
+    }
+
+    if (error == SP_NO_ERROR && ferror(stream))
+      error = SP_ERROR_IO;
+
+    if (error == SP_NO_ERROR) {
+      error = sparse_end(&state);
+    } else {
+      state.callback = NULL;
+      sparse_end(&state);
+    }
+  }
+
+  fclose(stream);
+  free(read_buffer);
+
+  if (error == SP_NO_ERROR) {
+    sp_index_end_range(&builder, offset);
+    error = builder.error;
+  }
+
+  /* The file has to be the same one the whole way through. */
+  if (error == SP_NO_ERROR
+      && (offset != stamp.size || !sp_stamp_file(source_path, &stamp_after) || !sp_same_stamp(&stamp, &stamp_after)))
+    error = SP_ERROR_IO;
+
+  if (error == SP_NO_ERROR)
+    error = sp_index_write(&builder, &stamp, options, index_path);
+
+  free(builder.entries);
+  free(builder.names);
+  return error;
+}
+
+
+/* Lookups */
+
+static sparse_error_t sp_index_load(sparse_index_t *index, const char *index_path)
+{
+#ifdef SP_INDEX_POSIX
+  struct stat info;
+  void *data;
+  int fd = open(index_path, O_RDONLY);
+
+  if (fd == -1)
+    return SP_ERROR_IO;
+
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return SP_ERROR_IO;
+  }
+
+  if ((uint64_t)info.st_size < SP_INDEX_HEADER_SIZE || (uint64_t)info.st_size > (size_t)-1) {
+    close(fd);
+    return SP_ERROR_BAD_FORMAT;
+  }
+
+  data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return SP_ERROR_IO;
+
+  index->data = (const unsigned char *)data;
+  index->size = (size_t)info.st_size;
+  index->mapped = 1;
+  return SP_NO_ERROR;
+#else
+  unsigned char *data;
+  long size;
+  FILE *stream = fopen(index_path, "rb");
+
+  if (stream == NULL)
+    return SP_ERROR_IO;
+
+  if (fseek(stream, 0, SEEK_END) != 0 || (size = ftell(stream)) < 0 || fseek(stream, 0, SEEK_SET) != 0) {
+    fclose(stream);
+    return SP_ERROR_IO;
+  }
+
+  if (size < SP_INDEX_HEADER_SIZE) {
+    fclose(stream);
+    return SP_ERROR_BAD_FORMAT;
+  }
+
+  data = (unsigned char *)malloc((size_t)size);
+  if (data == NULL) {
+    fclose(stream);
+    return SP_ERROR_NO_MEM;
+  }
+
+  if (fread(data, 1, (size_t)size, stream) != (size_t)size) {
+    free(data);
+    fclose(stream);
+    return SP_ERROR_IO;
+  }
+
+  fclose(stream);
+  index->data = data;
+  index->size = (size_t)size;
+  index->mapped = 0;
+  return SP_NO_ERROR;
+#endif
+}
+
+sparse_error_t sparse_index_open(sparse_index_t *index, const char *index_path, const char *source_path)
+{
+  sp_file_stamp_t stamp;
+  sp_file_stamp_t source_stamp;
+  uint64_t num_entries;
+  uint64_t names_size;
+  sparse_error_t error;
+
+  memset(index, 0, sizeof(*index));
+
+  error = sp_index_load(index, index_path);
+  if (error != SP_NO_ERROR)
+    return error;
+
+  if (memcmp(index->data, SP_INDEX_MAGIC, SP_INDEX_MAGIC_SIZE) != 0
+      || sp_get_u32(index->data + 8) != SP_INDEX_VERSION)
+    return SP_ERROR_BAD_FORMAT;
+
+  num_entries = sp_get_u64(index->data + 40);
+  names_size = sp_get_u64(index->data + 48);
+  if (num_entries > (index->size - SP_INDEX_HEADER_SIZE) / SP_INDEX_ENTRY_SIZE
+      || names_size != index->size - SP_INDEX_HEADER_SIZE - num_entries * SP_INDEX_ENTRY_SIZE)
+    return SP_ERROR_BAD_FORMAT;
+
+  index->options = (sparse_options_t)sp_get_u32(index->data + 12);
+  index->source_size = sp_get_u64(index->data + 16);
+  index->num_entries = (size_t)num_entries;
+  index->entries = index->data + SP_INDEX_HEADER_SIZE;
+  index->names = (const char *)index->entries + index->num_entries * SP_INDEX_ENTRY_SIZE;
+  index->names_size = (size_t)names_size;
+
+  stamp.size = index->source_size;
+  stamp.mtime_sec = (int64_t)sp_get_u64(index->data + 24);
+  stamp.mtime_nsec = sp_get_u32(index->data + 32);
+
+  if (!sp_stamp_file(source_path, &source_stamp))
+    return SP_ERROR_IO;
+  if (!sp_same_stamp(&stamp, &source_stamp))
+    return SP_ERROR_STALE_INDEX;
+
+  index->source = fopen(source_path, "rb");
+  return index->source == NULL ? SP_ERROR_IO : SP_NO_ERROR;
+}
+
+void sparse_index_close(sparse_index_t *index)
+{
+  if (index->data != NULL) {
+#ifdef SP_INDEX_POSIX
+    if (index->mapped)
+      munmap((void *)index->data, index->size);
+    else
+#endif
+      free((void *)index->data);
+  }
+
+  if (index->source != NULL)
+    fclose(index->source);
+
+  free(index->buffer);
+  memset(index, 0, sizeof(*index));
+}
+
+static int sp_index_entry_name(const sparse_index_t *index, const unsigned char *entry, const char **name, size_t *name_length)
+{
+  const uint32_t offset = sp_get_u32(entry + 24);
+  const uint32_t length = sp_get_u32(entry + 28);
+
+  if (offset > index->names_size || length > index->names_size - offset)
+    return 0;
+
+  *name = index->names + offset;
+  *name_length = length;
+  return 1;
+}
+
+/* Binary search for the first entry named name. */
+static sparse_error_t sp_index_find_entry(const sparse_index_t *index, const char *name, size_t name_length,
+                                          const unsigned char **entry_out)
+{
+  size_t low = 0;
+  size_t high = index->num_entries;
+  const unsigned char *entry;
+  const char *entry_name;
+  size_t entry_name_length;
+
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+
+    if (!sp_index_entry_name(index, index->entries + middle * SP_INDEX_ENTRY_SIZE, &entry_name, &entry_name_length))
+      return SP_ERROR_BAD_FORMAT;
+
+    if (sp_compare_names(entry_name, entry_name_length, name, name_length) < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low == index->num_entries)
+    return SP_ERROR_NOT_FOUND;
+
+  entry = index->entries + low * SP_INDEX_ENTRY_SIZE;
+  if (!sp_index_entry_name(index, entry, &entry_name, &entry_name_length))
+    return SP_ERROR_BAD_FORMAT;
+  if (sp_compare_names(entry_name, entry_name_length, name, name_length) != 0)
+    return SP_ERROR_NOT_FOUND;
+
+  if (sp_get_u64(entry) > sp_get_u64(entry + 8) || sp_get_u64(entry + 8) > index->source_size)
+    return SP_ERROR_BAD_FORMAT;
+
+  *entry_out = entry;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_index_find(const sparse_index_t *index, const char *name, size_t name_length,
+                                 uint64_t *range_begin, uint64_t *range_end)
+{
+  const unsigned char *entry;
+  const sparse_error_t error = sp_index_find_entry(index, name, name_length, &entry);
+
+  if (error == SP_NO_ERROR) {
+    *range_begin = sp_get_u64(entry);
+    *range_end = sp_get_u64(entry + 8);
+  }
+
+  return error;
+}
+
+static sparse_error_t sp_index_read_range(sparse_index_t *index, uint64_t range_begin, size_t length)
+{
+  size_t done = 0;
+
+  if (length > index->buffer_capacity || index->buffer == NULL) {
+    char *buffer = (char *)realloc(index->buffer, length > 0 ? length : 1);
+    if (buffer == NULL)
+      return SP_ERROR_NO_MEM;
+    index->buffer = buffer;
+    index->buffer_capacity = length > 0 ? length : 1;
+  }
+
+#ifdef SP_INDEX_POSIX
+  while (done < length) {
+    const ssize_t read_size = pread(fileno(index->source), index->buffer + done, length - done,
+                                    (off_t)(range_begin + done));
+    if (read_size <= 0)
+      return SP_ERROR_IO;
+    done += (size_t)read_size;
+  }
+#else
+  if (fseek(index->source, (long)range_begin, SEEK_SET) != 0)
+    return SP_ERROR_IO;
+  done = fread(index->buffer, 1, length, index->source);
+  if (done != length)
+    return SP_ERROR_IO;
+#endif
+
+  return SP_NO_ERROR;
+}
+
+static void sp_index_filter_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sp_index_filter_t *filter = (sp_index_filter_t *)context;
+
+  if (msg == SP_ERROR) {
+    if (filter->callback != NULL)
+      filter->callback(msg, begin, end, filter->context);
+    return;
+  }
+
+  if (filter->found == 0 && msg == SP_NAME && filter->depth == 0
+      && sp_compare_names(begin, begin == NULL ? 0 : (size_t)(end - begin), filter->name, filter->name_length) == 0)
+    filter->found = 1;
+
+  if (filter->found == 1 && filter->callback != NULL)
+    filter->callback(msg, begin, end, filter->context);
+
+  switch (msg) {
+  case SP_BEGIN_NODE:
+    ++filter->depth;
+    break;
+  case SP_END_NODE:
+    if (filter->depth > 0)
+      --filter->depth;
+    if (filter->found == 1 && filter->depth == 0)
+      filter->found = 2;
+    break;
+  case SP_VALUE:
+    if (filter->found == 1 && filter->depth == 0)
+      filter->found = 2;
+    break;
+  default:
+    break;
+  }
+}
+
+sparse_error_t sparse_index_lookup(sparse_index_t *index, const char *name, size_t name_length,
+                                   sparse_fn_t callback, void *context)
+{
+  const unsigned char *entry;
+  sp_index_filter_t filter;
+  sparse_state_t state;
+  uint64_t range_begin;
+  size_t length;
+  sparse_error_t error = sp_index_find_entry(index, name, name_length, &entry);
+
+  if (error != SP_NO_ERROR)
+    return error;
+
+  range_begin = sp_get_u64(entry);
+  length = (size_t)(sp_get_u64(entry + 8) - range_begin);
+
+  error = sp_index_read_range(index, range_begin, length);
+  if (error != SP_NO_ERROR)
+    return error;
+
+  if (sp_hash(SP_HASH_SEED, index->buffer, index->buffer + length) != sp_get_u64(entry + 16))
+    return SP_ERROR_STALE_INDEX;
+
+  filter.name = name;
+  filter.name_length = name_length;
+  filter.depth = 0;
+  filter.found = 0;
+  filter.callback = callback;
+  filter.context = context;
+
+  /* The range stays in the buffer until the next lookup, so nothing needs
+     copying. */
+  error = sparse_begin(&state, 0, (sparse_options_t)(index->options | SP_ZERO_COPY), sp_index_filter_event, &filter);
+  if (error != SP_NO_ERROR)
+    return error;
+
+  error = sparse_run(&state, index->buffer, index->buffer + length);
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  if (error == SP_NO_ERROR && filter.found == 0)
+    error = SP_ERROR_NOT_FOUND;
+
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
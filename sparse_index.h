@@ -0,0 +1,92 @@
+#ifndef __CMT_SPARSE_INDEX_H__
+#define __CMT_SPARSE_INDEX_H__
+
+#include "sparse.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* Suffix sparse_index_tool adds to a file's path to name its index. */
+#define SP_INDEX_SUFFIX ".spx"
+
+/* Size of the pieces a file is read in while it's being indexed. */
+#ifndef SP_INDEX_READ_SIZE
+#define SP_INDEX_READ_SIZE (1024 * 1024)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A sidecar index mapping each root field's name to the byte range of the file
+  it's in, so a single root node can be parsed without reading everything
+  before it.
+
+  Ranges are cut at root newlines (see sparse_split.h), so each one parses on
+  its own. A range holds every root field on the lines it covers, which is
+  usually just the one. The index records the file's size and modification
+  time and is refused if either changed, and each range is hashed so a range
+  that changed anyway is caught before it's parsed.
+
+  An open index isn't safe to use from several threads at once, but separate
+  indexes for the same file are.
+*/
+typedef struct s_sparse_index {
+  const unsigned char *data;
+  size_t size;
+  int mapped;
+
+  sparse_options_t options;
+  uint64_t source_size;
+  size_t num_entries;
+  const unsigned char *entries;
+  const char *names;
+  size_t names_size;
+
+  FILE *source;
+  /* Holds the range being parsed by sparse_index_lookup. */
+  char *buffer;
+  size_t buffer_capacity;
+} sparse_index_t;
+
+/*
+  Parses the file at source_path with options and writes its index to
+  index_path, replacing any index already there. The index is written to a
+  temporary file first and renamed into place, so readers never see a partial
+  one. Returns the parser's error if the file doesn't parse or SP_ERROR_IO if
+  either file can't be read or written (including if the source changed while
+  it was being read).
+*/
+sparse_error_t sparse_index_build(const char *source_path, const char *index_path, sparse_options_t options);
+
+/*
+  Opens the index at index_path for the file at source_path. Returns
+  SP_ERROR_BAD_FORMAT if it isn't an index and SP_ERROR_STALE_INDEX if the
+  file's size or modification time don't match the index. Close the index with
+  sparse_index_close whatever this returns.
+*/
+sparse_error_t sparse_index_open(sparse_index_t *index, const char *index_path, const char *source_path);
+void sparse_index_close(sparse_index_t *index);
+
+/*
+  Stores the byte range of the file holding the first root field named name.
+  Returns SP_ERROR_NOT_FOUND if there isn't one.
+*/
+sparse_error_t sparse_index_find(const sparse_index_t *index, const char *name, size_t name_length,
+                                 uint64_t *range_begin, uint64_t *range_end);
+
+/*
+  Reads and parses just the range holding the first root field named name,
+  with the options the index was built with, and sends callback that field's
+  events: its name and then either its value or its node up to and including
+  the closing brace. Returns SP_ERROR_NOT_FOUND if there's no such field and
+  SP_ERROR_STALE_INDEX if the range no longer matches the index.
+*/
+sparse_error_t sparse_index_lookup(sparse_index_t *index, const char *name, size_t name_length,
+                                   sparse_fn_t callback, void *context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_INDEX_H__ include guard */
@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sparse_index.h"
+
+/*
+  Build with a small read size, e.g. -DSP_INDEX_READ_SIZE=7, so ranges span
+  several reads.
+*/
+
+#define MAX_FIELDS (64)
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+/* The events of each root field in a document, in order. */
+typedef struct s_field_logs {
+  event_log_t names[MAX_FIELDS];
+  event_log_t events[MAX_FIELDS];
+  size_t num_fields;
+  size_t depth;
+} field_logs_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static void log_field_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static int check_lookups(const char *index_path, const char *path, const char *src, sparse_options_t options);
+static int write_file(const char *path, const char *src);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (length == 0)
+    return;
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static void log_field_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  field_logs_t *fields = (field_logs_t *)context;
+
+  if (msg == SP_NAME && fields->depth == 0) {
+    log_append(&fields->names[fields->num_fields], begin, begin == NULL ? 0 : (size_t)(end - begin));
+    ++fields->num_fields;
+  }
+
+  log_event(msg, begin, end, &fields->events[fields->num_fields - 1]);
+
+  if (msg == SP_BEGIN_NODE)
+    ++fields->depth;
+  else if (msg == SP_END_NODE)
+    --fields->depth;
+}
+
+/* Looks up every root field and checks it gets the same events as it does in a
+   full parse. Only the first of several fields with the same name is found. */
+static int check_lookups(const char *index_path, const char *path, const char *src, sparse_options_t options)
+{
+  field_logs_t fields;
+  sparse_index_t index;
+  event_log_t actual = { NULL, 0, 0 };
+  sparse_error_t error;
+  size_t field;
+  int failures = 0;
+
+  memset(&fields, 0, sizeof(fields));
+  {
+    sparse_state_t state;
+    sparse_begin(&state, 0, options, log_field_event, &fields);
+    sparse_run(&state, src, src + strlen(src));
+    sparse_end(&state);
+  }
+
+  error = sparse_index_open(&index, index_path, path);
+  if (error != SP_NO_ERROR) {
+    fprintf(stderr, "Could not open the index (%d).\n", (int)error);
+    sparse_index_close(&index);
+    return 1;
+  }
+
+  for (field = 0; field < fields.num_fields; ++field) {
+    const event_log_t *name = &fields.names[field];
+    size_t earlier;
+
+    for (earlier = 0; earlier < field; ++earlier) {
+      if (fields.names[earlier].size == name->size && memcmp(fields.names[earlier].data, name->data, name->size) == 0)
+        break;
+    }
+    if (earlier < field)
+      continue;
+
+    actual.size = 0;
+    error = sparse_index_lookup(&index, name->data, name->size, log_event, &actual);
+    if (error != SP_NO_ERROR || actual.size != fields.events[field].size
+        || memcmp(actual.data, fields.events[field].data, actual.size) != 0) {
+      fprintf(stderr, "Lookup of root field %zu (%.*s) with options %d differs from a full parse.\n",
+              field, (int)name->size, name->data, (int)options);
+      ++failures;
+    }
+  }
+
+  if (sparse_index_lookup(&index, "missing", 7, log_event, &actual) != SP_ERROR_NOT_FOUND) {
+    fprintf(stderr, "Expected a missing name not to be found.\n");
+    ++failures;
+  }
+
+  sparse_index_close(&index);
+
+  for (field = 0; field < MAX_FIELDS; ++field) {
+    free(fields.names[field].data);
+    free(fields.events[field].data);
+  }
+  free(actual.data);
+
+  return failures;
+}
+
+static int write_file(const char *path, const char *src)
+{
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return 0;
+  fwrite(src, 1, strlen(src), file);
+  return fclose(file) == 0;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "# Comment with a { brace\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u\n"
+    "}\n"
+    "escaped\\\nname value\\ with\\ttrailing   \n"
+    "width 800; height 600\n"
+    "materials/base/fl_tile1 duplicate\n"
+    "nested { a { b { c d } } } fov 100\n"
+    "last_field";
+
+  /* Appended when nameless root nodes are allowed. */
+  static const char *nameless_string =
+    "\n{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "after_nameless 1";
+
+  char src[1024];
+  char path[] = "/tmp/sparse_index_test_XXXXXX";
+  char index_path[64];
+  sparse_index_t index;
+  uint64_t range_begin;
+  uint64_t range_end;
+  int failures = 0;
+  int options;
+  int fd = mkstemp(path);
+
+  if (fd == -1) {
+    fprintf(stderr, "Could not create a temporary file.\n");
+    return 1;
+  }
+  close(fd);
+  snprintf(index_path, sizeof(index_path), "%s%s", path, SP_INDEX_SUFFIX);
+
+  for (options = 0; options < 16; ++options) {
+    snprintf(src, sizeof(src), "%s%s", test_string,
+             (options & (SP_NAMELESS_ROOT_NODES | SP_NAMELESS_NODES)) ? nameless_string : "");
+    if (!write_file(path, src)) {
+      fprintf(stderr, "Could not write the test file.\n");
+      ++failures;
+      continue;
+    }
+
+    if (sparse_index_build(path, index_path, (sparse_options_t)options) != SP_NO_ERROR) {
+      fprintf(stderr, "Could not build an index with options %d.\n", options);
+      ++failures;
+      continue;
+    }
+    failures += check_lookups(index_path, path, src, (sparse_options_t)options);
+  }
+
+  /* The range of a single-line field is just that line. */
+  write_file(path, test_string);
+  sparse_index_build(path, index_path, SP_DEFAULT_OPTIONS);
+  sparse_index_open(&index, index_path, path);
+  if (sparse_index_find(&index, "width", 5, &range_begin, &range_end) != SP_NO_ERROR
+      || strncmp(test_string + range_begin, "width 800; height 600\n", (size_t)(range_end - range_begin)) != 0
+      || range_end - range_begin != 22) {
+    fprintf(stderr, "Expected width's range to be its line.\n");
+    ++failures;
+  }
+  sparse_index_close(&index);
+
+  /* A range changed after the index was opened is caught when it's read. */
+  if (sparse_index_open(&index, index_path, path) != SP_NO_ERROR) {
+    fprintf(stderr, "Could not open the index.\n");
+    ++failures;
+  } else {
+    FILE *file = fopen(path, "r+b");
+    fseek(file, (long)strlen(test_string) - 4, SEEK_SET);
+    fputs("xxxx", file);
+    fclose(file);
+
+    if (sparse_index_lookup(&index, "last_field", 10, NULL, NULL) != SP_ERROR_STALE_INDEX) {
+      fprintf(stderr, "Expected a changed range to be stale.\n");
+      ++failures;
+    }
+    if (sparse_index_lookup(&index, "width", 5, NULL, NULL) != SP_NO_ERROR) {
+      fprintf(stderr, "Expected an unchanged range to still be found.\n");
+      ++failures;
+    }
+  }
+  sparse_index_close(&index);
+
+  /* A file of a different size is refused outright. */
+  write_file(path, "width 800\n");
+  if (sparse_index_open(&index, index_path, path) != SP_ERROR_STALE_INDEX) {
+    fprintf(stderr, "Expected the index to be stale.\n");
+    ++failures;
+  }
+  sparse_index_close(&index);
+
+  if (sparse_index_open(&index, path, path) != SP_ERROR_BAD_FORMAT) {
+    fprintf(stderr, "Expected a bad format error for something that isn't an index.\n");
+    ++failures;
+  }
+  sparse_index_close(&index);
+
+  write_file(path, "unclosed {\n");
+  if (sparse_index_build(path, index_path, SP_DEFAULT_OPTIONS) != SP_ERROR_INCOMPLETE_DOCUMENT) {
+    fprintf(stderr, "Expected an incomplete document error.\n");
+    ++failures;
+  }
+
+  unlink(path);
+  unlink(index_path);
+
+  if (sparse_index_build(path, index_path, SP_DEFAULT_OPTIONS) != SP_ERROR_IO) {
+    fprintf(stderr, "Expected an IO error for a missing file.\n");
+    ++failures;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+/*
+  Builds sidecar indexes (see sparse_index.h) and looks up root fields with
+  them. Build it with sparse.c, sparse_scan.c, sparse_split.c, sparse_util.c
+  and sparse_index.c:
+
+    sparse_index_tool build FILE [INDEX]
+    sparse_index_tool find FILE NAME [INDEX]
+
+  INDEX defaults to FILE with SP_INDEX_SUFFIX added. find prints the field as
+  an indented outline of its names and values.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_index.h"
+
+typedef struct s_print_state {
+  int depth;
+  int pending_name;
+} print_state_t;
+
+static void print_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  print_state_t *print = (print_state_t *)context;
+  const int length = begin == NULL ? 0 : (int)(end - begin);
+
+  switch (msg) {
+  case SP_NAME:
+    printf("%*s%.*s", print->depth * 2, "", length, begin);
+    print->pending_name = 1;
+    break;
+  case SP_VALUE:
+    printf(length > 0 ? " %.*s\n" : "\n", length, begin);
+    print->pending_name = 0;
+    break;
+  case SP_BEGIN_NODE:
+    printf(print->pending_name ? " {\n" : "%*s{\n", print->depth * 2, "");
+    print->pending_name = 0;
+    ++print->depth;
+    break;
+  case SP_END_NODE:
+    --print->depth;
+    printf("%*s}\n", print->depth * 2, "");
+    break;
+  case SP_ERROR:
+    fprintf(stderr, "%.*s\n", length, begin);
+    break;
+  default:
+    break;
+  }
+}
+
+static char *default_index_path(const char *path)
+{
+  const size_t length = strlen(path);
+  char *index_path = (char *)malloc(length + sizeof(SP_INDEX_SUFFIX));
+  if (index_path != NULL) {
+    memcpy(index_path, path, length);
+    memcpy(index_path + length, SP_INDEX_SUFFIX, sizeof(SP_INDEX_SUFFIX));
+  }
+  return index_path;
+}
+
+static int usage(void)
+{
+  fprintf(stderr,
+          "usage: sparse_index_tool build FILE [INDEX]\n"
+          "       sparse_index_tool find FILE NAME [INDEX]\n");
+  return 2;
+}
+
+int main(int argc, char const *argv[])
+{
+  sparse_error_t error;
+  char *index_path;
+  int index_arg;
+
+  if (argc < 3)
+    return usage();
+
+  if (strcmp(argv[1], "build") == 0 && argc <= 4)
+    index_arg = 3;
+  else if (strcmp(argv[1], "find") == 0 && argc >= 4 && argc <= 5)
+    index_arg = 4;
+  else
+    return usage();
+
+  index_path = argc > index_arg ? NULL : default_index_path(argv[2]);
+  if (argc <= index_arg && index_path == NULL) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  if (index_arg == 3) {
+    error = sparse_index_build(argv[2], index_path != NULL ? index_path : argv[index_arg], SP_DEFAULT_OPTIONS);
+  } else {
+    sparse_index_t index;
+    print_state_t print = { 0, 0 };
+
+    error = sparse_index_open(&index, index_path != NULL ? index_path : argv[index_arg], argv[2]);
+    if (error == SP_NO_ERROR)
+      error = sparse_index_lookup(&index, argv[3], strlen(argv[3]), print_event, &print);
+    sparse_index_close(&index);
+
+    if (error == SP_ERROR_NOT_FOUND)
+      fprintf(stderr, "%s: no root field named %s\n", argv[2], argv[3]);
+    else if (error == SP_ERROR_STALE_INDEX)
+      fprintf(stderr, "%s: the index is out of date, rebuild it\n", argv[2]);
+  }
+
+  if (error != SP_NO_ERROR && error != SP_ERROR_NOT_FOUND && error != SP_ERROR_STALE_INDEX)
+    fprintf(stderr, "%s: failed with error %d\n", argv[2], (int)error);
+
+  free(index_path);
+  return error == SP_NO_ERROR ? 0 : 1;
+}
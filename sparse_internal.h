@@ -0,0 +1,98 @@
+#ifndef __CMT_SPARSE_INTERNAL_H__
+#define __CMT_SPARSE_INTERNAL_H__
+
+/*
+  Internal to the Sparse implementation -- not part of the public API.
+*/
+
+#include "sparse.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Byte scanners (sparse_scan.c) used to skip over runs of characters that don't
+  change the parser's mode. Each returns a pointer to the first matching byte
+  in [begin, end) or end if there is none. On x86 these use SSE2 and, if the
+  CPU supports it, AVX2 (picked once at runtime). Define SP_NO_SIMD to build
+  only the plain C versions.
+*/
+
+/* Finds the next { } # ; \n \\ space or tab. */
+const char *sp_scan_structural(const char *begin, const char *end);
+/* Finds the next \n. */
+const char *sp_scan_newline(const char *begin, const char *end);
+/* Finds the next { } # or \\. */
+const char *sp_scan_braces(const char *begin, const char *end);
+
+/*
+  Sends any name or value still pending at the end of a document and checks
+  that every node was closed, without releasing anything (sparse.c). Leaves
+  the state ready to parse another document.
+*/
+sparse_error_t sp_end_document(sparse_state_t *state);
+
+/*
+  Stores an error in the state and sends it as an SP_ERROR message the same
+  way sparse_run does, for errors found outside of sparse_run (sparse.c).
+*/
+void sp_send_error(sparse_state_t *state, const char *error_begin, const char *error_end);
+
+/*
+  Points the state's error at storage of its own if it points into [begin,
+  end) (sparse.c). Call it before releasing input given to sparse_run, so an
+  invalid char error can still be read afterward.
+*/
+void sp_detach_error(sparse_state_t *state, const char *begin, const char *end);
+
+/*
+  Skipping the rest of the innermost open node without producing events for
+  it (sparse.c), for the reader and path queries. After a run has stopped on
+  a node's opening brace, sp_skip_begin drops anything pending and sets
+  *skip_depth to 1. sp_skip_node then looks for the closing brace, only
+  stopping on braces, comments and escapes, and returns where it stopped. It
+  can carry on across inputs; once *skip_depth is back to 0, the node is
+  closed and the state is in its parent again.
+*/
+void sp_skip_begin(sparse_state_t *state, size_t *skip_depth);
+const char *sp_skip_node(sparse_state_t *state, size_t *skip_depth, const char *src_iter, const char *src_end);
+
+/* Little-endian integers in index and compiled files (sparse_util.c). */
+void sp_put_u32(unsigned char *out, uint32_t value);
+void sp_put_u64(unsigned char *out, uint64_t value);
+uint32_t sp_get_u32(const unsigned char *in);
+uint64_t sp_get_u64(const unsigned char *in);
+
+/*
+  64-bit FNV-1a of [begin, end), carrying on from hash, which starts out as
+  SP_HASH_SEED (sparse_util.c). Every hash Sparse keeps is this one,
+  truncated to 32 bits where that's all a table needs.
+*/
+#define SP_HASH_SEED (UINT64_C(0xcbf29ce484222325))
+#define SP_HASH_PRIME (UINT64_C(0x100000001b3))
+uint64_t sp_hash(uint64_t hash, const char *begin, const char *end);
+
+/*
+  Writes the file at path by calling write on path plus ".tmp" and renaming
+  that over path once it's written, so nobody reading path ever sees half a
+  file (sparse_util.c). write returns 0 if it fails. Returns SP_ERROR_IO if the
+  file can't be written and SP_ERROR_NO_MEM if the temporary path can't be
+  allocated.
+*/
+typedef int (*sp_write_fn_t)(FILE *stream, void *context);
+sparse_error_t sp_replace_file(const char *path, sp_write_fn_t write, void *context);
+
+/*
+  Runs the whole file at path through the state (see sparse_parse_file) and
+  ends it, ending it without sending anything more if the file can't be read
+  (sparse_file.c). Used to build a document from a file.
+*/
+sparse_error_t sp_parse_whole_file(sparse_state_t *state, const char *path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_INTERNAL_H__ include guard */
@@ -0,0 +1,482 @@
+#include "sparse_query.h"
+#include "sparse_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const char *sp_errstr_no_mem = "Could not allocate memory for query state.";
+
+/* Compiling */
+
+static int sp_query_is_glob(const char *begin, const char *end)
+{
+  for (; begin != end; ++begin) {
+    if (*begin == '\\' && begin + 1 != end)
+      ++begin;
+    else if (*begin == '*' || *begin == '?')
+      return 1;
+  }
+  return 0;
+}
+
+/* Appends a segment for the name in [begin, end) to the query. query->text
+   has room for the whole path, so only segments need to grow. */
+static sparse_error_t sp_query_add_segment(sparse_query_t *query, size_t *segments_capacity, sparse_query_kind_t kind,
+                                           uint32_t text_offset, uint32_t text_length)
+{
+  sparse_query_segment_t *segment;
+
+  if (query->num_segments == *segments_capacity) {
+    const size_t capacity = *segments_capacity == 0 ? 16 : *segments_capacity * 2;
+    sparse_query_segment_t *segments = (sparse_query_segment_t *)realloc(query->segments, capacity * sizeof(*segments));
+    if (segments == NULL)
+      return SP_ERROR_NO_MEM;
+    query->segments = segments;
+    *segments_capacity = capacity;
+  }
+
+  segment = &query->segments[query->num_segments++];
+  segment->kind = kind;
+  segment->text_offset = text_offset;
+  segment->text_length = text_length;
+  return SP_NO_ERROR;
+}
+
+static sparse_error_t sp_query_add_name(sparse_query_t *query, size_t *segments_capacity, size_t *text_size,
+                                        const char *begin, const char *end)
+{
+  const size_t length = (size_t)(end - begin);
+  const size_t text_offset = *text_size;
+  sparse_query_kind_t kind;
+
+  if (length == 2 && begin[0] == '*' && begin[1] == '*') {
+    kind = SP_QUERY_ANY_PATH;
+  } else if (length == 1 && begin[0] == '*') {
+    kind = SP_QUERY_ANY;
+  } else if (sp_query_is_glob(begin, end)) {
+    kind = SP_QUERY_GLOB;
+    memcpy(query->text + *text_size, begin, length);
+    *text_size += length;
+  } else {
+    kind = SP_QUERY_LITERAL;
+    for (; begin != end; ++begin) {
+      if (*begin == '\\' && begin + 1 != end)
+        ++begin;
+      query->text[(*text_size)++] = *begin;
+    }
+  }
+
+  return sp_query_add_segment(query, segments_capacity, kind, (uint32_t)text_offset, (uint32_t)(*text_size - text_offset));
+}
+
+sparse_error_t sparse_query_compile(sparse_query_t *query, const char *const *paths, size_t num_paths)
+{
+  size_t segments_capacity = 0;
+  size_t text_capacity = 0;
+  size_t text_size = 0;
+  size_t path_index;
+  sparse_error_t error = SP_NO_ERROR;
+
+  memset(query, 0, sizeof(*query));
+
+  for (path_index = 0; path_index < num_paths; ++path_index)
+    text_capacity += strlen(paths[path_index]);
+
+  /* Offsets into the text are 32 bits. */
+  if (text_capacity > UINT32_MAX)
+    return SP_ERROR_NO_MEM;
+
+  query->text = (char *)malloc(text_capacity > 0 ? text_capacity : 1);
+  if (query->text == NULL)
+    return SP_ERROR_NO_MEM;
+
+  for (path_index = 0; error == SP_NO_ERROR && path_index < num_paths; ++path_index) {
+    const char *path = paths[path_index];
+    const char *const path_end = path + strlen(path);
+    const char *name = path;
+    const char *iter;
+
+    if (path != path_end) {
+      for (iter = path; iter != path_end && error == SP_NO_ERROR; ++iter) {
+        if (*iter == '\\' && iter + 1 != path_end) {
+          ++iter;
+        } else if (*iter == '/') {
+          error = sp_query_add_name(query, &segments_capacity, &text_size, name, iter);
+          name = iter + 1;
+        }
+      }
+
+      if (error == SP_NO_ERROR)
+        error = sp_query_add_name(query, &segments_capacity, &text_size, name, path_end);
+    }
+
+    if (error == SP_NO_ERROR)
+      error = sp_query_add_segment(query, &segments_capacity, SP_QUERY_ACCEPT, (uint32_t)path_index, 0);
+  }
+
+  query->num_paths = num_paths;
+  return error;
+}
+
+void sparse_query_free(sparse_query_t *query)
+{
+  free(query->segments);
+  free(query->text);
+  memset(query, 0, sizeof(*query));
+}
+
+
+/* Matching */
+
+/* Matches a name against a glob, where * matches any run of characters, ?
+   matches any one, and a backslash makes the next character plain. */
+static int sp_glob_match(const char *pattern, const char *pattern_end, const char *name, const char *name_end)
+{
+  const char *star_pattern = NULL;
+  const char *star_name = NULL;
+
+  while (name != name_end) {
+    if (pattern != pattern_end) {
+      const char *next = pattern + 1;
+      char c = *pattern;
+
+      if (c == '*') {
+        star_pattern = next;
+        star_name = name;
+        pattern = next;
+        continue;
+      }
+
+      if (c == '\\' && next != pattern_end)
+        c = *next++;
+      else if (c == '?')
+        c = *name;
+
+      if (c == *name) {
+        pattern = next;
+        ++name;
+        continue;
+      }
+    }
+
+    /* Backtrack, letting the last * take one more character. */
+    if (star_pattern == NULL)
+      return 0;
+    pattern = star_pattern;
+    name = ++star_name;
+  }
+
+  while (pattern != pattern_end && *pattern == '*')
+    ++pattern;
+  return pattern == pattern_end;
+}
+
+static int sp_query_segment_match(const sparse_query_t *query, const sparse_query_segment_t *segment,
+                                  const char *begin, const char *end)
+{
+  const char *text = query->text + segment->text_offset;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+
+  switch (segment->kind) {
+  case SP_QUERY_LITERAL:
+    return length == segment->text_length && (length == 0 || memcmp(begin, text, length) == 0);
+  case SP_QUERY_GLOB:
+    return sp_glob_match(text, text + segment->text_length, begin, begin + length);
+  case SP_QUERY_ANY:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int sp_query_reserve(sparse_query_state_t *state, size_t count)
+{
+  if (state->num_positions + state->num_next + count > state->positions_capacity) {
+    size_t capacity = state->positions_capacity * 2;
+    uint32_t *positions;
+
+    while (capacity < state->num_positions + state->num_next + count)
+      capacity *= 2;
+
+    positions = (uint32_t *)realloc(state->positions, capacity * sizeof(*positions));
+    if (positions == NULL)
+      return 0;
+    state->positions = positions;
+    state->positions_capacity = capacity;
+  }
+
+  return 1;
+}
+
+/*
+  Adds a segment to the set being built past the top of the stack, along with
+  the segment after it if this one can match no names at all. Returns the
+  lowest path index reached, or SP_QUERY_NO_PATH.
+*/
+static size_t sp_query_add_position(sparse_query_state_t *state, uint32_t position)
+{
+  const sparse_query_segment_t *segments = state->query->segments;
+  size_t accepted = SP_QUERY_NO_PATH;
+
+  for (;;) {
+    if (state->marks[position] == state->mark)
+      return accepted;
+
+    state->marks[position] = state->mark;
+    state->positions[state->num_positions + state->num_next++] = position;
+
+    if (segments[position].kind == SP_QUERY_ACCEPT && segments[position].text_offset < accepted)
+      accepted = segments[position].text_offset;
+
+    if (segments[position].kind != SP_QUERY_ANY_PATH)
+      return accepted;
+    ++position;
+  }
+}
+
+static void sp_query_next_mark(sparse_query_state_t *state)
+{
+  if (++state->mark == 0) {
+    memset(state->marks, 0, state->query->num_segments * sizeof(*state->marks));
+    state->mark = 1;
+  }
+}
+
+/*
+  Works out which segments could match the next name down from a field named
+  [begin, end) and returns the first path it matches, if any. The set can't be
+  bigger than the number of segments.
+*/
+static size_t sp_query_step(sparse_query_state_t *state, const char *begin, const char *end)
+{
+  const sparse_query_t *query = state->query;
+  const size_t set_begin = state->set_begins[state->depth];
+  const size_t set_end = state->num_positions;
+  size_t accepted = SP_QUERY_NO_PATH;
+  size_t index;
+
+  state->num_next = 0;
+  sp_query_next_mark(state);
+
+  for (index = set_begin; index < set_end; ++index) {
+    const uint32_t position = state->positions[index];
+    const sparse_query_segment_t *segment = &query->segments[position];
+    size_t path = SP_QUERY_NO_PATH;
+
+    if (segment->kind == SP_QUERY_ANY_PATH)
+      path = sp_query_add_position(state, position);
+    else if (sp_query_segment_match(query, segment, begin, end))
+      path = sp_query_add_position(state, position + 1);
+
+    if (path < accepted)
+      accepted = path;
+  }
+
+  return accepted;
+}
+
+static void sp_query_send(sparse_query_state_t *state, sparse_msg_t msg, const char *begin, const char *end)
+{
+  if (state->callback != NULL)
+    state->callback(state->match_path, msg, begin, end, state->context);
+}
+
+static void sp_query_no_mem(sparse_query_state_t *state)
+{
+  state->error = SP_ERROR_NO_MEM;
+  if (state->callback != NULL)
+    state->callback(SP_QUERY_NO_PATH, SP_ERROR, sp_errstr_no_mem, sp_errstr_no_mem + strlen(sp_errstr_no_mem), state->context);
+  sparse_halt(&state->parser);
+}
+
+/* The parser's callback. */
+static void sp_query_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sparse_query_state_t *state = (sparse_query_state_t *)context;
+
+  if (msg == SP_ERROR) {
+    if (state->callback != NULL)
+      state->callback(SP_QUERY_NO_PATH, msg, begin, end, state->context);
+    return;
+  }
+
+  if (state->error != SP_NO_ERROR)
+    return;
+
+  if (state->matching) {
+    sp_query_send(state, msg, begin, end);
+
+    switch (msg) {
+    case SP_BEGIN_NODE:
+      ++state->match_depth;
+      break;
+    case SP_END_NODE:
+      if (--state->match_depth == 0)
+        state->matching = 0;
+      break;
+    case SP_VALUE:
+      if (state->match_depth == 0)
+        state->matching = 0;
+      break;
+    default:
+      break;
+    }
+
+    return;
+  }
+
+  switch (msg) {
+  case SP_NAME:
+    state->match_path = sp_query_step(state, begin, end);
+    if (state->match_path != SP_QUERY_NO_PATH) {
+      state->num_next = 0;
+      state->matching = 1;
+      state->match_depth = 0;
+      sp_query_send(state, msg, begin, end);
+    }
+    break;
+
+  case SP_VALUE:
+    state->num_next = 0;
+    break;
+
+  case SP_BEGIN_NODE:
+    if (state->num_next == 0) {
+      /* Nothing in here can match. */
+      state->skip = 1;
+      sparse_halt(&state->parser);
+      break;
+    }
+
+    if (state->depth + 2 > state->set_begins_capacity) {
+      const size_t capacity = state->set_begins_capacity * 2;
+      size_t *set_begins = (size_t *)realloc(state->set_begins, capacity * sizeof(*set_begins));
+      if (set_begins == NULL) {
+        sp_query_no_mem(state);
+        break;
+      }
+      state->set_begins = set_begins;
+      state->set_begins_capacity = capacity;
+    }
+
+    state->set_begins[++state->depth] = state->num_positions;
+    state->num_positions += state->num_next;
+    state->num_next = 0;
+    /* Room for the next name's set. */
+    if (!sp_query_reserve(state, state->query->num_segments))
+      sp_query_no_mem(state);
+    break;
+
+  case SP_END_NODE:
+    if (state->depth > 0) {
+      state->num_next = 0;
+      state->num_positions = state->set_begins[state->depth--];
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+sparse_error_t sparse_query_begin(sparse_query_state_t *state, const sparse_query_t *query, sparse_options_t options,
+                                  sparse_query_fn_t callback, void *context)
+{
+  sparse_error_t error;
+  size_t path_begin = 0;
+  size_t index;
+
+  memset(state, 0, sizeof(*state));
+  state->query = query;
+  state->callback = callback;
+  state->context = context;
+
+  state->positions_capacity = query->num_segments * 2 + 1;
+  state->positions = (uint32_t *)malloc(state->positions_capacity * sizeof(*state->positions));
+  state->set_begins_capacity = 16;
+  state->set_begins = (size_t *)malloc(state->set_begins_capacity * sizeof(*state->set_begins));
+  state->marks = (uint32_t *)calloc(query->num_segments + 1, sizeof(*state->marks));
+
+  if (state->positions == NULL || state->set_begins == NULL || state->marks == NULL) {
+    free(state->positions);
+    free(state->set_begins);
+    free(state->marks);
+    memset(state, 0, sizeof(*state));
+    return SP_ERROR_NO_MEM;
+  }
+
+  /* Names and values only have to last through the callback. */
+  error = sparse_begin(&state->parser, 0, (sparse_options_t)(options | SP_ZERO_COPY), sp_query_event, state);
+  if (error != SP_NO_ERROR) {
+    state->error = error;
+    sparse_query_end(state);
+    return error;
+  }
+
+  /* The root's set is the first segment of every path. */
+  sp_query_next_mark(state);
+  for (index = 0; index < query->num_segments; ++index) {
+    if (index == path_begin)
+      sp_query_add_position(state, (uint32_t)index);
+    if (query->segments[index].kind == SP_QUERY_ACCEPT)
+      path_begin = index + 1;
+  }
+  state->set_begins[0] = 0;
+  state->num_positions = state->num_next;
+  state->num_next = 0;
+
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_query_run(sparse_query_state_t *state, const char *src_begin, const char *src_end)
+{
+  const char *src_iter = src_begin;
+  sparse_error_t error = state->error;
+
+  if (src_end == NULL)
+    src_end = src_begin + strlen(src_begin);
+
+  while (error == SP_NO_ERROR && src_iter != src_end) {
+    if (state->skip_depth > 0) {
+      src_iter = sp_skip_node(&state->parser, &state->skip_depth, src_iter, src_end);
+      continue;
+    }
+
+    error = sparse_run_partial(&state->parser, src_iter, src_end, &src_iter);
+    if (error == SP_NO_ERROR)
+      error = state->error;
+
+    if (error == SP_NO_ERROR && state->skip) {
+      state->skip = 0;
+      sp_skip_begin(&state->parser, &state->skip_depth);
+    }
+  }
+
+  state->error = error;
+  return error;
+}
+
+sparse_error_t sparse_query_end(sparse_query_state_t *state)
+{
+  sparse_error_t error = state->error;
+
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state->parser);
+  } else {
+    state->parser.callback = NULL;
+    sparse_end(&state->parser);
+  }
+
+  free(state->positions);
+  free(state->set_begins);
+  free(state->marks);
+  memset(state, 0, sizeof(*state));
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
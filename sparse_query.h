@@ -0,0 +1,116 @@
+#ifndef __CMT_SPARSE_QUERY_H__
+#define __CMT_SPARSE_QUERY_H__
+
+#include "sparse.h"
+#include <stdint.h>
+
+/* Path index passed along with errors, which don't belong to any path. */
+#define SP_QUERY_NO_PATH ((size_t)-1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Path queries. A path is a list of names separated by slashes, matched
+  against the names of the nodes leading to a field and the field's own name,
+  so `shader/0/map` matches the map field in the 0 node of the shader root
+  node. In a name, * matches any run of characters and ? any one character,
+  so a first name of just * would match the map in the 0 node of every root
+  node. A name that's just ** matches any number of names, including none. A
+  backslash makes the next character plain, so `materials\/base\/fl_tile1/0`
+  looks in the root node with slashes in its name.
+
+  A compiled query is only read while running, so one query can be shared by
+  any number of query states and threads.
+*/
+typedef enum {
+  SP_QUERY_LITERAL,
+  SP_QUERY_GLOB,
+  SP_QUERY_ANY,      /* * */
+  SP_QUERY_ANY_PATH, /* ** */
+  SP_QUERY_ACCEPT    /* End of a path (text_offset is the path's index) */
+} sparse_query_kind_t;
+
+typedef struct s_sparse_query_segment {
+  sparse_query_kind_t kind;
+  uint32_t text_offset;
+  uint32_t text_length;
+} sparse_query_segment_t;
+
+typedef struct s_sparse_query {
+  /* Every path's segments, one after another, each ending with an
+     SP_QUERY_ACCEPT. */
+  sparse_query_segment_t *segments;
+  size_t num_segments;
+  /* Literal names unescaped, glob names as written. */
+  char *text;
+  size_t num_paths;
+} sparse_query_t;
+
+/*
+  Called for each event of a matching field: its name, then its value or its
+  node up to and including the closing brace. path_index is the first path
+  that matched. Errors are sent with SP_QUERY_NO_PATH.
+*/
+typedef void (*sparse_query_fn_t)(size_t path_index, sparse_msg_t msg, const char *begin, const char *end, void *context);
+
+typedef struct s_sparse_query_state {
+  sparse_state_t parser;
+  const sparse_query_t *query;
+  sparse_query_fn_t callback;
+  void *context;
+
+  /* Segments that could match a name in each open node, stacked, with
+     set_begins[n] where node n's set begins. The set for the last name read
+     sits just past the top until it's known whether the name opens a node. */
+  uint32_t *positions;
+  size_t num_positions;
+  size_t positions_capacity;
+  size_t num_next;
+  size_t *set_begins;
+  size_t depth;
+  size_t set_begins_capacity;
+
+  /* Used to keep segments from being added to a set twice. */
+  uint32_t *marks;
+  uint32_t mark;
+
+  /* Set by the parser's callback when a node it just opened can't match, so
+     it's skipped once the parser halts. skip_depth counts the nodes left to
+     close while skipping. */
+  int skip;
+  size_t skip_depth;
+
+  /* Set while a matching field is being sent. */
+  int matching;
+  size_t match_path;
+  size_t match_depth;
+
+  sparse_error_t error;
+} sparse_query_state_t;
+
+/*
+  Compiles num_paths paths. Free the query with sparse_query_free when no
+  state is using it any longer, even if compiling failed.
+*/
+sparse_error_t sparse_query_compile(sparse_query_t *query, const char *const *paths, size_t num_paths);
+void sparse_query_free(sparse_query_t *query);
+
+/*
+  Begins a state that runs query against a document and only calls callback
+  for fields that match it. Nodes that can't hold a match are skipped over
+  without parsing their contents. Feed it the document with sparse_query_run
+  the same way as sparse_run, and finish with sparse_query_end, which checks
+  the document was complete and releases the state.
+*/
+sparse_error_t sparse_query_begin(sparse_query_state_t *state, const sparse_query_t *query, sparse_options_t options,
+                                  sparse_query_fn_t callback, void *context);
+sparse_error_t sparse_query_run(sparse_query_state_t *state, const char *src_begin, const char *src_end);
+sparse_error_t sparse_query_end(sparse_query_state_t *state);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_QUERY_H__ include guard */
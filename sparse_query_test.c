@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_query.h"
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_match(size_t path_index, sparse_msg_t msg, const char *begin, const char *end, void *context);
+static sparse_error_t run_query(event_log_t *log, const sparse_query_t *query, const char *src, size_t chunk_size);
+static int check_query(const char *src, const char *const *paths, size_t num_paths, const char *expected);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (length == 0)
+    return;
+  if (log->size + length + 1 > log->capacity) {
+    log->capacity = (log->size + length + 1) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+  log->data[log->size] = '\0';
+}
+
+/* Logs each event as path:msg:string with a space after it. Brace events
+   leave out the brace. */
+static void log_match(size_t path_index, sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  char header[32];
+
+  if (msg == SP_BEGIN_NODE || msg == SP_END_NODE)
+    begin = end = NULL;
+
+  if (path_index == SP_QUERY_NO_PATH)
+    snprintf(header, sizeof(header), "-:%d:", (int)msg);
+  else
+    snprintf(header, sizeof(header), "%zu:%d:", path_index, (int)msg);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, begin == NULL ? 0 : (size_t)(end - begin));
+  log_append(log, " ", 1);
+}
+
+static sparse_error_t run_query(event_log_t *log, const sparse_query_t *query, const char *src, size_t chunk_size)
+{
+  const size_t src_size = strlen(src);
+  sparse_query_state_t state;
+  sparse_error_t error;
+  size_t offset;
+
+  log->size = 0;
+  log_append(log, "", 0);
+  sparse_query_begin(&state, query, SP_DEFAULT_OPTIONS, log_match, log);
+
+  for (offset = 0; offset < src_size; offset += chunk_size) {
+    const size_t length = src_size - offset < chunk_size ? src_size - offset : chunk_size;
+    error = sparse_query_run(&state, src + offset, src + offset + length);
+    if (error != SP_NO_ERROR) {
+      sparse_query_end(&state);
+      return error;
+    }
+  }
+
+  return sparse_query_end(&state);
+}
+
+/* Runs the paths against src whole and in chunks of every size up to 16. */
+static int check_query(const char *src, const char *const *paths, size_t num_paths, const char *expected)
+{
+  event_log_t log = { NULL, 0, 0 };
+  sparse_query_t query;
+  size_t chunk_size;
+  int failures = 0;
+
+  sparse_query_compile(&query, paths, num_paths);
+
+  for (chunk_size = 1; chunk_size <= 16; ++chunk_size) {
+    const size_t size = chunk_size == 16 ? strlen(src) + 1 : chunk_size;
+    run_query(&log, &query, src, size);
+    if (log.data == NULL || strcmp(log.data, expected) != 0) {
+      fprintf(stderr, "Query %s in chunks of %zu:\n  expected %s\n  got      %s\n",
+              paths[0], size, expected, log.data != NULL ? log.data : "");
+      ++failures;
+      break;
+    }
+  }
+
+  sparse_query_free(&query);
+  free(log.data);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "    blend { src one; dst one }\n"
+    "  }\n"
+    "  1 { map textures/base/fl_tile1_glow.png }\n"
+    "  clamp_u\n"
+    "}\n"
+    "materials/base/fl_tile2 {\n"
+    "  0 { map \\{escaped\\}.png }\n"
+    "  map not_in_a_stage\n"
+    "  # map in a comment {\n"
+    "}\n"
+    "materials/base/wall { map unrelated }\n"
+    "width 800; height 600\n";
+
+  static const char *first_stage_maps[] = { "*/0/map" };
+  static const char *escaped_root[] = { "materials\\/base\\/fl_tile1/1" };
+  static const char *globs[] = { "materials\\/base\\/fl_tile?/?/map", "*wall/m*" };
+  static const char *any_depth[] = { "**/map", "**/src" };
+  static const char *roots[] = { "width", "height", "nothing" };
+  static const char *overlapping[] = { "materials\\/base\\/fl_tile1/0", "**/blend" };
+
+  int failures = 0;
+
+  failures += check_query(test_string, first_stage_maps, 1,
+    "0:3:map 0:4:textures/base/fl_tile1.png "
+    "0:3:map 0:4:{escaped}.png ");
+
+  failures += check_query(test_string, escaped_root, 1,
+    "0:3:1 0:1: 0:3:map 0:4:textures/base/fl_tile1_glow.png 0:2: ");
+
+  failures += check_query(test_string, globs, 2,
+    "0:3:map 0:4:textures/base/fl_tile1.png "
+    "0:3:map 0:4:textures/base/fl_tile1_glow.png "
+    "0:3:map 0:4:{escaped}.png "
+    "1:3:map 1:4:unrelated ");
+
+  failures += check_query(test_string, any_depth, 2,
+    "0:3:map 0:4:textures/base/fl_tile1.png "
+    "1:3:src 1:4:one "
+    "0:3:map 0:4:textures/base/fl_tile1_glow.png "
+    "0:3:map 0:4:{escaped}.png "
+    "0:3:map 0:4:not_in_a_stage "
+    "0:3:map 0:4:unrelated ");
+
+  failures += check_query(test_string, roots, 3, "0:3:width 0:4:800 1:3:height 1:4:600 ");
+
+  /* A node matching one path is sent whole even if another path would match
+     something inside it. */
+  failures += check_query(test_string, overlapping, 2,
+    "0:3:0 0:1: 0:3:map 0:4:textures/base/fl_tile1.png "
+    "0:3:blend 0:1: 0:3:src 0:4:one 0:3:dst 0:4:one 0:2: 0:2: ");
+
+  /* Errors are still caught in nodes that are skipped. */
+  failures += check_query("skipped { a b }\nunclosed { a b\n", first_stage_maps, 1, "-:-1:Document is incomplete. ");
+  failures += check_query("skipped { a b\n} }\n", first_stage_maps, 1, "-:-1:} ");
+
+  return failures == 0 ? 0 : 1;
+}
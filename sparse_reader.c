@@ -0,0 +1,144 @@
+#include "sparse_reader.h"
+#include "sparse_internal.h"
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+sparse_error_t sparse_reader_begin(sparse_reader_state_t *reader, size_t initial_buffer_capacity, sparse_options_t options)
+{
+  sparse_error_t error;
+
+  memset(reader, 0, sizeof(*reader));
+  /* Events only have to last until the next call, so there's no need to copy
+     anything that doesn't cross into the next input. */
+  error = sparse_begin(&reader->state, initial_buffer_capacity, (sparse_options_t)(options | SP_ZERO_COPY), NULL, NULL);
+  reader->state.events = reader->queue;
+  return error;
+}
+
+sparse_error_t sparse_reader_begin_string(sparse_reader_state_t *reader, sparse_options_t options, const char *src_begin, const char *src_end)
+{
+  const sparse_error_t error = sparse_reader_begin(reader, 0, options);
+
+  if (error == SP_NO_ERROR) {
+    sparse_reader_feed(reader, src_begin, src_end != NULL ? src_end : src_begin + strlen(src_begin));
+    sparse_reader_finish(reader);
+  }
+
+  return error;
+}
+
+sparse_error_t sparse_reader_end(sparse_reader_state_t *reader)
+{
+  /* Stopping partway through a document is fine for a reader, so don't let
+     sparse_end send anything. */
+  reader->state.events = NULL;
+  reader->state.mode = SP_FIND_NAME;
+  reader->state.depth = 0;
+  return sparse_end(&reader->state);
+}
+
+void sparse_reader_feed(sparse_reader_state_t *reader, const char *src_begin, const char *src_end)
+{
+  reader->src_iter = src_begin;
+  reader->src_end = src_end;
+}
+
+void sparse_reader_finish(sparse_reader_state_t *reader)
+{
+  reader->input_finished = 1;
+}
+
+sparse_error_t sparse_reader_next(sparse_reader_state_t *reader, sparse_event_t *event)
+{
+  for (;;) {
+    if (reader->queue_begin < reader->state.num_events) {
+      *event = reader->queue[reader->queue_begin++];
+      /* Errors are returned below, once everything before them is out. */
+      if (event->msg != SP_ERROR)
+        return SP_NO_ERROR;
+      continue;
+    }
+
+    reader->queue_begin = 0;
+    reader->state.num_events = 0;
+
+    if (reader->error != SP_NO_ERROR) {
+      event->msg = SP_ERROR;
+      event->begin = reader->state.error_begin;
+      event->end = reader->state.error_end;
+      return reader->error;
+    } else if (reader->document_finished) {
+      event->msg = SP_END_DOCUMENT;
+      event->begin = event->end = NULL;
+      return SP_NO_ERROR;
+    }
+
+    if (reader->src_iter != reader->src_end) {
+      if (reader->skip_depth > 0)
+        reader->src_iter = sp_skip_node(&reader->state, &reader->skip_depth, reader->src_iter, reader->src_end);
+      else
+        reader->error = sparse_run_partial(&reader->state, reader->src_iter, reader->src_end, &reader->src_iter);
+    } else if (reader->input_finished) {
+      reader->error = sp_end_document(&reader->state);
+      reader->document_finished = 1;
+    } else {
+      event->msg = SP_NEED_INPUT;
+      event->begin = event->end = NULL;
+      return SP_NO_ERROR;
+    }
+  }
+}
+
+void sparse_reader_skip_node(sparse_reader_state_t *reader)
+{
+  sparse_state_t *state = &reader->state;
+  size_t depth = state->depth;
+  size_t open = 0;
+  size_t index;
+
+  if (reader->error != SP_NO_ERROR)
+    return;
+
+  /* The state's depth counts nodes opened and closed by queued events the
+     caller hasn't seen yet, so work out which node they're in from what's
+     been handed out. */
+  for (index = reader->queue_begin; index < state->num_events; ++index) {
+    if (reader->queue[index].msg == SP_BEGIN_NODE)
+      --depth;
+    else if (reader->queue[index].msg == SP_END_NODE)
+      ++depth;
+  }
+
+  if (depth == 0)
+    return;
+
+  /* If the node's closing brace has been parsed already, skipping it is just
+     dropping events up to and including its END_NODE. */
+  for (index = reader->queue_begin; index < state->num_events; ++index) {
+    if (reader->queue[index].msg == SP_BEGIN_NODE) {
+      ++open;
+    } else if (reader->queue[index].msg == SP_END_NODE) {
+      if (open == 0) {
+        reader->queue_begin = index + 1;
+        return;
+      }
+      --open;
+    }
+  }
+
+  /* Otherwise nodes opened by the queue are skipped along with it. */
+  reader->queue_begin = 0;
+  state->num_events = 0;
+  state->depth -= open;
+
+  sp_skip_begin(state, &reader->skip_depth);
+  reader->skip_depth += open;
+  reader->src_iter = sp_skip_node(state, &reader->skip_depth, reader->src_iter, reader->src_end);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,71 @@
+#ifndef __CMT_SPARSE_READER_H__
+#define __CMT_SPARSE_READER_H__
+
+#include "sparse.h"
+
+#define SP_READER_QUEUE_CAPACITY (4)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Pull-style reader (wrapped by sparse_reader_t in C++). Instead of calling
+  back into your code, the reader hands out one event at a time from
+  sparse_reader_next. Events point either into the input you fed the reader or
+  into its buffer and are only valid until the next call to sparse_reader_next
+  or sparse_reader_skip_node.
+*/
+typedef struct s_sparse_reader {
+  sparse_state_t state;
+
+  const char *src_iter;
+  const char *src_end;
+
+  /* Filled in by the state. A single character produces at most three events
+     plus an error. */
+  sparse_event_t queue[SP_READER_QUEUE_CAPACITY];
+  size_t queue_begin;
+
+  /* Number of nodes still to be closed by sparse_reader_skip_node. */
+  size_t skip_depth;
+
+  int input_finished;
+  int document_finished;
+  sparse_error_t error;
+} sparse_reader_state_t;
+
+sparse_error_t sparse_reader_begin(sparse_reader_state_t *reader, size_t initial_buffer_capacity, sparse_options_t options);
+/* Begins a reader over a complete document in memory. */
+sparse_error_t sparse_reader_begin_string(sparse_reader_state_t *reader, sparse_options_t options, const char *src_begin, const char *src_end);
+sparse_error_t sparse_reader_end(sparse_reader_state_t *reader);
+
+/*
+  Gives the reader its next piece of input. Only call this after
+  sparse_reader_next has returned SP_NEED_INPUT (or before the first call),
+  and keep the input alive until it does so again.
+*/
+void sparse_reader_feed(sparse_reader_state_t *reader, const char *src_begin, const char *src_end);
+/* Tells the reader there's no more input coming. */
+void sparse_reader_finish(sparse_reader_state_t *reader);
+
+/*
+  Stores the next event in event. event->msg is SP_NEED_INPUT when the reader
+  has run out of input and SP_END_DOCUMENT once the document is done. If an
+  error occurs, returns it with event->msg set to SP_ERROR and the event's
+  string pointing at the error, and keeps returning it after that.
+*/
+sparse_error_t sparse_reader_next(sparse_reader_state_t *reader, sparse_event_t *event);
+
+/*
+  Skips the rest of the innermost node open in the events returned so far,
+  including its closing brace, without producing any events for it. Does
+  nothing at the root.
+*/
+void sparse_reader_skip_node(sparse_reader_state_t *reader);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_READER_H__ include guard */
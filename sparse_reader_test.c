@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_reader.h"
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static void log_callback_events(event_log_t *log, const char *src, sparse_options_t options);
+static void log_reader_events(event_log_t *log, const char *src, sparse_options_t options, size_t chunk_size);
+static int check_skip_node(void);
+static void read_to(sparse_reader_state_t *reader, sparse_event_t *event, const char *token);
+static int check_skip_queued(void);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static void log_callback_events(event_log_t *log, const char *src, sparse_options_t options)
+{
+  sparse_state_t state;
+  sparse_error_t error;
+  char result[32];
+
+  log->size = 0;
+  sparse_begin(&state, 0, options, log_event, log);
+  error = sparse_run(&state, src, NULL);
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+
+  snprintf(result, sizeof(result), "=%d", (int)error);
+  log_append(log, result, strlen(result));
+}
+
+/* Pulls every event out of a reader fed chunk_size bytes at a time. */
+static void log_reader_events(event_log_t *log, const char *src, sparse_options_t options, size_t chunk_size)
+{
+  const size_t length = strlen(src);
+  size_t offset = 0;
+  sparse_reader_state_t reader;
+  sparse_event_t event;
+  sparse_error_t error = SP_NO_ERROR;
+  char result[32];
+
+  log->size = 0;
+  sparse_reader_begin(&reader, 0, options);
+
+  for (;;) {
+    error = sparse_reader_next(&reader, &event);
+    if (error != SP_NO_ERROR) {
+      log_event(SP_ERROR, event.begin, event.end, log);
+      break;
+    } else if (event.msg == SP_END_DOCUMENT) {
+      break;
+    } else if (event.msg == SP_NEED_INPUT) {
+      const size_t next = offset + chunk_size < length ? offset + chunk_size : length;
+      if (offset == length) {
+        sparse_reader_finish(&reader);
+      } else {
+        sparse_reader_feed(&reader, src + offset, src + next);
+        offset = next;
+      }
+      continue;
+    }
+
+    log_event(event.msg, event.begin, event.end, log);
+  }
+
+  sparse_reader_end(&reader);
+  snprintf(result, sizeof(result), "=%d", (int)error);
+  log_append(log, result, strlen(result));
+}
+
+/* Skipping the first material's node should go straight to the next one. */
+static int check_skip_node(void)
+{
+  static const char *src =
+    "materials/first {\n"
+    "  0 { map a.png # { unbalanced in a comment\n }\n"
+    "  escaped \\} brace \\{\n"
+    "}\n"
+    "materials/second {\n"
+    "  0 { map b.png }\n"
+    "}\n";
+
+  sparse_reader_state_t reader;
+  sparse_event_t event;
+  int failures = 0;
+
+  sparse_reader_begin_string(&reader, SP_DEFAULT_OPTIONS, src, NULL);
+
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_NAME || strncmp(event.begin, "materials/first", 15) != 0;
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_BEGIN_NODE;
+
+  sparse_reader_skip_node(&reader);
+
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_NAME || strncmp(event.begin, "materials/second", 16) != 0;
+
+  /* Skip the second one from inside its child node. */
+  sparse_reader_next(&reader, &event);
+  sparse_reader_next(&reader, &event);
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_BEGIN_NODE;
+  sparse_reader_skip_node(&reader);
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_END_NODE;
+
+  failures += sparse_reader_next(&reader, &event) != SP_NO_ERROR || event.msg != SP_END_DOCUMENT;
+  sparse_reader_end(&reader);
+
+  if (failures != 0)
+    fprintf(stderr, "sparse_reader_skip_node didn't skip the right nodes.\n");
+  return failures;
+}
+
+/* Reads up to the first event with the given string. */
+static void read_to(sparse_reader_state_t *reader, sparse_event_t *event, const char *token)
+{
+  while (sparse_reader_next(reader, event) == SP_NO_ERROR && event->msg != SP_END_DOCUMENT
+         && ((size_t)(event->end - event->begin) != strlen(token)
+             || strncmp(event->begin, token, strlen(token)) != 0))
+    ;
+}
+
+/* A single char can queue several events, and skipping should go by the
+   ones handed out so far, not by how far the reader has parsed. */
+static int check_skip_queued(void)
+{
+  sparse_reader_state_t reader;
+  sparse_event_t event;
+  int failures = 0;
+
+  /* The } after c queues a's END_NODE along with c, so skipping a only
+     drops that. */
+  sparse_reader_begin_string(&reader, SP_TRIM_TRAILING_SPACES, "x {\n a {\n b c }\n d e\n}\nlast 1\n", NULL);
+  read_to(&reader, &event, "c");
+  sparse_reader_skip_node(&reader);
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_NAME || event.end - event.begin != 1 || *event.begin != 'd';
+  sparse_reader_end(&reader);
+
+  /* The { right after y queues y's BEGIN_NODE along with its name, and y's
+     node is skipped along with the rest of x. */
+  sparse_reader_begin_string(&reader, SP_TRIM_TRAILING_SPACES, "x {\n y{ n 1 }\n e f\n}\nlast 1\n", NULL);
+  read_to(&reader, &event, "y");
+  sparse_reader_skip_node(&reader);
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_NAME || event.end - event.begin != 4 || strncmp(event.begin, "last", 4) != 0;
+  failures += sparse_reader_next(&reader, &event) != SP_NO_ERROR || event.msg != SP_VALUE;
+  failures += sparse_reader_next(&reader, &event) != SP_NO_ERROR || event.msg != SP_END_DOCUMENT;
+  sparse_reader_end(&reader);
+
+  /* At the root, a queued nameless node isn't the caller's to skip. */
+  sparse_reader_begin_string(&reader, SP_NAMELESS_ROOT_NODES, "a b\n{ c d }\n", NULL);
+  read_to(&reader, &event, "");
+  sparse_reader_skip_node(&reader);
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_BEGIN_NODE;
+  sparse_reader_next(&reader, &event);
+  failures += event.msg != SP_NAME || event.end - event.begin != 1 || *event.begin != 'c';
+  sparse_reader_end(&reader);
+
+  if (failures != 0)
+    fprintf(stderr, "sparse_reader_skip_node skipped by events the caller hadn't read.\n");
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *tests[] = {
+    "# This is a named root node (technically just a field with a node value):\n"
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    # Incidentally, #s begin comments\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "  }\n"
+    "  clamp_u # Value-less fields\n"
+    "  clamp_v\n"
+    "}\n"
+    "\n"
+    "{\n"
+    "  reason_for_using none\n"
+    "}\n"
+    "fullscreen\n"
+    "fov 100 { nested after value }\n"
+    "width 800; height 600\n"
+    "escaped\\ name with\\ttabs  and   spaces   \n"
+    "last",
+    "outer {\n  inner { x }\n} }\n",
+    "open {\n  never closed\n",
+  };
+
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t actual = { NULL, 0, 0 };
+  size_t test_index;
+  size_t chunk_size;
+  int options_bits;
+  int failures = 0;
+
+  for (test_index = 0; test_index < sizeof(tests) / sizeof(*tests); ++test_index) {
+    for (options_bits = 0; options_bits < 32; ++options_bits) {
+      const sparse_options_t options = (sparse_options_t)options_bits;
+      log_callback_events(&expected, tests[test_index], options);
+
+      for (chunk_size = 1; chunk_size < 40; chunk_size += 3) {
+        log_reader_events(&actual, tests[test_index], options, chunk_size);
+        if (actual.size != expected.size || memcmp(actual.data, expected.data, actual.size) != 0) {
+          fprintf(stderr, "Reader events differ for test %zu, options %d, chunk size %zu\n",
+                  test_index, options_bits, chunk_size);
+          ++failures;
+        }
+      }
+    }
+  }
+
+  failures += check_skip_node();
+  failures += check_skip_queued();
+
+  free(expected.data);
+  free(actual.data);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+#include "sparse_internal.h"
+
+#if !defined(SP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SP_SCAN_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SP_SCAN_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SP_SCAN_AVX2 1
+#include <immintrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef const char *(*sp_scan_fn_t)(const char *begin, const char *end);
+
+/* 1 for every byte sp_scan_structural stops on */
+static const unsigned char sp_structural_chars[256] = {
+  ['\t'] = 1, ['\n'] = 1, [' '] = 1, ['#'] = 1,
+  [';'] = 1, ['\\'] = 1, ['{'] = 1, ['}'] = 1
+};
+
+static const char *sp_scan_structural_scalar(const char *begin, const char *end)
+{
+  for (; begin != end; ++begin) {
+    if (sp_structural_chars[(unsigned char)*begin])
+      break;
+  }
+  return begin;
+}
+
+static const char *sp_scan_newline_scalar(const char *begin, const char *end)
+{
+  for (; begin != end && *begin != '\n'; ++begin)
+    ;
+  return begin;
+}
+
+static const char *sp_scan_braces_scalar(const char *begin, const char *end)
+{
+  for (; begin != end; ++begin) {
+    const char c = *begin;
+    if (c == '{' || c == '}' || c == '#' || c == '\\')
+      break;
+  }
+  return begin;
+}
+
+#ifdef SP_SCAN_SSE2
+
+static unsigned sp_ctz(unsigned mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned)index;
+#else
+  return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static const char *sp_scan_structural_sse2(const char *begin, const char *end)
+{
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i hash = _mm_set1_epi8('#');
+  const __m128i semicolon = _mm_set1_epi8(';');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lbrace = _mm_set1_epi8('{');
+  const __m128i rbrace = _mm_set1_epi8('}');
+
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i chunk = _mm_loadu_si128((const __m128i *)begin);
+    const __m128i hits = _mm_or_si128(
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, newline)),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, hash))),
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, semicolon), _mm_cmpeq_epi8(chunk, backslash)),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, lbrace), _mm_cmpeq_epi8(chunk, rbrace))));
+    const unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_structural_scalar(begin, end);
+}
+
+static const char *sp_scan_newline_sse2(const char *begin, const char *end)
+{
+  const __m128i newline = _mm_set1_epi8('\n');
+
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i chunk = _mm_loadu_si128((const __m128i *)begin);
+    const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_newline_scalar(begin, end);
+}
+
+static const char *sp_scan_braces_sse2(const char *begin, const char *end)
+{
+  const __m128i hash = _mm_set1_epi8('#');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lbrace = _mm_set1_epi8('{');
+  const __m128i rbrace = _mm_set1_epi8('}');
+
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i chunk = _mm_loadu_si128((const __m128i *)begin);
+    const __m128i hits = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, hash), _mm_cmpeq_epi8(chunk, backslash)),
+      _mm_or_si128(_mm_cmpeq_epi8(chunk, lbrace), _mm_cmpeq_epi8(chunk, rbrace)));
+    const unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_braces_scalar(begin, end);
+}
+
+#endif /* SP_SCAN_SSE2 */
+
+#ifdef SP_SCAN_AVX2
+
+__attribute__((target("avx2")))
+static const char *sp_scan_structural_avx2(const char *begin, const char *end)
+{
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i semicolon = _mm256_set1_epi8(';');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lbrace = _mm256_set1_epi8('{');
+  const __m256i rbrace = _mm256_set1_epi8('}');
+
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i chunk = _mm256_loadu_si256((const __m256i *)begin);
+    const __m256i hits = _mm256_or_si256(
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(chunk, newline)),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, hash))),
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, semicolon), _mm256_cmpeq_epi8(chunk, backslash)),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lbrace), _mm256_cmpeq_epi8(chunk, rbrace))));
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_structural_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *sp_scan_newline_avx2(const char *begin, const char *end)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i chunk = _mm256_loadu_si256((const __m256i *)begin);
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_newline_sse2(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *sp_scan_braces_avx2(const char *begin, const char *end)
+{
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lbrace = _mm256_set1_epi8('{');
+  const __m256i rbrace = _mm256_set1_epi8('}');
+
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i chunk = _mm256_loadu_si256((const __m256i *)begin);
+    const __m256i hits = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, hash), _mm256_cmpeq_epi8(chunk, backslash)),
+      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lbrace), _mm256_cmpeq_epi8(chunk, rbrace)));
+    const unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+
+    if (mask != 0)
+      return begin + sp_ctz(mask);
+  }
+
+  return sp_scan_braces_sse2(begin, end);
+}
+
+static const char *sp_scan_structural_resolve(const char *begin, const char *end);
+static const char *sp_scan_newline_resolve(const char *begin, const char *end);
+static const char *sp_scan_braces_resolve(const char *begin, const char *end);
+
+static sp_scan_fn_t sp_scan_structural_impl = sp_scan_structural_resolve;
+static sp_scan_fn_t sp_scan_newline_impl = sp_scan_newline_resolve;
+static sp_scan_fn_t sp_scan_braces_impl = sp_scan_braces_resolve;
+
+/*
+  The first call through any scanner picks the best implementation for the
+  CPU and stores it for every later call. Racing threads all store the same
+  pointers, so relaxed atomics are enough.
+*/
+static void sp_scan_pick(void)
+{
+  const int avx2 = __builtin_cpu_supports("avx2");
+  __atomic_store_n(&sp_scan_structural_impl, avx2 ? sp_scan_structural_avx2 : sp_scan_structural_sse2, __ATOMIC_RELAXED);
+  __atomic_store_n(&sp_scan_newline_impl, avx2 ? sp_scan_newline_avx2 : sp_scan_newline_sse2, __ATOMIC_RELAXED);
+  __atomic_store_n(&sp_scan_braces_impl, avx2 ? sp_scan_braces_avx2 : sp_scan_braces_sse2, __ATOMIC_RELAXED);
+}
+
+static const char *sp_scan_structural_resolve(const char *begin, const char *end)
+{
+  sp_scan_pick();
+  return sp_scan_structural(begin, end);
+}
+
+static const char *sp_scan_newline_resolve(const char *begin, const char *end)
+{
+  sp_scan_pick();
+  return sp_scan_newline(begin, end);
+}
+
+static const char *sp_scan_braces_resolve(const char *begin, const char *end)
+{
+  sp_scan_pick();
+  return sp_scan_braces(begin, end);
+}
+
+const char *sp_scan_structural(const char *begin, const char *end)
+{
+  return __atomic_load_n(&sp_scan_structural_impl, __ATOMIC_RELAXED)(begin, end);
+}
+
+const char *sp_scan_newline(const char *begin, const char *end)
+{
+  return __atomic_load_n(&sp_scan_newline_impl, __ATOMIC_RELAXED)(begin, end);
+}
+
+const char *sp_scan_braces(const char *begin, const char *end)
+{
+  return __atomic_load_n(&sp_scan_braces_impl, __ATOMIC_RELAXED)(begin, end);
+}
+
+#elif defined(SP_SCAN_SSE2)
+
+const char *sp_scan_structural(const char *begin, const char *end)
+{
+  return sp_scan_structural_sse2(begin, end);
+}
+
+const char *sp_scan_newline(const char *begin, const char *end)
+{
+  return sp_scan_newline_sse2(begin, end);
+}
+
+const char *sp_scan_braces(const char *begin, const char *end)
+{
+  return sp_scan_braces_sse2(begin, end);
+}
+
+#else
+
+const char *sp_scan_structural(const char *begin, const char *end)
+{
+  return sp_scan_structural_scalar(begin, end);
+}
+
+const char *sp_scan_newline(const char *begin, const char *end)
+{
+  return sp_scan_newline_scalar(begin, end);
+}
+
+const char *sp_scan_braces(const char *begin, const char *end)
+{
+  return sp_scan_braces_scalar(begin, end);
+}
+
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,87 @@
+#include "sparse_split.h"
+#include "sparse_internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sparse_splitter_init(sparse_splitter_t *splitter)
+{
+  splitter->depth = 0;
+  splitter->in_comment = 0;
+  splitter->in_escape = 0;
+}
+
+const char *sparse_splitter_next(sparse_splitter_t *splitter, const char *src_begin, const char *src_end, const char *split_min)
+{
+  const char *src_iter = src_begin;
+  /* Next newline once we're looking for a split, so long root lines with lots
+     of escapes aren't scanned over and over. */
+  const char *newline = NULL;
+
+  while (src_iter != src_end) {
+    if (splitter->in_escape) {
+      splitter->in_escape = 0;
+      ++src_iter;
+      continue;
+    }
+
+    /* Backslashes and braces don't count in comments. */
+    if (splitter->in_comment) {
+      src_iter = sp_scan_newline(src_iter, src_end);
+      if (src_iter == src_end)
+        break;
+
+      splitter->in_comment = 0;
+      ++src_iter;
+      if (splitter->depth == 0 && src_iter > split_min)
+        return src_iter;
+      continue;
+    }
+
+    if (splitter->depth == 0 && src_iter >= split_min) {
+      const char *special;
+
+      if (newline == NULL || newline < src_iter)
+        newline = sp_scan_newline(src_iter, src_end);
+
+      special = sp_scan_braces(src_iter, newline);
+      if (special == newline)
+        return newline == src_end ? NULL : newline + 1;
+      src_iter = special;
+    } else if (splitter->depth == 0 && split_min < src_end) {
+      /* Stop at split_min so a newline right after it isn't skipped. */
+      src_iter = sp_scan_braces(src_iter, split_min);
+      if (src_iter == split_min)
+        continue;
+    } else {
+      src_iter = sp_scan_braces(src_iter, src_end);
+      if (src_iter == src_end)
+        break;
+    }
+
+    switch (*src_iter) {
+    case '{':
+      ++splitter->depth;
+      break;
+    case '}':
+      /* An error in the parser, so just keep the depth sane. */
+      if (splitter->depth > 0)
+        --splitter->depth;
+      break;
+    case '#':
+      splitter->in_comment = 1;
+      break;
+    default: /* \\ */
+      splitter->in_escape = 1;
+      break;
+    }
+    ++src_iter;
+  }
+
+  return NULL;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,42 @@
+#ifndef __CMT_SPARSE_SPLIT_H__
+#define __CMT_SPARSE_SPLIT_H__
+
+#include "sparse.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Finds places where a document can be cut into pieces that parse on their
+  own: just past a newline at the root that isn't escaped. Any such newline
+  (including one that ends a comment) leaves the parser at the root, looking
+  for a name, with nothing pending, which is the same as a fresh state, so each
+  piece produces exactly the events it would have as part of the whole.
+
+  This only tracks braces, comments and escapes, so it's much faster than
+  parsing. It doesn't check for errors; a piece that starts after an error is
+  only meaningful up to that error.
+*/
+typedef struct s_sparse_splitter {
+  size_t depth;
+  int in_comment;
+  int in_escape;
+} sparse_splitter_t;
+
+void sparse_splitter_init(sparse_splitter_t *splitter);
+
+/*
+  Scans forward from src_begin and returns the position just past the first
+  root newline at or after split_min, or NULL if there isn't one before
+  src_end. The splitter keeps track of where it is, so the document can be
+  scanned in chunks by passing each chunk in turn, and the next call after a
+  split picks up from the returned position.
+*/
+const char *sparse_splitter_next(sparse_splitter_t *splitter, const char *src_begin, const char *src_end, const char *split_min);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_SPLIT_H__ include guard */
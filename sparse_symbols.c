@@ -0,0 +1,219 @@
+#include "sparse_symbols.h"
+#include "sparse_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_SYMBOL_BLOCK_CAPACITY (16 * 1024)
+#define SP_DEFAULT_SYMBOLS_CAPACITY (64)
+
+struct s_sparse_symbol_block {
+  struct s_sparse_symbol_block *next;
+  size_t size;
+  size_t capacity;
+  char data[];
+};
+
+/* Empty names may be NULL. */
+static uint32_t sp_symbol_hash(const char *name, size_t length)
+{
+  return (uint32_t)(length == 0 ? SP_HASH_SEED : sp_hash(SP_HASH_SEED, name, name + length));
+}
+
+/* Copies name into the table's blocks with a null terminator. Blocks are
+   never moved or freed before the table is, so copies stay put. */
+static const char *sp_symbols_copy(sparse_symbols_t *symbols, const char *name, size_t length)
+{
+  struct s_sparse_symbol_block *block = symbols->names;
+  char *copy;
+
+  if (block == NULL || block->capacity - block->size < length + 1) {
+    size_t capacity = SP_SYMBOL_BLOCK_CAPACITY;
+    if (capacity < length + 1)
+      capacity = length + 1;
+
+    block = (struct s_sparse_symbol_block *)malloc(sizeof(*block) + capacity);
+    if (block == NULL)
+      return NULL;
+
+    block->size = 0;
+    block->capacity = capacity;
+    block->next = symbols->names;
+    symbols->names = block;
+  }
+
+  copy = block->data + block->size;
+  if (length > 0)
+    memcpy(copy, name, length);
+  copy[length] = '\0';
+  block->size += length + 1;
+  return copy;
+}
+
+/* The slot holding symbol with hash, or the empty slot it would go in. */
+static size_t sp_symbols_slot(const sparse_symbols_t *symbols, const char *name, size_t length, uint32_t hash)
+{
+  const size_t mask = symbols->num_slots - 1;
+  size_t slot = hash & mask;
+
+  for (;; slot = (slot + 1) & mask) {
+    const uint32_t symbol = symbols->slots[slot];
+    const sparse_symbol_t *entry;
+
+    if (symbol == SP_NO_SYMBOL)
+      return slot;
+
+    entry = &symbols->symbols[symbol];
+    if (entry->hash == hash && entry->length == length && (length == 0 || memcmp(entry->name, name, length) == 0))
+      return slot;
+  }
+}
+
+static sparse_error_t sp_symbols_grow_slots(sparse_symbols_t *symbols)
+{
+  const size_t num_slots = symbols->num_slots * 2;
+  uint32_t *slots = (uint32_t *)malloc(num_slots * sizeof(*slots));
+  size_t index;
+
+  if (slots == NULL)
+    return SP_ERROR_NO_MEM;
+
+  memset(slots, 0xFF, num_slots * sizeof(*slots));
+  for (index = 0; index < symbols->num_symbols; ++index) {
+    size_t slot = symbols->symbols[index].hash & (num_slots - 1);
+    while (slots[slot] != SP_NO_SYMBOL)
+      slot = (slot + 1) & (num_slots - 1);
+    slots[slot] = (uint32_t)index;
+  }
+
+  free(symbols->slots);
+  symbols->slots = slots;
+  symbols->num_slots = num_slots;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_symbols_init(sparse_symbols_t *symbols)
+{
+  memset(symbols, 0, sizeof(*symbols));
+
+  symbols->symbols = (sparse_symbol_t *)malloc(SP_DEFAULT_SYMBOLS_CAPACITY * sizeof(*symbols->symbols));
+  symbols->slots = (uint32_t *)malloc(SP_DEFAULT_SYMBOLS_CAPACITY * 2 * sizeof(*symbols->slots));
+
+  if (symbols->symbols == NULL || symbols->slots == NULL) {
+    sparse_symbols_free(symbols);
+    return SP_ERROR_NO_MEM;
+  }
+
+  symbols->symbols_capacity = SP_DEFAULT_SYMBOLS_CAPACITY;
+  symbols->num_slots = SP_DEFAULT_SYMBOLS_CAPACITY * 2;
+  memset(symbols->slots, 0xFF, symbols->num_slots * sizeof(*symbols->slots));
+
+  return SP_NO_ERROR;
+}
+
+void sparse_symbols_free(sparse_symbols_t *symbols)
+{
+  struct s_sparse_symbol_block *block = symbols->names;
+
+  while (block != NULL) {
+    struct s_sparse_symbol_block *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  free(symbols->symbols);
+  free(symbols->slots);
+  memset(symbols, 0, sizeof(*symbols));
+}
+
+sparse_error_t sparse_symbols_intern(sparse_symbols_t *symbols, const char *name, size_t length, uint32_t *symbol)
+{
+  const uint32_t hash = sp_symbol_hash(name, length);
+  size_t slot = sp_symbols_slot(symbols, name, length, hash);
+  sparse_symbol_t *entry;
+
+  if (symbols->slots[slot] != SP_NO_SYMBOL) {
+    *symbol = symbols->slots[slot];
+    return SP_NO_ERROR;
+  }
+
+  if (length > UINT32_MAX || symbols->num_symbols == SP_NO_SYMBOL)
+    return SP_ERROR_NO_MEM;
+
+  if (symbols->num_symbols == symbols->symbols_capacity) {
+    const size_t capacity = symbols->symbols_capacity * 2;
+    sparse_symbol_t *grown = (sparse_symbol_t *)realloc(symbols->symbols, capacity * sizeof(*grown));
+    if (grown == NULL)
+      return SP_ERROR_NO_MEM;
+    symbols->symbols = grown;
+    symbols->symbols_capacity = capacity;
+  }
+
+  if ((symbols->num_symbols + 1) * 2 > symbols->num_slots) {
+    if (sp_symbols_grow_slots(symbols) != SP_NO_ERROR)
+      return SP_ERROR_NO_MEM;
+    slot = sp_symbols_slot(symbols, name, length, hash);
+  }
+
+  entry = &symbols->symbols[symbols->num_symbols];
+  entry->name = sp_symbols_copy(symbols, name, length);
+  if (entry->name == NULL)
+    return SP_ERROR_NO_MEM;
+  entry->length = (uint32_t)length;
+  entry->hash = hash;
+
+  symbols->slots[slot] = (uint32_t)symbols->num_symbols;
+  *symbol = (uint32_t)symbols->num_symbols++;
+  return SP_NO_ERROR;
+}
+
+uint32_t sparse_symbols_find(const sparse_symbols_t *symbols, const char *name, size_t length)
+{
+  return symbols->slots[sp_symbols_slot(symbols, name, length, sp_symbol_hash(name, length))];
+}
+
+const char *sparse_symbols_name(const sparse_symbols_t *symbols, uint32_t symbol, size_t *length)
+{
+  if (symbol >= symbols->num_symbols)
+    return NULL;
+  if (length != NULL)
+    *length = symbols->symbols[symbol].length;
+  return symbols->symbols[symbol].name;
+}
+
+void sparse_interner_fn(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sparse_interner_t *interner = (sparse_interner_t *)context;
+  uint32_t symbol = SP_NO_SYMBOL;
+
+  if (msg == SP_NAME) {
+    const sparse_error_t error = sparse_symbols_intern(interner->symbols, begin, (size_t)(end - begin), &symbol);
+    if (error == SP_NO_ERROR) {
+      const sparse_symbol_t *entry = &interner->symbols->symbols[symbol];
+      begin = entry->name;
+      end = begin + entry->length;
+    } else {
+      interner->error = error;
+    }
+  }
+
+  interner->callback(msg, symbol, begin, end, interner->context);
+}
+
+sparse_error_t sparse_begin_interned(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                     sparse_interner_t *interner, sparse_symbols_t *symbols,
+                                     sparse_symbol_fn_t callback, void *context)
+{
+  interner->symbols = symbols;
+  interner->callback = callback;
+  interner->context = context;
+  interner->error = SP_NO_ERROR;
+  return sparse_begin(state, initial_buffer_capacity, options, sparse_interner_fn, interner);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,89 @@
+#ifndef __CMT_SPARSE_SYMBOLS_H__
+#define __CMT_SPARSE_SYMBOLS_H__
+
+#include "sparse.h"
+#include <stdint.h>
+
+#define SP_NO_SYMBOL ((uint32_t)0xFFFFFFFFu)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Symbol table. Each distinct name interned gets the next symbol, starting
+  at 0, and keeps it for as long as the table lives, so symbols for names a
+  handler cares about can be interned before parsing and compared against
+  the ones names are given while parsing. The table keeps one
+  null-terminated copy of each name, which never moves.
+
+  Interning changes the table, so a table shared between threads needs a
+  lock around sparse_symbols_intern and anything parsing with it. Finding
+  symbols and names only reads it.
+*/
+typedef struct s_sparse_symbol {
+  const char *name;
+  uint32_t length;
+  uint32_t hash;
+} sparse_symbol_t;
+
+struct s_sparse_symbol_block;
+
+typedef struct s_sparse_symbols {
+  /* Indexed by symbol. */
+  sparse_symbol_t *symbols;
+  size_t num_symbols;
+  size_t symbols_capacity;
+
+  /* Open-addressed hash of symbols, SP_NO_SYMBOL where empty. The number of
+     slots is a power of two kept at least twice the number of symbols. */
+  uint32_t *slots;
+  size_t num_slots;
+
+  struct s_sparse_symbol_block *names;
+} sparse_symbols_t;
+
+sparse_error_t sparse_symbols_init(sparse_symbols_t *symbols);
+void sparse_symbols_free(sparse_symbols_t *symbols);
+
+/* Sets *symbol to name's symbol, adding it if it's new. */
+sparse_error_t sparse_symbols_intern(sparse_symbols_t *symbols, const char *name, size_t length, uint32_t *symbol);
+/* Returns name's symbol or SP_NO_SYMBOL if it hasn't been interned. */
+uint32_t sparse_symbols_find(const sparse_symbols_t *symbols, const char *name, size_t length);
+/* Returns the table's copy of symbol's name, or NULL if there's no such
+   symbol. length may be NULL. */
+const char *sparse_symbols_name(const sparse_symbols_t *symbols, uint32_t symbol, size_t *length);
+
+/*
+  Interned parsing. Called for each event the way sparse_fn_t is, along with
+  the name's symbol for SP_NAME (where begin and end point to the table's
+  copy of the name) and SP_NO_SYMBOL for everything else.
+*/
+typedef void (*sparse_symbol_fn_t)(sparse_msg_t msg, uint32_t symbol, const char *begin, const char *end, void *context);
+
+typedef struct s_sparse_interner {
+  sparse_symbols_t *symbols;
+  sparse_symbol_fn_t callback;
+  void *context;
+
+  /* Set if a name couldn't be interned, in which case it was sent with
+     SP_NO_SYMBOL. */
+  sparse_error_t error;
+} sparse_interner_t;
+
+/*
+  Begins a state that interns each name into symbols and sends events to
+  callback with their symbols. interner only needs to outlive the state.
+  Check interner->error after running the state.
+*/
+sparse_error_t sparse_begin_interned(sparse_state_t *state, size_t initial_buffer_capacity, sparse_options_t options,
+                                     sparse_interner_t *interner, sparse_symbols_t *symbols,
+                                     sparse_symbol_fn_t callback, void *context);
+/* The sparse_fn_t used by sparse_begin_interned (context is the interner). */
+void sparse_interner_fn(sparse_msg_t msg, const char *begin, const char *end, void *context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_SYMBOLS_H__ include guard */
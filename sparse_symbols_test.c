@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_document.h"
+#include "sparse_symbols.h"
+
+typedef struct s_dispatch {
+  uint32_t map_symbol;
+  size_t num_maps;
+  size_t num_names;
+  int bad_symbol;
+  const sparse_symbols_t *symbols;
+} dispatch_t;
+
+static const char *const test_string =
+  "materials/base/fl_tile1 {\n"
+  "  0 {\n    map textures/base/fl_tile1.png\n    clamp_u\n    clamp_v\n  }\n"
+  "  1 {\n    map textures/base/fl_tile1_glow.png\n    blend add\n  }\n"
+  "}\n"
+  "materials/base/fl_tile2 {\n"
+  "  0 {\n    map textures/base/fl_tile2.png\n    clamp_u\n    clamp_v\n  }\n"
+  "}\n"
+  "width 800; height 600\n";
+
+static int check_table(void)
+{
+  sparse_symbols_t symbols;
+  char name[32];
+  uint32_t symbol;
+  uint32_t index;
+  size_t length;
+  int failures = 0;
+
+  if (sparse_symbols_init(&symbols) != SP_NO_ERROR)
+    return 1;
+
+  /* Enough names to grow the table a few times. */
+  for (index = 0; index < 5000; ++index) {
+    snprintf(name, sizeof(name), "name_%u", index);
+    if (sparse_symbols_intern(&symbols, name, strlen(name), &symbol) != SP_NO_ERROR || symbol != index) {
+      fprintf(stderr, "Interning %s gave symbol %u\n", name, symbol);
+      ++failures;
+      break;
+    }
+  }
+
+  for (index = 0; index < 5000; index += 7) {
+    const char *copy;
+    snprintf(name, sizeof(name), "name_%u", index);
+    copy = sparse_symbols_name(&symbols, index, &length);
+    if (sparse_symbols_find(&symbols, name, strlen(name)) != index || copy == NULL || length != strlen(name)
+        || strcmp(copy, name) != 0 || sparse_symbols_intern(&symbols, name, strlen(name), &symbol) != SP_NO_ERROR
+        || symbol != index) {
+      fprintf(stderr, "Symbol %u didn't stay the same\n", index);
+      ++failures;
+      break;
+    }
+  }
+
+  if (sparse_symbols_find(&symbols, "name_5000", 9) != SP_NO_SYMBOL || sparse_symbols_name(&symbols, 5000, NULL) != NULL
+      || sparse_symbols_intern(&symbols, "", 0, &symbol) != SP_NO_ERROR || symbol != 5000
+      || sparse_symbols_find(&symbols, "", 0) != 5000) {
+    fprintf(stderr, "Missing or empty names were wrong\n");
+    ++failures;
+  }
+
+  sparse_symbols_free(&symbols);
+  return failures;
+}
+
+static void dispatch_event(sparse_msg_t msg, uint32_t symbol, const char *begin, const char *end, void *context)
+{
+  dispatch_t *dispatch = (dispatch_t *)context;
+  const char *name;
+  size_t length;
+
+  if (msg != SP_NAME) {
+    dispatch->bad_symbol |= symbol != SP_NO_SYMBOL;
+    return;
+  }
+
+  ++dispatch->num_names;
+  if (symbol == dispatch->map_symbol)
+    ++dispatch->num_maps;
+
+  name = sparse_symbols_name(dispatch->symbols, symbol, &length);
+  dispatch->bad_symbol |= name != begin || length != (size_t)(end - begin);
+}
+
+/* Handlers can switch on symbols they interned before parsing. */
+static int check_interned_events(void)
+{
+  sparse_symbols_t symbols;
+  sparse_interner_t interner;
+  sparse_state_t state;
+  dispatch_t dispatch;
+  int failures = 0;
+
+  memset(&dispatch, 0, sizeof(dispatch));
+  sparse_symbols_init(&symbols);
+  sparse_symbols_intern(&symbols, "map", 3, &dispatch.map_symbol);
+  dispatch.symbols = &symbols;
+
+  sparse_begin_interned(&state, 0, SP_TRIM_TRAILING_SPACES, &interner, &symbols, dispatch_event, &dispatch);
+  if (sparse_run(&state, test_string, NULL) != SP_NO_ERROR || sparse_end(&state) != SP_NO_ERROR
+      || interner.error != SP_NO_ERROR) {
+    fprintf(stderr, "Interned parse failed\n");
+    ++failures;
+  }
+
+  /* Names are interned once however often they appear. */
+  if (dispatch.num_maps != 3 || dispatch.num_names != 15 || dispatch.bad_symbol || symbols.num_symbols != 10) {
+    fprintf(stderr, "Interned events were wrong: %zu maps, %zu names, %zu symbols\n",
+            dispatch.num_maps, dispatch.num_names, symbols.num_symbols);
+    ++failures;
+  }
+
+  sparse_symbols_free(&symbols);
+  return failures;
+}
+
+static int check_interned_document(void)
+{
+  sparse_symbols_t symbols;
+  sparse_document_t plain;
+  sparse_document_t interned;
+  uint32_t tile, zero, map;
+  size_t index;
+  int failures = 0;
+
+  sparse_symbols_init(&symbols);
+  if (sparse_document_parse(&plain, test_string, NULL, SP_TRIM_TRAILING_SPACES) != SP_NO_ERROR
+      || sparse_document_parse_interned(&interned, &symbols, test_string, NULL, SP_TRIM_TRAILING_SPACES) != SP_NO_ERROR) {
+    fprintf(stderr, "Failed to parse documents\n");
+    return 1;
+  }
+
+  if (plain.num_nodes != interned.num_nodes) {
+    fprintf(stderr, "Interned document has %zu nodes, not %zu\n", interned.num_nodes, plain.num_nodes);
+    ++failures;
+  }
+
+  for (index = 1; index < plain.num_nodes && index < interned.num_nodes; ++index) {
+    const sparse_node_t *left = &plain.nodes[index];
+    const sparse_node_t *right = &interned.nodes[index];
+    const uint32_t symbol = sparse_document_symbol(&interned, (uint32_t)index);
+    if (left->name_length != right->name_length || strcmp(left->name, right->name) != 0
+        || left->first_child != right->first_child || left->next_sibling != right->next_sibling
+        || right->name != sparse_symbols_name(&symbols, symbol, NULL)) {
+      fprintf(stderr, "Interned node %zu differs\n", index);
+      ++failures;
+    }
+  }
+
+  tile = sparse_document_find(&interned, SP_DOCUMENT_ROOT, "materials/base/fl_tile1", 23);
+  zero = tile == SP_NO_NODE ? SP_NO_NODE : sparse_document_find_symbol(&interned, tile, sparse_symbols_find(&symbols, "0", 1));
+  map = zero == SP_NO_NODE ? SP_NO_NODE : sparse_document_find(&interned, zero, "map", 3);
+  if (map == SP_NO_NODE || strcmp(interned.nodes[map].value, "textures/base/fl_tile1.png") != 0
+      || sparse_document_find(&interned, SP_DOCUMENT_ROOT, "missing", 7) != SP_NO_NODE
+      || sparse_document_symbol(&interned, SP_DOCUMENT_ROOT) != SP_NO_SYMBOL
+      || sparse_document_symbol(&plain, 1) != SP_NO_SYMBOL) {
+    fprintf(stderr, "Interned lookups failed\n");
+    ++failures;
+  }
+
+  sparse_document_free(&plain);
+  sparse_document_free(&interned);
+  sparse_symbols_free(&symbols);
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  failures += check_table();
+  failures += check_interned_events();
+  failures += check_interned_document();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -3,8 +3,31 @@
 #include <string.h>
 #include "sparse.h"
 
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+/* For log_document, to send events to log_event one at a time. */
+#define NO_BATCH ((size_t)-1)
+
 static void check_sparse_result(sparse_error_t error);
 static void sparse_handle(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static void log_batch(const sparse_record_t *records, size_t num_records, const char *data, void *context);
+static sparse_error_t log_document(event_log_t *log, const char *src, size_t length, sparse_options_t options, size_t split, size_t chunk_size, size_t batch_capacity);
+static int check_chunked_runs(const char *src, sparse_options_t options);
+static int check_reset(const char *const *srcs, size_t num_srcs, sparse_options_t options);
+static int check_stats(const char *const *srcs, size_t num_srcs);
+static sparse_error_t log_reference(event_log_t *log, const char *src, size_t length, sparse_options_t options);
+static int check_reference(sparse_options_t options, unsigned seed);
+
+typedef struct s_alloc_counts {
+  size_t allocs;
+  size_t reallocs;
+  size_t frees;
+} alloc_counts_t;
 
 static void check_sparse_result(sparse_error_t error)
 {
@@ -20,6 +43,24 @@ static void check_sparse_result(sparse_error_t error)
   case SP_ERROR_INCOMPLETE_DOCUMENT:
     fprintf(stderr, "The document provided to Sparse was incomplete when sparse_end was called.\n");
     break;
+  case SP_ERROR_IO:
+    fprintf(stderr, "Sparse couldn't read the file it was given.\n");
+    break;
+  case SP_ERROR_BAD_FORMAT:
+    fprintf(stderr, "The file given to Sparse wasn't in the format it expected.\n");
+    break;
+  case SP_ERROR_NOT_FOUND:
+    fprintf(stderr, "Sparse couldn't find the root field it was asked for.\n");
+    break;
+  case SP_ERROR_STALE_INDEX:
+    fprintf(stderr, "The file changed since its index was built.\n");
+    break;
+  case SP_ERROR_INVALID_VALUE:
+    fprintf(stderr, "Sparse was given a value that isn't of the type asked for.\n");
+    break;
+  case SP_ERROR_OUT_OF_RANGE:
+    fprintf(stderr, "Sparse was given a value too large for its type.\n");
+    break;
   case SP_NO_ERROR:
     break;
   }
@@ -37,7 +78,7 @@ static void sparse_handle(sparse_msg_t msg, const char *begin, const char *end,
 
   /* Copy the string passed to sparse_handle (always copy it if possible). */
   if (string_len > 0) {
-    tstring = calloc(string_len, sizeof(*tstring));
+    tstring = calloc(string_len + 1, sizeof(*tstring));
     strncpy(tstring, begin, string_len);
   } else {
     tstring = "EMPTY";
@@ -50,6 +91,477 @@ static void sparse_handle(sparse_msg_t msg, const char *begin, const char *end,
     free(tstring);
 }
 
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+/* Records each event as its message, length, and bytes. */
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static void log_batch(const sparse_record_t *records, size_t num_records, const char *data, void *context)
+{
+  size_t index;
+  for (index = 0; index < num_records; ++index) {
+    const char *begin = data + records[index].offset;
+    log_event(records[index].msg, begin, begin + records[index].length, context);
+  }
+}
+
+/*
+  Parses src in pieces and logs every event and the final error. If split is
+  nonzero, the document is split in two there, otherwise it's fed chunk_size
+  bytes at a time. Unless batch_capacity is NO_BATCH, events are delivered in
+  batches of up to that many.
+*/
+static sparse_error_t log_document(event_log_t *log, const char *src, size_t length, sparse_options_t options, size_t split, size_t chunk_size, size_t batch_capacity)
+{
+  sparse_state_t state;
+  sparse_batch_t batch;
+  sparse_record_t records[8];
+  sparse_error_t error;
+  size_t offset = 0;
+  char result[32];
+
+  log->size = 0;
+  if (batch_capacity != NO_BATCH)
+    error = sparse_begin_batched(&state, 0, options, &batch, batch_capacity != 0 ? records : NULL, batch_capacity,
+                                 log_batch, log);
+  else
+    error = sparse_begin(&state, 0, options, log_event, log);
+
+  while (error == SP_NO_ERROR && offset < length) {
+    size_t next = split != 0 ? (offset < split ? split : length) : offset + chunk_size;
+    if (next > length)
+      next = length;
+    error = sparse_run(&state, src + offset, src + next);
+    offset = next;
+  }
+
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    free(state.buffer);
+    if (batch_capacity != NO_BATCH)
+      free(batch.data);
+  }
+
+  snprintf(result, sizeof(result), "=%d", (int)error);
+  log_append(log, result, strlen(result));
+  return error;
+}
+
+/*
+  Every way of splitting a document across sparse_run calls has to produce the
+  same events as parsing it in one go. Single-byte chunks never give the
+  vectorized scanners more than one byte, so they also check that path against
+  the char-at-a-time one. With SP_ZERO_COPY or batched delivery, the events are
+  compared against a plain parse.
+*/
+static int check_chunked_runs(const char *src, sparse_options_t options)
+{
+  const size_t length = strlen(src);
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t actual = { NULL, 0, 0 };
+  size_t index;
+  int failures = 0;
+
+  static const size_t batch_capacities[] = { NO_BATCH, 0, 1, 3, 7 };
+
+  log_document(&expected, src, length, (sparse_options_t)(options & ~SP_ZERO_COPY), 0, length + 1, NO_BATCH);
+
+  for (index = 1; index < length + 16; ++index) {
+    const size_t split = index < length ? index : 0;
+    const size_t chunk_size = index < length ? 0 : index - length + 1;
+    size_t batch;
+
+    for (batch = 0; batch < sizeof(batch_capacities) / sizeof(*batch_capacities); ++batch) {
+      log_document(&actual, src, length, options, split, chunk_size, batch_capacities[batch]);
+
+      if (actual.size != expected.size || memcmp(actual.data, expected.data, actual.size) != 0) {
+        fprintf(stderr, "Events differ for options %d at %s %zu with batches of %zu\n", (int)options,
+                split != 0 ? "split" : "chunk size", split != 0 ? split : chunk_size, batch_capacities[batch]);
+        ++failures;
+      }
+    }
+  }
+
+  free(expected.data);
+  free(actual.data);
+  return failures;
+}
+
+static void *counting_alloc(size_t size, void *user)
+{
+  ++((alloc_counts_t *)user)->allocs;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *block, size_t size, void *user)
+{
+  ++((alloc_counts_t *)user)->reallocs;
+  return realloc(block, size);
+}
+
+static void counting_free(void *block, void *user)
+{
+  ++((alloc_counts_t *)user)->frees;
+  free(block);
+}
+
+/*
+  A state reused with sparse_reset has to produce the same events as a fresh
+  one for each document, get all its memory from its allocator, and once its
+  buffer has grown for the documents it's given, not allocate at all.
+*/
+static int check_reset(const char *const *srcs, size_t num_srcs, sparse_options_t options)
+{
+  alloc_counts_t counts = { 0, 0, 0 };
+  const sparse_allocator_t allocator = { counting_alloc, counting_realloc, counting_free, &counts };
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t actual = { NULL, 0, 0 };
+  sparse_state_t state;
+  size_t warm_allocs = 0;
+  size_t pass;
+  size_t index;
+  int failures = 0;
+
+  check_sparse_result(sparse_begin_with_allocator(&state, 1, options, NULL, NULL, &allocator));
+
+  for (pass = 0; pass < 2; ++pass) {
+    if (pass == 1)
+      warm_allocs = counts.allocs + counts.reallocs;
+
+    for (index = 0; index < num_srcs; ++index) {
+      const size_t length = strlen(srcs[index]);
+      sparse_error_t error;
+      char result[32];
+
+      log_document(&expected, srcs[index], length, options, 0, length + 1, NO_BATCH);
+
+      actual.size = 0;
+      sparse_reset(&state, options, log_event, &actual);
+      error = sparse_run(&state, srcs[index], srcs[index] + length);
+      if (error == SP_NO_ERROR)
+        error = sparse_reset(&state, options, NULL, NULL);
+      else
+        state.callback = NULL;
+
+      snprintf(result, sizeof(result), "=%d", (int)error);
+      log_append(&actual, result, strlen(result));
+
+      if (actual.size != expected.size || memcmp(actual.data, expected.data, actual.size) != 0) {
+        fprintf(stderr, "Events differ after reset for options %d in document %zu\n", (int)options, index);
+        ++failures;
+      }
+    }
+  }
+
+  if (counts.allocs + counts.reallocs != warm_allocs) {
+    fprintf(stderr, "Reset state allocated %zu times parsing documents again.\n",
+            counts.allocs + counts.reallocs - warm_allocs);
+    ++failures;
+  }
+
+  sparse_end(&state);
+  if (counts.allocs == 0 || counts.frees != counts.allocs) {
+    fprintf(stderr, "Allocator made %zu allocations and %zu frees.\n", counts.allocs, counts.frees);
+    ++failures;
+  }
+
+  free(expected.data);
+  free(actual.data);
+  return failures;
+}
+
+static void count_msg(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  (void)begin; (void)end;
+  ++((uint64_t *)context)[msg + 1];
+}
+
+/*
+  Stats are only kept when built with SP_STATS, so this checks they're zero
+  otherwise. With it, every byte of a document that parses is counted under
+  some mode, and events are counted the same as the callback sees them.
+*/
+static int check_stats(const char *const *srcs, size_t num_srcs)
+{
+  static const char *const modes_src = "# c\nname value\nnode {\n  inner {\n    e\\ sc\\\\ v\n  }\n}\n";
+  uint64_t counts[SP_STATS_NUM_MSGS];
+  sparse_stats_t stats;
+  sparse_state_t state;
+  int failures = 0;
+
+#ifdef SP_STATS
+  size_t index;
+  int options_bits;
+
+  for (index = 0; index < num_srcs; ++index) {
+    for (options_bits = 0; options_bits < 32; ++options_bits) {
+      const size_t length = strlen(srcs[index]);
+      const size_t chunk_size = 7;
+      size_t offset;
+      size_t mode;
+      uint64_t mode_total = 0;
+      sparse_error_t error = SP_NO_ERROR;
+
+      memset(counts, 0, sizeof(counts));
+      check_sparse_result(sparse_begin(&state, 1, (sparse_options_t)options_bits, count_msg, counts));
+      for (offset = 0; offset < length && error == SP_NO_ERROR; offset += chunk_size) {
+        const size_t end = offset + chunk_size < length ? offset + chunk_size : length;
+        error = sparse_run(&state, srcs[index] + offset, srcs[index] + end);
+      }
+      if (error == SP_NO_ERROR)
+        sparse_reset(&state, (sparse_options_t)options_bits, NULL, NULL);
+
+      sparse_get_stats(&state, &stats);
+      for (mode = 0; mode < SP_STATS_NUM_MODES; ++mode)
+        mode_total += stats.mode_bytes[mode];
+
+      if ((error == SP_NO_ERROR && mode_total != length) || memcmp(counts, stats.msg_counts, sizeof(counts)) != 0
+          || (error == SP_NO_ERROR && stats.runs != (length + chunk_size - 1) / chunk_size)
+          || stats.peak_buffer_capacity != state.buffer_capacity || stats.callback_ns > stats.run_ns) {
+        fprintf(stderr, "Stats for document %zu with options %d are wrong (%llu of %zu bytes counted).\n",
+                index, options_bits, (unsigned long long)mode_total, length);
+        ++failures;
+      }
+
+      state.callback = NULL;
+      sparse_end(&state);
+    }
+  }
+
+  check_sparse_result(sparse_begin(&state, 4, SP_TRIM_TRAILING_SPACES, count_msg, counts));
+  check_sparse_result(sparse_run(&state, modes_src, NULL));
+  sparse_get_stats(&state, &stats);
+  if (stats.mode_bytes[SP_READ_COMMENT] != 3 || stats.mode_bytes[SP_READ_NAME] != 4 + 4 + 5 + 7
+      || stats.mode_bytes[SP_READ_VALUE] != 5 + 1 || stats.escapes != 2 || stats.max_depth != 2
+      || stats.buffer_reallocs == 0 || stats.runs != 1) {
+    fprintf(stderr, "Stats for a known document are wrong.\n");
+    ++failures;
+  }
+
+  sparse_reset_stats(&state);
+  sparse_get_stats(&state, &stats);
+  if (stats.runs != 0 || stats.escapes != 0 || stats.peak_buffer_capacity != state.buffer_capacity) {
+    fprintf(stderr, "Stats weren't reset.\n");
+    ++failures;
+  }
+  sparse_end(&state);
+#else
+  (void)srcs; (void)num_srcs;
+  memset(counts, 0, sizeof(counts));
+
+  check_sparse_result(sparse_begin(&state, 0, SP_DEFAULT_OPTIONS, count_msg, counts));
+  check_sparse_result(sparse_run(&state, modes_src, NULL));
+  memset(&stats, 0xFF, sizeof(stats));
+  if (sparse_get_stats(&state, &stats) != 0 || stats.runs != 0 || stats.mode_bytes[SP_READ_NAME] != 0) {
+    fprintf(stderr, "Stats weren't zero without SP_STATS.\n");
+    ++failures;
+  }
+  sparse_end(&state);
+#endif
+
+  return failures;
+}
+
+/*
+  Reference parser: the grammar one char at a time, with no spans, scanners or
+  tables, so sparse_run can be checked against something obviously right.
+  Logs the same way log_document does.
+*/
+static sparse_error_t log_reference(event_log_t *log, const char *src, size_t length, sparse_options_t options)
+{
+  const int consume_whitespace = (options & SP_CONSUME_WHITESPACE) != 0;
+  const int trim_spaces = (options & SP_TRIM_TRAILING_SPACES) != 0;
+  const int nameless_nodes = (options & SP_NAMELESS_NODES) != 0;
+  const int nameless_roots = nameless_nodes || (options & SP_NAMELESS_ROOT_NODES) != 0;
+  sparse_mode_t mode = SP_FIND_NAME;
+  sparse_error_t error = SP_NO_ERROR;
+  char *token = malloc(length + 1);
+  size_t token_size = 0;
+  size_t num_spaces_trailing = 0;
+  size_t depth = 0;
+  int in_escape = 0;
+  int last_char;
+  int current_char = 0;
+  size_t index;
+  char result[32];
+
+  log->size = 0;
+
+#define REF_SEND_TOKEN(MSG) {                                                \
+    log_event((MSG), token, token + token_size - num_spaces_trailing, log); \
+    token_size = 0;                                                          \
+  }
+#define REF_FAIL(AT) {                                                       \
+    log_event(SP_ERROR, (AT), (AT) + 1, log);                                \
+    error = SP_ERROR_INVALID_CHAR;                                           \
+    goto done;                                                               \
+  }
+
+  for (index = 0; index < length; ++index) {
+    last_char = current_char;
+    current_char = (unsigned char)src[index];
+
+    if (mode == SP_READ_COMMENT) {
+      if (current_char == '\n')
+        mode = SP_FIND_NAME;
+      continue;
+    }
+
+    if (in_escape) {
+      const char *const from = "nrabft0";
+      const char *const to = "\n\r\a\b\f\t";
+      const char *const found = current_char == 0 ? NULL : strchr(from, current_char);
+      if (found != NULL)
+        current_char = (unsigned char)to[found - from];
+      in_escape = 0;
+      num_spaces_trailing = 0;
+    } else if (current_char == ' ' || current_char == '\t') {
+      if ((consume_whitespace && last_char == current_char) || mode == SP_FIND_NAME || mode == SP_FIND_VALUE)
+        continue;
+      if (mode == SP_READ_NAME) {
+        REF_SEND_TOKEN(SP_NAME);
+        mode = SP_FIND_VALUE;
+        continue;
+      }
+      if (trim_spaces)
+        ++num_spaces_trailing;
+    } else if (current_char == '{') {
+      if (mode == SP_READ_NAME || mode == SP_FIND_VALUE) {
+        if (mode == SP_READ_NAME)
+          REF_SEND_TOKEN(SP_NAME);
+      } else {
+        if (mode == SP_READ_VALUE)
+          REF_SEND_TOKEN(SP_VALUE);
+        if (!nameless_nodes && !(depth == 0 && nameless_roots))
+          REF_FAIL(src + index);
+        log_event(SP_NAME, "", "", log);
+      }
+      ++depth;
+      log_event(SP_BEGIN_NODE, src + index, src + index + 1, log);
+      mode = SP_FIND_NAME;
+      continue;
+    } else if (current_char == '}') {
+      if (mode == SP_READ_VALUE)
+        REF_SEND_TOKEN(SP_VALUE)
+      else if (mode != SP_FIND_NAME)
+        REF_FAIL(src + index);
+      if (depth == 0)
+        REF_FAIL(src + index);
+      --depth;
+      log_event(SP_END_NODE, src + index, src + index + 1, log);
+      mode = SP_FIND_NAME;
+      continue;
+    } else if (current_char == '#' || current_char == ';' || current_char == '\n') {
+      if (mode == SP_READ_NAME)
+        REF_SEND_TOKEN(SP_NAME);
+      if (mode == SP_READ_NAME || mode == SP_FIND_VALUE)
+        log_event(SP_VALUE, "", "", log);
+      else if (mode == SP_READ_VALUE)
+        REF_SEND_TOKEN(SP_VALUE);
+      mode = current_char == '#' ? SP_READ_COMMENT : SP_FIND_NAME;
+      continue;
+    } else if (current_char == '\\') {
+      in_escape = 1;
+      continue;
+    } else {
+      num_spaces_trailing = 0;
+    }
+
+    if (mode == SP_FIND_NAME)
+      mode = SP_READ_NAME;
+    else if (mode == SP_FIND_VALUE)
+      mode = SP_READ_VALUE;
+    token[token_size++] = (char)current_char;
+  }
+
+  if (mode == SP_READ_NAME) {
+    REF_SEND_TOKEN(SP_NAME);
+    log_event(SP_VALUE, "", "", log);
+  } else if (mode == SP_READ_VALUE) {
+    REF_SEND_TOKEN(SP_VALUE);
+  } else if (mode == SP_FIND_VALUE) {
+    log_event(SP_VALUE, "", "", log);
+  }
+
+  if (depth != 0) {
+    static const char *const incomplete = "Document is incomplete.";
+    log_event(SP_ERROR, incomplete, incomplete + strlen(incomplete), log);
+    error = SP_ERROR_INCOMPLETE_DOCUMENT;
+  }
+
+#undef REF_SEND_TOKEN
+#undef REF_FAIL
+
+  done:
+  free(token);
+  snprintf(result, sizeof(result), "=%d", (int)error);
+  log_append(log, result, strlen(result));
+  return error;
+}
+
+/*
+  Random documents made mostly of structural chars and escapes, fed to
+  sparse_run whole and in pieces, have to give the same events as the
+  reference parser.
+*/
+static int check_reference(sparse_options_t options, unsigned seed)
+{
+  static const char alphabet[] = "ab  \t\t{}#;\n\\\\nt0";
+  static const size_t chunk_sizes[] = { 1, 2, 3, 5, 16, 4096 };
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t actual = { NULL, 0, 0 };
+  char src[96];
+  size_t doc;
+  size_t chunk;
+  int failures = 0;
+
+  for (doc = 0; doc < 200; ++doc) {
+    size_t length;
+    size_t index;
+
+    seed = seed * 1103515245u + 12345u;
+    length = (seed >> 16) % sizeof(src);
+    for (index = 0; index < length; ++index) {
+      seed = seed * 1103515245u + 12345u;
+      src[index] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+    }
+
+    log_reference(&expected, src, length, options);
+
+    for (chunk = 0; chunk < sizeof(chunk_sizes) / sizeof(*chunk_sizes); ++chunk) {
+      log_document(&actual, src, length, options, 0, chunk_sizes[chunk], NO_BATCH);
+
+      if (actual.size != expected.size || memcmp(actual.data, expected.data, actual.size) != 0) {
+        fprintf(stderr, "Events differ from the reference for options %d in chunks of %zu: \"%.*s\"\n",
+                (int)options, chunk_sizes[chunk], (int)length, src);
+        ++failures;
+        break;
+      }
+    }
+  }
+
+  free(expected.data);
+  free(actual.data);
+  return failures;
+}
+
 int main(int argc, char const *argv[])
 {
   (void)argc; (void)argv;
@@ -84,5 +596,39 @@ int main(int argc, char const *argv[])
   check_sparse_result(sparse_run(&state, test_string, test_string + 10));
   check_sparse_result(sparse_run(&state, test_string + 10, NULL));
   check_sparse_result(sparse_end(&state));
+
+  static const char *chunk_tests[] = {
+    "long_name_without_any_structure_at_all_to_cross_vector_widths value_that_is_also_long_enough_to_need_more_than_one_vector\n"
+    "# a comment that runs longer than thirty-two bytes { } ; \\ with structural chars\n"
+    "node {\n  escaped\\ name a\\tb\\\\c\\{\\}\\#\\;\\n\\0 trailing   \n\tdouble  spaced\t\tvalue\t\t \n}\n"
+    "{ nameless_root_only_with_option }\n"
+    "semi;colons;everywhere a;b c\n"
+    "unterminated_field_at_end",
+    "outer {\n  inner { deep { deeper value } }\n  x {\n    } }\nextra }\n",
+    "open {\n  never closed\n",
+    "\\ leading escaped space and a # comment without a newline at the end",
+  };
+  int failures = 0;
+  size_t test_index;
+  int options_bits;
+
+  for (test_index = 0; test_index < sizeof(chunk_tests) / sizeof(*chunk_tests); ++test_index) {
+    for (options_bits = 0; options_bits < 32; ++options_bits)
+      failures += check_chunked_runs(chunk_tests[test_index], (sparse_options_t)options_bits);
+  }
+
+  for (options_bits = 0; options_bits < 32; ++options_bits)
+    failures += check_reset(chunk_tests, sizeof(chunk_tests) / sizeof(*chunk_tests), (sparse_options_t)options_bits);
+
+  failures += check_stats(chunk_tests, sizeof(chunk_tests) / sizeof(*chunk_tests));
+
+  for (options_bits = 0; options_bits < 32; ++options_bits)
+    failures += check_reference((sparse_options_t)options_bits, (unsigned)options_bits + 1);
+
+  if (failures != 0) {
+    fprintf(stderr, "%d chunked parses did not match.\n", failures);
+    return 1;
+  }
+
   return 0;
 }
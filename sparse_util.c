@@ -0,0 +1,86 @@
+#include "sparse_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sp_put_u32(unsigned char *out, uint32_t value)
+{
+  int index;
+  for (index = 0; index < 4; ++index)
+    out[index] = (unsigned char)(value >> (index * 8));
+}
+
+void sp_put_u64(unsigned char *out, uint64_t value)
+{
+  int index;
+  for (index = 0; index < 8; ++index)
+    out[index] = (unsigned char)(value >> (index * 8));
+}
+
+uint32_t sp_get_u32(const unsigned char *in)
+{
+  uint32_t value = 0;
+  int index;
+  for (index = 3; index >= 0; --index)
+    value = (value << 8) | in[index];
+  return value;
+}
+
+uint64_t sp_get_u64(const unsigned char *in)
+{
+  uint64_t value = 0;
+  int index;
+  for (index = 7; index >= 0; --index)
+    value = (value << 8) | in[index];
+  return value;
+}
+
+uint64_t sp_hash(uint64_t hash, const char *begin, const char *end)
+{
+  for (; begin != end; ++begin) {
+    hash ^= (unsigned char)*begin;
+    hash *= SP_HASH_PRIME;
+  }
+  return hash;
+}
+
+sparse_error_t sp_replace_file(const char *path, sp_write_fn_t write, void *context)
+{
+  const size_t path_length = strlen(path);
+  char *temp_path = (char *)malloc(path_length + 5);
+  sparse_error_t error = SP_NO_ERROR;
+  FILE *stream;
+
+  if (temp_path == NULL)
+    return SP_ERROR_NO_MEM;
+
+  memcpy(temp_path, path, path_length);
+  memcpy(temp_path + path_length, ".tmp", 5);
+
+  stream = fopen(temp_path, "wb");
+  if (stream == NULL) {
+    error = SP_ERROR_IO;
+  } else {
+    const int written = write(stream, context);
+    if (fclose(stream) != 0 || !written)
+      error = SP_ERROR_IO;
+#ifdef _WIN32
+    if (error == SP_NO_ERROR)
+      remove(path);
+#endif
+    if (error == SP_NO_ERROR && rename(temp_path, path) != 0)
+      error = SP_ERROR_IO;
+    if (error != SP_NO_ERROR)
+      remove(temp_path);
+  }
+
+  free(temp_path);
+  return error;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,424 @@
+#include "sparse_value.h"
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Doubles hold every integer up to this exactly, and powers of ten up to
+   10^SP_VALUE_MAX_EXACT_POWER. */
+#define SP_VALUE_MAX_EXACT_MANTISSA (UINT64_C(1) << 53)
+#define SP_VALUE_MAX_EXACT_POWER (22)
+/* Exponents are clamped to this while reading them, far past where any
+   double overflows or underflows. */
+#define SP_VALUE_MAX_EXPONENT (100000)
+/* Numbers up to this long are copied onto the stack for strtod. */
+#define SP_VALUE_STACK_CAPACITY (128)
+
+static const double sp_powers_of_ten[SP_VALUE_MAX_EXACT_POWER + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int sp_is_blank(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+static int sp_is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static char sp_lower(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/* Narrows [*begin, *end) to the value inside any spaces and tabs. */
+static void sp_trim_blanks(const char **begin, const char **end)
+{
+  while (*begin != *end && sp_is_blank(**begin))
+    ++*begin;
+  while (*end != *begin && sp_is_blank((*end)[-1]))
+    --*end;
+}
+
+/* True if [begin, end) is word in any case. */
+static int sp_is_word(const char *begin, const char *end, const char *word)
+{
+  for (; begin != end; ++begin, ++word) {
+    if (*word == '\0' || sp_lower(*begin) != *word)
+      return 0;
+  }
+  return *word == '\0';
+}
+
+/* Reads eight bytes as a little-endian integer whatever the byte order.
+   Compilers turn this into a single load where they can. */
+static uint64_t sp_load_le64(const char *src)
+{
+  const unsigned char *bytes = (const unsigned char *)src;
+  return (uint64_t)bytes[0] | ((uint64_t)bytes[1] << 8) | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24)
+    | ((uint64_t)bytes[4] << 32) | ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[6] << 48) | ((uint64_t)bytes[7] << 56);
+}
+
+/* True if all eight bytes of chunk are digits. */
+static int sp_is_eight_digits(uint64_t chunk)
+{
+  return ((chunk & UINT64_C(0xF0F0F0F0F0F0F0F0))
+          | (((chunk + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4))
+    == UINT64_C(0x3333333333333333);
+}
+
+/* The value of eight digits, first digit in the lowest byte. Pairs of digits
+   are combined, then pairs of pairs, then the two halves, with a multiply
+   doing two of each at a time. */
+static uint32_t sp_eight_digits_value(uint64_t chunk)
+{
+  const uint64_t mask = UINT64_C(0x000000FF000000FF);
+  const uint64_t low_multiplier = 100 + (UINT64_C(1000000) << 32);
+  const uint64_t high_multiplier = 1 + (UINT64_C(10000) << 32);
+  chunk -= UINT64_C(0x3030303030303030);
+  chunk = (chunk * 10) + (chunk >> 8);
+  return (uint32_t)((((chunk & mask) * low_multiplier) + (((chunk >> 16) & mask) * high_multiplier)) >> 32);
+}
+
+/*
+  Reads a run of digits onto *value, eight at a time while that can't
+  overflow. Stops before a digit that would take *value past UINT64_MAX, so
+  if that happens the returned position is still on a digit.
+*/
+static const char *sp_read_digits(const char *iter, const char *end, uint64_t *value)
+{
+  uint64_t result = *value;
+
+  while (end - iter >= 8 && result < UINT64_C(100000000000)) {
+    const uint64_t chunk = sp_load_le64(iter);
+    if (!sp_is_eight_digits(chunk))
+      break;
+    result = result * 100000000 + sp_eight_digits_value(chunk);
+    iter += 8;
+  }
+
+  for (; iter != end && sp_is_digit(*iter); ++iter) {
+    const unsigned digit = (unsigned)(*iter - '0');
+    if (result > (UINT64_MAX - digit) / 10)
+      break;
+    result = result * 10 + digit;
+  }
+
+  *value = result;
+  return iter;
+}
+
+static const char *sp_skip_digits(const char *iter, const char *end)
+{
+  while (iter != end && sp_is_digit(*iter))
+    ++iter;
+  return iter;
+}
+
+/* Reads an unsigned integer that makes up all of [begin, end). */
+static sparse_error_t sp_parse_magnitude(const char *begin, const char *end, uint64_t *magnitude)
+{
+  const char *iter;
+  uint64_t value = 0;
+
+  if (begin == end || !sp_is_digit(*begin))
+    return SP_ERROR_INVALID_VALUE;
+
+  iter = sp_read_digits(begin, end, &value);
+  if (iter != end && sp_is_digit(*iter))
+    return sp_skip_digits(iter, end) == end ? SP_ERROR_OUT_OF_RANGE : SP_ERROR_INVALID_VALUE;
+  if (iter != end)
+    return SP_ERROR_INVALID_VALUE;
+
+  *magnitude = value;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_parse_int(const char *begin, const char *end, int64_t *out)
+{
+  uint64_t magnitude;
+  sparse_error_t error;
+  int negative = 0;
+
+  sp_trim_blanks(&begin, &end);
+  if (begin != end && (*begin == '-' || *begin == '+')) {
+    negative = *begin == '-';
+    ++begin;
+  }
+
+  error = sp_parse_magnitude(begin, end, &magnitude);
+  if (error != SP_NO_ERROR)
+    return error;
+
+  if (negative) {
+    if (magnitude > (uint64_t)INT64_MAX + 1)
+      return SP_ERROR_OUT_OF_RANGE;
+    *out = magnitude == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)magnitude;
+  } else {
+    if (magnitude > (uint64_t)INT64_MAX)
+      return SP_ERROR_OUT_OF_RANGE;
+    *out = (int64_t)magnitude;
+  }
+
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_parse_uint(const char *begin, const char *end, uint64_t *out)
+{
+  sp_trim_blanks(&begin, &end);
+  if (begin != end && *begin == '+')
+    ++begin;
+  return sp_parse_magnitude(begin, end, out);
+}
+
+/*
+  Parses a number that has already been checked with strtod, for the ones
+  that can't be worked out exactly with a single multiply or divide. The
+  number is copied so it's null-terminated, with its period replaced by the
+  locale's decimal point, since that's the only part of its syntax strtod
+  reads differently from locale to locale.
+*/
+static sparse_error_t sp_parse_double_slow(const char *begin, const char *end, double *out)
+{
+  char stack_buffer[SP_VALUE_STACK_CAPACITY];
+  const char *point = localeconv()->decimal_point;
+  const size_t point_length = strlen(point);
+  const size_t capacity = (size_t)(end - begin) + point_length + 1;
+  char *buffer = stack_buffer;
+  char *write;
+  char *parse_end;
+  double result;
+  int saved_errno = errno;
+  sparse_error_t error = SP_NO_ERROR;
+
+  if (capacity > sizeof(stack_buffer)) {
+    buffer = (char *)malloc(capacity);
+    if (buffer == NULL)
+      return SP_ERROR_NO_MEM;
+  }
+
+  write = buffer;
+  for (; begin != end; ++begin) {
+    if (*begin == '.') {
+      memcpy(write, point, point_length);
+      write += point_length;
+    } else {
+      *write++ = *begin;
+    }
+  }
+  *write = '\0';
+
+  errno = 0;
+  result = strtod(buffer, &parse_end);
+  if (parse_end != write)
+    error = SP_ERROR_INVALID_VALUE;
+  else if (errno == ERANGE && isinf(result))
+    error = SP_ERROR_OUT_OF_RANGE;
+  else
+    *out = result;
+  errno = saved_errno;
+
+  if (buffer != stack_buffer)
+    free(buffer);
+  return error;
+}
+
+sparse_error_t sparse_parse_double(const char *begin, const char *end, double *out)
+{
+  const char *number_begin;
+  const char *iter;
+  const char *digits_begin;
+  uint64_t mantissa = 0;
+  long exponent = 0;
+  size_t num_digits = 0;
+  int truncated = 0;
+  int negative = 0;
+  double result;
+
+  sp_trim_blanks(&begin, &end);
+  number_begin = iter = begin;
+  if (iter != end && (*iter == '-' || *iter == '+')) {
+    negative = *iter == '-';
+    ++iter;
+  }
+
+  if (iter != end && !sp_is_digit(*iter) && *iter != '.') {
+    if (sp_is_word(iter, end, "inf") || sp_is_word(iter, end, "infinity"))
+      result = HUGE_VAL;
+    else if (sp_is_word(iter, end, "nan"))
+      result = NAN;
+    else
+      return SP_ERROR_INVALID_VALUE;
+    *out = negative ? -result : result;
+    return SP_NO_ERROR;
+  }
+
+  /* Integer part. Digits that don't fit in the mantissa only scale it. */
+  digits_begin = iter;
+  iter = sp_read_digits(iter, end, &mantissa);
+  if (iter != end && sp_is_digit(*iter)) {
+    const char *dropped = iter;
+    iter = sp_skip_digits(iter, end);
+    exponent += (long)(iter - dropped);
+    truncated = 1;
+  }
+  num_digits = (size_t)(iter - digits_begin);
+
+  /* Fraction. Digits that don't fit are left off. */
+  if (iter != end && *iter == '.') {
+    ++iter;
+    digits_begin = iter;
+    if (!truncated) {
+      iter = sp_read_digits(iter, end, &mantissa);
+      exponent -= (long)(iter - digits_begin);
+    }
+    if (iter != end && sp_is_digit(*iter)) {
+      iter = sp_skip_digits(iter, end);
+      truncated = 1;
+    }
+    num_digits += (size_t)(iter - digits_begin);
+  }
+
+  if (num_digits == 0)
+    return SP_ERROR_INVALID_VALUE;
+
+  if (iter != end && (*iter == 'e' || *iter == 'E')) {
+    long written = 0;
+    int negative_exponent = 0;
+
+    ++iter;
+    if (iter != end && (*iter == '-' || *iter == '+')) {
+      negative_exponent = *iter == '-';
+      ++iter;
+    }
+    if (iter == end || !sp_is_digit(*iter))
+      return SP_ERROR_INVALID_VALUE;
+    for (; iter != end && sp_is_digit(*iter); ++iter) {
+      if (written < SP_VALUE_MAX_EXPONENT)
+        written = written * 10 + (*iter - '0');
+    }
+    exponent += negative_exponent ? -written : written;
+  }
+
+  if (iter != end)
+    return SP_ERROR_INVALID_VALUE;
+
+  /* Both the mantissa and the power of ten are exact doubles here, so one
+     multiply or divide rounds the result correctly. Past 10^22, the mantissa
+     can sometimes take a few of the powers itself and stay exact. */
+  if (mantissa == 0 && !truncated) {
+    result = 0.0;
+  } else if (truncated || mantissa > SP_VALUE_MAX_EXACT_MANTISSA) {
+    return sp_parse_double_slow(number_begin, end, out);
+  } else if (exponent < 0 && exponent >= -SP_VALUE_MAX_EXACT_POWER) {
+    result = (double)mantissa / sp_powers_of_ten[-exponent];
+  } else if (exponent >= 0 && exponent <= SP_VALUE_MAX_EXACT_POWER) {
+    result = (double)mantissa * sp_powers_of_ten[exponent];
+  } else {
+    for (; exponent > SP_VALUE_MAX_EXACT_POWER && mantissa <= SP_VALUE_MAX_EXACT_MANTISSA / 10; --exponent)
+      mantissa *= 10;
+    if (exponent > SP_VALUE_MAX_EXACT_POWER || exponent < 0)
+      return sp_parse_double_slow(number_begin, end, out);
+    result = (double)mantissa * sp_powers_of_ten[exponent];
+  }
+
+  *out = negative ? -result : result;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_parse_bool(const char *begin, const char *end, int *out)
+{
+  static const char *const true_words[] = { "true", "yes", "on", "1" };
+  static const char *const false_words[] = { "false", "no", "off", "0" };
+  size_t index;
+
+  sp_trim_blanks(&begin, &end);
+  for (index = 0; index < sizeof(true_words) / sizeof(true_words[0]); ++index) {
+    if (sp_is_word(begin, end, true_words[index])) {
+      *out = 1;
+      return SP_NO_ERROR;
+    }
+    if (sp_is_word(begin, end, false_words[index])) {
+      *out = 0;
+      return SP_NO_ERROR;
+    }
+  }
+
+  return SP_ERROR_INVALID_VALUE;
+}
+
+/* Finds the end of the number starting at iter. */
+static const char *sp_next_blank(const char *iter, const char *end)
+{
+  while (iter != end && !sp_is_blank(*iter))
+    ++iter;
+  return iter;
+}
+
+sparse_error_t sparse_parse_ints(const char *begin, const char *end, int64_t *values, size_t capacity, size_t *count)
+{
+  size_t found = 0;
+
+  for (;;) {
+    const char *number_end;
+    int64_t value;
+    sparse_error_t error;
+
+    while (begin != end && sp_is_blank(*begin))
+      ++begin;
+    if (begin == end)
+      break;
+
+    number_end = sp_next_blank(begin, end);
+    error = sparse_parse_int(begin, number_end, &value);
+    if (error != SP_NO_ERROR)
+      return error;
+    if (found < capacity)
+      values[found] = value;
+    ++found;
+    begin = number_end;
+  }
+
+  *count = found;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_parse_doubles(const char *begin, const char *end, double *values, size_t capacity, size_t *count)
+{
+  size_t found = 0;
+
+  for (;;) {
+    const char *number_end;
+    double value;
+    sparse_error_t error;
+
+    while (begin != end && sp_is_blank(*begin))
+      ++begin;
+    if (begin == end)
+      break;
+
+    number_end = sp_next_blank(begin, end);
+    error = sparse_parse_double(begin, number_end, &value);
+    if (error != SP_NO_ERROR)
+      return error;
+    if (found < capacity)
+      values[found] = value;
+    ++found;
+    begin = number_end;
+  }
+
+  *count = found;
+  return SP_NO_ERROR;
+}
+
+#ifdef __cplusplus
+}
+#endif
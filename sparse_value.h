@@ -0,0 +1,54 @@
+#ifndef __CMT_SPARSE_VALUE_H__
+#define __CMT_SPARSE_VALUE_H__
+
+#include "sparse.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Typed values. These read a value straight from the [begin, end) range a
+  callback, reader event or document node hands out, so there's no need to
+  copy it into a null-terminated string first. They never look at the
+  locale: the decimal point is always a period. Spaces and tabs around the
+  value are skipped, anything else that isn't part of it makes the value
+  invalid, and an empty range (including a node's NULL value) is invalid too.
+
+  Each returns SP_ERROR_INVALID_VALUE if the range doesn't hold a value of
+  that type and SP_ERROR_OUT_OF_RANGE if it does but it doesn't fit, and
+  leaves *out alone when it fails.
+*/
+
+/* A decimal integer with an optional + or - sign. */
+sparse_error_t sparse_parse_int(const char *begin, const char *end, int64_t *out);
+/* A decimal integer with an optional + sign. */
+sparse_error_t sparse_parse_uint(const char *begin, const char *end, uint64_t *out);
+
+/*
+  A decimal number with an optional sign, fraction and exponent (1, -2.5,
+  .5, 3., 6.02e23), or inf, infinity or nan in any case. Rounded correctly.
+  Numbers too large for a double are out of range; ones too small round to
+  zero.
+*/
+sparse_error_t sparse_parse_double(const char *begin, const char *end, double *out);
+
+/* true, yes, on or 1 and false, no, off or 0, in any case. */
+sparse_error_t sparse_parse_bool(const char *begin, const char *end, int *out);
+
+/*
+  Numbers separated by spaces and tabs, such as a vector or color. Stores up
+  to capacity of them in values and sets *count to how many there are in
+  all, so a count larger than capacity means some didn't fit. An empty range
+  holds no numbers. Fails on the first number that isn't valid, with the
+  ones before it stored and *count left alone.
+*/
+sparse_error_t sparse_parse_ints(const char *begin, const char *end, int64_t *values, size_t capacity, size_t *count);
+sparse_error_t sparse_parse_doubles(const char *begin, const char *end, double *values, size_t capacity, size_t *count);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_VALUE_H__ include guard */
@@ -0,0 +1,306 @@
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_value.h"
+
+typedef struct s_int_test {
+  const char *src;
+  sparse_error_t error;
+  int64_t value;
+} int_test_t;
+
+typedef struct s_double_test {
+  const char *src;
+  sparse_error_t error;
+} double_test_t;
+
+static const int_test_t int_tests[] = {
+  { "0", SP_NO_ERROR, 0 },
+  { "  42\t", SP_NO_ERROR, 42 },
+  { "-17", SP_NO_ERROR, -17 },
+  { "+17", SP_NO_ERROR, 17 },
+  { "0000000000000000000000000012", SP_NO_ERROR, 12 },
+  { "12345678", SP_NO_ERROR, 12345678 },
+  { "1234567890123456", SP_NO_ERROR, INT64_C(1234567890123456) },
+  { "9223372036854775807", SP_NO_ERROR, INT64_MAX },
+  { "-9223372036854775808", SP_NO_ERROR, INT64_MIN },
+  { "9223372036854775808", SP_ERROR_OUT_OF_RANGE, 0 },
+  { "-9223372036854775809", SP_ERROR_OUT_OF_RANGE, 0 },
+  { "18446744073709551616", SP_ERROR_OUT_OF_RANGE, 0 },
+  { "123456789012345678901234567890", SP_ERROR_OUT_OF_RANGE, 0 },
+  { "123456789012345678901234567890x", SP_ERROR_INVALID_VALUE, 0 },
+  { "", SP_ERROR_INVALID_VALUE, 0 },
+  { "   ", SP_ERROR_INVALID_VALUE, 0 },
+  { "-", SP_ERROR_INVALID_VALUE, 0 },
+  { "--1", SP_ERROR_INVALID_VALUE, 0 },
+  { "1 2", SP_ERROR_INVALID_VALUE, 0 },
+  { "12345678a", SP_ERROR_INVALID_VALUE, 0 },
+  { "1234567:", SP_ERROR_INVALID_VALUE, 0 },
+  { "1.5", SP_ERROR_INVALID_VALUE, 0 },
+  { "0x10", SP_ERROR_INVALID_VALUE, 0 },
+};
+
+/* Valid ones are checked against strtod in the C locale. */
+static const double_test_t double_tests[] = {
+  { "0", SP_NO_ERROR },
+  { "-0", SP_NO_ERROR },
+  { "1", SP_NO_ERROR },
+  { " 0.5 ", SP_NO_ERROR },
+  { ".5", SP_NO_ERROR },
+  { "-.5", SP_NO_ERROR },
+  { "3.", SP_NO_ERROR },
+  { "0.1", SP_NO_ERROR },
+  { "3.14159265358979323846264338327950288", SP_NO_ERROR },
+  { "6.02214076e23", SP_NO_ERROR },
+  { "1e22", SP_NO_ERROR },
+  { "1e23", SP_NO_ERROR },
+  { "12e30", SP_NO_ERROR },
+  { "9007199254740993", SP_NO_ERROR },
+  { "123456789012345678901234567890", SP_NO_ERROR },
+  { "0.000000000000000000000000000001", SP_NO_ERROR },
+  { "2.2250738585072011e-308", SP_NO_ERROR },
+  { "4.9e-324", SP_NO_ERROR },
+  { "1e-400", SP_NO_ERROR },
+  { "0e999999999999", SP_NO_ERROR },
+  { "1.7976931348623157e308", SP_NO_ERROR },
+  { "1E+2", SP_NO_ERROR },
+  { "1e-2", SP_NO_ERROR },
+  { "inf", SP_NO_ERROR },
+  { "-Infinity", SP_NO_ERROR },
+  { "1e309", SP_ERROR_OUT_OF_RANGE },
+  { "-1e999999999999", SP_ERROR_OUT_OF_RANGE },
+  { "", SP_ERROR_INVALID_VALUE },
+  { ".", SP_ERROR_INVALID_VALUE },
+  { "-", SP_ERROR_INVALID_VALUE },
+  { "e5", SP_ERROR_INVALID_VALUE },
+  { "1e", SP_ERROR_INVALID_VALUE },
+  { "1e+", SP_ERROR_INVALID_VALUE },
+  { "1.2.3", SP_ERROR_INVALID_VALUE },
+  { "1,5", SP_ERROR_INVALID_VALUE },
+  { "0x1p3", SP_ERROR_INVALID_VALUE },
+  { "infinit", SP_ERROR_INVALID_VALUE },
+  { "1 2", SP_ERROR_INVALID_VALUE },
+};
+
+static int same_double(double left, double right)
+{
+  if (isnan(left) || isnan(right))
+    return isnan(left) && isnan(right);
+  return memcmp(&left, &right, sizeof(left)) == 0;
+}
+
+static int check_ints(void)
+{
+  size_t index;
+  int failures = 0;
+
+  for (index = 0; index < sizeof(int_tests) / sizeof(*int_tests); ++index) {
+    const int_test_t *test = &int_tests[index];
+    const char *end = test->src + strlen(test->src);
+    int64_t value = -1;
+    const sparse_error_t error = sparse_parse_int(test->src, end, &value);
+
+    if (error != test->error || (error == SP_NO_ERROR && value != test->value) || (error != SP_NO_ERROR && value != -1)) {
+      fprintf(stderr, "Parsing int \"%s\" gave error %d, value %lld\n", test->src, (int)error, (long long)value);
+      ++failures;
+    }
+  }
+
+  {
+    const char *max = "18446744073709551615";
+    uint64_t value = 0;
+    if (sparse_parse_uint(max, max + strlen(max), &value) != SP_NO_ERROR || value != UINT64_MAX
+        || sparse_parse_uint("-1", &"-1"[2], &value) != SP_ERROR_INVALID_VALUE) {
+      fprintf(stderr, "Parsing uints failed\n");
+      ++failures;
+    }
+  }
+
+  return failures;
+}
+
+/* Checks one number against strtod in the C locale. */
+static int check_double(const char *src, sparse_error_t expected_error)
+{
+  double value = -1.0;
+  const sparse_error_t error = sparse_parse_double(src, src + strlen(src), &value);
+
+  if (error != expected_error) {
+    fprintf(stderr, "Parsing double \"%s\" gave error %d, expected %d\n", src, (int)error, (int)expected_error);
+    return 1;
+  }
+
+  if (error == SP_NO_ERROR && !same_double(value, strtod(src, NULL))) {
+    fprintf(stderr, "Parsing double \"%s\" gave %.17g, expected %.17g\n", src, value, strtod(src, NULL));
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Random numbers of the shapes config files hold, and ones with too many
+   digits or too large an exponent to parse without falling back to strtod. */
+static int check_random_doubles(void)
+{
+  char src[96];
+  int failures = 0;
+  int round;
+
+  srand(1234);
+  for (round = 0; round < 200000 && failures < 10; ++round) {
+    char *write = src;
+    int num_digits = 1 + rand() % (round % 4 == 0 ? 40 : 17);
+    int point = rand() % (num_digits + 1);
+    int digit;
+
+    if (rand() % 2)
+      *write++ = '-';
+    for (digit = 0; digit < num_digits; ++digit) {
+      if (digit == point && rand() % 2)
+        *write++ = '.';
+      *write++ = (char)('0' + rand() % 10);
+    }
+    if (rand() % 3 == 0)
+      write += sprintf(write, "e%d", rand() % 700 - 350);
+    *write = '\0';
+
+    failures += check_double(src, isinf(strtod(src, NULL)) ? SP_ERROR_OUT_OF_RANGE : SP_NO_ERROR);
+  }
+
+  return failures;
+}
+
+static int check_doubles(void)
+{
+  size_t index;
+  int failures = 0;
+
+  for (index = 0; index < sizeof(double_tests) / sizeof(*double_tests); ++index)
+    failures += check_double(double_tests[index].src, double_tests[index].error);
+
+  {
+    const char *nan = "NaN";
+    double value = 0.0;
+    if (sparse_parse_double(nan, nan, &value) != SP_ERROR_INVALID_VALUE || sparse_parse_double(NULL, NULL, &value) != SP_ERROR_INVALID_VALUE
+        || sparse_parse_double(nan, nan + 3, &value) != SP_NO_ERROR || !isnan(value)) {
+      fprintf(stderr, "Parsing NaN failed\n");
+      ++failures;
+    }
+  }
+
+  return failures + check_random_doubles();
+}
+
+/* A locale with a decimal comma mustn't change what a period means. */
+static int check_locale(void)
+{
+  static const char *const locales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8" };
+  const char *src = "1.00000000000000000000000000001";
+  double value = 0.0;
+  size_t index;
+  int failures = 0;
+
+  for (index = 0; index < sizeof(locales) / sizeof(*locales); ++index) {
+    if (setlocale(LC_NUMERIC, locales[index]) != NULL)
+      break;
+  }
+  if (index == sizeof(locales) / sizeof(*locales))
+    return 0;
+
+  if (sparse_parse_double(src, src + strlen(src), &value) != SP_NO_ERROR || value != 1.0
+      || sparse_parse_double("2.5", &"2.5"[3], &value) != SP_NO_ERROR || value != 2.5
+      || sparse_parse_double("2,5", &"2,5"[3], &value) != SP_ERROR_INVALID_VALUE) {
+    fprintf(stderr, "Parsing doubles depends on the locale\n");
+    ++failures;
+  }
+
+  setlocale(LC_NUMERIC, "C");
+  return failures;
+}
+
+static int check_bools(void)
+{
+  static const char *const trues[] = { "true", "TRUE", " Yes ", "on", "1" };
+  static const char *const falses[] = { "false", "False", "no", "OFF\t", "0" };
+  static const char *const invalids[] = { "", "t", "truee", "2", "of", "yes no" };
+  size_t index;
+  int failures = 0;
+  int value;
+
+  for (index = 0; index < sizeof(trues) / sizeof(*trues); ++index) {
+    value = -1;
+    if (sparse_parse_bool(trues[index], trues[index] + strlen(trues[index]), &value) != SP_NO_ERROR || value != 1) {
+      fprintf(stderr, "\"%s\" isn't true\n", trues[index]);
+      ++failures;
+    }
+  }
+
+  for (index = 0; index < sizeof(falses) / sizeof(*falses); ++index) {
+    value = -1;
+    if (sparse_parse_bool(falses[index], falses[index] + strlen(falses[index]), &value) != SP_NO_ERROR || value != 0) {
+      fprintf(stderr, "\"%s\" isn't false\n", falses[index]);
+      ++failures;
+    }
+  }
+
+  for (index = 0; index < sizeof(invalids) / sizeof(*invalids); ++index) {
+    value = -1;
+    if (sparse_parse_bool(invalids[index], invalids[index] + strlen(invalids[index]), &value) != SP_ERROR_INVALID_VALUE
+        || value != -1) {
+      fprintf(stderr, "\"%s\" isn't invalid\n", invalids[index]);
+      ++failures;
+    }
+  }
+
+  return failures;
+}
+
+static int check_vectors(void)
+{
+  const char *color = " 0.25\t0.5  1 ";
+  const char *ids = "10 -20 30 40";
+  const char *bad = "1 2 x 4";
+  double doubles[3] = { 0, 0, 0 };
+  int64_t ints[2] = { 0, 0 };
+  size_t count = 99;
+  int failures = 0;
+
+  if (sparse_parse_doubles(color, color + strlen(color), doubles, 3, &count) != SP_NO_ERROR || count != 3
+      || doubles[0] != 0.25 || doubles[1] != 0.5 || doubles[2] != 1.0) {
+    fprintf(stderr, "Parsing a vector of doubles failed\n");
+    ++failures;
+  }
+
+  if (sparse_parse_ints(ids, ids + strlen(ids), ints, 2, &count) != SP_NO_ERROR || count != 4
+      || ints[0] != 10 || ints[1] != -20) {
+    fprintf(stderr, "Parsing more ints than fit failed\n");
+    ++failures;
+  }
+
+  count = 99;
+  if (sparse_parse_doubles(bad, bad + strlen(bad), doubles, 3, &count) != SP_ERROR_INVALID_VALUE || count != 99
+      || sparse_parse_ints("  ", &"  "[2], ints, 2, &count) != SP_NO_ERROR || count != 0
+      || sparse_parse_ints(NULL, NULL, NULL, 0, &count) != SP_NO_ERROR || count != 0) {
+    fprintf(stderr, "Parsing invalid or empty vectors failed\n");
+    ++failures;
+  }
+
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  int failures = 0;
+
+  (void)argc; (void)argv;
+
+  failures += check_ints();
+  failures += check_doubles();
+  failures += check_locale();
+  failures += check_bools();
+  failures += check_vectors();
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sparse_writer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define SP_WRITE_FD(fd, data, size) _write((fd), (data), (unsigned int)(size))
+#else
+#include <unistd.h>
+#define SP_WRITE_FD(fd, data, size) write((fd), (data), (size))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SP_WRITER_MIN_CAPACITY (256)
+
+/* Room for a run of indentation in a single copy. */
+static const char sp_spaces[] = "                                                                ";
+
+/*
+  The character to write after a backslash for each byte, or 0 if it can be
+  written as is. These are the escapes sparse_run understands, plus anything
+  else it treats specially, which it takes literally after a backslash.
+  Spaces only need escaping in some places, so they're left to the caller.
+*/
+static const char sp_escapes[256] = {
+  '0', 0, 0, 0, 0, 0, 0, 'a', 'b', 't', 'n', 0, 'f', 'r', 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, '#', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ';', 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '{', 0, '}', 0, 0,
+};
+
+static sparse_error_t sp_writer_fail(sparse_writer_state_t *writer, sparse_error_t error)
+{
+  if (writer->error == SP_NO_ERROR)
+    writer->error = error;
+  return writer->error;
+}
+
+static sparse_error_t sp_writer_flush(sparse_writer_state_t *writer)
+{
+  sparse_error_t error;
+
+  if (writer->size == 0)
+    return SP_NO_ERROR;
+
+  error = writer->flush(writer->buffer, writer->size, writer->context);
+  writer->size = 0;
+  return error;
+}
+
+/* Makes room for at least one more byte: flushes the buffer if there's a
+   flush function and otherwise grows it if the writer owns it. */
+static int sp_writer_make_room(sparse_writer_state_t *writer, size_t wanted)
+{
+  if (writer->flush != NULL) {
+    const sparse_error_t error = sp_writer_flush(writer);
+    if (error != SP_NO_ERROR) {
+      sp_writer_fail(writer, error);
+      return 0;
+    }
+  } else if (writer->owns_buffer) {
+    size_t capacity = writer->capacity * 2;
+    char *buffer;
+
+    while (capacity - writer->size < wanted)
+      capacity *= 2;
+
+    buffer = (char *)realloc(writer->buffer, capacity);
+    if (buffer == NULL) {
+      sp_writer_fail(writer, SP_ERROR_NO_MEM);
+      return 0;
+    }
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+  } else {
+    sp_writer_fail(writer, SP_ERROR_NO_MEM);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void sp_writer_put(sparse_writer_state_t *writer, const char *data, size_t length)
+{
+  while (length > writer->capacity - writer->size) {
+    const size_t room = writer->capacity - writer->size;
+
+    /* With a flush function, fill the buffer up before passing it on. */
+    if (writer->flush != NULL && room > 0) {
+      memcpy(writer->buffer + writer->size, data, room);
+      writer->size += room;
+      data += room;
+      length -= room;
+    }
+
+    if (!sp_writer_make_room(writer, length))
+      return;
+  }
+
+  memcpy(writer->buffer + writer->size, data, length);
+  writer->size += length;
+}
+
+static void sp_writer_put_char(sparse_writer_state_t *writer, char c)
+{
+  if (writer->size == writer->capacity && !sp_writer_make_room(writer, 1))
+    return;
+  writer->buffer[writer->size++] = c;
+}
+
+static void sp_writer_put_escape(sparse_writer_state_t *writer, char escape)
+{
+  sp_writer_put_char(writer, '\\');
+  sp_writer_put_char(writer, escape);
+}
+
+static void sp_writer_put_indent(sparse_writer_state_t *writer)
+{
+  size_t count = writer->depth * writer->indent;
+
+  while (count > 0 && writer->error == SP_NO_ERROR) {
+    const size_t length = count < sizeof(sp_spaces) - 1 ? count : sizeof(sp_spaces) - 1;
+    sp_writer_put(writer, sp_spaces, length);
+    count -= length;
+  }
+}
+
+/* Copies runs that don't need escaping in one go. */
+static void sp_writer_put_name(sparse_writer_state_t *writer, const char *begin, const char *end)
+{
+  const char *run = begin;
+  const char *iter;
+
+  for (iter = begin; iter != end; ++iter) {
+    const char escape = (*iter == ' ' ? ' ' : sp_escapes[(unsigned char)*iter]);
+    if (escape != 0) {
+      sp_writer_put(writer, run, (size_t)(iter - run));
+      sp_writer_put_escape(writer, escape);
+      run = iter + 1;
+    }
+  }
+
+  sp_writer_put(writer, run, (size_t)(iter - run));
+}
+
+/*
+  Like sp_writer_put_name, except spaces are only escaped where sparse_run
+  would drop them: at the start of a value, after another space (which
+  SP_CONSUME_WHITESPACE would merge), and at the end (which
+  SP_TRIM_TRAILING_SPACES would trim). Tabs are always escaped.
+*/
+static void sp_writer_put_value(sparse_writer_state_t *writer, const char *begin, const char *end)
+{
+  const char *trailing = end;
+  const char *run = begin;
+  const char *iter;
+
+  while (trailing != begin && trailing[-1] == ' ')
+    --trailing;
+
+  for (iter = begin; iter != end; ++iter) {
+    char escape = sp_escapes[(unsigned char)*iter];
+    if (*iter == ' ' && (iter == begin || iter[-1] == ' ' || iter >= trailing))
+      escape = ' ';
+    if (escape != 0) {
+      sp_writer_put(writer, run, (size_t)(iter - run));
+      sp_writer_put_escape(writer, escape);
+      run = iter + 1;
+    }
+  }
+
+  sp_writer_put(writer, run, (size_t)(iter - run));
+}
+
+static sparse_error_t sp_writer_fd_flush(const char *data, size_t size, void *context)
+{
+  const int fd = *(const int *)context;
+
+  while (size > 0) {
+    const long written = (long)SP_WRITE_FD(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return SP_ERROR_IO;
+    }
+    data += written;
+    size -= (size_t)written;
+  }
+
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_writer_begin(sparse_writer_state_t *writer, char *buffer, size_t capacity)
+{
+  memset(writer, 0, sizeof(*writer));
+  writer->indent = SP_WRITER_DEFAULT_INDENT;
+  writer->error = SP_NO_ERROR;
+  writer->fd = -1;
+
+  if (buffer == NULL) {
+    if (capacity < SP_WRITER_MIN_CAPACITY)
+      capacity = SP_WRITER_MIN_CAPACITY;
+    buffer = (char *)malloc(capacity);
+    if (buffer == NULL)
+      return sp_writer_fail(writer, SP_ERROR_NO_MEM);
+    writer->owns_buffer = 1;
+  }
+
+  writer->buffer = buffer;
+  writer->capacity = capacity;
+  return SP_NO_ERROR;
+}
+
+sparse_error_t sparse_writer_begin_flush(sparse_writer_state_t *writer, size_t capacity, sparse_flush_fn_t flush, void *context)
+{
+  const sparse_error_t error = sparse_writer_begin(writer, NULL, capacity);
+
+  writer->flush = flush;
+  writer->context = context;
+  return error;
+}
+
+sparse_error_t sparse_writer_begin_fd(sparse_writer_state_t *writer, int fd)
+{
+  const sparse_error_t error = sparse_writer_begin_flush(writer, SP_WRITER_BLOCK_SIZE, sp_writer_fd_flush, NULL);
+
+  writer->fd = fd;
+  writer->context = &writer->fd;
+  return error;
+}
+
+sparse_error_t sparse_writer_end(sparse_writer_state_t *writer)
+{
+  if (writer->error != SP_NO_ERROR)
+    return writer->error;
+
+  if (writer->flush != NULL) {
+    const sparse_error_t error = sp_writer_flush(writer);
+    if (error != SP_NO_ERROR)
+      return sp_writer_fail(writer, error);
+  }
+
+  if (writer->depth > 0 || writer->has_name)
+    return sp_writer_fail(writer, SP_ERROR_INCOMPLETE_DOCUMENT);
+
+  return SP_NO_ERROR;
+}
+
+void sparse_writer_free(sparse_writer_state_t *writer)
+{
+  if (writer->owns_buffer)
+    free(writer->buffer);
+  memset(writer, 0, sizeof(*writer));
+}
+
+sparse_error_t sparse_writer_name(sparse_writer_state_t *writer, const char *name, size_t name_length)
+{
+  if (writer->error != SP_NO_ERROR)
+    return writer->error;
+  if (writer->has_name)
+    return sp_writer_fail(writer, SP_ERROR_INVALID_CHAR);
+
+  writer->has_name = 1;
+  writer->empty_name = name_length == 0;
+  writer->separator = (name_length > 0 && name[name_length - 1] == ' ') ? '\t' : ' ';
+
+  sp_writer_put_indent(writer);
+  if (name_length > 0)
+    sp_writer_put_name(writer, name, name + name_length);
+  return writer->error;
+}
+
+sparse_error_t sparse_writer_value(sparse_writer_state_t *writer, const char *value, size_t value_length)
+{
+  if (writer->error != SP_NO_ERROR)
+    return writer->error;
+  if (!writer->has_name || writer->empty_name)
+    return sp_writer_fail(writer, SP_ERROR_INVALID_CHAR);
+
+  writer->has_name = 0;
+
+  if (value_length > 0) {
+    sp_writer_put_char(writer, writer->separator);
+    sp_writer_put_value(writer, value, value + value_length);
+  }
+  sp_writer_put_char(writer, '\n');
+  return writer->error;
+}
+
+sparse_error_t sparse_writer_begin_node(sparse_writer_state_t *writer)
+{
+  if (writer->error != SP_NO_ERROR)
+    return writer->error;
+
+  if (!writer->has_name)
+    sp_writer_put_indent(writer);
+
+  if (writer->has_name && !writer->empty_name)
+    sp_writer_put(writer, " {\n", 3);
+  else
+    sp_writer_put(writer, "{\n", 2);
+
+  writer->has_name = 0;
+  ++writer->depth;
+  return writer->error;
+}
+
+sparse_error_t sparse_writer_end_node(sparse_writer_state_t *writer)
+{
+  if (writer->error != SP_NO_ERROR)
+    return writer->error;
+  if (writer->has_name || writer->depth == 0)
+    return sp_writer_fail(writer, SP_ERROR_INVALID_CHAR);
+
+  --writer->depth;
+  sp_writer_put_indent(writer);
+  sp_writer_put(writer, "}\n", 2);
+  return writer->error;
+}
+
+sparse_error_t sparse_writer_field(sparse_writer_state_t *writer, const char *name, size_t name_length,
+                                   const char *value, size_t value_length)
+{
+  sparse_writer_name(writer, name, name_length);
+  return sparse_writer_value(writer, value, value_length);
+}
+
+void sparse_writer_fn(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  sparse_writer_state_t *writer = (sparse_writer_state_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+
+  switch (msg) {
+  case SP_NAME: sparse_writer_name(writer, begin, length); break;
+  case SP_VALUE: sparse_writer_value(writer, begin, length); break;
+  case SP_BEGIN_NODE: sparse_writer_begin_node(writer); break;
+  case SP_END_NODE: sparse_writer_end_node(writer); break;
+  default: break;
+  }
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
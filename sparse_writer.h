@@ -0,0 +1,103 @@
+#ifndef __CMT_SPARSE_WRITER_H__
+#define __CMT_SPARSE_WRITER_H__
+
+#include "sparse.h"
+
+/* Size of the buffer sparse_writer_begin_fd writes through. */
+#ifndef SP_WRITER_BLOCK_SIZE
+#define SP_WRITER_BLOCK_SIZE (256 * 1024)
+#endif
+
+#define SP_WRITER_DEFAULT_INDENT (2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Takes a full buffer from a writer. Return anything but SP_NO_ERROR to stop
+   the writer. */
+typedef sparse_error_t (*sparse_flush_fn_t)(const char *data, size_t size, void *context);
+
+/*
+  Writes a document from the same events a parser produces (wrapped by
+  sparse_writer_t in C++). Names and values are escaped so parsing the output
+  gives back exactly the events written, whatever options it's parsed with.
+  Fields go on their own lines, indented indent spaces per level.
+
+  Output goes into the buffer: a caller's buffer, one that grows as needed, or
+  one that's handed to a flush function whenever it fills up. Errors are
+  sticky; once a call fails, the rest do nothing and return the same error.
+*/
+typedef struct s_sparse_writer_state {
+  char *buffer;
+  size_t size;
+  size_t capacity;
+  int owns_buffer;
+
+  /* NULL unless writing through a flush function. */
+  sparse_flush_fn_t flush;
+  void *context;
+  int fd;
+
+  size_t depth;
+  size_t indent;
+  /* Set after a name, until its value or node is written. */
+  int has_name;
+  int empty_name;
+  /* Goes between the name and its value. A raw space after an escaped one
+     is dropped with SP_CONSUME_WHITESPACE, so names ending in a space are
+     followed by a tab instead. */
+  char separator;
+
+  sparse_error_t error;
+} sparse_writer_state_t;
+
+/*
+  Begins a writer that writes into buffer (capacity bytes) and returns
+  SP_ERROR_NO_MEM if it runs out of room. If buffer is NULL, the writer
+  allocates its own and grows it as needed, starting at capacity bytes. Either
+  way, the output is writer->buffer, writer->size bytes long.
+*/
+sparse_error_t sparse_writer_begin(sparse_writer_state_t *writer, char *buffer, size_t capacity);
+/* Begins a writer that passes its output to flush capacity bytes at a time. */
+sparse_error_t sparse_writer_begin_flush(sparse_writer_state_t *writer, size_t capacity, sparse_flush_fn_t flush, void *context);
+/* Begins a writer that writes to fd in SP_WRITER_BLOCK_SIZE blocks. Returns
+   SP_ERROR_IO if a write fails. The fd is left open. */
+sparse_error_t sparse_writer_begin_fd(sparse_writer_state_t *writer, int fd);
+
+/*
+  Flushes anything left and returns SP_ERROR_INCOMPLETE_DOCUMENT if a node is
+  still open or a name has nothing after it. The output stays in the buffer
+  until sparse_writer_free.
+*/
+sparse_error_t sparse_writer_end(sparse_writer_state_t *writer);
+void sparse_writer_free(sparse_writer_state_t *writer);
+
+/*
+  Writes a field's name, then either its value or the start of its node. A
+  node without a name first (or with an empty one) is written as a nameless
+  node, which only parses with SP_NAMELESS_NODES or, at the root,
+  SP_NAMELESS_ROOT_NODES. Returns SP_ERROR_INVALID_CHAR for calls out of
+  order: a value without a name, a name after a name, closing a node that
+  isn't open, or a value for an empty name, which can't be written.
+*/
+sparse_error_t sparse_writer_name(sparse_writer_state_t *writer, const char *name, size_t name_length);
+sparse_error_t sparse_writer_value(sparse_writer_state_t *writer, const char *value, size_t value_length);
+sparse_error_t sparse_writer_begin_node(sparse_writer_state_t *writer);
+sparse_error_t sparse_writer_end_node(sparse_writer_state_t *writer);
+
+/* Writes a name and value at once. */
+sparse_error_t sparse_writer_field(sparse_writer_state_t *writer, const char *name, size_t name_length,
+                                   const char *value, size_t value_length);
+
+/*
+  A sparse_fn_t that writes each event to the writer passed as context, so a
+  parser can feed a writer directly. Errors are left in the writer.
+*/
+void sparse_writer_fn(sparse_msg_t msg, const char *begin, const char *end, void *context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* end __CMT_SPARSE_WRITER_H__ include guard */
@@ -0,0 +1,352 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sparse_writer.h"
+
+#define SP_STR(S) (S), sizeof(S) - 1
+
+typedef struct s_event_log {
+  char *data;
+  size_t size;
+  size_t capacity;
+} event_log_t;
+
+static void log_append(event_log_t *log, const void *data, size_t length);
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context);
+static sparse_error_t log_parse(event_log_t *log, const char *src, size_t size, sparse_options_t options);
+static sparse_error_t log_flush(const char *data, size_t size, void *context);
+static void write_document(sparse_writer_state_t *writer, int nameless, event_log_t *expected);
+static int check_escapes(void);
+static int check_round_trip(const char *src);
+static int check_flush(void);
+static int check_fd(void);
+static int check_errors(void);
+
+static void log_append(event_log_t *log, const void *data, size_t length)
+{
+  if (length == 0)
+    return;
+  if (log->size + length > log->capacity) {
+    log->capacity = (log->size + length) * 2;
+    log->data = realloc(log->data, log->capacity);
+  }
+  memcpy(log->data + log->size, data, length);
+  log->size += length;
+}
+
+static void log_event(sparse_msg_t msg, const char *begin, const char *end, void *context)
+{
+  event_log_t *log = (event_log_t *)context;
+  const size_t length = (begin == NULL ? 0 : (size_t)(end - begin));
+  char header[32];
+  snprintf(header, sizeof(header), "%d:%zu:", (int)msg, length);
+  log_append(log, header, strlen(header));
+  log_append(log, begin, length);
+}
+
+static sparse_error_t log_parse(event_log_t *log, const char *src, size_t size, sparse_options_t options)
+{
+  sparse_state_t state;
+  sparse_error_t error;
+
+  log->size = 0;
+  sparse_begin(&state, 0, options, log_event, log);
+  error = sparse_run(&state, src, src + size);
+  if (error == SP_NO_ERROR) {
+    error = sparse_end(&state);
+  } else {
+    state.callback = NULL;
+    sparse_end(&state);
+  }
+  return error;
+}
+
+static sparse_error_t log_flush(const char *data, size_t size, void *context)
+{
+  log_append((event_log_t *)context, data, size);
+  return SP_NO_ERROR;
+}
+
+/*
+  Writes names and values that need every kind of escape, and logs the events
+  a parser should send for them. Nameless nodes are only written if nameless
+  is set.
+*/
+static void write_document(sparse_writer_state_t *writer, int nameless, event_log_t *expected)
+{
+  static const struct {
+    const char *name;
+    size_t name_length;
+    const char *value;
+    size_t value_length;
+  } fields[] = {
+    { SP_STR("plain"), SP_STR("value with spaces") },
+    { SP_STR("spaced name"), SP_STR("  leading, double  and trailing spaces  ") },
+    { SP_STR("tab\tname"), SP_STR("\ttabs\t\tin a value\t") },
+    { SP_STR("structural{}#;"), SP_STR("{braces} # not a comment; not a new field") },
+    { SP_STR("back\\slash"), SP_STR("\\n is not a newline\\") },
+    { SP_STR("controls\n\r"), SP_STR("\n\r\a\b\f\t\0 and NUL") },
+    { SP_STR("\0"), SP_STR("\0") },
+    { SP_STR("empty"), SP_STR("") },
+    { SP_STR(" "), SP_STR(" ") },
+  };
+  static const char open[] = "{";
+  static const char close[] = "}";
+  size_t index;
+
+  for (index = 0; index < sizeof(fields) / sizeof(fields[0]); ++index) {
+    if (index == 2 || index == 5) {
+      static const char node[] = "node \\ name";
+      sparse_writer_name(writer, SP_STR(node));
+      sparse_writer_begin_node(writer);
+      log_event(SP_NAME, node, node + sizeof(node) - 1, expected);
+      log_event(SP_BEGIN_NODE, open, open + 1, expected);
+    }
+
+    if (index == 4 && nameless) {
+      sparse_writer_begin_node(writer);
+      log_event(SP_NAME, NULL, NULL, expected);
+      log_event(SP_BEGIN_NODE, open, open + 1, expected);
+    }
+
+    sparse_writer_field(writer, fields[index].name, fields[index].name_length,
+                        fields[index].value, fields[index].value_length);
+    log_event(SP_NAME, fields[index].name, fields[index].name + fields[index].name_length, expected);
+    log_event(SP_VALUE, fields[index].value, fields[index].value + fields[index].value_length, expected);
+
+    if (index == 3 || index == 7 || (index == 4 && nameless)) {
+      sparse_writer_end_node(writer);
+      log_event(SP_END_NODE, close, close + 1, expected);
+    }
+  }
+}
+
+/* Whatever options the output is parsed with, it should give back exactly
+   the events written. */
+static int check_escapes(void)
+{
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t parsed = { NULL, 0, 0 };
+  int options;
+  int failures = 0;
+
+  for (options = 0; options < 0x20; ++options) {
+    const int nameless = (options & SP_NAMELESS_NODES) != 0;
+    sparse_writer_state_t writer;
+    sparse_error_t error;
+
+    expected.size = 0;
+    sparse_writer_begin(&writer, NULL, 0);
+    write_document(&writer, nameless, &expected);
+    error = sparse_writer_end(&writer);
+
+    if (error == SP_NO_ERROR)
+      error = log_parse(&parsed, writer.buffer, writer.size, (sparse_options_t)options);
+
+    if (error != SP_NO_ERROR || parsed.size != expected.size ||
+        memcmp(parsed.data, expected.data, expected.size) != 0) {
+      fprintf(stderr, "Written document doesn't parse back with options %#x (error %d):\n%.*s\n",
+              options, (int)error, (int)writer.size, writer.buffer);
+      ++failures;
+    }
+
+    sparse_writer_free(&writer);
+  }
+
+  free(expected.data);
+  free(parsed.data);
+  return failures;
+}
+
+/* Parses src, writes its events back out and checks that parsing that gives
+   the same events. */
+static int check_round_trip(const char *src)
+{
+  event_log_t original = { NULL, 0, 0 };
+  event_log_t parsed = { NULL, 0, 0 };
+  int options;
+  int failures = 0;
+
+  for (options = 0; options < 0x20; ++options) {
+    sparse_writer_state_t writer;
+    sparse_state_t state;
+    sparse_error_t error;
+
+    if (log_parse(&original, src, strlen(src), (sparse_options_t)options) != SP_NO_ERROR)
+      continue;
+
+    sparse_writer_begin(&writer, NULL, 0);
+    sparse_begin(&state, 0, (sparse_options_t)options, sparse_writer_fn, &writer);
+    error = sparse_run(&state, src, NULL);
+    if (error == SP_NO_ERROR)
+      error = sparse_end(&state);
+    if (error == SP_NO_ERROR)
+      error = sparse_writer_end(&writer);
+    if (error == SP_NO_ERROR)
+      error = log_parse(&parsed, writer.buffer, writer.size, (sparse_options_t)options);
+
+    if (error != SP_NO_ERROR || parsed.size != original.size ||
+        memcmp(parsed.data, original.data, original.size) != 0) {
+      fprintf(stderr, "Round trip changed events with options %#x (error %d):\n%.*s\n",
+              options, (int)error, (int)writer.size, writer.buffer);
+      ++failures;
+    }
+
+    sparse_writer_free(&writer);
+  }
+
+  free(original.data);
+  free(parsed.data);
+  return failures;
+}
+
+/* Flushing through a small buffer has to give the same output as writing into
+   one that grows. */
+static int check_flush(void)
+{
+  event_log_t expected = { NULL, 0, 0 };
+  event_log_t flushed = { NULL, 0, 0 };
+  sparse_writer_state_t whole;
+  sparse_writer_state_t writer;
+  int failures = 0;
+
+  sparse_writer_begin(&whole, NULL, 0);
+  write_document(&whole, 1, &expected);
+  sparse_writer_end(&whole);
+
+  sparse_writer_begin_flush(&writer, 1, log_flush, &flushed);
+  write_document(&writer, 1, &expected);
+  if (sparse_writer_end(&writer) != SP_NO_ERROR || flushed.size != whole.size ||
+      memcmp(flushed.data, whole.buffer, whole.size) != 0) {
+    fprintf(stderr, "Flushed output differs from buffered output\n");
+    ++failures;
+  }
+
+  sparse_writer_free(&writer);
+  sparse_writer_free(&whole);
+  free(expected.data);
+  free(flushed.data);
+  return failures;
+}
+
+static int check_fd(void)
+{
+  static const char document[] = "a b\nnode {\n  c d\n}\n";
+  char result[sizeof(document)] = { 0 };
+  sparse_writer_state_t writer;
+  FILE *file = tmpfile();
+  int failures = 0;
+
+  if (file == NULL)
+    return 0;
+
+  sparse_writer_begin_fd(&writer, fileno(file));
+  sparse_writer_field(&writer, SP_STR("a"), SP_STR("b"));
+  sparse_writer_name(&writer, SP_STR("node"));
+  sparse_writer_begin_node(&writer);
+  sparse_writer_field(&writer, SP_STR("c"), SP_STR("d"));
+  sparse_writer_end_node(&writer);
+  if (sparse_writer_end(&writer) != SP_NO_ERROR) {
+    fprintf(stderr, "Writing to a file failed\n");
+    ++failures;
+  }
+  sparse_writer_free(&writer);
+
+  rewind(file);
+  if (fread(result, 1, sizeof(result) - 1, file) != sizeof(document) - 1 || strcmp(result, document) != 0) {
+    fprintf(stderr, "File contents differ:\n%s\n", result);
+    ++failures;
+  }
+
+  fclose(file);
+  return failures;
+}
+
+static int check_errors(void)
+{
+  sparse_writer_state_t writer;
+  char small[8];
+  int failures = 0;
+
+#define SP_CHECK(EXPR, ERROR)                                                 \
+  if ((EXPR) != (ERROR)) {                                                    \
+    fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #ERROR);      \
+    ++failures;                                                               \
+  }
+
+  /* A full caller buffer fails, and keeps failing. */
+  sparse_writer_begin(&writer, small, sizeof(small));
+  SP_CHECK(sparse_writer_field(&writer, SP_STR("a"), SP_STR("b")), SP_NO_ERROR);
+  SP_CHECK(sparse_writer_field(&writer, SP_STR("name"), SP_STR("value")), SP_ERROR_NO_MEM);
+  SP_CHECK(sparse_writer_field(&writer, SP_STR("a"), SP_STR("b")), SP_ERROR_NO_MEM);
+  SP_CHECK(sparse_writer_end(&writer), SP_ERROR_NO_MEM);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  SP_CHECK(sparse_writer_value(&writer, SP_STR("value")), SP_ERROR_INVALID_CHAR);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  sparse_writer_name(&writer, SP_STR("a"));
+  SP_CHECK(sparse_writer_name(&writer, SP_STR("b")), SP_ERROR_INVALID_CHAR);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  sparse_writer_name(&writer, SP_STR(""));
+  SP_CHECK(sparse_writer_value(&writer, SP_STR("value")), SP_ERROR_INVALID_CHAR);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  SP_CHECK(sparse_writer_end_node(&writer), SP_ERROR_INVALID_CHAR);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  sparse_writer_name(&writer, SP_STR("node"));
+  sparse_writer_begin_node(&writer);
+  SP_CHECK(sparse_writer_end(&writer), SP_ERROR_INCOMPLETE_DOCUMENT);
+  sparse_writer_free(&writer);
+
+  sparse_writer_begin(&writer, NULL, 0);
+  sparse_writer_name(&writer, SP_STR("name"));
+  SP_CHECK(sparse_writer_end(&writer), SP_ERROR_INCOMPLETE_DOCUMENT);
+  sparse_writer_free(&writer);
+
+#undef SP_CHECK
+
+  return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+  (void)argc; (void)argv;
+
+  static const char *test_string =
+    "materials/base/fl_tile1 {\n"
+    "  0 {\n"
+    "    map textures/base/fl_tile1.png # Field with a value\n"
+    "    blend { src one; dst one }\n"
+    "  }\n"
+    "  1 { map  \\ spaced\\   out\\  \t}\n"
+    "  clamp_u\n"
+    "}\n"
+    "materials/base/fl_tile2 { map \\{escaped\\}.png\\r\\n }\n"
+    "{\n"
+    "  reason_for_using nameless root nodes\n"
+    "  { nested nameless }\n"
+    "}\n"
+    "width 800; height 600\n";
+
+  int failures = 0;
+
+  failures += check_escapes();
+  failures += check_round_trip(test_string);
+  failures += check_flush();
+  failures += check_fd();
+  failures += check_errors();
+
+  return failures == 0 ? 0 : 1;
+}